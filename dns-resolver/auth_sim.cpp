@@ -0,0 +1,629 @@
+// Локальные авторитативные DNS-серверы для проверки и нагрузочного теста
+// резолвера без доступа в интернет. Иерархия зон (корень -> TLD -> зоны)
+// описывается в файле, каждая зона обслуживается своими адресами loopback
+// (127.0.0.2, 127.0.0.3, ...), а резолвер получает адрес корня через -r или
+// файл подсказок -R.
+//
+//   ./auth_sim [options]
+//     --zones FILE    файл иерархии (bench.zones)
+//     --port N        порт UDP и TCP на всех адресах (53)
+//
+// Формат файла, по строке на директиву; комментарии начинаются с ';' или '#':
+//   zone <имя> <адрес>[,<адрес>...] [delay=<мс>] [negative=<с>]
+//       зона и адреса ее серверов; delay - задержка каждого ответа,
+//       negative - поле MINIMUM синтезированной записи SOA (60)
+//   <имя> <TTL> <A|AAAA|NS|CNAME> <значение>
+//       запись; NS ниже вершины зоны - делегирование, адреса серверов имен
+//       внутри делегированной зоны уходят в ответ как glue, остальные
+//       делегирования получаются без glue. Имя "*.<зона>" - wildcard
+//   truncate <имя>
+//       авторитативный ответ по UDP на это имя всегда с флагом TC,
+//       полный - только по TCP
+//
+// Ответы по UDP больше 512 байт тоже усекаются с флагом TC.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <queue>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cctype>
+#include <csignal>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const uint16_t TYPE_A = 1;
+const uint16_t TYPE_NS = 2;
+const uint16_t TYPE_CNAME = 5;
+const uint16_t TYPE_SOA = 6;
+const uint16_t TYPE_AAAA = 28;
+
+const size_t MAX_UDP_SIZE = 512;
+
+struct Record {
+    std::string name;
+    uint16_t type;
+    uint32_t ttl;
+    std::string value;      // адрес или имя
+};
+
+struct Zone {
+    std::string name;       // "" - корень
+    std::vector<std::string> addresses;
+    int delay_ms;
+    uint32_t negative_ttl;
+};
+
+// Иерархия только читается после загрузки, поэтому потоки TCP
+// используют ее без блокировок
+struct Hierarchy {
+    std::vector<Zone> zones;
+    std::multimap<std::string, Record> records;
+    std::set<std::string> names;        // владельцы записей и их предки
+    std::set<std::string> truncated;
+};
+
+// Ответ, отложенный на задержку зоны
+struct Delayed {
+    Clock::time_point due;
+    int fd;
+    sockaddr_in peer;
+    std::vector<uint8_t> packet;
+
+    bool operator>(const Delayed& other) const { return due > other.due; }
+};
+
+volatile sig_atomic_t g_stop = 0;
+Hierarchy g_hierarchy;
+
+void onSignal(int) {
+    g_stop = 1;
+}
+
+std::string normalizeName(std::string name) {
+    std::transform(name.begin(), name.end(), name.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    while (!name.empty() && name.back() == '.') {
+        name.pop_back();
+    }
+    return name;
+}
+
+bool inZone(const std::string& name, const std::string& zone) {
+    if (zone.empty() || name == zone) {
+        return true;
+    }
+    return name.size() > zone.size() && name.compare(name.size() - zone.size(), zone.size(), zone) == 0 &&
+           name[name.size() - zone.size() - 1] == '.';
+}
+
+std::string parentName(const std::string& name) {
+    size_t dot = name.find('.');
+    return dot == std::string::npos ? std::string() : name.substr(dot + 1);
+}
+
+std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::istringstream iss(list);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+bool loadHierarchy(const std::string& path, Hierarchy& hierarchy) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Cannot open " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int line_no = 0;
+    while (std::getline(file, line)) {
+        line_no++;
+        size_t comment = line.find_first_of(";#");
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        std::istringstream iss(line);
+        std::vector<std::string> tokens;
+        std::string token;
+        while (iss >> token) {
+            tokens.push_back(token);
+        }
+        if (tokens.empty()) {
+            continue;
+        }
+
+        if (tokens[0] == "zone" && tokens.size() >= 3) {
+            Zone zone;
+            zone.name = normalizeName(tokens[1]);
+            zone.addresses = splitList(tokens[2]);
+            zone.delay_ms = 0;
+            zone.negative_ttl = 60;
+            for (size_t i = 3; i < tokens.size(); i++) {
+                if (tokens[i].compare(0, 6, "delay=") == 0) {
+                    zone.delay_ms = atoi(tokens[i].c_str() + 6);
+                } else if (tokens[i].compare(0, 9, "negative=") == 0) {
+                    zone.negative_ttl = static_cast<uint32_t>(atoi(tokens[i].c_str() + 9));
+                } else {
+                    std::cerr << path << ":" << line_no << ": unknown zone option " << tokens[i] << std::endl;
+                    return false;
+                }
+            }
+            hierarchy.zones.push_back(zone);
+        } else if (tokens[0] == "truncate" && tokens.size() == 2) {
+            hierarchy.truncated.insert(normalizeName(tokens[1]));
+        } else if (tokens.size() == 4) {
+            Record record;
+            record.name = normalizeName(tokens[0]);
+            record.ttl = static_cast<uint32_t>(atoi(tokens[1].c_str()));
+            record.value = tokens[3];
+            if (tokens[2] == "A") {
+                record.type = TYPE_A;
+            } else if (tokens[2] == "AAAA") {
+                record.type = TYPE_AAAA;
+            } else if (tokens[2] == "NS" || tokens[2] == "CNAME") {
+                record.type = tokens[2] == "NS" ? TYPE_NS : TYPE_CNAME;
+                record.value = normalizeName(record.value);
+            } else {
+                std::cerr << path << ":" << line_no << ": unsupported type " << tokens[2] << std::endl;
+                return false;
+            }
+            for (std::string name = record.name; !name.empty(); name = parentName(name)) {
+                hierarchy.names.insert(name);
+            }
+            hierarchy.records.insert(std::make_pair(record.name, record));
+        } else {
+            std::cerr << path << ":" << line_no << ": cannot parse \"" << line << "\"" << std::endl;
+            return false;
+        }
+    }
+
+    if (hierarchy.zones.empty()) {
+        std::cerr << path << ": no zones" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::vector<Record> recordsOf(const std::string& name, uint16_t type = 0) {
+    std::vector<Record> result;
+    auto range = g_hierarchy.records.equal_range(name);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (type == 0 || it->second.type == type) {
+            result.push_back(it->second);
+        }
+    }
+    return result;
+}
+
+// Записи имени с учетом wildcard ближайшего существующего предка
+std::vector<Record> lookupName(const std::string& name, const std::string& zone) {
+    std::vector<Record> records = recordsOf(name);
+    if (!records.empty() || g_hierarchy.names.count(name)) {
+        return records;
+    }
+    for (std::string encloser = parentName(name); inZone(encloser, zone); encloser = parentName(encloser)) {
+        if (g_hierarchy.names.count(encloser) || encloser == zone) {
+            records = recordsOf(encloser.empty() ? "*" : "*." + encloser);
+            for (auto& record : records) {
+                record.name = name;
+            }
+            break;
+        }
+        if (encloser.empty()) {
+            break;
+        }
+    }
+    return records;
+}
+
+// Самое высокое делегирование между зоной и именем
+std::string findCut(const std::string& name, const std::string& zone) {
+    std::vector<std::string> ancestors;
+    for (std::string current = name; current != zone && !current.empty(); current = parentName(current)) {
+        ancestors.push_back(current);
+    }
+    for (auto it = ancestors.rbegin(); it != ancestors.rend(); ++it) {
+        if (!recordsOf(*it, TYPE_NS).empty()) {
+            return *it;
+        }
+    }
+    return std::string();
+}
+
+void appendUint16(std::vector<uint8_t>& packet, uint16_t value) {
+    packet.push_back(static_cast<uint8_t>(value >> 8));
+    packet.push_back(static_cast<uint8_t>(value & 0xFF));
+}
+
+void appendUint32(std::vector<uint8_t>& packet, uint32_t value) {
+    appendUint16(packet, static_cast<uint16_t>(value >> 16));
+    appendUint16(packet, static_cast<uint16_t>(value & 0xFFFF));
+}
+
+void appendName(std::vector<uint8_t>& packet, const std::string& name) {
+    size_t start = 0;
+    while (start < name.size()) {
+        size_t dot = name.find('.', start);
+        if (dot == std::string::npos) {
+            dot = name.size();
+        }
+        packet.push_back(static_cast<uint8_t>(dot - start));
+        packet.insert(packet.end(), name.begin() + start, name.begin() + dot);
+        start = dot + 1;
+    }
+    packet.push_back(0);
+}
+
+void appendRecord(std::vector<uint8_t>& packet, const Record& record) {
+    std::vector<uint8_t> rdata;
+    if (record.type == TYPE_A) {
+        rdata.resize(4);
+        inet_pton(AF_INET, record.value.c_str(), rdata.data());
+    } else if (record.type == TYPE_AAAA) {
+        rdata.resize(16);
+        inet_pton(AF_INET6, record.value.c_str(), rdata.data());
+    } else {
+        appendName(rdata, record.value);
+    }
+    appendName(packet, record.name);
+    appendUint16(packet, record.type);
+    appendUint16(packet, 1);
+    appendUint32(packet, record.ttl);
+    appendUint16(packet, static_cast<uint16_t>(rdata.size()));
+    packet.insert(packet.end(), rdata.begin(), rdata.end());
+}
+
+void appendSoa(std::vector<uint8_t>& packet, const Zone& zone) {
+    std::string prefix = zone.name.empty() ? "" : "." + zone.name;
+    std::vector<uint8_t> rdata;
+    appendName(rdata, "ns" + prefix);
+    appendName(rdata, "hostmaster" + prefix);
+    for (uint32_t value : {1u, 3600u, 600u, 86400u, zone.negative_ttl}) {
+        appendUint32(rdata, value);
+    }
+    appendName(packet, zone.name);
+    appendUint16(packet, TYPE_SOA);
+    appendUint16(packet, 1);
+    appendUint32(packet, zone.negative_ttl);
+    appendUint16(packet, static_cast<uint16_t>(rdata.size()));
+    packet.insert(packet.end(), rdata.begin(), rdata.end());
+}
+
+// Ответ на запрос, пришедший на адрес local; пустой вектор - не отвечать
+std::vector<uint8_t> answer(const std::string& local, const uint8_t* query, size_t len, bool tcp,
+                            int& delay_ms) {
+    std::vector<uint8_t> packet;
+    delay_ms = 0;
+    if (len < 12 || (query[2] & 0x80)) {
+        return packet;
+    }
+
+    size_t offset = 12;
+    std::string name;
+    while (offset < len && query[offset] != 0 && (query[offset] & 0xC0) == 0) {
+        uint8_t length = query[offset];
+        if (offset + 1 + length > len) {
+            return packet;
+        }
+        if (!name.empty()) {
+            name += ".";
+        }
+        name.append(reinterpret_cast<const char*>(query) + offset + 1, length);
+        offset += 1 + length;
+    }
+    if (offset + 5 > len) {
+        return packet;
+    }
+    name = normalizeName(name);
+    uint16_t qtype = static_cast<uint16_t>((query[offset + 1] << 8) | query[offset + 2]);
+    size_t question_end = offset + 5;
+
+    // Самая глубокая зона этого адреса, содержащая имя
+    const Zone* zone = nullptr;
+    for (const auto& candidate : g_hierarchy.zones) {
+        bool served = std::find(candidate.addresses.begin(), candidate.addresses.end(), local) !=
+                      candidate.addresses.end();
+        if (served && inZone(name, candidate.name) && (!zone || candidate.name.size() > zone->name.size())) {
+            zone = &candidate;
+        }
+    }
+
+    uint16_t flags = 0x8000 | (query[2] & 0x01) << 8;      // QR, RD из запроса
+    std::vector<Record> answers;
+    std::vector<Record> authority;
+    std::vector<Record> additional;
+    bool soa = false;
+
+    if (!zone) {
+        flags |= 5;                                         // REFUSED
+    } else {
+        delay_ms = zone->delay_ms;
+        std::string cut = findCut(name, zone->name);
+        if (!cut.empty()) {
+            // Делегирование: NS и glue только для серверов внутри зоны
+            authority = recordsOf(cut, TYPE_NS);
+            for (const auto& ns : authority) {
+                if (inZone(ns.value, cut)) {
+                    for (const auto& glue : recordsOf(ns.value)) {
+                        if (glue.type == TYPE_A || glue.type == TYPE_AAAA) {
+                            additional.push_back(glue);
+                        }
+                    }
+                }
+            }
+        } else {
+            flags |= 0x0400;                                // AA
+            std::string current = name;
+            std::vector<Record> records = lookupName(current, zone->name);
+            bool exists = !records.empty() || g_hierarchy.names.count(name) || name == zone->name;
+            // Цепочка CNAME внутри зоны
+            for (int hops = 0; hops < 8 && !records.empty(); hops++) {
+                bool matched = false;
+                for (const auto& record : records) {
+                    if (record.type == qtype) {
+                        answers.push_back(record);
+                        matched = true;
+                    }
+                }
+                if (matched || qtype == TYPE_CNAME) {
+                    break;
+                }
+                std::string target;
+                for (const auto& record : records) {
+                    if (record.type == TYPE_CNAME) {
+                        answers.push_back(record);
+                        target = record.value;
+                    }
+                }
+                if (target.empty() || !inZone(target, zone->name) || !findCut(target, zone->name).empty()) {
+                    break;
+                }
+                records = lookupName(target, zone->name);
+            }
+            if (answers.empty()) {
+                soa = true;
+                if (!exists) {
+                    flags |= 3;                             // NXDOMAIN
+                }
+            }
+        }
+    }
+
+    bool truncate = !tcp && (flags & 0x0400) && g_hierarchy.truncated.count(name);
+    for (int attempt = 0; attempt < 2; attempt++) {
+        packet.assign(query, query + 2);
+        appendUint16(packet, static_cast<uint16_t>(flags | (truncate ? 0x0200 : 0)));
+        appendUint16(packet, 1);
+        appendUint16(packet, static_cast<uint16_t>(truncate ? 0 : answers.size()));
+        appendUint16(packet, static_cast<uint16_t>(truncate ? 0 : authority.size() + (soa ? 1 : 0)));
+        appendUint16(packet, static_cast<uint16_t>(truncate ? 0 : additional.size()));
+        packet.insert(packet.end(), query + 12, query + question_end);
+        if (truncate) {
+            break;
+        }
+        for (const auto& record : answers) {
+            appendRecord(packet, record);
+        }
+        for (const auto& record : authority) {
+            appendRecord(packet, record);
+        }
+        if (soa) {
+            appendSoa(packet, *zone);
+        }
+        for (const auto& record : additional) {
+            appendRecord(packet, record);
+        }
+        if (tcp || packet.size() <= MAX_UDP_SIZE) {
+            break;
+        }
+        truncate = true;
+    }
+    return packet;
+}
+
+bool readFull(int fd, uint8_t* data, size_t len) {
+    while (len > 0) {
+        ssize_t received = recv(fd, data, len, 0);
+        if (received <= 0) {
+            return false;
+        }
+        data += received;
+        len -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+// Соединение TCP: запросы с префиксом длины, пока клиент не закроет
+void serveTcp(int fd, std::string local) {
+    timeval timeout = {10, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    uint8_t prefix[2];
+    while (readFull(fd, prefix, 2)) {
+        std::vector<uint8_t> query(static_cast<size_t>((prefix[0] << 8) | prefix[1]));
+        if (!readFull(fd, query.data(), query.size())) {
+            break;
+        }
+        int delay_ms = 0;
+        std::vector<uint8_t> response = answer(local, query.data(), query.size(), true, delay_ms);
+        if (response.empty()) {
+            break;
+        }
+        if (delay_ms > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+        }
+        std::vector<uint8_t> framed;
+        appendUint16(framed, static_cast<uint16_t>(response.size()));
+        framed.insert(framed.end(), response.begin(), response.end());
+        if (send(fd, framed.data(), framed.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(framed.size())) {
+            break;
+        }
+    }
+    close(fd);
+}
+
+int openSocket(const std::string& address, int port, int type) {
+    int fd = socket(AF_INET, type, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) <= 0 ||
+        bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        (type == SOCK_STREAM && listen(fd, 128) < 0)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string zones_path = "bench.zones";
+    int port = 53;
+
+    for (int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << option << std::endl;
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (option == "--zones") {
+            zones_path = value;
+        } else if (option == "--port") {
+            port = atoi(value.c_str());
+        } else {
+            std::cerr << "Unknown option: " << option << std::endl;
+            return 1;
+        }
+    }
+    if (!loadHierarchy(zones_path, g_hierarchy)) {
+        return 1;
+    }
+
+    // Сокеты UDP и TCP на каждом адресе из иерархии
+    std::vector<pollfd> fds;
+    std::vector<std::string> fd_addresses;
+    std::vector<bool> fd_listening;
+    std::set<std::string> addresses;
+    for (const auto& zone : g_hierarchy.zones) {
+        addresses.insert(zone.addresses.begin(), zone.addresses.end());
+    }
+    for (const auto& address : addresses) {
+        for (int type : {SOCK_DGRAM, SOCK_STREAM}) {
+            int fd = openSocket(address, port, type);
+            if (fd < 0) {
+                std::cerr << "Cannot listen on " << address << ":" << port << ": " << strerror(errno) << std::endl;
+                return 1;
+            }
+            fds.push_back({fd, POLLIN, 0});
+            fd_addresses.push_back(address);
+            fd_listening.push_back(type == SOCK_STREAM);
+        }
+    }
+
+    // Без SA_RESTART: сигнал прерывает poll
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::cerr << "Serving " << g_hierarchy.zones.size() << " zones on " << addresses.size()
+              << " addresses, port " << port << std::endl;
+
+    std::priority_queue<Delayed, std::vector<Delayed>, std::greater<Delayed>> delayed;
+    uint64_t udp_queries = 0;
+    uint64_t tcp_connections = 0;
+    uint8_t buffer[MAX_UDP_SIZE];
+    while (!g_stop) {
+        int timeout_ms = -1;
+        if (!delayed.empty()) {
+            auto wait = std::chrono::ceil<std::chrono::milliseconds>(delayed.top().due - Clock::now());
+            timeout_ms = static_cast<int>(std::max<long long>(0, wait.count()));
+        }
+        int ready = poll(fds.data(), fds.size(), timeout_ms);
+
+        Clock::time_point now = Clock::now();
+        while (!delayed.empty() && delayed.top().due <= now) {
+            const Delayed& item = delayed.top();
+            sendto(item.fd, item.packet.data(), item.packet.size(), 0,
+                   reinterpret_cast<const sockaddr*>(&item.peer), sizeof(item.peer));
+            delayed.pop();
+        }
+        if (ready <= 0) {
+            continue;
+        }
+
+        for (size_t i = 0; i < fds.size(); i++) {
+            if (!(fds[i].revents & POLLIN)) {
+                continue;
+            }
+            if (fd_listening[i]) {
+                int client = accept(fds[i].fd, nullptr, nullptr);
+                if (client >= 0) {
+                    tcp_connections++;
+                    std::thread(serveTcp, client, fd_addresses[i]).detach();
+                }
+                continue;
+            }
+            sockaddr_in peer;
+            socklen_t peer_len = sizeof(peer);
+            ssize_t received = recvfrom(fds[i].fd, buffer, sizeof(buffer), MSG_DONTWAIT,
+                                        reinterpret_cast<sockaddr*>(&peer), &peer_len);
+            if (received <= 0) {
+                continue;
+            }
+            udp_queries++;
+            int delay_ms = 0;
+            std::vector<uint8_t> response = answer(fd_addresses[i], buffer, static_cast<size_t>(received),
+                                                   false, delay_ms);
+            if (response.empty()) {
+                continue;
+            }
+            if (delay_ms > 0) {
+                delayed.push({now + std::chrono::milliseconds(delay_ms), fds[i].fd, peer, response});
+            } else {
+                sendto(fds[i].fd, response.data(), response.size(), 0,
+                       reinterpret_cast<sockaddr*>(&peer), peer_len);
+            }
+        }
+    }
+    std::cerr << "Answered " << udp_queries << " UDP queries, accepted " << tcp_connections
+              << " TCP connections" << std::endl;
+    for (const auto& pfd : fds) {
+        close(pfd.fd);
+    }
+    return 0;
+}
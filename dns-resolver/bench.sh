@@ -0,0 +1,52 @@
+#!/bin/bash
+
+# Offline benchmark of the server mode: auth_sim serves the zone hierarchy
+# of bench.zones on loopback addresses, the resolver starts from its root
+# (bench.hints) with an empty cache, and dns_bench measures a cold pass over
+# all names and then a warm pass: answers per second and latency.
+# Binding port 53 of the stand-in needs root.
+# Usage: ./bench.sh  (or make bench)
+#   RESOLVER     resolver binary (./dns_resolver)
+#   ZONES        zone hierarchy for auth_sim (bench.zones)
+#   HINTS        root hints for the resolver (bench.hints)
+#   SERVER_PORT  port of the resolver (15353)
+#   SERVER_ARGS  extra resolver options, e.g. "-w 32"
+#   BENCH_ARGS   options of dns_bench, e.g. "--outstanding 1000 --names 10000"
+
+ZONES=${ZONES:-bench.zones}
+HINTS=${HINTS:-bench.hints}
+SERVER_PORT=${SERVER_PORT:-15353}
+RESOLVER=${RESOLVER:-./dns_resolver}
+LOG_DIR=$(mktemp -d /tmp/dns-bench-logs.XXXXXX)
+
+cleanup() {
+    [ -n "$SERVER_PID" ] && kill -INT "$SERVER_PID" 2>/dev/null
+    [ -n "$AUTH_PID" ] && kill "$AUTH_PID" 2>/dev/null
+    wait 2>/dev/null
+}
+trap cleanup EXIT
+
+wait_for_port() {
+    for _ in $(seq 50); do
+        (echo > /dev/tcp/$1/$2) 2>/dev/null && return 0
+        sleep 0.1
+    done
+    echo "Nothing is listening on $1:$2" >&2
+    return 1
+}
+
+./auth_sim --zones "$ZONES" > "$LOG_DIR/auth.log" 2>&1 &
+AUTH_PID=$!
+$RESOLVER -R "$HINTS" -s "127.0.0.1:$SERVER_PORT" $SERVER_ARGS > "$LOG_DIR/server.log" 2>&1 &
+SERVER_PID=$!
+ROOT=$(awk '!/^[;#]/ && $(NF-1) == "A" {print $NF; exit}' "$HINTS")
+if ! wait_for_port "$ROOT" 53; then
+    cat "$LOG_DIR/auth.log" >&2
+    exit 1
+fi
+wait_for_port 127.0.0.1 "$SERVER_PORT" || exit 1
+
+./dns_bench --server "127.0.0.1:$SERVER_PORT" --prime $BENCH_ARGS
+STATUS=$?
+echo "Logs: $LOG_DIR"
+exit $STATUS
@@ -0,0 +1,363 @@
+// Нагрузочный клиент для режима сервера: держит заданное число запросов
+// в полете через один UDP-сокет, выбирая имена зон auth_sim равновероятно,
+// и печатает для каждого прохода число ответов в секунду, коды ответов и
+// задержку отдельно для холодных и теплых запросов.
+//
+//   ./dns_bench [options]
+//     --server IP:PORT  сервер под нагрузкой (127.0.0.1:5353)
+//     --queries N       запросов всего (100000)
+//     --outstanding N   запросов в полете одновременно (200, не больше 60000)
+//     --names N         разных имен hostN.<зона> (1000)
+//     --zones LIST      зоны через запятую, имена делятся между ними
+//                       поровну (bench.test,cdn.test)
+//     --type A|AAAA     тип запросов (A)
+//     --timeout-ms N    запрос без ответа за это время считается потерянным (2000)
+//     --prime           сначала холодный проход: каждое имя по одному разу
+//     --seed N          зерно генератора (1)
+//
+// Холодный запрос - первый запрос к имени: его ответа еще нет в кэше
+// сервера, и сервер разрешает имя итеративно (делегирования зон при этом
+// могут быть уже в кэше). Остальные запросы теплые. С --prime холодный
+// проход по всем именам измеряется отдельно, и следующие за ним --queries
+// запросов почти все теплые; без него холодные и теплые запросы смешаны.
+//
+// Ответы сопоставляются с запросами по ID: он выбирается из свободных
+// значений таблицы запросов в полете, а ответ принимается, только если
+// его вопрос совпадает с отправленным.
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct BenchConfig {
+    std::string server_host;
+    int server_port;
+    size_t queries;
+    size_t outstanding;
+    size_t names;
+    std::vector<std::string> zones;
+    uint16_t type;
+    int timeout_ms;
+    bool prime;
+    unsigned seed;
+
+    BenchConfig() : server_host("127.0.0.1"), server_port(5353), queries(100000), outstanding(200),
+                    names(1000), zones{"bench.test", "cdn.test"}, type(1), timeout_ms(2000), prime(false), seed(1) {}
+};
+
+// Запрос в полете; индекс в таблице - его ID
+struct Slot {
+    bool used;
+    size_t name;
+    bool cold;
+    Clock::time_point sent;
+};
+
+BenchConfig g_config;
+
+std::string hostName(size_t index) {
+    return "host" + std::to_string(index) + "." + g_config.zones[index % g_config.zones.size()];
+}
+
+// Секция Question запроса к имени
+std::vector<uint8_t> buildQuestion(const std::string& name) {
+    std::vector<uint8_t> question;
+    size_t start = 0;
+    while (start < name.size()) {
+        size_t dot = name.find('.', start);
+        if (dot == std::string::npos) {
+            dot = name.size();
+        }
+        question.push_back(static_cast<uint8_t>(dot - start));
+        question.insert(question.end(), name.begin() + start, name.begin() + dot);
+        start = dot + 1;
+    }
+    question.push_back(0);
+    question.push_back(static_cast<uint8_t>(g_config.type >> 8));
+    question.push_back(static_cast<uint8_t>(g_config.type & 0xFF));
+    question.push_back(0);
+    question.push_back(1);
+    return question;
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(std::ceil(p * sorted.size())) - 1;
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+void printLatency(const char* label, std::vector<double>& samples) {
+    std::sort(samples.begin(), samples.end());
+    std::cout << "  " << std::left << std::setw(10) << label << std::right << std::fixed << std::setprecision(2);
+    if (samples.empty()) {
+        std::cout << "none" << std::endl;
+        return;
+    }
+    std::cout << samples.size() << " queries, p50 " << percentile(samples, 0.50)
+              << " ms, p99 " << percentile(samples, 0.99)
+              << " ms, max " << samples.back() << " ms" << std::endl;
+}
+
+struct PassResult {
+    size_t sent;
+    size_t timeouts;
+    size_t unmatched;
+    size_t rcodes[16];
+    std::vector<double> cold_ms;
+    std::vector<double> warm_ms;
+    double seconds;
+};
+
+void printPass(const char* label, PassResult& result) {
+    size_t answered = result.cold_ms.size() + result.warm_ms.size();
+    std::cout << label << ": " << result.sent << " queries in " << std::fixed << std::setprecision(2)
+              << result.seconds << " s, " << std::setprecision(0) << answered / result.seconds
+              << " answers/s" << std::endl;
+    std::cout << "  Responses " << result.rcodes[0] << " NOERROR, " << result.rcodes[3] << " NXDOMAIN, "
+              << result.rcodes[2] << " SERVFAIL, "
+              << answered - result.rcodes[0] - result.rcodes[2] - result.rcodes[3] << " other" << std::endl;
+    std::cout << "  Lost      " << result.timeouts << " timeouts, " << result.unmatched
+              << " unmatched responses" << std::endl;
+    printLatency("Cold", result.cold_ms);
+    printLatency("Warm", result.warm_ms);
+}
+
+// Отправляет запросы к именам из последовательности, держа в полете
+// не больше --outstanding; таблица ID общая для всех проходов
+class Driver {
+public:
+    Driver(int fd, const std::vector<std::vector<uint8_t>>& questions, std::mt19937& rng)
+        : fd_(fd), questions_(questions), slots_(65536), queried_(questions.size(), false), in_flight_(0) {
+        for (size_t i = 0; i < slots_.size(); ++i) {
+            free_ids_.push_back(static_cast<uint16_t>(i));
+        }
+        std::shuffle(free_ids_.begin(), free_ids_.end(), rng);
+    }
+
+    PassResult run(const std::vector<size_t>& sequence) {
+        PassResult result;
+        result.sent = 0;
+        result.timeouts = 0;
+        result.unmatched = 0;
+        std::fill(std::begin(result.rcodes), std::end(result.rcodes), 0);
+        std::chrono::milliseconds timeout(g_config.timeout_ms);
+
+        Clock::time_point started = Clock::now();
+        Clock::time_point last_sweep = started;
+        while (result.sent < sequence.size() || in_flight_ > 0) {
+            while (result.sent < sequence.size() && in_flight_ < g_config.outstanding) {
+                uint16_t id = free_ids_.back();
+                size_t name = sequence[result.sent];
+                std::vector<uint8_t> packet = {static_cast<uint8_t>(id >> 8), static_cast<uint8_t>(id & 0xFF),
+                                               0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0};
+                packet.insert(packet.end(), questions_[name].begin(), questions_[name].end());
+                if (send(fd_, packet.data(), packet.size(), 0) < 0) {
+                    break;      // буфер сокета полон - дождемся ответов
+                }
+                free_ids_.pop_back();
+                slots_[id].used = true;
+                slots_[id].name = name;
+                slots_[id].cold = !queried_[name];
+                queried_[name] = true;
+                slots_[id].sent = Clock::now();
+                ++result.sent;
+                ++in_flight_;
+            }
+
+            pollfd pfd = {fd_, POLLIN, 0};
+            poll(&pfd, 1, 10);
+            receive(result);
+
+            Clock::time_point now = Clock::now();
+            if (now - last_sweep >= std::chrono::milliseconds(50)) {
+                last_sweep = now;
+                for (size_t id = 0; id < slots_.size(); ++id) {
+                    if (slots_[id].used && now - slots_[id].sent >= timeout) {
+                        slots_[id].used = false;
+                        free_ids_.push_back(static_cast<uint16_t>(id));
+                        --in_flight_;
+                        ++result.timeouts;
+                    }
+                }
+            }
+        }
+        result.seconds = std::chrono::duration<double>(Clock::now() - started).count();
+        return result;
+    }
+
+private:
+    int fd_;
+    const std::vector<std::vector<uint8_t>>& questions_;
+    std::vector<Slot> slots_;
+    std::vector<uint16_t> free_ids_;
+    std::vector<bool> queried_;
+    size_t in_flight_;
+
+    void receive(PassResult& result) {
+        uint8_t buffer[4096];
+        ssize_t received;
+        while ((received = recv(fd_, buffer, sizeof(buffer), 0)) > 0) {
+            Clock::time_point now = Clock::now();
+            if (received < 12) {
+                ++result.unmatched;
+                continue;
+            }
+            uint16_t id = static_cast<uint16_t>((buffer[0] << 8) | buffer[1]);
+            Slot& slot = slots_[id];
+            const std::vector<uint8_t>& question = questions_[slot.name];
+            if (!slot.used || static_cast<size_t>(received) < 12 + question.size() ||
+                memcmp(buffer + 12, question.data(), question.size()) != 0) {
+                ++result.unmatched;
+                continue;
+            }
+            slot.used = false;
+            free_ids_.push_back(id);
+            --in_flight_;
+            result.rcodes[buffer[3] & 0x0F]++;
+            double ms = std::chrono::duration<double, std::milli>(now - slot.sent).count();
+            (slot.cold ? result.cold_ms : result.warm_ms).push_back(ms);
+        }
+    }
+};
+
+bool parseArgs(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--prime") {
+            g_config.prime = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--server") {
+            size_t colon = value.rfind(':');
+            if (colon == std::string::npos) {
+                std::cerr << "Expected IP:PORT for --server" << std::endl;
+                return false;
+            }
+            g_config.server_host = value.substr(0, colon);
+            g_config.server_port = std::atoi(value.c_str() + colon + 1);
+        } else if (arg == "--queries") {
+            g_config.queries = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (arg == "--outstanding") {
+            g_config.outstanding = std::min<size_t>(60000, std::max<size_t>(1, std::strtoul(value.c_str(), nullptr, 10)));
+        } else if (arg == "--names") {
+            g_config.names = std::max<size_t>(1, std::strtoul(value.c_str(), nullptr, 10));
+        } else if (arg == "--zones") {
+            g_config.zones.clear();
+            std::istringstream iss(value);
+            std::string zone;
+            while (std::getline(iss, zone, ',')) {
+                if (!zone.empty()) {
+                    g_config.zones.push_back(zone);
+                }
+            }
+            if (g_config.zones.empty()) {
+                std::cerr << "Expected a list of zones for --zones" << std::endl;
+                return false;
+            }
+        } else if (arg == "--type") {
+            if (value == "A") {
+                g_config.type = 1;
+            } else if (value == "AAAA") {
+                g_config.type = 28;
+            } else {
+                std::cerr << "Unsupported type " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--timeout-ms") {
+            g_config.timeout_ms = std::atoi(value.c_str());
+        } else if (arg == "--seed") {
+            g_config.seed = static_cast<unsigned>(std::strtoul(value.c_str(), nullptr, 10));
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (!parseArgs(argc, argv)) {
+        return 1;
+    }
+
+    sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(static_cast<uint16_t>(g_config.server_port));
+    if (inet_pton(AF_INET, g_config.server_host.c_str(), &server.sin_addr) <= 0) {
+        std::cerr << "Invalid server address " << g_config.server_host << std::endl;
+        return 1;
+    }
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&server), sizeof(server)) < 0) {
+        std::cerr << "Cannot open socket: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    int buffer_size = 4 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+
+    std::vector<std::vector<uint8_t>> questions(g_config.names);
+    for (size_t i = 0; i < g_config.names; ++i) {
+        questions[i] = buildQuestion(hostName(i));
+    }
+
+    std::mt19937 rng(g_config.seed);
+    Driver driver(fd, questions, rng);
+
+    std::string zones;
+    for (const auto& zone : g_config.zones) {
+        zones += (zones.empty() ? "" : ", ") + zone;
+    }
+    std::cout << "Workload:   " << g_config.names << " names in " << zones << ", type "
+              << (g_config.type == 1 ? "A" : "AAAA") << ", " << g_config.outstanding << " outstanding"
+              << std::endl;
+
+    bool failed = false;
+    if (g_config.prime) {
+        std::vector<size_t> order(g_config.names);
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        std::shuffle(order.begin(), order.end(), rng);
+        PassResult cold = driver.run(order);
+        printPass("Cold pass", cold);
+        failed = cold.timeouts == order.size();
+    }
+
+    std::uniform_int_distribution<size_t> pick(0, g_config.names - 1);
+    std::vector<size_t> sequence(g_config.queries);
+    for (size_t i = 0; i < sequence.size(); ++i) {
+        sequence[i] = pick(rng);
+    }
+    PassResult result = driver.run(sequence);
+    printPass(g_config.prime ? "Warm pass" : "Mixed pass", result);
+    close(fd);
+    return failed || (result.timeouts == sequence.size() && !sequence.empty()) ? 1 : 0;
+}
@@ -0,0 +1,152 @@
+#include "dns_cache.hpp"
+#include <algorithm>
+#include <cctype>
+
+namespace {
+
+// Накладные расходы на запись сверх ключа и значений: узлы списка и
+// таблицы, заголовки строк
+const size_t ENTRY_OVERHEAD = 128;
+
+// Тип ключа для NXDOMAIN: относится ко всем типам записей имени
+const uint16_t ANY_TYPE = 0;
+
+} // namespace
+
+DNSCache::DNSCache(const DNSCacheConfig& config)
+    : config_(config), bytes_(0), hits_(0), misses_(0), evictions_(0) {
+}
+
+std::string DNSCache::normalize(const std::string& name) {
+    std::string result = name;
+    while (!result.empty() && result.back() == '.') {
+        result.pop_back();
+    }
+    std::transform(result.begin(), result.end(), result.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return result;
+}
+
+std::string DNSCache::makeKey(const std::string& name, uint16_t type) {
+    return normalize(name) + "/" + std::to_string(type);
+}
+
+void DNSCache::store(const std::string& name, DNSRecordType type,
+                     const std::vector<std::string>& values, uint32_t ttl) {
+    if (ttl == 0 || values.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    insertLocked(makeKey(name, static_cast<uint16_t>(type)), Status::HIT, values,
+                 std::min(ttl, config_.max_ttl));
+    // Имя существует: прежний NXDOMAIN больше не верен
+    auto it = index_.find(makeKey(name, ANY_TYPE));
+    if (it != index_.end()) {
+        eraseLocked(it);
+    }
+}
+
+void DNSCache::storeNegative(const std::string& name, DNSRecordType type, bool nxdomain, uint32_t ttl) {
+    if (ttl == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint16_t key_type = nxdomain ? ANY_TYPE : static_cast<uint16_t>(type);
+    insertLocked(makeKey(name, key_type), nxdomain ? Status::NXDOMAIN : Status::NODATA,
+                 std::vector<std::string>(), std::min(ttl, config_.max_negative_ttl));
+}
+
+DNSCache::Status DNSCache::lookup(const std::string& name, DNSRecordType type,
+                                  std::vector<std::string>& values, uint32_t& ttl) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Clock::time_point now = Clock::now();
+
+    auto it = findLocked(makeKey(name, static_cast<uint16_t>(type)), now);
+    if (it == lru_.end()) {
+        it = findLocked(makeKey(name, ANY_TYPE), now);
+    }
+    if (it == lru_.end()) {
+        misses_++;
+        return Status::MISS;
+    }
+
+    lru_.splice(lru_.begin(), lru_, it);
+    hits_++;
+    values = it->values;
+    ttl = static_cast<uint32_t>(
+        std::chrono::ceil<std::chrono::seconds>(it->expires - now).count());
+    return it->status;
+}
+
+void DNSCache::insertLocked(const std::string& key, Status status,
+                            const std::vector<std::string>& values, uint32_t ttl) {
+    auto existing = index_.find(key);
+    if (existing != index_.end()) {
+        eraseLocked(existing);
+    }
+
+    Entry entry;
+    entry.key = key;
+    entry.status = status;
+    entry.values = values;
+    entry.expires = Clock::now() + std::chrono::seconds(ttl);
+    entry.bytes = ENTRY_OVERHEAD + 2 * key.size();
+    for (const auto& value : values) {
+        entry.bytes += value.size() + sizeof(std::string);
+    }
+    if (entry.bytes > config_.max_bytes) {
+        return;
+    }
+
+    lru_.push_front(std::move(entry));
+    index_[key] = lru_.begin();
+    bytes_ += lru_.front().bytes;
+
+    while (bytes_ > config_.max_bytes && !lru_.empty()) {
+        eraseLocked(index_.find(lru_.back().key));
+        evictions_++;
+    }
+}
+
+void DNSCache::eraseLocked(std::unordered_map<std::string, std::list<Entry>::iterator>::iterator it) {
+    bytes_ -= it->second->bytes;
+    lru_.erase(it->second);
+    index_.erase(it);
+}
+
+std::list<DNSCache::Entry>::iterator DNSCache::findLocked(const std::string& key, Clock::time_point now) {
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        return lru_.end();
+    }
+    if (it->second->expires <= now) {
+        eraseLocked(it);
+        return lru_.end();
+    }
+    return it->second;
+}
+
+size_t DNSCache::entries() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lru_.size();
+}
+
+size_t DNSCache::bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+}
+
+uint64_t DNSCache::hits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hits_;
+}
+
+uint64_t DNSCache::misses() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return misses_;
+}
+
+uint64_t DNSCache::evictions() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return evictions_;
+}
@@ -0,0 +1,88 @@
+#ifndef DNS_CACHE_HPP
+#define DNS_CACHE_HPP
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include "dns_resolver.hpp"
+
+// Ограничения кэша
+struct DNSCacheConfig {
+    size_t max_bytes;           // примерный объем записей в памяти
+    uint32_t max_ttl;           // верхняя граница TTL положительных ответов, секунды
+    uint32_t max_negative_ttl;  // верхняя граница TTL отрицательных ответов (RFC 2308, п. 5)
+
+    DNSCacheConfig() : max_bytes(4 * 1024 * 1024), max_ttl(86400), max_negative_ttl(10800) {}
+};
+
+// Общий для всех запросов кэш наборов записей (RRset) с учетом TTL:
+// ответы, делегирования (NS) и адреса серверов имен (glue). Хранит и
+// отрицательные ответы - NXDOMAIN для имени целиком и NODATA для пары
+// имя/тип. При превышении объема вытесняются давно не использованные
+// записи (LRU). Потокобезопасен.
+class DNSCache {
+public:
+    enum class Status {
+        MISS,
+        HIT,
+        NXDOMAIN,   // имени не существует
+        NODATA      // имя есть, записей этого типа нет
+    };
+
+    explicit DNSCache(const DNSCacheConfig& config = DNSCacheConfig());
+
+    DNSCache(const DNSCache&) = delete;
+    DNSCache& operator=(const DNSCache&) = delete;
+
+    // Набор записей name/type; TTL 0 не кэшируется
+    void store(const std::string& name, DNSRecordType type,
+               const std::vector<std::string>& values, uint32_t ttl);
+    void storeNegative(const std::string& name, DNSRecordType type, bool nxdomain, uint32_t ttl);
+
+    // При HIT заполняет values, а ttl - оставшимся временем жизни
+    Status lookup(const std::string& name, DNSRecordType type,
+                  std::vector<std::string>& values, uint32_t& ttl);
+
+    // Имя в нижнем регистре и без завершающей точки
+    static std::string normalize(const std::string& name);
+
+    size_t entries() const;
+    size_t bytes() const;
+    uint64_t hits() const;
+    uint64_t misses() const;
+    uint64_t evictions() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry {
+        std::string key;
+        Status status;
+        std::vector<std::string> values;
+        Clock::time_point expires;
+        size_t bytes;
+    };
+
+    DNSCacheConfig config_;
+    mutable std::mutex mutex_;
+    std::list<Entry> lru_;      // в начале - недавно использованные
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    size_t bytes_;
+    uint64_t hits_;
+    uint64_t misses_;
+    uint64_t evictions_;
+
+    static std::string makeKey(const std::string& name, uint16_t type);
+    void insertLocked(const std::string& key, Status status,
+                      const std::vector<std::string>& values, uint32_t ttl);
+    void eraseLocked(std::unordered_map<std::string, std::list<Entry>::iterator>::iterator it);
+    // Находит действующую запись, удаляя истекшую
+    std::list<Entry>::iterator findLocked(const std::string& key, Clock::time_point now);
+};
+
+#endif // DNS_CACHE_HPP
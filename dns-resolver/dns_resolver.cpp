@@ -1,5 +1,9 @@
 #include "dns_resolver.hpp"
+#include "dns_cache.hpp"
+#include "dns_server.hpp"
+#include <csignal>
 #include <iostream>
+#include <fstream>
 #include <sstream>
 #include <iomanip>
 #include <cstring>
@@ -11,6 +15,8 @@
 #include <ctime>
 #include <algorithm>
 #include <stdexcept>
+#include <chrono>
+#include <cmath>
 
 // Корневые DNS серверы
 const std::vector<std::string> DNSResolver::ROOT_SERVERS = {
@@ -83,15 +89,15 @@ bool UDPSocket::sendTo(const std::string& server_ip, uint16_t port, const void*
     return sent == static_cast<ssize_t>(len);
 }
 
-ssize_t UDPSocket::recvFrom(void* buffer, size_t len, std::string& from_ip, uint16_t& from_port, int timeout_sec) {
+ssize_t UDPSocket::recvFrom(void* buffer, size_t len, std::string& from_ip, uint16_t& from_port, int timeout_ms) {
     if (!isValid()) {
         return -1;
     }
     
     // Установка таймаута через setsockopt для более надежной работы
     struct timeval timeout;
-    timeout.tv_sec = timeout_sec;
-    timeout.tv_usec = 0;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
     if (setsockopt(sockfd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
         // Если не удалось установить через setsockopt, используем select
     }
@@ -224,7 +230,41 @@ ssize_t TCPSocket::recv(void* buffer, size_t len, int timeout_sec) {
 
 // ==================== DNSResolver Implementation ====================
 
-DNSResolver::DNSResolver(bool debug_mode) : debug_mode_(debug_mode) {
+DNSResolver::DNSResolver(bool debug_mode, std::shared_ptr<DNSCache> cache)
+    : debug_mode_(debug_mode), cache_(cache ? cache : std::make_shared<DNSCache>()),
+      root_servers_(ROOT_SERVERS), rng_(std::random_device()()) {
+}
+
+bool DNSResolver::loadRootHints(const std::string& path, std::vector<std::string>& servers) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    
+    servers.clear();
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t comment = line.find(';');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        std::istringstream iss(line);
+        std::vector<std::string> tokens;
+        std::string token;
+        while (iss >> token) {
+            tokens.push_back(token);
+        }
+        
+        // "адрес" или "имя TTL [IN] A адрес" как в named.root
+        in_addr addr;
+        if (tokens.size() == 1 && inet_pton(AF_INET, tokens[0].c_str(), &addr) == 1) {
+            servers.push_back(tokens[0]);
+        } else if (tokens.size() >= 4 && tokens[tokens.size() - 2] == "A" &&
+                   inet_pton(AF_INET, tokens.back().c_str(), &addr) == 1) {
+            servers.push_back(tokens.back());
+        }
+    }
+    return !servers.empty();
 }
 
 bool DNSResolver::isValidDomainName(const std::string& domain) {
@@ -387,6 +427,14 @@ bool DNSResolver::parseResourceRecord(const std::vector<uint8_t>& packet, size_t
         if (rr.type == DNSRecordType::CNAME) {
             rr.cname = rr.ns_name;
         }
+    } else if (rr.type == DNSRecordType::SOA) {
+        // MNAME, RNAME, затем SERIAL, REFRESH, RETRY, EXPIRE, MINIMUM
+        size_t soa_offset = offset - rr.data_length;
+        parseDNSName(packet, soa_offset);
+        parseDNSName(packet, soa_offset);
+        if (soa_offset + 20 <= offset) {
+            rr.soa_minimum = ntohl(*reinterpret_cast<const uint32_t*>(&packet[soa_offset + 16]));
+        }
     }
     
     return true;
@@ -396,7 +444,8 @@ bool DNSResolver::parseDNSResponse(const std::vector<uint8_t>& response,
                                    DNSRecordType /* query_type */,
                                    std::vector<DNSResourceRecord>& answers,
                                    std::vector<DNSResourceRecord>& authority,
-                                   std::vector<DNSResourceRecord>& additional) {
+                                   std::vector<DNSResourceRecord>& additional,
+                                   uint8_t& rcode) {
     if (response.size() < sizeof(DNSHeader)) {
         return false;
     }
@@ -404,11 +453,10 @@ bool DNSResolver::parseDNSResponse(const std::vector<uint8_t>& response,
     const DNSHeader* header = reinterpret_cast<const DNSHeader*>(response.data());
     uint16_t flags = ntohs(header->flags);
     
-    // Проверка на ошибки
-    uint8_t rcode = flags & 0x0F;
-    if (rcode == 3) { // NXDOMAIN
+    // Проверка на ошибки; NXDOMAIN разбирается ради SOA в Authority секции
+    rcode = flags & 0x0F;
+    if (rcode == 3) {
         debugLog("Domain not found (NXDOMAIN)");
-        return false;
     } else if (rcode != 0) {
         debugLog("DNS error code: " + std::to_string(rcode));
         return false;
@@ -465,70 +513,197 @@ bool DNSResolver::parseDNSResponse(const std::vector<uint8_t>& response,
     return true;
 }
 
-bool DNSResolver::queryUDP(const std::string& server_ip, const std::vector<uint8_t>& query, 
-                          std::vector<uint8_t>& response, bool& truncated, uint16_t expected_id) {
+bool DNSResolver::raceUDP(const std::vector<std::string>& servers, const std::string& domain, DNSRecordType type,
+                          std::vector<uint8_t>& response, bool& truncated, std::string& answered_by,
+                          std::vector<std::string>& failed) {
+    typedef std::chrono::steady_clock Clock;
+    
     UDPSocket socket;
     if (!socket.isValid()) {
         debugLog("Failed to create UDP socket: " + std::string(strerror(errno)));
+        failed = servers;
         return false;
     }
     
-    debugLog("Querying " + server_ip + " via UDP");
+    // Запрос к одному серверу; у каждого свой ID
+    struct Attempt {
+        std::string server;
+        uint16_t id;
+        Clock::time_point sent;
+        bool done;
+    };
+    std::vector<Attempt> attempts;
     
-    if (!socket.sendTo(server_ip, 53, query.data(), query.size())) {
-        debugLog("Failed to send UDP query: " + std::string(strerror(errno)));
-        return false;
-    }
+    std::vector<std::string> order = rankServers(servers);
+    size_t next = 0;
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + std::chrono::milliseconds(QUERY_TIMEOUT_MS);
+    Clock::time_point next_send = start;
     
-    uint8_t buffer[512];
-    std::string from_ip;
-    uint16_t from_port;
-    // Короткий таймаут для быстрого переключения между серверами
-    ssize_t received = socket.recvFrom(buffer, sizeof(buffer), from_ip, from_port, 3);
+    auto elapsedMs = [](Clock::time_point from, Clock::time_point to) {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    };
     
-    if (received < static_cast<ssize_t>(sizeof(DNSHeader))) {
+    uint8_t buffer[512];
+    while (true) {
+        Clock::time_point now = Clock::now();
+        size_t pending = 0;
+        for (const auto& attempt : attempts) {
+            if (!attempt.done) {
+                pending++;
+            }
+        }
+        
+        // Следующий сервер - по истечении паузы или сразу, если все
+        // опрошенные уже ответили ошибкой
+        if (next < order.size() && now < deadline && (now >= next_send || pending == 0)) {
+            Attempt attempt;
+            attempt.server = order[next++];
+            bool unique;
+            do {
+                attempt.id = newQueryId();
+                unique = true;
+                for (const auto& other : attempts) {
+                    if (other.id == attempt.id) {
+                        unique = false;
+                    }
+                }
+            } while (!unique);
+            attempt.done = false;
+            
+            std::vector<uint8_t> query = createDNSQuery(attempt.id, domain, type);
+            debugLog("Querying " + attempt.server + " via UDP");
+            if (!socket.sendTo(attempt.server, 53, query.data(), query.size())) {
+                debugLog("Failed to send UDP query: " + std::string(strerror(errno)));
+                failed.push_back(attempt.server);
+                continue;
+            }
+            attempt.sent = now;
+            attempts.push_back(attempt);
+            next_send = now + std::chrono::milliseconds(staggerFor(attempt.server));
+            continue;
+        }
+        
+        if ((pending == 0 && next >= order.size()) || now >= deadline) {
+            break;
+        }
+        
+        Clock::time_point wake = deadline;
+        if (next < order.size() && next_send < wake) {
+            wake = next_send;
+        }
+        int wait_ms = std::max(1, static_cast<int>(std::ceil(elapsedMs(now, wake))));
+        
+        std::string from_ip;
+        uint16_t from_port = 0;
+        ssize_t received = socket.recvFrom(buffer, sizeof(buffer), from_ip, from_port, wait_ms);
         if (received < 0) {
-            debugLog("No response or timeout from " + server_ip);
-        } else {
-            debugLog("Response too short from " + server_ip);
+            continue;
         }
-        return false;
-    }
-    
-    // Проверяем, что ответ пришел от правильного сервера
-    if (from_ip != server_ip) {
-        debugLog("Response from different IP: " + from_ip + " (expected " + server_ip + ")");
-        // Все равно принимаем ответ, так как некоторые серверы могут использовать другой IP
-    }
-    
-    response.assign(buffer, buffer + received);
-    
-    // Проверка заголовка
-    if (response.size() < sizeof(DNSHeader)) {
-        debugLog("Response too short");
-        return false;
-    }
-    
-    const DNSHeader* header = reinterpret_cast<const DNSHeader*>(response.data());
-    
-    // Проверка ID запроса (защита от подмены ответов)
-    uint16_t response_id = ntohs(header->id);
-    if (response_id != expected_id) {
-        debugLog("Response ID mismatch: expected " + std::to_string(expected_id) + 
-                 ", got " + std::to_string(response_id));
-        return false;
+        
+        // Ответ принимается только от того сервера, которому ушел запрос с этим ID
+        uint16_t response_id = received >= static_cast<ssize_t>(sizeof(DNSHeader))
+            ? ntohs(reinterpret_cast<const DNSHeader*>(buffer)->id) : 0;
+        Attempt* match = nullptr;
+        for (auto& attempt : attempts) {
+            if (!attempt.done && attempt.id == response_id && attempt.server == from_ip && from_port == 53) {
+                match = &attempt;
+            }
+        }
+        if (received < static_cast<ssize_t>(sizeof(DNSHeader)) || !match) {
+            debugLog("Ignoring unexpected response from " + from_ip + " (ID " + std::to_string(response_id) + ")");
+            continue;
+        }
+        
+        Clock::time_point arrived = Clock::now();
+        noteResponse(match->server, elapsedMs(match->sent, arrived));
+        
+        uint16_t flags = ntohs(reinterpret_cast<const DNSHeader*>(buffer)->flags);
+        uint8_t rcode = flags & 0x0F;
+        if ((flags & 0x8000) == 0 || (rcode != 0 && rcode != 3)) {
+            // SERVFAIL, REFUSED и т.п.: ждем остальных
+            debugLog("Server " + match->server + " answered with error code " + std::to_string(rcode));
+            match->done = true;
+            failed.push_back(match->server);
+            continue;
+        }
+        
+        // Проигравшие серверы не штрафуются, но их SRTT не меньше прошедшего времени
+        for (auto& attempt : attempts) {
+            if (!attempt.done && &attempt != match) {
+                ServerStats& stats = server_stats_[attempt.server];
+                stats.srtt_ms = std::max(stats.srtt_ms, elapsedMs(attempt.sent, arrived));
+                stats.measured = true;
+            }
+        }
+        
+        response.assign(buffer, buffer + received);
+        truncated = (flags & 0x0200) != 0; // TC (Truncated) флаг
+        answered_by = match->server;
+        if (truncated) {
+            debugLog("Response truncated, will retry via TCP");
+        }
+        debugLog("Received " + std::to_string(received) + " bytes from " + from_ip + " after " +
+                 std::to_string(static_cast<int>(elapsedMs(start, arrived))) + " ms");
+        return true;
     }
     
-    // Проверка на усеченный пакет
-    uint16_t flags = ntohs(header->flags);
-    truncated = (flags & 0x0200) != 0; // TC (Truncated) флаг
-    
-    if (truncated) {
-        debugLog("Response truncated, will retry via TCP");
+    Clock::time_point now = Clock::now();
+    for (const auto& attempt : attempts) {
+        if (!attempt.done) {
+            debugLog("No response or timeout from " + attempt.server);
+            noteTimeout(attempt.server, elapsedMs(attempt.sent, now));
+            failed.push_back(attempt.server);
+        }
     }
-    
-    debugLog("Received " + std::to_string(received) + " bytes from " + from_ip);
-    return true;
+    return false;
+}
+
+std::vector<std::string> DNSResolver::rankServers(const std::vector<std::string>& servers) const {
+    // Еще не опрошенные серверы идут первыми, чтобы узнать их время ответа
+    std::vector<std::pair<double, std::string>> ranked;
+    for (const auto& server : servers) {
+        auto it = server_stats_.find(server);
+        ranked.emplace_back(it != server_stats_.end() ? it->second.srtt_ms : 0.0, server);
+    }
+    std::stable_sort(ranked.begin(), ranked.end(),
+                     [](const std::pair<double, std::string>& a, const std::pair<double, std::string>& b) {
+                         return a.first < b.first;
+                     });
+    
+    std::vector<std::string> order;
+    for (const auto& entry : ranked) {
+        order.push_back(entry.second);
+    }
+    return order;
+}
+
+int DNSResolver::staggerFor(const std::string& server) const {
+    // Ждем чуть дольше обычного времени ответа сервера
+    auto it = server_stats_.find(server);
+    if (it == server_stats_.end() || !it->second.measured) {
+        return DEFAULT_STAGGER_MS;
+    }
+    int stagger = static_cast<int>(it->second.srtt_ms * 1.5) + 10;
+    return std::min(std::max(stagger, MIN_STAGGER_MS), MAX_STAGGER_MS);
+}
+
+void DNSResolver::noteResponse(const std::string& server, double rtt_ms) {
+    ServerStats& stats = server_stats_[server];
+    stats.srtt_ms = stats.measured ? 0.7 * stats.srtt_ms + 0.3 * rtt_ms : rtt_ms;
+    stats.measured = true;
+}
+
+void DNSResolver::noteTimeout(const std::string& server, double waited_ms) {
+    // Молчащий сервер уходит в конец очереди, но не навсегда
+    ServerStats& stats = server_stats_[server];
+    stats.srtt_ms = std::min(std::max(stats.srtt_ms * 2, waited_ms + QUERY_TIMEOUT_MS), 60000.0);
+    stats.measured = true;
+}
+
+uint16_t DNSResolver::newQueryId() {
+    std::uniform_int_distribution<int> distribution(0, 0xFFFF);
+    return static_cast<uint16_t>(distribution(rng_));
 }
 
 bool DNSResolver::queryTCP(const std::string& server_ip, const std::vector<uint8_t>& query, 
@@ -600,6 +775,7 @@ bool DNSResolver::queryTCP(const std::string& server_ip, const std::vector<uint8
 
 bool DNSResolver::iterativeResolve(const std::string& domain, DNSRecordType type, 
                                    const std::vector<std::string>& name_servers,
+                                   const std::string& zone, int depth,
                                    std::vector<std::string>& results) {
     const int MAX_ITERATIONS = 20; // Защита от бесконечных циклов
     const int MAX_SERVER_TRIES = 2; // Максимум попыток для каждого уровня серверов (уменьшено для быстрого выхода)
@@ -609,10 +785,13 @@ bool DNSResolver::iterativeResolve(const std::string& domain, DNSRecordType type
     const int MAX_TOTAL_FAILURES = 5; // Общее ограничение на количество неудач
     
     std::vector<std::string> current_servers = name_servers;
+    // Зона, за которую отвечают текущие серверы
+    std::string current_zone = zone;
     
     while (iterations < MAX_ITERATIONS) {
         iterations++;
-        debugLog("=== Iteration " + std::to_string(iterations) + " ===");
+        debugLog("=== Iteration " + std::to_string(iterations) + " (zone: " +
+                 (current_zone.empty() ? "." : current_zone) + ") ===");
         
         if (current_servers.empty()) {
             debugLog("No more name servers to query");
@@ -643,37 +822,40 @@ bool DNSResolver::iterativeResolve(const std::string& domain, DNSRecordType type
             return false;
         }
         
-        // Выбираем первый сервер из списка
-        std::string server = current_servers[0];
-        debugLog("Querying server: " + server);
-        
-        // Создаем запрос
-        uint16_t query_id = static_cast<uint16_t>(time(nullptr) & 0xFFFF);
-        std::vector<uint8_t> query = createDNSQuery(query_id, domain, type);
-        
-        // Пробуем UDP с коротким таймаутом
+        // Опрашиваем серверы уровня наперегонки, начиная с самого быстрого
         std::vector<uint8_t> response;
         bool truncated = false;
-        bool success = queryUDP(server, query, response, truncated, query_id);
+        std::string server;
+        std::vector<std::string> failed;
+        bool success = raceUDP(current_servers, domain, type, response, truncated, server, failed);
         
-        // Если усечено, переключаемся на TCP
+        // Если усечено, переключаемся на TCP к ответившему серверу
         if (success && truncated) {
             debugLog("UDP response truncated, switching to TCP");
+            uint16_t query_id = newQueryId();
+            std::vector<uint8_t> query = createDNSQuery(query_id, domain, type);
             success = queryTCP(server, query, response, query_id);
+            if (!success) {
+                failed.push_back(server);
+            }
         }
         
         if (!success) {
             server_tries++;
             total_failures++;
-            debugLog("Query failed, trying next server (attempt " + std::to_string(server_tries) + "/" + std::to_string(MAX_SERVER_TRIES) + ", total failures: " + std::to_string(total_failures) + ")");
+            debugLog("Query failed, trying remaining servers (attempt " + std::to_string(server_tries) + "/" + std::to_string(MAX_SERVER_TRIES) + ", total failures: " + std::to_string(total_failures) + ")");
+            
+            // Убираем серверы, которые не ответили
+            for (const auto& dead : failed) {
+                current_servers.erase(std::remove(current_servers.begin(), current_servers.end(), dead),
+                                      current_servers.end());
+            }
             
             // Если серверов больше нет, выходим
-            if (current_servers.size() <= 1) {
+            if (current_servers.empty()) {
                 debugLog("No more servers to try");
                 return false;
             }
-            
-            current_servers.erase(current_servers.begin());
             continue;
         }
         
@@ -685,13 +867,23 @@ bool DNSResolver::iterativeResolve(const std::string& domain, DNSRecordType type
         std::vector<DNSResourceRecord> answers;
         std::vector<DNSResourceRecord> authority;
         std::vector<DNSResourceRecord> additional;
+        uint8_t rcode = 0;
         
-        if (!parseDNSResponse(response, type, answers, authority, additional)) {
+        if (!parseDNSResponse(response, type, answers, authority, additional, rcode)) {
             debugLog("Failed to parse response");
-            current_servers.erase(current_servers.begin());
+            current_servers.erase(std::remove(current_servers.begin(), current_servers.end(), server),
+                                  current_servers.end());
             continue;
         }
         
+        // Записи вне зоны опрошенного сервера отбрасываются (защита кэша от подмены)
+        cacheRecords(current_zone, answers, authority, additional);
+        
+        if (rcode == 3) {
+            cacheNegative(domain, type, true, current_zone, authority);
+            return false;
+        }
+        
         // Проверяем ответы
         bool found_final_answer = false;
         std::string cname_target;
@@ -710,6 +902,10 @@ bool DNSResolver::iterativeResolve(const std::string& domain, DNSRecordType type
                     results.push_back(rr.ns_name);
                     debugLog("Found NS record: " + rr.ns_name);
                     found_final_answer = true;
+                } else if (type == DNSRecordType::CNAME && !rr.cname.empty()) {
+                    results.push_back(rr.cname);
+                    debugLog("Found CNAME record: " + rr.cname);
+                    found_final_answer = true;
                 }
             } else if (rr.type == DNSRecordType::CNAME && !rr.cname.empty()) {
                 cname_target = rr.cname;
@@ -722,63 +918,78 @@ bool DNSResolver::iterativeResolve(const std::string& domain, DNSRecordType type
             return true;
         }
         
-        // Если нашли CNAME, нужно разрешить его (но с ограничением глубины)
-        if (!cname_target.empty() && iterations < MAX_ITERATIONS - 5) {
+        // Если нашли CNAME, разрешаем целевое имя (начиная с кэша)
+        if (!cname_target.empty()) {
             debugLog("Following CNAME to: " + cname_target);
-            std::vector<std::string> cname_results;
-            if (iterativeResolve(cname_target, type, ROOT_SERVERS, cname_results)) {
-                results.insert(results.end(), cname_results.begin(), cname_results.end());
-                return true;
-            }
-            debugLog("Failed to resolve CNAME target");
+            return resolveName(cname_target, type, depth + 1, results);
         }
         
-        // Ищем NS записи в Authority секции
+        // Ищем делегирование в Authority секции: NS записи зоны ниже текущей,
+        // в которую входит искомое имя
         std::vector<std::string> next_servers;
+        std::string next_zone;
+        bool has_soa = false;
         for (const auto& rr : authority) {
-            if (rr.type == DNSRecordType::NS && !rr.ns_name.empty()) {
-                next_servers.push_back(rr.ns_name);
+            if (rr.type == DNSRecordType::SOA) {
+                has_soa = true;
+            }
+            if (rr.type != DNSRecordType::NS || rr.ns_name.empty()) {
+                continue;
+            }
+            std::string owner = DNSCache::normalize(rr.name);
+            if (owner == current_zone || !inZone(owner, current_zone) || !inZone(domain, owner)) {
+                debugLog("Ignoring out-of-zone NS " + rr.ns_name + " for " + owner);
+                continue;
+            }
+            if (next_zone.empty() || owner == next_zone) {
+                next_zone = owner;
+                next_servers.push_back(DNSCache::normalize(rr.ns_name));
                 debugLog("Found authority NS: " + rr.ns_name);
             }
         }
         
-        // Ищем IP адреса для NS серверов в Additional секции
+        // Ответ без записей и без делегирования - NODATA
+        if (next_servers.empty()) {
+            if (has_soa) {
+                debugLog("No records of this type (NODATA)");
+                cacheNegative(domain, type, false, current_zone, authority);
+            } else {
+                debugLog("No more servers to query");
+            }
+            return false;
+        }
+        
+        // Адреса серверов имен: glue из Additional секции, затем кэш
         current_servers.clear();
         for (const auto& rr : additional) {
-            if (rr.type == DNSRecordType::A && !rr.ipv4_address.empty()) {
+            if (rr.type == DNSRecordType::A && !rr.ipv4_address.empty() &&
+                std::find(next_servers.begin(), next_servers.end(), DNSCache::normalize(rr.name)) != next_servers.end()) {
                 current_servers.push_back(rr.ipv4_address);
                 debugLog("Found NS server IP: " + rr.ipv4_address);
             }
         }
+        if (current_servers.empty()) {
+            for (const auto& ns : next_servers) {
+                std::vector<std::string> addresses;
+                uint32_t ttl = 0;
+                if (cache_->lookup(ns, DNSRecordType::A, addresses, ttl) == DNSCache::Status::HIT) {
+                    current_servers.insert(current_servers.end(), addresses.begin(), addresses.end());
+                    debugLog("Found cached NS server IPs for " + ns);
+                }
+            }
+        }
         
         // Если не нашли IP адреса, нужно разрешить имена NS серверов
-        if (current_servers.empty() && !next_servers.empty()) {
+        if (current_servers.empty()) {
             debugLog("Need to resolve NS server names");
-            // Рекурсивно разрешаем первый NS сервер (с ограничением итераций)
-            if (iterations < MAX_ITERATIONS - 3) {
+            // Пробуем не больше двух серверов, начиная с ближайшей известной зоны
+            for (size_t i = 0; i < next_servers.size() && i < 2 && current_servers.empty(); i++) {
                 std::vector<std::string> ns_ips;
-                if (iterativeResolve(next_servers[0], DNSRecordType::A, ROOT_SERVERS, ns_ips)) {
+                if (resolveName(next_servers[i], DNSRecordType::A, depth + 1, ns_ips)) {
                     current_servers = ns_ips;
-                    server_tries = 0; // Сброс счетчика при переходе на новый уровень
                 } else {
-                    debugLog("Failed to resolve NS server name: " + next_servers[0]);
-                    // Пробуем следующий NS сервер, если есть
-                    if (next_servers.size() > 1 && iterations < MAX_ITERATIONS - 3) {
-                        std::vector<std::string> ns_ips2;
-                        if (iterativeResolve(next_servers[1], DNSRecordType::A, ROOT_SERVERS, ns_ips2)) {
-                            current_servers = ns_ips2;
-                            server_tries = 0;
-                        } else {
-                            debugLog("Failed to resolve second NS server name");
-                            return false;
-                        }
-                    } else {
-                        return false;
-                    }
+                    debugLog("Failed to resolve NS server name: " + next_servers[i]);
                 }
-            } else {
-                debugLog("Too many iterations, cannot resolve NS server names");
-                return false;
             }
         }
         
@@ -787,7 +998,8 @@ bool DNSResolver::iterativeResolve(const std::string& domain, DNSRecordType type
             return false;
         }
         
-        // Сброс счетчика при переходе на новый уровень серверов
+        // Переход на новый уровень серверов
+        current_zone = next_zone;
         server_tries = 0;
     }
     
@@ -795,6 +1007,137 @@ bool DNSResolver::iterativeResolve(const std::string& domain, DNSRecordType type
     return false;
 }
 
+bool DNSResolver::resolveName(const std::string& domain, DNSRecordType type, int depth,
+                              std::vector<std::string>& results) {
+    if (depth > MAX_LOOKUP_DEPTH) {
+        debugLog("Too many nested lookups, giving up on " + domain);
+        return false;
+    }
+    
+    // Ответ из кэша, в том числе через цепочку CNAME
+    std::string name = DNSCache::normalize(domain);
+    for (int hops = 0; hops <= MAX_LOOKUP_DEPTH; hops++) {
+        std::vector<std::string> values;
+        uint32_t ttl = 0;
+        DNSCache::Status status = cache_->lookup(name, type, values, ttl);
+        if (status == DNSCache::Status::HIT) {
+            debugLog("Cache hit: " + name + " " + recordTypeToString(type) + " (TTL " + std::to_string(ttl) + ")");
+            results.insert(results.end(), values.begin(), values.end());
+            return true;
+        }
+        if (status == DNSCache::Status::NXDOMAIN || status == DNSCache::Status::NODATA) {
+            debugLog("Negative cache hit: " + name + (status == DNSCache::Status::NXDOMAIN ? " (NXDOMAIN)" : " (NODATA)"));
+            return false;
+        }
+        if (type == DNSRecordType::CNAME ||
+            cache_->lookup(name, DNSRecordType::CNAME, values, ttl) != DNSCache::Status::HIT) {
+            break;
+        }
+        debugLog("Cached CNAME " + name + " -> " + values[0]);
+        name = DNSCache::normalize(values[0]);
+    }
+    
+    std::string zone;
+    std::vector<std::string> servers;
+    closestServers(name, zone, servers);
+    if (zone.empty()) {
+        debugLog("Starting from root servers");
+    } else {
+        debugLog("Starting from cached delegation for " + zone);
+    }
+    return iterativeResolve(name, type, servers, zone, depth, results);
+}
+
+void DNSResolver::closestServers(const std::string& domain, std::string& zone, std::vector<std::string>& servers) {
+    // Ищем самый глубокий закэшированный срез зоны, для серверов которого известны адреса
+    std::string suffix = domain;
+    while (!suffix.empty()) {
+        std::vector<std::string> ns_names;
+        uint32_t ttl = 0;
+        if (cache_->lookup(suffix, DNSRecordType::NS, ns_names, ttl) == DNSCache::Status::HIT) {
+            servers.clear();
+            for (const auto& ns : ns_names) {
+                std::vector<std::string> addresses;
+                if (cache_->lookup(ns, DNSRecordType::A, addresses, ttl) == DNSCache::Status::HIT) {
+                    servers.insert(servers.end(), addresses.begin(), addresses.end());
+                }
+            }
+            if (!servers.empty()) {
+                zone = suffix;
+                return;
+            }
+        }
+        size_t dot = suffix.find('.');
+        suffix = dot == std::string::npos ? std::string() : suffix.substr(dot + 1);
+    }
+    zone.clear();
+    servers = root_servers_;
+}
+
+void DNSResolver::cacheRecords(const std::string& zone,
+                               const std::vector<DNSResourceRecord>& answers,
+                               const std::vector<DNSResourceRecord>& authority,
+                               const std::vector<DNSResourceRecord>& additional) {
+    // Записи собираются в наборы по имени и типу; TTL набора - наименьший
+    std::map<std::pair<std::string, DNSRecordType>, std::pair<std::vector<std::string>, uint32_t>> rrsets;
+    auto collect = [&](const std::vector<DNSResourceRecord>& section, bool delegations_only) {
+        for (const auto& rr : section) {
+            std::string value = recordValue(rr);
+            std::string owner = DNSCache::normalize(rr.name);
+            if (value.empty() || !inZone(owner, zone) ||
+                (delegations_only && rr.type != DNSRecordType::NS)) {
+                continue;
+            }
+            auto& rrset = rrsets[std::make_pair(owner, rr.type)];
+            if (rrset.first.empty() || rr.ttl < rrset.second) {
+                rrset.second = rr.ttl;
+            }
+            if (std::find(rrset.first.begin(), rrset.first.end(), value) == rrset.first.end()) {
+                rrset.first.push_back(value);
+            }
+        }
+    };
+    collect(answers, false);
+    collect(authority, true);
+    collect(additional, false);
+    
+    for (const auto& rrset : rrsets) {
+        cache_->store(rrset.first.first, rrset.first.second, rrset.second.first, rrset.second.second);
+    }
+}
+
+void DNSResolver::cacheNegative(const std::string& domain, DNSRecordType type, bool nxdomain,
+                                const std::string& zone, const std::vector<DNSResourceRecord>& authority) {
+    // RFC 2308: без SOA ответ не кэшируется, TTL - меньшее из TTL записи SOA и ее поля MINIMUM
+    for (const auto& rr : authority) {
+        if (rr.type == DNSRecordType::SOA && inZone(DNSCache::normalize(rr.name), zone)) {
+            uint32_t ttl = std::min(rr.ttl, rr.soa_minimum);
+            cache_->storeNegative(domain, type, nxdomain, ttl);
+            debugLog("Cached negative answer for " + domain + " (TTL " + std::to_string(ttl) + ")");
+            return;
+        }
+    }
+}
+
+bool DNSResolver::inZone(const std::string& name, const std::string& zone) {
+    if (zone.empty() || name == zone) {
+        return true;
+    }
+    return name.size() > zone.size() &&
+           name.compare(name.size() - zone.size(), zone.size(), zone) == 0 &&
+           name[name.size() - zone.size() - 1] == '.';
+}
+
+std::string DNSResolver::recordValue(const DNSResourceRecord& rr) {
+    switch (rr.type) {
+        case DNSRecordType::A: return rr.ipv4_address;
+        case DNSRecordType::AAAA: return rr.ipv6_address;
+        case DNSRecordType::NS: return DNSCache::normalize(rr.ns_name);
+        case DNSRecordType::CNAME: return DNSCache::normalize(rr.cname);
+        default: return std::string();
+    }
+}
+
 bool DNSResolver::resolve(const std::string& domain, DNSRecordType type, std::vector<std::string>& results) {
     results.clear();
     
@@ -804,9 +1147,8 @@ bool DNSResolver::resolve(const std::string& domain, DNSRecordType type, std::ve
     }
     
     debugLog("Resolving " + domain + " (type: " + recordTypeToString(type) + ")");
-    debugLog("Starting from root servers");
     
-    return iterativeResolve(domain, type, ROOT_SERVERS, results);
+    return resolveName(domain, type, 0, results);
 }
 
 void DNSResolver::debugLog(const std::string& message) {
@@ -834,24 +1176,105 @@ std::string DNSResolver::ipv6ToString(const uint8_t* addr) {
 
 // ==================== Main Function ====================
 
-int main(int argc, char* argv[]) {
-    if (argc < 3) {
-        std::cerr << "Usage: " << argv[0] << " [-d] <domain> <type>" << std::endl;
-        std::cerr << "  -d       : Enable debug mode" << std::endl;
-        std::cerr << "  domain   : Domain name to resolve" << std::endl;
-        std::cerr << "  type     : Record type (A, AAAA, NS, etc.)" << std::endl;
+DNSServer* g_server = nullptr;
+
+void signalHandler(int /* signal */) {
+    if (g_server) {
+        g_server->stop();
+    }
+}
+
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [-d] [-r <ip,...> | -R <file>] <domain> <type>" << std::endl;
+    std::cerr << "       " << program << " [-d] [-r <ip,...> | -R <file>] [-w <workers>] -s [<address>:]<port>" << std::endl;
+    std::cerr << "  -d       : Enable debug mode" << std::endl;
+    std::cerr << "  -r       : Root servers to start from instead of the built-in ones" << std::endl;
+    std::cerr << "  -R       : Read root servers from a root hints file (named.root format)" << std::endl;
+    std::cerr << "  -s       : Run as a recursive DNS server on UDP and TCP (default 0.0.0.0)" << std::endl;
+    std::cerr << "  -w       : Resolver threads of the server (16)" << std::endl;
+    std::cerr << "  domain   : Domain name to resolve" << std::endl;
+    std::cerr << "  type     : Record type (A, AAAA, NS, etc.)" << std::endl;
+}
+
+std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::istringstream iss(list);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+int runServer(const DNSServerConfig& config) {
+    DNSServer server(config);
+    if (!server.start()) {
         return 1;
     }
+    g_server = &server;
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+    
+    std::cerr << "DNS server listening on " << config.address << ":" << config.port
+              << " (UDP and TCP), " << config.workers << " resolver threads" << std::endl;
+    server.run();
+    g_server = nullptr;
     
+    std::cerr << "Shutting down DNS server" << std::endl;
+    server.printStats(std::cerr);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
     bool debug_mode = false;
     std::string domain;
     std::string type_str;
+    std::vector<std::string> root_servers;
+    bool server_mode = false;
+    DNSServerConfig server_config;
     
-    // Парсинг аргументов
+    // Парсинг аргументов: сначала ключи, затем имя и тип
     int arg_idx = 1;
-    if (argc >= 4 && std::string(argv[1]) == "-d") {
-        debug_mode = true;
-        arg_idx = 2;
+    while (arg_idx < argc && argv[arg_idx][0] == '-') {
+        std::string option = argv[arg_idx++];
+        if (option == "-d") {
+            debug_mode = true;
+        } else if (option == "-r" && arg_idx < argc) {
+            root_servers = splitList(argv[arg_idx++]);
+        } else if (option == "-R" && arg_idx < argc) {
+            if (!DNSResolver::loadRootHints(argv[arg_idx], root_servers)) {
+                std::cerr << "Error: no IPv4 root servers in " << argv[arg_idx] << std::endl;
+                return 1;
+            }
+            arg_idx++;
+        } else if (option == "-w" && arg_idx < argc) {
+            server_config.workers = static_cast<size_t>(std::max(1, atoi(argv[arg_idx++])));
+        } else if (option == "-s" && arg_idx < argc) {
+            std::string listen = argv[arg_idx++];
+            size_t colon = listen.rfind(':');
+            if (colon != std::string::npos) {
+                server_config.address = listen.substr(0, colon);
+                listen = listen.substr(colon + 1);
+            }
+            server_config.port = static_cast<uint16_t>(atoi(listen.c_str()));
+            server_mode = true;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    
+    if (server_mode) {
+        server_config.debug = debug_mode;
+        server_config.root_servers = root_servers;
+        return runServer(server_config);
+    }
+    
+    if (arg_idx + 2 > argc) {
+        printUsage(argv[0]);
+        return 1;
     }
     
     if (arg_idx >= argc) {
@@ -884,6 +1307,9 @@ int main(int argc, char* argv[]) {
     
     // Создание резолвера и разрешение
     DNSResolver resolver(debug_mode);
+    if (!root_servers.empty()) {
+        resolver.setRootServers(root_servers);
+    }
     std::vector<std::string> results;
     
     if (resolver.resolve(domain, type, results)) {
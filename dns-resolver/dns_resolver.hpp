@@ -5,6 +5,8 @@
 #include <vector>
 #include <cstdint>
 #include <memory>
+#include <map>
+#include <random>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -55,6 +57,7 @@ struct DNSResourceRecord {
     std::string ipv6_address;  // для AAAA записи
     std::string ns_name;       // для NS записи
     std::string cname;         // для CNAME записи
+    uint32_t soa_minimum = 0;  // для SOA записи: TTL отрицательных ответов
 };
 
 // RAII обертка для UDP сокета
@@ -75,7 +78,7 @@ public:
     int getFd() const { return sockfd_; }
     
     bool sendTo(const std::string& server_ip, uint16_t port, const void* data, size_t len);
-    ssize_t recvFrom(void* buffer, size_t len, std::string& from_ip, uint16_t& from_port, int timeout_sec = 5);
+    ssize_t recvFrom(void* buffer, size_t len, std::string& from_ip, uint16_t& from_port, int timeout_ms = 5000);
     
 private:
     int sockfd_;
@@ -106,20 +109,51 @@ private:
     int sockfd_;
 };
 
+class DNSCache;
+
 // DNS резолвер
 class DNSResolver {
 public:
-    DNSResolver(bool debug_mode = false);
+    // Резолверы могут разделять один кэш; без него создается собственный
+    DNSResolver(bool debug_mode = false, std::shared_ptr<DNSCache> cache = nullptr);
     
     // Основной метод разрешения
     bool resolve(const std::string& domain, DNSRecordType type, std::vector<std::string>& results);
     
+    std::shared_ptr<DNSCache> cache() const { return cache_; }
+    
+    // Замена корневых серверов (root hints), например локальными для тестов
+    void setRootServers(const std::vector<std::string>& servers) { root_servers_ = servers; }
+    // Адреса IPv4 из файла подсказок: формат named.root или по адресу в строке
+    static bool loadRootHints(const std::string& path, std::vector<std::string>& servers);
+    
 private:
     bool debug_mode_;
+    std::shared_ptr<DNSCache> cache_;
+    std::vector<std::string> root_servers_;
     
     // Корневые DNS серверы
     static const std::vector<std::string> ROOT_SERVERS;
     
+    // Ожидание ответа на один опрос уровня серверов
+    static const int QUERY_TIMEOUT_MS = 3000;
+    // Пауза перед запросом к следующему серверу, пока нет ответа
+    static const int DEFAULT_STAGGER_MS = 200;
+    static const int MIN_STAGGER_MS = 50;
+    static const int MAX_STAGGER_MS = 400;
+    // Глубина вложенных разрешений (CNAME, имена серверов без glue)
+    static const int MAX_LOOKUP_DEPTH = 8;
+    
+    // Сглаженное время ответа сервера (SRTT) для выбора порядка опроса
+    struct ServerStats {
+        double srtt_ms;
+        bool measured;
+        
+        ServerStats() : srtt_ms(0), measured(false) {}
+    };
+    std::map<std::string, ServerStats> server_stats_;
+    std::mt19937 rng_;
+    
     // Создание DNS запроса
     std::vector<uint8_t> createDNSQuery(uint16_t id, const std::string& domain, DNSRecordType type);
     
@@ -128,7 +162,8 @@ private:
                          DNSRecordType query_type,
                          std::vector<DNSResourceRecord>& answers,
                          std::vector<DNSResourceRecord>& authority,
-                         std::vector<DNSResourceRecord>& additional);
+                         std::vector<DNSResourceRecord>& additional,
+                         uint8_t& rcode);
     
     // Парсинг имени из DNS пакета (с поддержкой компрессии)
     std::string parseDNSName(const std::vector<uint8_t>& packet, size_t& offset);
@@ -136,19 +171,49 @@ private:
     // Парсинг одной Resource Record
     bool parseResourceRecord(const std::vector<uint8_t>& packet, size_t& offset, DNSResourceRecord& rr);
     
-    // Отправка запроса через UDP
-    bool queryUDP(const std::string& server_ip, const std::vector<uint8_t>& query, 
-                  std::vector<uint8_t>& response, bool& truncated, uint16_t expected_id);
+    // Опрос серверов через UDP наперегонки: запрос уходит лучшему по SRTT
+    // серверу, а если ответа нет, через паузу - следующему; принимается
+    // первый годный ответ. Все запросы идут через один сокет, ответы
+    // различаются по ID и адресу отправителя. Серверы, которые не ответили
+    // или ответили ошибкой, добавляются в failed.
+    bool raceUDP(const std::vector<std::string>& servers, const std::string& domain, DNSRecordType type,
+                 std::vector<uint8_t>& response, bool& truncated, std::string& answered_by,
+                 std::vector<std::string>& failed);
     
     // Отправка запроса через TCP
     bool queryTCP(const std::string& server_ip, const std::vector<uint8_t>& query, 
                   std::vector<uint8_t>& response, uint16_t expected_id);
     
-    // Итеративное разрешение
+    // Разрешение с учетом кэша: ответ, цепочка CNAME или ближайший срез зоны
+    bool resolveName(const std::string& domain, DNSRecordType type, int depth,
+                     std::vector<std::string>& results);
+    
+    // Итеративное разрешение, начиная с серверов зоны zone ("" - корень)
     bool iterativeResolve(const std::string& domain, DNSRecordType type, 
                         const std::vector<std::string>& name_servers,
+                        const std::string& zone, int depth,
                         std::vector<std::string>& results);
     
+    // Серверы самой глубокой закэшированной зоны, в которую входит domain
+    void closestServers(const std::string& domain, std::string& zone, std::vector<std::string>& servers);
+    
+    // Сохранение в кэш записей из зоны zone и отрицательных ответов (RFC 2308)
+    void cacheRecords(const std::string& zone,
+                      const std::vector<DNSResourceRecord>& answers,
+                      const std::vector<DNSResourceRecord>& authority,
+                      const std::vector<DNSResourceRecord>& additional);
+    void cacheNegative(const std::string& domain, DNSRecordType type, bool nxdomain,
+                       const std::string& zone, const std::vector<DNSResourceRecord>& authority);
+    static bool inZone(const std::string& name, const std::string& zone);
+    static std::string recordValue(const DNSResourceRecord& rr);
+    
+    // Порядок опроса и учет времени ответа серверов
+    std::vector<std::string> rankServers(const std::vector<std::string>& servers) const;
+    int staggerFor(const std::string& server) const;
+    void noteResponse(const std::string& server, double rtt_ms);
+    void noteTimeout(const std::string& server, double waited_ms);
+    uint16_t newQueryId();
+    
     // Вспомогательные функции
     void debugLog(const std::string& message);
     std::string recordTypeToString(DNSRecordType type);
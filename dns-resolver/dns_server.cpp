@@ -0,0 +1,652 @@
+#include "dns_server.hpp"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+namespace {
+
+// RCODE ответов
+const uint8_t RCODE_NOERROR = 0;
+const uint8_t RCODE_FORMERR = 1;
+const uint8_t RCODE_SERVFAIL = 2;
+const uint8_t RCODE_NXDOMAIN = 3;
+const uint8_t RCODE_NOTIMP = 4;
+const uint8_t RCODE_REFUSED = 5;
+
+const size_t UDP_LIMIT = 512;           // без EDNS (RFC 1035, п. 4.2.1)
+const size_t TCP_LIMIT = 65535;
+const int MAX_CNAME_CHAIN = 8;
+
+// Дескрипторы сокетов сервера - малые числа, а идентификаторы TCP-соединений
+// в событиях epoll сдвинуты выше 32 бит, поэтому data.u64 различает их
+const uint64_t CONNECTION_TAG = 1ULL << 32;
+
+bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+bool supportedType(uint16_t type) {
+    return type == static_cast<uint16_t>(DNSRecordType::A) ||
+           type == static_cast<uint16_t>(DNSRecordType::AAAA) ||
+           type == static_cast<uint16_t>(DNSRecordType::NS) ||
+           type == static_cast<uint16_t>(DNSRecordType::CNAME);
+}
+
+void appendUint16(std::vector<uint8_t>& packet, uint16_t value) {
+    packet.push_back(static_cast<uint8_t>(value >> 8));
+    packet.push_back(static_cast<uint8_t>(value & 0xFF));
+}
+
+void appendUint32(std::vector<uint8_t>& packet, uint32_t value) {
+    appendUint16(packet, static_cast<uint16_t>(value >> 16));
+    appendUint16(packet, static_cast<uint16_t>(value & 0xFFFF));
+}
+
+void appendName(std::vector<uint8_t>& packet, const std::string& name) {
+    size_t start = 0;
+    while (start < name.size()) {
+        size_t dot = name.find('.', start);
+        if (dot == std::string::npos) {
+            dot = name.size();
+        }
+        size_t length = std::min<size_t>(dot - start, 63);
+        packet.push_back(static_cast<uint8_t>(length));
+        packet.insert(packet.end(), name.begin() + start, name.begin() + start + length);
+        start = dot + 1;
+    }
+    packet.push_back(0);
+}
+
+} // namespace
+
+DNSServer::DNSServer(const DNSServerConfig& config, std::shared_ptr<DNSCache> cache)
+    : config_(config), cache_(cache ? cache : std::make_shared<DNSCache>()),
+      epoll_fd_(-1), udp_fd_(-1), tcp_fd_(-1), wake_fd_(-1), stopping_(false), next_connection_(1) {
+}
+
+DNSServer::~DNSServer() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        stopping_ = true;
+    }
+    queue_cond_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+    for (const auto& connection : connections_) {
+        close(connection.second.fd);
+    }
+    for (int fd : {udp_fd_, tcp_fd_, wake_fd_, epoll_fd_}) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+bool DNSServer::start() {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config_.port);
+    if (inet_pton(AF_INET, config_.address.c_str(), &addr.sin_addr) <= 0) {
+        std::cerr << "Invalid listen address: " << config_.address << std::endl;
+        return false;
+    }
+
+    epoll_fd_ = epoll_create1(0);
+    wake_fd_ = eventfd(0, EFD_NONBLOCK);
+    udp_fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    tcp_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (epoll_fd_ < 0 || wake_fd_ < 0 || udp_fd_ < 0 || tcp_fd_ < 0) {
+        std::cerr << "Error creating server sockets: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    int opt = 1;
+    setsockopt(tcp_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    // Всплеск запросов не должен теряться в очереди сокета
+    int buffer = 4 * 1024 * 1024;
+    setsockopt(udp_fd_, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+
+    if (bind(udp_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        bind(tcp_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        listen(tcp_fd_, 128) < 0) {
+        std::cerr << "Cannot listen on " << config_.address << ":" << config_.port << ": "
+                  << strerror(errno) << std::endl;
+        return false;
+    }
+    setNonBlocking(udp_fd_);
+    setNonBlocking(tcp_fd_);
+
+    for (int fd : {udp_fd_, tcp_fd_, wake_fd_}) {
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u64 = static_cast<uint64_t>(fd);
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    for (size_t i = 0; i < std::max<size_t>(config_.workers, 1); i++) {
+        workers_.emplace_back(&DNSServer::workerLoop, this);
+    }
+    return true;
+}
+
+void DNSServer::stop() {
+    stopping_ = true;
+    uint64_t one = 1;
+    ssize_t written = write(wake_fd_, &one, sizeof(one));
+    (void)written;
+}
+
+void DNSServer::run() {
+    epoll_event events[256];
+
+    while (!stopping_) {
+        int count = epoll_wait(epoll_fd_, events, 256, 1000);
+        if (count < 0 && errno != EINTR) {
+            std::cerr << "epoll_wait failed: " << strerror(errno) << std::endl;
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            uint64_t tag = events[i].data.u64;
+            if (tag >= CONNECTION_TAG) {
+                handleTcp(tag - CONNECTION_TAG, events[i].events);
+            } else if (static_cast<int>(tag) == udp_fd_) {
+                handleUdp();
+            } else if (static_cast<int>(tag) == tcp_fd_) {
+                acceptTcp();
+            } else if (static_cast<int>(tag) == wake_fd_) {
+                uint64_t value;
+                ssize_t drained = read(wake_fd_, &value, sizeof(value));
+                (void)drained;
+                drainResolutions();
+            }
+        }
+        sweepConnections();
+    }
+}
+
+// ==================== Workers ====================
+
+void DNSServer::workerLoop() {
+    DNSResolver resolver(config_.debug, cache_);
+    if (!config_.root_servers.empty()) {
+        resolver.setRootServers(config_.root_servers);
+    }
+
+    while (true) {
+        std::pair<std::string, DNSRecordType> job;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            queue_cond_.wait(lock, [this]() { return stopping_ || !jobs_.empty(); });
+            if (stopping_) {
+                return;
+            }
+            job = jobs_.front();
+            jobs_.pop_front();
+        }
+
+        Resolution resolution;
+        resolution.key = makeKey(job.first, job.second);
+        std::vector<std::string> results;
+        bool resolved = resolver.resolve(job.first, job.second, results);
+        // Ответ собирается из кэша, где есть цепочка CNAME и оставшиеся TTL
+        if (!answerFromCache(job.first, job.second, resolution.rcode, resolution.answers)) {
+            resolution.answers.clear();
+            if (resolved) {
+                // Записи с нулевым TTL в кэш не попадают
+                resolution.rcode = RCODE_NOERROR;
+                for (const auto& result : results) {
+                    resolution.answers.push_back(AnswerRecord{job.first, job.second, 0, result});
+                }
+            } else {
+                resolution.rcode = RCODE_SERVFAIL;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            done_.push_back(std::move(resolution));
+        }
+        uint64_t one = 1;
+        ssize_t written = write(wake_fd_, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+void DNSServer::drainResolutions() {
+    std::deque<Resolution> done;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        done.swap(done_);
+    }
+    for (const auto& resolution : done) {
+        auto it = pending_.find(resolution.key);
+        if (it == pending_.end()) {
+            continue;
+        }
+        std::vector<Waiter> waiters;
+        waiters.swap(it->second);
+        pending_.erase(it);
+        for (const auto& waiter : waiters) {
+            reply(waiter, resolution.rcode, resolution.answers);
+        }
+    }
+}
+
+// ==================== Queries ====================
+
+bool DNSServer::parseQuery(const uint8_t* data, size_t len, Query& query, uint8_t& rcode) {
+    if (len < sizeof(DNSHeader)) {
+        return false;
+    }
+    const DNSHeader* header = reinterpret_cast<const DNSHeader*>(data);
+    uint16_t flags = ntohs(header->flags);
+    if (flags & 0x8000) {
+        return false;   // ответ, а не запрос - не отвечаем
+    }
+    query.id = ntohs(header->id);
+    query.rd = (flags & 0x0100) != 0;
+
+    // Секция Question: имя без компрессии, тип и класс
+    size_t offset = sizeof(DNSHeader);
+    std::string name;
+    while (offset < len && data[offset] != 0) {
+        uint8_t length = data[offset];
+        if ((length & 0xC0) != 0 || offset + 1 + length > len || name.size() + length + 1 > 255) {
+            rcode = RCODE_FORMERR;
+            return true;
+        }
+        if (!name.empty()) {
+            name += ".";
+        }
+        name.append(reinterpret_cast<const char*>(data + offset + 1), length);
+        offset += 1 + length;
+    }
+    if (ntohs(header->qdcount) != 1 || offset + 5 > len) {
+        rcode = RCODE_FORMERR;
+        return true;
+    }
+    uint16_t qtype = static_cast<uint16_t>((data[offset + 1] << 8) | data[offset + 2]);
+    uint16_t qclass = static_cast<uint16_t>((data[offset + 3] << 8) | data[offset + 4]);
+    query.question.assign(data + sizeof(DNSHeader), data + offset + 5);
+    query.name = DNSCache::normalize(name);
+    query.type = static_cast<DNSRecordType>(qtype);
+
+    uint8_t opcode = (flags >> 11) & 0x0F;
+    if (opcode != 0 || qclass != static_cast<uint16_t>(DNSClass::IN) || !supportedType(qtype)) {
+        rcode = RCODE_NOTIMP;
+    } else {
+        rcode = RCODE_NOERROR;
+    }
+    return true;
+}
+
+void DNSServer::handleQuery(Waiter& waiter) {
+    const Query& query = waiter.query;
+    uint8_t rcode = RCODE_NOERROR;
+    std::vector<AnswerRecord> answers;
+    if (answerFromCache(query.name, query.type, rcode, answers)) {
+        stats_.cache_answers++;
+        reply(waiter, rcode, answers);
+        return;
+    }
+    if (!query.rd) {
+        // Итеративные запросы обслуживаются только из кэша
+        stats_.refused++;
+        reply(waiter, RCODE_REFUSED, answers);
+        return;
+    }
+
+    std::string key = makeKey(query.name, query.type);
+    auto it = pending_.find(key);
+    if (it != pending_.end()) {
+        stats_.coalesced++;
+        it->second.push_back(waiter);
+        return;
+    }
+    if (pending_.size() >= config_.max_pending) {
+        stats_.dropped++;
+        reply(waiter, RCODE_SERVFAIL, answers);
+        return;
+    }
+
+    pending_[key].push_back(waiter);
+    stats_.resolutions++;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        jobs_.push_back(std::make_pair(query.name, query.type));
+    }
+    queue_cond_.notify_one();
+}
+
+bool DNSServer::answerFromCache(const std::string& name, DNSRecordType type,
+                                uint8_t& rcode, std::vector<AnswerRecord>& answers) {
+    std::string current = name;
+    for (int hops = 0; hops <= MAX_CNAME_CHAIN; hops++) {
+        std::vector<std::string> values;
+        uint32_t ttl = 0;
+        DNSCache::Status status = cache_->lookup(current, type, values, ttl);
+        if (status == DNSCache::Status::HIT) {
+            for (const auto& value : values) {
+                answers.push_back(AnswerRecord{current, type, ttl, value});
+            }
+            rcode = RCODE_NOERROR;
+            return true;
+        }
+        if (status == DNSCache::Status::NXDOMAIN || status == DNSCache::Status::NODATA) {
+            rcode = status == DNSCache::Status::NXDOMAIN ? RCODE_NXDOMAIN : RCODE_NOERROR;
+            return true;
+        }
+        if (type == DNSRecordType::CNAME ||
+            cache_->lookup(current, DNSRecordType::CNAME, values, ttl) != DNSCache::Status::HIT) {
+            return false;
+        }
+        answers.push_back(AnswerRecord{current, DNSRecordType::CNAME, ttl, values[0]});
+        current = values[0];
+    }
+    return false;
+}
+
+void DNSServer::reply(const Waiter& waiter, uint8_t rcode, const std::vector<AnswerRecord>& answers) {
+    if (rcode == RCODE_SERVFAIL) {
+        stats_.servfail++;
+    }
+    bool truncated = false;
+    std::vector<uint8_t> response = buildResponse(waiter.query, rcode, answers,
+                                                  waiter.tcp ? TCP_LIMIT : UDP_LIMIT, truncated);
+    if (truncated) {
+        stats_.truncated++;
+    }
+
+    if (!waiter.tcp) {
+        sendto(udp_fd_, response.data(), response.size(), 0,
+               reinterpret_cast<const sockaddr*>(&waiter.udp_peer), sizeof(waiter.udp_peer));
+        return;
+    }
+
+    auto it = connections_.find(waiter.connection);
+    if (it == connections_.end()) {
+        return;     // клиент уже закрыл соединение
+    }
+    Connection& connection = it->second;
+    connection.outstanding--;
+    appendUint16(connection.out, static_cast<uint16_t>(response.size()));
+    connection.out.insert(connection.out.end(), response.begin(), response.end());
+    flushConnection(waiter.connection);
+}
+
+std::vector<uint8_t> DNSServer::buildResponse(const Query& query, uint8_t rcode,
+                                              const std::vector<AnswerRecord>& answers, size_t limit,
+                                              bool& truncated) {
+    std::vector<uint8_t> packet;
+    appendUint16(packet, query.id);
+    // QR=1, RD как в запросе, RA=1
+    uint16_t flags = 0x8000 | (query.rd ? 0x0100 : 0) | 0x0080 | rcode;
+    appendUint16(packet, flags);
+    appendUint16(packet, query.question.empty() ? 0 : 1);
+    appendUint16(packet, 0);    // ANCOUNT, заполняется ниже
+    appendUint16(packet, 0);
+    appendUint16(packet, 0);
+    packet.insert(packet.end(), query.question.begin(), query.question.end());
+    size_t question_end = packet.size();
+
+    uint16_t ancount = 0;
+    for (const auto& answer : answers) {
+        // Имя из вопроса - указателем на него (смещение 12)
+        if (answer.name == query.name) {
+            appendUint16(packet, 0xC00C);
+        } else {
+            appendName(packet, answer.name);
+        }
+        appendUint16(packet, static_cast<uint16_t>(answer.type));
+        appendUint16(packet, static_cast<uint16_t>(DNSClass::IN));
+        appendUint32(packet, answer.ttl);
+
+        std::vector<uint8_t> rdata;
+        if (answer.type == DNSRecordType::A) {
+            rdata.resize(4);
+            inet_pton(AF_INET, answer.value.c_str(), rdata.data());
+        } else if (answer.type == DNSRecordType::AAAA) {
+            rdata.resize(16);
+            inet_pton(AF_INET6, answer.value.c_str(), rdata.data());
+        } else {
+            appendName(rdata, answer.value);
+        }
+        appendUint16(packet, static_cast<uint16_t>(rdata.size()));
+        packet.insert(packet.end(), rdata.begin(), rdata.end());
+        ancount++;
+    }
+
+    truncated = packet.size() > limit;
+    if (truncated) {
+        // Клиент повторит запрос по TCP
+        packet.resize(question_end);
+        ancount = 0;
+        packet[2] |= 0x02;
+    }
+    packet[6] = static_cast<uint8_t>(ancount >> 8);
+    packet[7] = static_cast<uint8_t>(ancount & 0xFF);
+    return packet;
+}
+
+std::string DNSServer::makeKey(const std::string& name, DNSRecordType type) {
+    return name + "/" + std::to_string(static_cast<uint16_t>(type));
+}
+
+// ==================== UDP ====================
+
+void DNSServer::handleUdp() {
+    uint8_t buffer[UDP_LIMIT];
+    // Ограничение на один проход, чтобы TCP и готовые ответы не ждали
+    for (int i = 0; i < 256; i++) {
+        sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        ssize_t received = recvfrom(udp_fd_, buffer, sizeof(buffer), 0,
+                                    reinterpret_cast<sockaddr*>(&peer), &peer_len);
+        if (received < 0) {
+            return;
+        }
+        stats_.udp_queries++;
+
+        Waiter waiter;
+        waiter.tcp = false;
+        waiter.udp_peer = peer;
+        waiter.connection = 0;
+        uint8_t rcode = RCODE_NOERROR;
+        if (!parseQuery(buffer, static_cast<size_t>(received), waiter.query, rcode)) {
+            continue;
+        }
+        if (rcode != RCODE_NOERROR) {
+            if (rcode == RCODE_NOTIMP) {
+                stats_.refused++;
+            }
+            reply(waiter, rcode, std::vector<AnswerRecord>());
+            continue;
+        }
+        handleQuery(waiter);
+    }
+}
+
+// ==================== TCP ====================
+
+void DNSServer::acceptTcp() {
+    while (true) {
+        int fd = accept(tcp_fd_, nullptr, nullptr);
+        if (fd < 0) {
+            return;
+        }
+        if (connections_.size() >= config_.max_tcp_connections) {
+            close(fd);
+            continue;
+        }
+        setNonBlocking(fd);
+
+        uint64_t id = next_connection_++;
+        Connection connection;
+        connection.fd = fd;
+        connection.outstanding = 0;
+        connection.last_active = Clock::now();
+        connection.writing = false;
+        connections_[id] = connection;
+
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u64 = CONNECTION_TAG + id;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+void DNSServer::handleTcp(uint64_t id, uint32_t events) {
+    auto it = connections_.find(id);
+    if (it == connections_.end()) {
+        return;
+    }
+    if (events & EPOLLOUT) {
+        flushConnection(id);
+        it = connections_.find(id);
+        if (it == connections_.end()) {
+            return;
+        }
+    }
+    if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+        return;
+    }
+
+    Connection& connection = it->second;
+    uint8_t buffer[4096];
+    while (true) {
+        ssize_t received = recv(connection.fd, buffer, sizeof(buffer), 0);
+        if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            closeConnection(id);
+            return;
+        }
+        if (received < 0) {
+            break;
+        }
+        connection.in.insert(connection.in.end(), buffer, buffer + received);
+        connection.last_active = Clock::now();
+    }
+
+    // Запросы с префиксом длины (RFC 1035, п. 4.2.2), возможно несколько подряд
+    size_t offset = 0;
+    std::vector<Waiter> queries;
+    while (connection.in.size() - offset >= 2) {
+        size_t length = (connection.in[offset] << 8) | connection.in[offset + 1];
+        if (connection.in.size() - offset - 2 < length) {
+            break;
+        }
+        Waiter waiter;
+        waiter.tcp = true;
+        memset(&waiter.udp_peer, 0, sizeof(waiter.udp_peer));
+        waiter.connection = id;
+        uint8_t rcode = RCODE_NOERROR;
+        bool parsed = parseQuery(connection.in.data() + offset + 2, length, waiter.query, rcode);
+        offset += 2 + length;
+        if (!parsed) {
+            continue;
+        }
+        stats_.tcp_queries++;
+        connection.outstanding++;
+        if (rcode != RCODE_NOERROR) {
+            if (rcode == RCODE_NOTIMP) {
+                stats_.refused++;
+            }
+            reply(waiter, rcode, std::vector<AnswerRecord>());
+            if (connections_.find(id) == connections_.end()) {
+                return;
+            }
+            continue;
+        }
+        queries.push_back(waiter);
+    }
+    connection.in.erase(connection.in.begin(), connection.in.begin() + offset);
+
+    // Ответ из кэша может закрыть соединение при ошибке записи
+    for (auto& waiter : queries) {
+        if (connections_.find(id) == connections_.end()) {
+            return;
+        }
+        handleQuery(waiter);
+    }
+}
+
+void DNSServer::flushConnection(uint64_t id) {
+    auto it = connections_.find(id);
+    if (it == connections_.end()) {
+        return;
+    }
+    Connection& connection = it->second;
+    size_t sent = 0;
+    while (sent < connection.out.size()) {
+        ssize_t n = send(connection.fd, connection.out.data() + sent, connection.out.size() - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            closeConnection(id);
+            return;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    connection.out.erase(connection.out.begin(), connection.out.begin() + sent);
+    connection.last_active = Clock::now();
+
+    // EPOLLOUT нужен, только пока есть неотправленные байты
+    bool writing = !connection.out.empty();
+    if (writing != connection.writing) {
+        connection.writing = writing;
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | (writing ? static_cast<uint32_t>(EPOLLOUT) : 0);
+        event.data.u64 = CONNECTION_TAG + id;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection.fd, &event);
+    }
+}
+
+void DNSServer::closeConnection(uint64_t id) {
+    auto it = connections_.find(id);
+    if (it == connections_.end()) {
+        return;
+    }
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, it->second.fd, nullptr);
+    close(it->second.fd);
+    connections_.erase(it);
+}
+
+void DNSServer::sweepConnections() {
+    Clock::time_point now = Clock::now();
+    std::vector<uint64_t> idle;
+    for (const auto& entry : connections_) {
+        const Connection& connection = entry.second;
+        if (connection.outstanding == 0 && connection.out.empty() &&
+            now - connection.last_active > std::chrono::milliseconds(config_.tcp_idle_timeout_ms)) {
+            idle.push_back(entry.first);
+        }
+    }
+    for (uint64_t id : idle) {
+        closeConnection(id);
+    }
+}
+
+void DNSServer::printStats(std::ostream& out) const {
+    out << "Queries: " << stats_.udp_queries << " UDP, " << stats_.tcp_queries << " TCP; "
+        << stats_.cache_answers << " answered from cache, "
+        << stats_.resolutions << " resolved, "
+        << stats_.coalesced << " joined a resolution in progress" << std::endl;
+    out << "Errors: " << stats_.servfail << " SERVFAIL, " << stats_.refused << " refused, "
+        << stats_.dropped << " over the pending limit, "
+        << stats_.truncated << " truncated UDP answers" << std::endl;
+    out << "Cache: " << cache_->entries() << " entries, " << cache_->bytes() << " bytes, "
+        << cache_->hits() << " hits, " << cache_->misses() << " misses, "
+        << cache_->evictions() << " evictions" << std::endl;
+}
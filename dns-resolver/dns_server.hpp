@@ -0,0 +1,161 @@
+#ifndef DNS_SERVER_HPP
+#define DNS_SERVER_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <iosfwd>
+#include <cstdint>
+#include <netinet/in.h>
+#include "dns_resolver.hpp"
+#include "dns_cache.hpp"
+
+// Параметры режима сервера
+struct DNSServerConfig {
+    std::string address;            // адрес для UDP и TCP
+    uint16_t port;
+    size_t workers;                 // потоки итеративного разрешения
+    size_t max_pending;             // разных вопросов в разрешении одновременно
+    size_t max_tcp_connections;
+    int tcp_idle_timeout_ms;        // TCP-соединение без запросов закрывается
+    bool debug;
+    std::vector<std::string> root_servers;  // пусто - встроенные корневые серверы
+
+    DNSServerConfig() : address("0.0.0.0"), port(53), workers(16), max_pending(10000),
+                        max_tcp_connections(1024), tcp_idle_timeout_ms(10000), debug(false) {}
+};
+
+// Запись секции Answer, которую сервер отправляет клиенту
+struct AnswerRecord {
+    std::string name;
+    DNSRecordType type;
+    uint32_t ttl;
+    std::string value;      // адрес или имя
+};
+
+// Рекурсивный кэширующий DNS-сервер для stub-резолверов (запросы с битом RD).
+// Один поток с циклом событий на epoll принимает запросы по UDP и TCP и
+// сразу отвечает из общего кэша. Промахи передаются пулу потоков, каждый со
+// своим DNSResolver: итеративное разрешение блокирующее, а цикл событий -
+// нет, поэтому тысячи ожидающих клиентов держат только записи в таблице.
+// Одинаковые вопросы разных клиентов разрешаются один раз.
+class DNSServer {
+public:
+    struct Stats {
+        uint64_t udp_queries;
+        uint64_t tcp_queries;
+        uint64_t cache_answers;     // отвечено из кэша без разрешения
+        uint64_t resolutions;       // вопросы, переданные пулу
+        uint64_t coalesced;         // запросы, присоединенные к чужому разрешению
+        uint64_t servfail;
+        uint64_t refused;           // без RD и без ответа в кэше, неподдерживаемые
+        uint64_t truncated;         // ответы UDP, не поместившиеся в 512 байт
+        uint64_t dropped;           // превышен max_pending
+
+        Stats() : udp_queries(0), tcp_queries(0), cache_answers(0), resolutions(0), coalesced(0),
+                  servfail(0), refused(0), truncated(0), dropped(0) {}
+    };
+
+    explicit DNSServer(const DNSServerConfig& config, std::shared_ptr<DNSCache> cache = nullptr);
+    ~DNSServer();
+
+    DNSServer(const DNSServer&) = delete;
+    DNSServer& operator=(const DNSServer&) = delete;
+
+    // Открывает сокеты и запускает пул; false - если не удалось
+    bool start();
+    // Цикл событий до вызова stop()
+    void run();
+    // Можно вызывать из обработчика сигнала
+    void stop();
+
+    Stats stats() const { return stats_; }
+    void printStats(std::ostream& out) const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    // Разобранный запрос клиента
+    struct Query {
+        uint16_t id;
+        bool rd;
+        std::string name;                   // в нижнем регистре
+        DNSRecordType type;
+        std::vector<uint8_t> question;      // секция Question как в запросе
+    };
+
+    // Клиент, ожидающий ответа на вопрос
+    struct Waiter {
+        Query query;
+        bool tcp;
+        sockaddr_in udp_peer;
+        uint64_t connection;                // для TCP
+    };
+
+    // Итог разрешения вопроса
+    struct Resolution {
+        std::string key;
+        uint8_t rcode;
+        std::vector<AnswerRecord> answers;
+    };
+
+    struct Connection {
+        int fd;
+        std::vector<uint8_t> in;
+        std::vector<uint8_t> out;
+        size_t outstanding;                 // запросы без ответа
+        Clock::time_point last_active;
+        bool writing;                       // ждем EPOLLOUT
+    };
+
+    DNSServerConfig config_;
+    std::shared_ptr<DNSCache> cache_;
+    int epoll_fd_;
+    int udp_fd_;
+    int tcp_fd_;
+    int wake_fd_;                           // eventfd: готовые разрешения и stop()
+    std::atomic<bool> stopping_;
+    Stats stats_;
+
+    std::map<uint64_t, Connection> connections_;
+    uint64_t next_connection_;
+
+    // Вопросы в разрешении и клиенты, ждущие каждого из них
+    std::map<std::string, std::vector<Waiter>> pending_;
+
+    std::vector<std::thread> workers_;
+    std::mutex queue_mutex_;
+    std::condition_variable queue_cond_;
+    std::deque<std::pair<std::string, DNSRecordType>> jobs_;
+    std::deque<Resolution> done_;
+
+    void workerLoop();
+    void handleUdp();
+    void acceptTcp();
+    void handleTcp(uint64_t id, uint32_t events);
+    void closeConnection(uint64_t id);
+    void flushConnection(uint64_t id);
+    void sweepConnections();
+    void drainResolutions();
+
+    bool parseQuery(const uint8_t* data, size_t len, Query& query, uint8_t& rcode);
+    void handleQuery(Waiter& waiter);
+    void reply(const Waiter& waiter, uint8_t rcode, const std::vector<AnswerRecord>& answers);
+
+    // Ответ из кэша с цепочкой CNAME; false - данных недостаточно
+    bool answerFromCache(const std::string& name, DNSRecordType type,
+                         uint8_t& rcode, std::vector<AnswerRecord>& answers);
+    static std::vector<uint8_t> buildResponse(const Query& query, uint8_t rcode,
+                                              const std::vector<AnswerRecord>& answers, size_t limit,
+                                              bool& truncated);
+    static std::string makeKey(const std::string& name, DNSRecordType type);
+};
+
+#endif // DNS_SERVER_HPP
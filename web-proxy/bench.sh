@@ -0,0 +1,45 @@
+#!/bin/bash
+
+# Offline proxy benchmark: starts the origin simulator and the proxy with
+# an empty cache, drives Zipf-distributed load through the proxy and
+# prints hit ratio, throughput and hit/miss latency.
+# Usage: ./bench.sh  (or make bench)
+#   PROXY                    proxy binary (./proxy_server)
+#   PROXY_PORT, ORIGIN_PORT  ports to use (18080, 19080)
+#   PROXY_ARGS               cache limits of the proxy, e.g. "0 200" (MB, objects)
+#   ORIGIN_ARGS              options of origin_sim, e.g. "--delay-ms 50 --fail-rate 0.01"
+#   DRIVER_ARGS              options of load_driver, e.g. "--threads 16 --zipf 1.1"
+
+PROXY_PORT=${PROXY_PORT:-18080}
+ORIGIN_PORT=${ORIGIN_PORT:-19080}
+PROXY=${PROXY:-./proxy_server}
+CACHE_DIR=$(mktemp -d /tmp/proxy-bench-cache.XXXXXX)
+LOG_DIR=$(mktemp -d /tmp/proxy-bench-logs.XXXXXX)
+
+cleanup() {
+    [ -n "$PROXY_PID" ] && kill -INT "$PROXY_PID" 2>/dev/null
+    [ -n "$ORIGIN_PID" ] && kill "$ORIGIN_PID" 2>/dev/null
+    wait 2>/dev/null
+    rm -rf "$CACHE_DIR"
+}
+trap cleanup EXIT
+
+wait_for_port() {
+    for _ in $(seq 50); do
+        (echo > /dev/tcp/127.0.0.1/$1) 2>/dev/null && return 0
+        sleep 0.1
+    done
+    echo "Nothing is listening on port $1" >&2
+    return 1
+}
+
+./origin_sim --port "$ORIGIN_PORT" $ORIGIN_ARGS > "$LOG_DIR/origin.log" 2>&1 &
+ORIGIN_PID=$!
+$PROXY "$PROXY_PORT" "$CACHE_DIR" $PROXY_ARGS > "$LOG_DIR/proxy.log" 2>&1 &
+PROXY_PID=$!
+wait_for_port "$ORIGIN_PORT" && wait_for_port "$PROXY_PORT" || exit 1
+
+./load_driver --proxy "127.0.0.1:$PROXY_PORT" --origin "127.0.0.1:$ORIGIN_PORT" $DRIVER_ARGS
+STATUS=$?
+echo "Logs: $LOG_DIR"
+exit $STATUS
@@ -0,0 +1,151 @@
+#include "body_compression.hpp"
+#include <algorithm>
+#include <sstream>
+#include <cctype>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace {
+
+// windowBits for deflateInit2/inflateInit2: 15 bits, gzip wrapper
+const int kGzipWindowBits = 15 + 16;
+
+std::string trimLower(const std::string& s) {
+    size_t start = s.find_first_not_of(" \t");
+    if (start == std::string::npos) {
+        return "";
+    }
+    size_t end = s.find_last_not_of(" \t");
+    std::string out = s.substr(start, end - start + 1);
+    std::transform(out.begin(), out.end(), out.begin(), ::tolower);
+    return out;
+}
+
+bool endsWith(const std::string& s, const char* suffix) {
+    std::string tail(suffix);
+    return s.size() >= tail.size() && s.compare(s.size() - tail.size(), tail.size(), tail) == 0;
+}
+
+} // namespace
+
+bool gzipCompress(const std::string& data, int level, std::string& out) {
+    z_stream stream = z_stream();
+    if (deflateInit2(&stream, level, Z_DEFLATED, kGzipWindowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    out.resize(deflateBound(&stream, data.size()));
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    stream.avail_out = static_cast<uInt>(out.size());
+    // The bound guarantees that a single call finishes the stream
+    int result = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return result == Z_STREAM_END;
+}
+
+bool gzipCompressFile(int fd, uint64_t length, int level,
+                      const std::function<bool(const char*, size_t)>& sink) {
+    z_stream stream = z_stream();
+    if (deflateInit2(&stream, level, Z_DEFLATED, kGzipWindowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+
+    char input[65536];
+    char output[65536];
+    uint64_t offset = 0;
+    int result = Z_OK;
+    while (result == Z_OK) {
+        if (stream.avail_in == 0 && offset < length) {
+            ssize_t n = pread(fd, input, static_cast<size_t>(std::min<uint64_t>(sizeof(input), length - offset)),
+                              offset);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break; // the file is shorter than said
+            }
+            offset += n;
+            stream.next_in = reinterpret_cast<Bytef*>(input);
+            stream.avail_in = static_cast<uInt>(n);
+        }
+        stream.next_out = reinterpret_cast<Bytef*>(output);
+        stream.avail_out = sizeof(output);
+        result = deflate(&stream, offset < length ? Z_NO_FLUSH : Z_FINISH);
+        size_t produced = sizeof(output) - stream.avail_out;
+        if ((result == Z_OK || result == Z_STREAM_END) && produced > 0 && !sink(output, produced)) {
+            break;
+        }
+    }
+    deflateEnd(&stream);
+    return result == Z_STREAM_END;
+}
+
+bool gzipDecompress(const char* data, size_t len, std::string& out) {
+    z_stream stream = z_stream();
+    if (inflateInit2(&stream, kGzipWindowBits) != Z_OK) {
+        return false;
+    }
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = static_cast<uInt>(len);
+
+    out.clear();
+    char buffer[65536];
+    int result = Z_OK;
+    while (result == Z_OK) {
+        stream.next_out = reinterpret_cast<Bytef*>(buffer);
+        stream.avail_out = sizeof(buffer);
+        result = inflate(&stream, Z_NO_FLUSH);
+        if (result == Z_OK || result == Z_STREAM_END) {
+            out.append(buffer, sizeof(buffer) - stream.avail_out);
+        }
+        if (result == Z_OK && stream.avail_in == 0 && stream.avail_out != 0) {
+            break; // truncated input
+        }
+    }
+    inflateEnd(&stream);
+    return result == Z_STREAM_END;
+}
+
+bool acceptsGzip(const std::string& acceptEncoding) {
+    bool gzipListed = false;
+    bool gzipAllowed = false;
+    bool anyAllowed = false;
+
+    std::istringstream iss(acceptEncoding);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        std::string coding = item;
+        double q = 1.0;
+        size_t semicolon = item.find(';');
+        if (semicolon != std::string::npos) {
+            coding = item.substr(0, semicolon);
+            std::string param = trimLower(item.substr(semicolon + 1));
+            if (param.compare(0, 2, "q=") == 0) {
+                q = std::strtod(param.c_str() + 2, nullptr);
+            }
+        }
+        coding = trimLower(coding);
+        if (coding == "gzip" || coding == "x-gzip") {
+            gzipListed = true;
+            gzipAllowed = q > 0;
+        } else if (coding == "*") {
+            anyAllowed = q > 0;
+        }
+    }
+    return gzipListed ? gzipAllowed : anyAllowed;
+}
+
+bool isCompressibleType(const std::string& contentType) {
+    std::string type = trimLower(contentType.substr(0, contentType.find(';')));
+    if (type.compare(0, 5, "text/") == 0) {
+        return true;
+    }
+    return type == "application/json" || type == "application/javascript" ||
+           type == "application/x-javascript" || type == "application/ecmascript" ||
+           type == "application/xml" || type == "image/svg+xml" ||
+           endsWith(type, "+json") || endsWith(type, "+xml");
+}
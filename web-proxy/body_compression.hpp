@@ -0,0 +1,30 @@
+#ifndef BODY_COMPRESSION_HPP
+#define BODY_COMPRESSION_HPP
+
+#include <string>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+// gzip coding of stored response bodies (zlib). Compressible responses
+// are kept gzip-encoded in the cache and only decoded for clients that do
+// not accept gzip.
+
+// Compresses `data` into a single gzip member at `level` (1-9).
+bool gzipCompress(const std::string& data, int level, std::string& out);
+// Compresses the first `length` bytes of the file `fd` the same way, in
+// bounded pieces: the output goes to `sink`, and stops when it fails.
+bool gzipCompressFile(int fd, uint64_t length, int level,
+                      const std::function<bool(const char*, size_t)>& sink);
+// Decodes a gzip member. Fails on corrupt or truncated input.
+bool gzipDecompress(const char* data, size_t len, std::string& out);
+
+// True if an Accept-Encoding value allows gzip: listed (or "*") with a
+// non-zero q-value, and not excluded with q=0.
+bool acceptsGzip(const std::string& acceptEncoding);
+
+// Text-like media types (text/*, JSON, JavaScript, XML, SVG) that are
+// worth compressing; images, video and archives are compressed already.
+bool isCompressibleType(const std::string& contentType);
+
+#endif // BODY_COMPRESSION_HPP
@@ -0,0 +1,75 @@
+#include "body_spool.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+BodySpool::BodySpool(const std::string& dir, uint64_t maxBytes)
+    : dir_(dir), fd_(-1), size_(0), maxBytes_(maxBytes), failed_(false) {}
+
+BodySpool::~BodySpool() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+void BodySpool::giveUp() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    failed_ = true;
+}
+
+bool BodySpool::append(const char* data, size_t len) {
+    if (failed_) {
+        return false;
+    }
+    if (maxBytes_ > 0 && len > maxBytes_ - size_) {
+        giveUp();
+        return false;
+    }
+    if (fd_ < 0) {
+        std::string pattern = dir_ + "/spool.XXXXXX";
+        std::vector<char> path(pattern.begin(), pattern.end());
+        path.push_back('\0');
+        fd_ = mkostemp(&path[0], O_CLOEXEC);
+        if (fd_ < 0) {
+            giveUp();
+            return false;
+        }
+        unlink(&path[0]);
+    }
+
+    size_t written = 0;
+    while (written < len) {
+        ssize_t n = ::write(fd_, data + written, len - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            giveUp();
+            return false;
+        }
+        written += n;
+    }
+    size_ += len;
+    return true;
+}
+
+bool BodySpool::readAll(std::string& out) const {
+    out.resize(size_);
+    size_t done = 0;
+    while (done < out.size()) {
+        ssize_t n = pread(fd_, &out[done], out.size() - done, done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
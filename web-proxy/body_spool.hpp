@@ -0,0 +1,43 @@
+#ifndef BODY_SPOOL_HPP
+#define BODY_SPOOL_HPP
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Body of a response on its way into the cache, written to a temporary
+// file in `dir` as it arrives so that it is never held in memory whole.
+// The file is created with the first bytes and unlinked at once, so it
+// goes away with the spool. A body that grows past `maxBytes` (0 =
+// unlimited), or that cannot be written, is given up: the spool is then
+// no longer ok() and takes no more bytes.
+class BodySpool {
+public:
+    BodySpool(const std::string& dir, uint64_t maxBytes);
+    ~BodySpool();
+
+    BodySpool(const BodySpool&) = delete;
+    BodySpool& operator=(const BodySpool&) = delete;
+
+    // Returns false once the body was given up.
+    bool append(const char* data, size_t len);
+
+    bool ok() const { return !failed_; }
+    // -1 while the body is empty
+    int fd() const { return fd_; }
+    uint64_t size() const { return size_; }
+
+    // Reads the whole body, for bodies known to be small.
+    bool readAll(std::string& out) const;
+
+private:
+    std::string dir_;
+    int fd_;
+    uint64_t size_;
+    uint64_t maxBytes_;
+    bool failed_;
+
+    void giveUp();
+};
+
+#endif // BODY_SPOOL_HPP
@@ -0,0 +1,95 @@
+#include "cache_admission.hpp"
+#include <algorithm>
+
+namespace {
+
+// splitmix64 finalizer; spreads the FNV key hashes over the rows
+uint64_t mix(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    value ^= value >> 31;
+    return value;
+}
+
+const uint64_t kRowSeeds[] = {
+    0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL
+};
+
+} // namespace
+
+FrequencySketch::FrequencySketch(size_t expectedKeys) : additions_(0), resets_(0) {
+    width_ = 1024;
+    while (width_ < expectedKeys && width_ < (size_t(1) << 24)) {
+        width_ <<= 1;
+    }
+    counters_.assign(kDepth * width_, 0);
+    // Ten samples per counter, as in the TinyLFU paper
+    sampleSize_ = 10 * static_cast<uint64_t>(width_);
+}
+
+size_t FrequencySketch::indexOf(uint64_t keyHash, size_t row) const {
+    return row * width_ + (mix(keyHash + kRowSeeds[row]) & (width_ - 1));
+}
+
+unsigned FrequencySketch::estimateLocked(uint64_t keyHash) const {
+    unsigned count = kMaxCount;
+    for (size_t row = 0; row < kDepth; ++row) {
+        count = std::min<unsigned>(count, counters_[indexOf(keyHash, row)]);
+    }
+    return count;
+}
+
+void FrequencySketch::increment(uint64_t keyHash) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    unsigned count = estimateLocked(keyHash);
+    if (count < kMaxCount) {
+        for (size_t row = 0; row < kDepth; ++row) {
+            uint8_t& counter = counters_[indexOf(keyHash, row)];
+            if (counter == count) {
+                counter++;
+            }
+        }
+    }
+    if (++additions_ >= sampleSize_) {
+        halveLocked();
+    }
+}
+
+void FrequencySketch::halveLocked() {
+    for (size_t i = 0; i < counters_.size(); ++i) {
+        counters_[i] >>= 1;
+    }
+    additions_ /= 2;
+    resets_++;
+}
+
+unsigned FrequencySketch::estimate(uint64_t keyHash) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return estimateLocked(keyHash);
+}
+
+uint64_t FrequencySketch::resets() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return resets_;
+}
+
+AdmissionFilter::AdmissionFilter(size_t expectedKeys) : sketch_(expectedKeys) {}
+
+void AdmissionFilter::record(uint64_t keyHash) {
+    sketch_.increment(keyHash);
+}
+
+bool AdmissionFilter::admit(uint64_t candidateHash, uint64_t victimHash) const {
+    // Ties go to the victim, which has proven itself in the cache
+    return sketch_.estimate(candidateHash) > sketch_.estimate(victimHash);
+}
+
+unsigned AdmissionFilter::estimate(uint64_t keyHash) const {
+    return sketch_.estimate(keyHash);
+}
+
+uint64_t AdmissionFilter::resets() const {
+    return sketch_.resets();
+}
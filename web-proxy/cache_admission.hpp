@@ -0,0 +1,62 @@
+#ifndef CACHE_ADMISSION_HPP
+#define CACHE_ADMISSION_HPP
+
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+// Approximate request counts of recently seen keys: a count-min sketch
+// of four rows of 4-bit counters, incremented conservatively (only the
+// rows holding the minimum). After `sampleSize` increments every counter
+// is halved, so counts reflect recent popularity rather than all time.
+class FrequencySketch {
+public:
+    // `expectedKeys` sets the width of the rows and the sample size
+    explicit FrequencySketch(size_t expectedKeys);
+
+    FrequencySketch(const FrequencySketch&) = delete;
+    FrequencySketch& operator=(const FrequencySketch&) = delete;
+
+    void increment(uint64_t keyHash);
+    unsigned estimate(uint64_t keyHash) const;
+
+    // Number of times the counters have been halved
+    uint64_t resets() const;
+
+private:
+    static const size_t kDepth = 4;
+    static const unsigned kMaxCount = 15;
+
+    mutable std::mutex mutex_;
+    std::vector<uint8_t> counters_;     // kDepth rows of `width_` counters
+    size_t width_;                      // a power of two
+    uint64_t sampleSize_;
+    uint64_t additions_;
+    uint64_t resets_;
+
+    size_t indexOf(uint64_t keyHash, size_t row) const;
+    unsigned estimateLocked(uint64_t keyHash) const;
+    void halveLocked();
+};
+
+// TinyLFU admission: once the cache is full, a new object only replaces
+// the one eviction would remove next if it has been requested more often
+// recently. Objects requested once in a while (scans, one-off downloads)
+// then never displace the working set.
+class AdmissionFilter {
+public:
+    explicit AdmissionFilter(size_t expectedKeys);
+
+    // Called for every lookup, hit or miss
+    void record(uint64_t keyHash);
+    bool admit(uint64_t candidateHash, uint64_t victimHash) const;
+
+    unsigned estimate(uint64_t keyHash) const;
+    uint64_t resets() const;
+
+private:
+    FrequencySketch sketch_;
+};
+
+#endif // CACHE_ADMISSION_HPP
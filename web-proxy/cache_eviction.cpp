@@ -0,0 +1,78 @@
+#include "cache_eviction.hpp"
+#include <algorithm>
+
+GdsfPolicy::GdsfPolicy() : inflation_(0.0) {}
+
+double GdsfPolicy::priorityOf(const Item& item) const {
+    // Cost is 1 per object, which optimizes the object hit ratio
+    return inflation_ + static_cast<double>(item.frequency) /
+                        static_cast<double>(std::max<uint64_t>(item.size, 1));
+}
+
+void GdsfPolicy::insert(uint64_t keyHash, uint64_t size, uint32_t frequency) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unordered_map<uint64_t, Item>::iterator it = items_.find(keyHash);
+    if (it != items_.end()) {
+        // A replaced object keeps its request history
+        queue_.erase(std::make_pair(it->second.priority, keyHash));
+        frequency = std::max(frequency, it->second.frequency);
+        items_.erase(it);
+    }
+
+    Item item;
+    item.size = size;
+    item.frequency = std::max<uint32_t>(frequency, 1);
+    item.priority = priorityOf(item);
+    items_[keyHash] = item;
+    queue_.insert(std::make_pair(item.priority, keyHash));
+}
+
+void GdsfPolicy::access(uint64_t keyHash) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unordered_map<uint64_t, Item>::iterator it = items_.find(keyHash);
+    if (it == items_.end()) {
+        return;
+    }
+    Item& item = it->second;
+    queue_.erase(std::make_pair(item.priority, keyHash));
+    item.frequency++;
+    item.priority = priorityOf(item);
+    queue_.insert(std::make_pair(item.priority, keyHash));
+}
+
+void GdsfPolicy::remove(uint64_t keyHash) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unordered_map<uint64_t, Item>::iterator it = items_.find(keyHash);
+    if (it == items_.end()) {
+        return;
+    }
+    queue_.erase(std::make_pair(it->second.priority, keyHash));
+    items_.erase(it);
+}
+
+bool GdsfPolicy::popVictim(uint64_t& keyHash) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (queue_.empty()) {
+        return false;
+    }
+    std::set<std::pair<double, uint64_t> >::iterator victim = queue_.begin();
+    inflation_ = victim->first;
+    keyHash = victim->second;
+    items_.erase(keyHash);
+    queue_.erase(victim);
+    return true;
+}
+
+bool GdsfPolicy::peekVictim(uint64_t& keyHash) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (queue_.empty()) {
+        return false;
+    }
+    keyHash = queue_.begin()->second;
+    return true;
+}
+
+size_t GdsfPolicy::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return items_.size();
+}
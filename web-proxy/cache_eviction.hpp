@@ -0,0 +1,47 @@
+#ifndef CACHE_EVICTION_HPP
+#define CACHE_EVICTION_HPP
+
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+// Greedy-Dual-Size-Frequency replacement policy. Each object has the
+// priority L + frequency / size, where L is the priority of the last
+// evicted object; small, frequently used objects are kept longest and
+// L "ages" objects that stop being requested. All operations are
+// O(log n), so the policy is maintained incrementally as the cache
+// changes instead of by rescanning the cache.
+class GdsfPolicy {
+public:
+    GdsfPolicy();
+
+    void insert(uint64_t keyHash, uint64_t size, uint32_t frequency = 1);
+    void access(uint64_t keyHash);
+    void remove(uint64_t keyHash);
+
+    // Removes and returns the object with the lowest priority.
+    bool popVictim(uint64_t& keyHash);
+    // The object popVictim would remove next, left in place.
+    bool peekVictim(uint64_t& keyHash) const;
+
+    size_t size() const;
+
+private:
+    struct Item {
+        double priority;
+        uint64_t size;
+        uint32_t frequency;
+    };
+
+    mutable std::mutex mutex_;
+    std::unordered_map<uint64_t, Item> items_;
+    std::set<std::pair<double, uint64_t> > queue_;
+    double inflation_;
+
+    double priorityOf(const Item& item) const;
+};
+
+#endif // CACHE_EVICTION_HPP
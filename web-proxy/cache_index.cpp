@@ -0,0 +1,513 @@
+#include "cache_index.hpp"
+#include <fstream>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+
+const char kIndexMagic[8] = {'P', 'X', 'Y', 'I', 'N', 'D', 'E', 'X'};
+const uint32_t kIndexVersion = 3;
+const char kFileMagic[4] = {'P', 'X', 'C', '2'};
+const uint64_t kInitialCapacity = 1024;
+
+enum SlotState : uint16_t {
+    SLOT_EMPTY = 0,
+    SLOT_USED = 1,
+    SLOT_TOMBSTONE = 2
+};
+
+std::atomic<unsigned> g_tempCounter(0);
+
+size_t mappingSizeFor(uint64_t capacity) {
+    return sizeof(CacheIndexHeader) + capacity * sizeof(CacheIndexSlot);
+}
+
+bool isHexName(const char* name, size_t length) {
+    if (std::strlen(name) != length) {
+        return false;
+    }
+    for (size_t i = 0; i < length; ++i) {
+        char c = name[i];
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool makeDirectory(const std::string& path) {
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+} // namespace
+
+CacheIndex::CacheIndex(const std::string& cacheDir)
+    : cacheDir_(cacheDir), indexPath_(cacheDir + "/index.bin"),
+      fd_(-1), mapping_(nullptr), mappingSize_(0), rebuiltFrom_(0) {
+    if (!mapFile(false, 0) || !header()->clean) {
+        unmapFile();
+        rebuild();
+    }
+}
+
+CacheIndex::~CacheIndex() {
+    flush();
+    unmapFile();
+}
+
+uint64_t CacheIndex::hashKey(const std::string& key) {
+    // 64-bit FNV-1a; 0 is reserved for empty slots
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash == 0 ? 1 : hash;
+}
+
+std::string CacheIndex::objectPath(uint64_t keyHash) const {
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(keyHash));
+    std::string hex(name);
+    return cacheDir_ + "/" + hex.substr(0, 2) + "/" + hex.substr(2, 2) + "/" + hex;
+}
+
+CacheIndexHeader* CacheIndex::header() const {
+    return static_cast<CacheIndexHeader*>(mapping_);
+}
+
+CacheIndexSlot* CacheIndex::slots() const {
+    return reinterpret_cast<CacheIndexSlot*>(static_cast<char*>(mapping_) + sizeof(CacheIndexHeader));
+}
+
+bool CacheIndex::mapFile(bool create, uint64_t capacity) {
+    int flags = create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR;
+    fd_ = ::open(indexPath_.c_str(), flags, 0644);
+    if (fd_ < 0) {
+        return false;
+    }
+
+    if (create) {
+        mappingSize_ = mappingSizeFor(capacity);
+        if (ftruncate(fd_, mappingSize_) != 0) {
+            return false;
+        }
+    } else {
+        struct stat info;
+        if (fstat(fd_, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(CacheIndexHeader)) {
+            return false;
+        }
+        mappingSize_ = info.st_size;
+    }
+
+    mapping_ = mmap(nullptr, mappingSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (mapping_ == MAP_FAILED) {
+        mapping_ = nullptr;
+        return false;
+    }
+
+    CacheIndexHeader* hdr = header();
+    if (create) {
+        // ftruncate zero-fills, so every slot starts out empty
+        std::memcpy(hdr->magic, kIndexMagic, sizeof(kIndexMagic));
+        hdr->version = kIndexVersion;
+        hdr->clean = 0;
+        hdr->capacity = capacity;
+        return true;
+    }
+
+    return std::memcmp(hdr->magic, kIndexMagic, sizeof(kIndexMagic)) == 0 &&
+           hdr->version == kIndexVersion &&
+           hdr->capacity > 0 && (hdr->capacity & (hdr->capacity - 1)) == 0 &&
+           mappingSizeFor(hdr->capacity) == mappingSize_;
+}
+
+void CacheIndex::unmapFile() {
+    if (mapping_) {
+        munmap(mapping_, mappingSize_);
+        mapping_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    mappingSize_ = 0;
+}
+
+void CacheIndex::rebuild() {
+    if (!mapFile(true, kInitialCapacity)) {
+        throw std::runtime_error("Failed to create cache index: " + indexPath_);
+    }
+
+    // Only the fixed-size headers of the object files are read
+    rebuiltFrom_ = 0;
+    DIR* top = opendir(cacheDir_.c_str());
+    while (top) {
+        dirent* first = readdir(top);
+        if (!first) {
+            break;
+        }
+        if (!isHexName(first->d_name, 2)) {
+            continue;
+        }
+        std::string firstPath = cacheDir_ + "/" + first->d_name;
+        DIR* middle = opendir(firstPath.c_str());
+        while (middle) {
+            dirent* second = readdir(middle);
+            if (!second) {
+                break;
+            }
+            if (!isHexName(second->d_name, 2)) {
+                continue;
+            }
+            std::string secondPath = firstPath + "/" + second->d_name;
+            DIR* leaf = opendir(secondPath.c_str());
+            while (leaf) {
+                dirent* object = readdir(leaf);
+                if (!object) {
+                    break;
+                }
+                std::string objectFile = secondPath + "/" + object->d_name;
+                if (std::strstr(object->d_name, ".tmp.")) {
+                    // Leftover from an interrupted write
+                    std::remove(objectFile.c_str());
+                    continue;
+                }
+                if (!isHexName(object->d_name, 16)) {
+                    continue;
+                }
+                rebuiltFrom_++;
+                CacheEntry entry;
+                if (readObject(objectFile, entry, nullptr) &&
+                    objectPath(hashKey(entry.key)) == objectFile) {
+                    put(hashKey(entry.key), entry);
+                } else {
+                    std::remove(objectFile.c_str());
+                }
+            }
+            if (leaf) {
+                closedir(leaf);
+            }
+        }
+        if (middle) {
+            closedir(middle);
+        }
+    }
+    if (top) {
+        closedir(top);
+    }
+
+    flush();
+}
+
+void CacheIndex::grow() {
+    std::vector<CacheIndexSlot> live;
+    live.reserve(header()->used);
+    uint64_t capacity = header()->capacity;
+    for (uint64_t i = 0; i < capacity; ++i) {
+        if (slots()[i].state == SLOT_USED) {
+            live.push_back(slots()[i]);
+        }
+    }
+
+    // Rehash in place when the table is mostly tombstones, otherwise double it
+    uint64_t newCapacity = (live.size() + 1) * 2 > capacity ? capacity * 2 : capacity;
+    unmapFile();
+    if (!mapFile(true, newCapacity)) {
+        throw std::runtime_error("Failed to grow cache index: " + indexPath_);
+    }
+    for (const CacheIndexSlot& slot : live) {
+        CacheIndexSlot* target = findSlot(slot.keyHash, true);
+        *target = slot;
+        header()->used++;
+        header()->totalBytes += slot.size;
+    }
+}
+
+void CacheIndex::markDirty() {
+    header()->clean = 0;
+}
+
+CacheIndexSlot* CacheIndex::findSlot(uint64_t keyHash, bool forInsert) const {
+    uint64_t mask = header()->capacity - 1;
+    CacheIndexSlot* firstTombstone = nullptr;
+
+    // Linear probing; the load factor is kept below 0.7, so an empty slot exists
+    for (uint64_t i = keyHash & mask; ; i = (i + 1) & mask) {
+        CacheIndexSlot* slot = &slots()[i];
+        if (slot->state == SLOT_EMPTY) {
+            if (!forInsert) {
+                return nullptr;
+            }
+            return firstTombstone ? firstTombstone : slot;
+        }
+        if (slot->state == SLOT_TOMBSTONE) {
+            if (!firstTombstone) {
+                firstTombstone = slot;
+            }
+        } else if (slot->keyHash == keyHash) {
+            return slot;
+        }
+    }
+}
+
+bool CacheIndex::lookup(uint64_t keyHash, CacheEntry& entry) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const CacheIndexSlot* slot = findSlot(keyHash, false);
+    if (!slot) {
+        return false;
+    }
+
+    entry.filePath = objectPath(keyHash);
+    entry.size = slot->size;
+    entry.timestamp = static_cast<time_t>(slot->storedAt);
+    entry.expiresAt = static_cast<time_t>(slot->expiresAt);
+    entry.staleWhileRevalidate = slot->staleWhileRevalidate;
+    entry.statusCode = slot->statusCode;
+    entry.frequency = slot->frequency;
+    entry.varyHash = slot->varyHash;
+    return true;
+}
+
+void CacheIndex::put(uint64_t keyHash, const CacheEntry& entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CacheIndexHeader* hdr = header();
+    if ((hdr->used + hdr->tombstones + 1) * 10 > hdr->capacity * 7) {
+        grow();
+        hdr = header();
+    }
+    markDirty();
+
+    CacheIndexSlot* slot = findSlot(keyHash, true);
+    uint32_t frequency = entry.frequency;
+    if (slot->state == SLOT_USED) {
+        // A replaced object keeps its hit count
+        hdr->totalBytes -= slot->size;
+        frequency = std::max(frequency, slot->frequency);
+    } else {
+        if (slot->state == SLOT_TOMBSTONE) {
+            hdr->tombstones--;
+        }
+        hdr->used++;
+    }
+
+    slot->keyHash = keyHash;
+    slot->size = entry.size;
+    slot->storedAt = entry.timestamp;
+    slot->expiresAt = entry.expiresAt;
+    slot->staleWhileRevalidate = static_cast<int32_t>(entry.staleWhileRevalidate);
+    slot->statusCode = static_cast<uint16_t>(entry.statusCode);
+    slot->state = SLOT_USED;
+    slot->frequency = frequency;
+    slot->lastAccess = entry.timestamp;
+    slot->varyHash = entry.varyHash;
+    hdr->totalBytes += entry.size;
+}
+
+void CacheIndex::touch(uint64_t keyHash, time_t now) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CacheIndexSlot* slot = findSlot(keyHash, false);
+    if (slot) {
+        markDirty();
+        slot->frequency++;
+        slot->lastAccess = now;
+    }
+}
+
+void CacheIndex::forEach(const std::function<void(uint64_t, uint64_t, uint32_t)>& visit) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t capacity = header()->capacity;
+    for (uint64_t i = 0; i < capacity; ++i) {
+        const CacheIndexSlot& slot = slots()[i];
+        if (slot.state == SLOT_USED) {
+            visit(slot.keyHash, slot.size, slot.frequency);
+        }
+    }
+}
+
+bool CacheIndex::erase(uint64_t keyHash) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CacheIndexSlot* slot = findSlot(keyHash, false);
+    if (!slot) {
+        return false;
+    }
+    markDirty();
+    slot->state = SLOT_TOMBSTONE;
+    header()->used--;
+    header()->tombstones++;
+    header()->totalBytes -= slot->size;
+    return true;
+}
+
+void CacheIndex::flush() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!mapping_) {
+        return;
+    }
+    header()->clean = 1;
+    msync(mapping_, mappingSize_, MS_SYNC);
+}
+
+size_t CacheIndex::entryCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return header()->used;
+}
+
+uint64_t CacheIndex::totalBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return header()->totalBytes;
+}
+
+bool CacheIndex::writeObject(const std::string& path, const CacheEntry& entry,
+                             const std::string& response) {
+    return writeObject(path, entry, response, -1, 0);
+}
+
+bool CacheIndex::writeObject(const std::string& path, const CacheEntry& entry,
+                             const std::string& head, int bodyFd, uint64_t bodyLength) {
+    // Create the two shard directory levels if needed
+    size_t leafSlash = path.find_last_of('/');
+    size_t middleSlash = path.find_last_of('/', leafSlash - 1);
+    if (!makeDirectory(path.substr(0, middleSlash)) ||
+        !makeDirectory(path.substr(0, leafSlash))) {
+        return false;
+    }
+
+    CacheFileHeader hdr;
+    std::memset(&hdr, 0, sizeof(hdr));
+    std::memcpy(hdr.magic, kFileMagic, sizeof(kFileMagic));
+    hdr.statusCode = static_cast<uint16_t>(entry.statusCode);
+    hdr.flags = entry.compressed ? kObjectCompressed : 0;
+    hdr.etagLength = static_cast<uint16_t>(std::min<size_t>(entry.etag.size(), 0xFFFF));
+    hdr.lastModifiedLength = static_cast<uint16_t>(std::min<size_t>(entry.lastModified.size(), 0xFFFF));
+    hdr.keyLength = static_cast<uint32_t>(entry.key.size());
+    hdr.storedAt = entry.timestamp;
+    hdr.expiresAt = entry.expiresAt;
+    hdr.staleWhileRevalidate = static_cast<int32_t>(entry.staleWhileRevalidate);
+    hdr.responseLength = head.size() + bodyLength;
+    hdr.varyHash = entry.varyHash;
+
+    // Write to a temporary file and rename, so readers never see a partial object
+    std::string tempPath = stagingPath(path);
+    {
+        std::ofstream file(tempPath, std::ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        file.write(entry.key.data(), entry.key.size());
+        file.write(entry.etag.data(), hdr.etagLength);
+        file.write(entry.lastModified.data(), hdr.lastModifiedLength);
+        file.write(head.data(), head.size());
+        char buffer[65536];
+        for (uint64_t offset = 0; offset < bodyLength && file.good(); ) {
+            ssize_t n = pread(bodyFd, buffer,
+                              static_cast<size_t>(std::min<uint64_t>(sizeof(buffer), bodyLength - offset)), offset);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                file.setstate(std::ios::failbit);
+                break;
+            }
+            file.write(buffer, n);
+            offset += n;
+        }
+        if (!file.good()) {
+            file.close();
+            std::remove(tempPath.c_str());
+            return false;
+        }
+    }
+
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::string CacheIndex::stagingPath(const std::string& path) {
+    return path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(g_tempCounter++);
+}
+
+bool CacheIndex::readObject(const std::string& path, CacheEntry& entry, std::string* response) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    CacheFileHeader hdr;
+    if (!file.read(reinterpret_cast<char*>(&hdr), sizeof(hdr)) ||
+        std::memcmp(hdr.magic, kFileMagic, sizeof(kFileMagic)) != 0) {
+        return false;
+    }
+
+    std::string fields(hdr.keyLength + hdr.etagLength + hdr.lastModifiedLength, '\0');
+    if (!file.read(&fields[0], fields.size())) {
+        return false;
+    }
+    entry.key = fields.substr(0, hdr.keyLength);
+    entry.etag = fields.substr(hdr.keyLength, hdr.etagLength);
+    entry.lastModified = fields.substr(hdr.keyLength + hdr.etagLength, hdr.lastModifiedLength);
+    entry.filePath = path;
+    entry.statusCode = hdr.statusCode;
+    entry.timestamp = static_cast<time_t>(hdr.storedAt);
+    entry.expiresAt = static_cast<time_t>(hdr.expiresAt);
+    entry.staleWhileRevalidate = hdr.staleWhileRevalidate;
+    entry.size = hdr.responseLength;
+    entry.compressed = (hdr.flags & kObjectCompressed) != 0;
+    entry.varyHash = hdr.varyHash;
+
+    if (response) {
+        response->resize(hdr.responseLength);
+        if (hdr.responseLength > 0 && !file.read(&(*response)[0], hdr.responseLength)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int CacheIndex::openObject(const std::string& path, CacheEntry& entry, uint64_t& responseOffset) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    CacheFileHeader hdr;
+    std::string fields;
+    bool valid = pread(fd, &hdr, sizeof(hdr), 0) == static_cast<ssize_t>(sizeof(hdr)) &&
+                 std::memcmp(hdr.magic, kFileMagic, sizeof(kFileMagic)) == 0;
+    if (valid) {
+        fields.resize(hdr.keyLength + hdr.etagLength + hdr.lastModifiedLength);
+        valid = fields.empty() ||
+                pread(fd, &fields[0], fields.size(), sizeof(hdr)) == static_cast<ssize_t>(fields.size());
+    }
+    if (!valid) {
+        ::close(fd);
+        return -1;
+    }
+    entry.key = fields.substr(0, hdr.keyLength);
+    entry.etag = fields.substr(hdr.keyLength, hdr.etagLength);
+    entry.lastModified = fields.substr(hdr.keyLength + hdr.etagLength, hdr.lastModifiedLength);
+    entry.filePath = path;
+    entry.statusCode = hdr.statusCode;
+    entry.timestamp = static_cast<time_t>(hdr.storedAt);
+    entry.expiresAt = static_cast<time_t>(hdr.expiresAt);
+    entry.staleWhileRevalidate = hdr.staleWhileRevalidate;
+    entry.size = hdr.responseLength;
+    entry.compressed = (hdr.flags & kObjectCompressed) != 0;
+    entry.varyHash = hdr.varyHash;
+    responseOffset = sizeof(hdr) + fields.size();
+    return fd;
+}
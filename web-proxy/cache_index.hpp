@@ -0,0 +1,151 @@
+#ifndef CACHE_INDEX_HPP
+#define CACHE_INDEX_HPP
+
+#include <string>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+#include <ctime>
+
+struct CacheEntry {
+    std::string key;
+    std::string filePath;
+    std::string lastModified;
+    std::string etag;
+    time_t timestamp;               // when the response was stored or last revalidated
+    time_t expiresAt;               // fresh until this time
+    long staleWhileRevalidate;      // seconds it may be served stale while refreshing
+    int statusCode;
+    uint64_t size;                  // bytes of the stored response
+    uint32_t frequency;             // number of hits, kept in the index
+    bool compressed;                // body stored gzip-encoded by the proxy
+    // Hash of the response's Vary field names, 0 if it does not vary. A
+    // URL whose responses vary has a marker entry (status 0, the names as
+    // its response) under its own key, and one variant per combination of
+    // the request's values under a secondary key.
+    uint64_t varyHash;
+
+    CacheEntry() : timestamp(0), expiresAt(0), staleWhileRevalidate(0), statusCode(0),
+                   size(0), frequency(0), compressed(false), varyHash(0) {}
+
+    bool isVaryMarker() const { return statusCode == 0 && varyHash != 0; }
+};
+
+// CacheFileHeader::flags: the response body was gzip-encoded when stored
+const uint16_t kObjectCompressed = 1;
+
+#pragma pack(push, 1)
+// Header of a cached object file. It is followed by the cache key, the
+// ETag and Last-Modified values and the stored response itself.
+struct CacheFileHeader {
+    char magic[4];
+    uint16_t statusCode;
+    uint16_t etagLength;
+    uint16_t lastModifiedLength;
+    uint16_t flags;                 // kObjectCompressed
+    uint32_t keyLength;
+    int64_t storedAt;
+    int64_t expiresAt;
+    int32_t staleWhileRevalidate;
+    uint64_t responseLength;
+    uint64_t varyHash;
+};
+
+// One slot of the on-disk index hash table
+struct CacheIndexSlot {
+    uint64_t keyHash;               // 0 = empty
+    uint64_t size;
+    int64_t storedAt;
+    int64_t expiresAt;
+    int32_t staleWhileRevalidate;
+    uint16_t statusCode;
+    uint16_t state;
+    uint32_t frequency;
+    int64_t lastAccess;
+    uint64_t varyHash;
+};
+
+struct CacheIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t clean;                 // 1 if the index matched the files when last flushed
+    uint64_t capacity;              // number of slots, a power of two
+    uint64_t used;                  // live slots
+    uint64_t tombstones;
+    uint64_t totalBytes;
+};
+#pragma pack(pop)
+
+// Memory-mapped open-addressing hash table mapping key hashes to cached
+// object metadata, stored in <cacheDir>/index.bin. Objects live in a
+// two-level sharded layout <cacheDir>/ab/cd/<hash>, so lookups never need
+// to stat files or parse metadata. If the index is missing or was not
+// flushed cleanly it is rebuilt from the object file headers.
+class CacheIndex {
+public:
+    explicit CacheIndex(const std::string& cacheDir);
+    ~CacheIndex();
+
+    CacheIndex(const CacheIndex&) = delete;
+    CacheIndex& operator=(const CacheIndex&) = delete;
+
+    static uint64_t hashKey(const std::string& key);
+    std::string objectPath(uint64_t keyHash) const;
+
+    // Fills the index fields of `entry` (not key, ETag, Last-Modified or
+    // whether it is compressed).
+    bool lookup(uint64_t keyHash, CacheEntry& entry) const;
+    void put(uint64_t keyHash, const CacheEntry& entry);
+    bool erase(uint64_t keyHash);
+    // Records a hit on the entry.
+    void touch(uint64_t keyHash, time_t now);
+    // Visits every live entry: key hash, size and hit count.
+    void forEach(const std::function<void(uint64_t, uint64_t, uint32_t)>& visit) const;
+
+    // Syncs the mapping and marks the index consistent with the files.
+    void flush();
+
+    size_t entryCount() const;
+    uint64_t totalBytes() const;
+    // Number of object files scanned when the index had to be rebuilt.
+    size_t rebuiltFrom() const { return rebuiltFrom_; }
+
+    // Object files: header, key, validators, then the response.
+    static bool writeObject(const std::string& path, const CacheEntry& entry,
+                            const std::string& response);
+    // The same for a response whose body is the first `bodyLength` bytes of
+    // the file `bodyFd`, copied in bounded pieces.
+    static bool writeObject(const std::string& path, const CacheEntry& entry,
+                            const std::string& head, int bodyFd, uint64_t bodyLength);
+    // Reads the header and validators; the response too if `response` is set.
+    static bool readObject(const std::string& path, CacheEntry& entry,
+                           std::string* response);
+    // Opens an object file for reading parts of the response, e.g. with
+    // sendfile; `responseOffset` is where the response starts. Returns the
+    // descriptor, or -1.
+    static int openObject(const std::string& path, CacheEntry& entry, uint64_t& responseOffset);
+    // A unique name next to `path` for an object written before it is
+    // renamed into place; rebuilds remove such files as leftovers.
+    static std::string stagingPath(const std::string& path);
+
+private:
+    std::string cacheDir_;
+    std::string indexPath_;
+    mutable std::mutex mutex_;
+    int fd_;
+    void* mapping_;
+    size_t mappingSize_;
+    size_t rebuiltFrom_;
+
+    CacheIndexHeader* header() const;
+    CacheIndexSlot* slots() const;
+    bool mapFile(bool create, uint64_t capacity);
+    void unmapFile();
+    void rebuild();
+    void grow();
+    void markDirty();
+    CacheIndexSlot* findSlot(uint64_t keyHash, bool forInsert) const;
+};
+
+#endif // CACHE_INDEX_HPP
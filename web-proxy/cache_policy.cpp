@@ -0,0 +1,228 @@
+#include "cache_policy.hpp"
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// Upper bound for heuristic freshness (RFC 7234, section 4.2.2)
+const long kMaxHeuristicLifetime = 24 * 60 * 60;
+
+std::string toLower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+    return s;
+}
+
+std::string trim(const std::string& s) {
+    size_t start = s.find_first_not_of(" \t");
+    if (start == std::string::npos) {
+        return "";
+    }
+    size_t end = s.find_last_not_of(" \t");
+    return s.substr(start, end - start + 1);
+}
+
+std::string headerValue(const std::map<std::string, std::string>& headers, const std::string& name) {
+    std::map<std::string, std::string>::const_iterator it = headers.find(name);
+    return it != headers.end() ? it->second : std::string();
+}
+
+long parseDeltaSeconds(const std::string& value) {
+    std::string digits = trim(value);
+    if (digits.size() >= 2 && digits[0] == '"' && digits[digits.size() - 1] == '"') {
+        digits = digits.substr(1, digits.size() - 2);
+    }
+    if (digits.empty() || !std::isdigit(static_cast<unsigned char>(digits[0]))) {
+        return -1;
+    }
+    return std::strtol(digits.c_str(), nullptr, 10);
+}
+
+} // namespace
+
+CacheControl CacheControl::parse(const std::string& value) {
+    CacheControl cc;
+    std::istringstream iss(value);
+    std::string directive;
+
+    while (std::getline(iss, directive, ',')) {
+        directive = trim(directive);
+        std::string name = directive;
+        std::string argument;
+        size_t eq = directive.find('=');
+        if (eq != std::string::npos) {
+            name = trim(directive.substr(0, eq));
+            argument = directive.substr(eq + 1);
+        }
+        name = toLower(name);
+
+        if (name == "no-store") {
+            cc.noStore = true;
+        } else if (name == "no-cache") {
+            cc.noCache = true;
+        } else if (name == "private") {
+            cc.isPrivate = true;
+        } else if (name == "public") {
+            cc.isPublic = true;
+        } else if (name == "must-revalidate") {
+            cc.mustRevalidate = true;
+        } else if (name == "proxy-revalidate") {
+            cc.proxyRevalidate = true;
+        } else if (name == "max-age") {
+            cc.maxAge = parseDeltaSeconds(argument);
+        } else if (name == "s-maxage") {
+            cc.sMaxAge = parseDeltaSeconds(argument);
+        } else if (name == "stale-while-revalidate") {
+            cc.staleWhileRevalidate = parseDeltaSeconds(argument);
+        }
+    }
+    return cc;
+}
+
+time_t parseHttpDate(const std::string& value) {
+    static const char* const formats[] = {
+        "%a, %d %b %Y %H:%M:%S GMT",    // IMF-fixdate
+        "%A, %d-%b-%y %H:%M:%S GMT",    // obsolete RFC 850
+        "%a %b %d %H:%M:%S %Y"          // asctime()
+    };
+
+    std::string trimmed = trim(value);
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+        struct tm tm;
+        std::memset(&tm, 0, sizeof(tm));
+        const char* end = strptime(trimmed.c_str(), formats[i], &tm);
+        if (end && *end == '\0') {
+            return timegm(&tm);
+        }
+    }
+    return -1;
+}
+
+std::string formatHttpDate(time_t value) {
+    struct tm tm;
+    gmtime_r(&value, &tm);
+    char buffer[64];
+    strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buffer;
+}
+
+Freshness computeFreshness(const std::map<std::string, std::string>& headers,
+                           time_t responseTime) {
+    Freshness freshness;
+    CacheControl cc = CacheControl::parse(headerValue(headers, "cache-control"));
+
+    time_t date = parseHttpDate(headerValue(headers, "date"));
+    if (date < 0) {
+        date = responseTime;
+    }
+
+    // Age of the response when it reached us
+    long age = std::max(0L, static_cast<long>(responseTime - date));
+    long ageHeader = parseDeltaSeconds(headerValue(headers, "age"));
+    age = std::max(age, ageHeader);
+
+    long lifetime = 0;
+    std::string expires = headerValue(headers, "expires");
+    std::string lastModified = headerValue(headers, "last-modified");
+    if (cc.sMaxAge >= 0) {
+        lifetime = cc.sMaxAge;
+    } else if (cc.maxAge >= 0) {
+        lifetime = cc.maxAge;
+    } else if (!expires.empty()) {
+        // An invalid Expires value means "already expired"
+        time_t expiresAt = parseHttpDate(expires);
+        lifetime = expiresAt < 0 ? 0 : std::max(0L, static_cast<long>(expiresAt - date));
+    } else if (!lastModified.empty()) {
+        // Heuristic: 10% of the time since the last modification
+        time_t modified = parseHttpDate(lastModified);
+        if (modified >= 0 && modified <= date) {
+            lifetime = std::min(static_cast<long>(date - modified) / 10, kMaxHeuristicLifetime);
+            freshness.heuristic = true;
+        }
+    }
+
+    if (cc.noCache) {
+        lifetime = 0;
+    }
+
+    freshness.expiresAt = responseTime - age + lifetime;
+    if (!cc.noCache && !cc.mustRevalidate && !cc.proxyRevalidate && cc.staleWhileRevalidate > 0) {
+        freshness.staleWhileRevalidate = cc.staleWhileRevalidate;
+    }
+    return freshness;
+}
+
+bool isStorableResponse(const std::map<std::string, std::string>& headers,
+                        bool requestHasAuthorization) {
+    CacheControl cc = CacheControl::parse(headerValue(headers, "cache-control"));
+    if (cc.noStore || cc.isPrivate) {
+        return false;
+    }
+    if (trim(headerValue(headers, "vary")) == "*") {
+        return false;
+    }
+
+    // Responses to authenticated requests need explicit permission (RFC 7234, 3.2)
+    if (requestHasAuthorization && !cc.isPublic && cc.sMaxAge < 0 && !cc.mustRevalidate) {
+        return false;
+    }
+
+    // Without a lifetime or a validator the stored copy could never be reused
+    bool hasLifetime = cc.maxAge >= 0 || cc.sMaxAge >= 0 ||
+                       headers.count("expires") > 0 || headers.count("last-modified") > 0;
+    bool hasValidator = headers.count("etag") > 0 || headers.count("last-modified") > 0;
+    return hasLifetime || hasValidator;
+}
+
+std::vector<std::string> parseVary(const std::string& value) {
+    std::vector<std::string> names;
+    std::istringstream iss(value);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        item = toLower(trim(item));
+        if (!item.empty()) {
+            names.push_back(item);
+        }
+    }
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    return names;
+}
+
+std::string normalizeVaryValue(const std::string& lowercaseName, const std::string& value) {
+    if (lowercaseName == "accept-encoding") {
+        std::vector<std::string> codings;
+        std::istringstream iss(value);
+        std::string item;
+        while (std::getline(iss, item, ',')) {
+            size_t semicolon = item.find(';');
+            std::string coding = toLower(trim(item.substr(0, semicolon)));
+            if (semicolon != std::string::npos) {
+                std::string param = toLower(trim(item.substr(semicolon + 1)));
+                if (param.compare(0, 2, "q=") == 0 && std::strtod(param.c_str() + 2, nullptr) <= 0) {
+                    continue;
+                }
+            }
+            if (!coding.empty()) {
+                codings.push_back(coding);
+            }
+        }
+        std::sort(codings.begin(), codings.end());
+        codings.erase(std::unique(codings.begin(), codings.end()), codings.end());
+        std::string normalized;
+        for (size_t i = 0; i < codings.size(); ++i) {
+            normalized += (i == 0 ? "" : ",") + codings[i];
+        }
+        return normalized;
+    }
+
+    std::string normalized;
+    for (size_t i = 0; i < value.size(); ++i) {
+        if (value[i] != ' ' && value[i] != '\t') {
+            normalized += static_cast<char>(std::tolower(static_cast<unsigned char>(value[i])));
+        }
+    }
+    return normalized;
+}
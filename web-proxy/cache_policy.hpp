@@ -0,0 +1,61 @@
+#ifndef CACHE_POLICY_HPP
+#define CACHE_POLICY_HPP
+
+#include <string>
+#include <map>
+#include <vector>
+#include <ctime>
+
+// Parsed Cache-Control directives (RFC 7234, section 5.2).
+// Delta-seconds directives that are absent are -1.
+struct CacheControl {
+    bool noStore;
+    bool noCache;
+    bool isPrivate;
+    bool isPublic;
+    bool mustRevalidate;
+    bool proxyRevalidate;
+    long maxAge;
+    long sMaxAge;
+    long staleWhileRevalidate;
+
+    CacheControl() : noStore(false), noCache(false), isPrivate(false), isPublic(false),
+                     mustRevalidate(false), proxyRevalidate(false),
+                     maxAge(-1), sMaxAge(-1), staleWhileRevalidate(-1) {}
+
+    static CacheControl parse(const std::string& value);
+};
+
+// Freshness of a stored response, in absolute times.
+struct Freshness {
+    time_t expiresAt;               // fresh until this time
+    long staleWhileRevalidate;      // seconds it may be served stale while refreshing
+    bool heuristic;                 // lifetime was guessed from Last-Modified
+
+    Freshness() : expiresAt(0), staleWhileRevalidate(0), heuristic(false) {}
+};
+
+// Parses an HTTP-date in any of the three formats of RFC 7231,
+// section 7.1.1.1. Returns -1 if the value is not a valid date.
+time_t parseHttpDate(const std::string& value);
+std::string formatHttpDate(time_t value);
+
+// Computes the freshness of a response received at `responseTime` from
+// its (lowercased) headers, as a shared cache would (RFC 7234, 4.2).
+Freshness computeFreshness(const std::map<std::string, std::string>& headers,
+                           time_t responseTime);
+
+// Returns true if the response headers allow a shared cache to store it.
+bool isStorableResponse(const std::map<std::string, std::string>& headers,
+                        bool requestHasAuthorization);
+
+// Field names listed in a Vary value, lowercased, sorted and without
+// duplicates, so that equivalent values select variants alike.
+std::vector<std::string> parseVary(const std::string& value);
+
+// A request field value reduced to what tells variants apart: lowercase
+// without whitespace, and for Accept-Encoding the sorted set of codings
+// it accepts.
+std::string normalizeVaryValue(const std::string& lowercaseName, const std::string& value);
+
+#endif // CACHE_POLICY_HPP
@@ -0,0 +1,641 @@
+#include "client_connection.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+
+namespace {
+
+// Response bytes taken from a shared fetch ahead of what the client accepted
+const size_t kStreamWindow = 256 * 1024;
+// Largest single sendfile call, so one client cannot hold the reactor
+const size_t kFileSendChunk = 1024 * 1024;
+// A response head that has not ended by now is passed through unframed
+const size_t kMaxResponseHead = 64 * 1024;
+// Request body bytes held for the origin before reading from the client pauses
+const size_t kUploadWindow = 256 * 1024;
+const char kContinue[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+int statusOf(const std::string& head) {
+    size_t space = head.find(' ');
+    return space == std::string::npos ? 0 : std::atoi(head.c_str() + space + 1);
+}
+
+} // namespace
+
+const uint64_t ClientConnection::kMaxBufferedBody;
+
+ClientConnection::ClientConnection(Reactor& reactor, int fd, int idleTimeoutMs, int keepAliveTimeoutMs,
+                                   size_t maxRequests, uint64_t maxBodyBytes,
+                                   const RequestCallback& onRequest, const Logger& log)
+    : reactor_(reactor), fd_(fd), idleTimeoutMs_(idleTimeoutMs), keepAliveTimeoutMs_(keepAliveTimeoutMs),
+      maxRequests_(maxRequests), onRequest_(onRequest), log_(log), state_(READING_REQUEST),
+      requests_(0), waitingForRequest_(false), requestKeepAlive_(false), headRequest_(false),
+      headSent_(false), keepAlive_(false), continueSent_(false), outputOffset_(0), fileFd_(-1),
+      fileOffset_(0), fileRemaining_(0), finishing_(false),
+      streamOffset_(0), pullScheduled_(false), idleTimer_(0), stallTimer_(0), events_(0),
+      hasTail_(false), sourceEvents_(0), relayWantsWrite_(false) {
+    parser_.setMaxBodyBytes(maxBodyBytes);
+}
+
+ClientConnection::~ClientConnection() {
+    // Timers and the reactor registration are released by close(); a
+    // connection may be destroyed on another thread after that
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+    closeFile();
+}
+
+void ClientConnection::start() {
+    events_ = EPOLLIN;
+    reactor_.add(fd_, events_, shared_from_this());
+    armIdleTimer();
+}
+
+void ClientConnection::onEvent(uint32_t events) {
+    std::shared_ptr<ClientConnection> guard = shared_from_this();
+
+    if ((events & (EPOLLERR | EPOLLHUP)) && !(events & EPOLLIN)) {
+        close();
+        return;
+    }
+    if ((events & EPOLLRDHUP) && awaitingResponse()) {
+        // Taken as giving up, as a half-closing client cannot be told apart
+        log_("Client closed the connection while waiting for the response");
+        close();
+        return;
+    }
+    if ((events & EPOLLIN) && (state_ == READING_REQUEST || uploading())) {
+        readInput();
+    }
+    if ((events & EPOLLOUT) && state_ != CLOSED) {
+        if (relay_) {
+            pumpRelay();
+        } else {
+            pump();
+        }
+    }
+}
+
+void ClientConnection::readInput() {
+    char buffer[16384];
+    while (state_ == READING_REQUEST || (uploading() && !upload_->full())) {
+        ssize_t n = recv(fd_, buffer, sizeof(buffer), 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n <= 0) {
+            close();
+            return;
+        }
+        waitingForRequest_ = false;
+        armIdleTimer();
+        if (state_ == PROCESSING) {
+            feedUpload(buffer, n);
+        } else if (takeRequest(buffer, n)) {
+            return;
+        }
+    }
+    if (state_ == PROCESSING) {
+        // Reading pauses while the upload stream is full
+        updateEvents();
+    }
+}
+
+bool ClientConnection::takeRequest(const char* data, size_t len) {
+    // The parser keeps what it needs; only bytes past the end of the
+    // request stay buffered here
+    size_t consumed = parser_.feed(data, len);
+    if (parser_.bodyPending()) {
+        // The client may wait for this before it sends the body
+        if (!continueSent_ && parser_.head().get("expect").equalsIgnoreCase("100-continue")) {
+            continueSent_ = true;
+            queueOutput(kContinue, sizeof(kContinue) - 1);
+            pump();
+            if (state_ == CLOSED) {
+                return true;
+            }
+        }
+        if (parser_.chunked() || parser_.contentLength() > kMaxBufferedBody) {
+            startUpload();
+            return true;
+        }
+    }
+    if (!parser_.complete() && !parser_.failed()) {
+        return false;
+    }
+    input_.append(data + consumed, len - consumed);
+    dispatchRequest();
+    return true;
+}
+
+void ClientConnection::dispatchRequest() {
+    requests_++;
+    // After a rejected request the input cannot be framed any more, and
+    // after CONNECT it belongs to the tunnel
+    const HttpRequestHead& head = parser_.head();
+    requestKeepAlive_ = !parser_.failed() && head.keepAlive() &&
+                        !head.method().equalsIgnoreCase("CONNECT") &&
+                        (maxRequests_ == 0 || requests_ < maxRequests_);
+    headRequest_ = head.method().equalsIgnoreCase("HEAD");
+    state_ = PROCESSING;
+    updateEvents();
+    onRequest_(shared_from_this(), parser_);
+}
+
+void ClientConnection::startUpload() {
+    upload_ = std::make_shared<UploadStream>(
+        parser_.chunked() ? UploadStream::kUnknownLength : parser_.contentLength(), kUploadWindow);
+    std::string body = parser_.takeBody();
+    upload_->append(body.data(), body.size());
+
+    std::weak_ptr<ClientConnection> weak = shared_from_this();
+    upload_->onDrained([weak]() {
+        std::shared_ptr<ClientConnection> conn = weak.lock();
+        if (conn && conn->state_ != CLOSED) {
+            conn->updateEvents();
+        }
+    });
+    dispatchRequest();
+}
+
+void ClientConnection::feedUpload(const char* data, size_t len) {
+    size_t consumed = parser_.feed(data, len);
+    std::string body = parser_.takeBody();
+    upload_->append(body.data(), body.size());
+    if (parser_.failed()) {
+        // What follows cannot be framed; the response ends the connection
+        log_("Rejecting request body (" + std::to_string(parser_.errorStatus()) + ")");
+        requestKeepAlive_ = false;
+        keepAlive_ = false;
+        upload_->fail(parser_.errorStatus());
+    } else if (parser_.complete()) {
+        input_.append(data + consumed, len - consumed);
+        upload_->finish();
+    }
+}
+
+void ClientConnection::readBufferedInput() {
+    state_ = READING_REQUEST;
+    std::string pending;
+    pending.swap(input_);
+    if (takeRequest(pending.data(), pending.size())) {
+        return;
+    }
+    updateEvents();
+    armIdleTimer();
+}
+
+std::string ClientConnection::takeBufferedInput() {
+    std::string input;
+    input.swap(input_);
+    return input;
+}
+
+void ClientConnection::send(const std::string& data) {
+    if (state_ == CLOSED) {
+        return;
+    }
+    queueOutput(data.data(), data.size());
+    pump();
+}
+
+void ClientConnection::queueOutput(const char* data, size_t len) {
+    if (headSent_) {
+        output_.append(data, len);
+        return;
+    }
+
+    // The head is held back until it is complete, so that its connection
+    // fields can be set for this client
+    size_t searchFrom = responseHead_.size() >= 3 ? responseHead_.size() - 3 : 0;
+    responseHead_.append(data, len);
+    size_t end = responseHead_.find("\r\n\r\n", searchFrom);
+    if (end == std::string::npos) {
+        if (responseHead_.size() > kMaxResponseHead) {
+            output_.append(responseHead_);
+            responseHead_.clear();
+            headSent_ = true;
+            keepAlive_ = false;
+        }
+        return;
+    }
+    std::string head = responseHead_.substr(0, end + 4);
+    std::string rest = responseHead_.substr(end + 4);
+    responseHead_.clear();
+
+    // An interim response (100 Continue) is followed by the final one
+    int status = statusOf(head);
+    if (status < 100 || status >= 200) {
+        keepAlive_ = frameResponseHead(head, headRequest_, requestKeepAlive_);
+        headSent_ = true;
+    }
+    output_.append(head);
+    if (!rest.empty()) {
+        queueOutput(rest.data(), rest.size());
+    }
+}
+
+void ClientConnection::sendFile(int fileFd, uint64_t offset, uint64_t length) {
+    if (state_ == CLOSED || fileFd_ >= 0) {
+        ::close(fileFd);
+        return;
+    }
+    fileFd_ = fileFd;
+    fileOffset_ = offset;
+    fileRemaining_ = length;
+    pump();
+}
+
+bool ClientConnection::sendFromFile() {
+    if (fileFd_ < 0 || pendingOutput() > 0) {
+        return false;
+    }
+    if (fileRemaining_ == 0) {
+        closeFile();
+        return true;
+    }
+    off_t offset = static_cast<off_t>(fileOffset_);
+    ssize_t n = sendfile(fd_, fileFd_, &offset, std::min<uint64_t>(fileRemaining_, kFileSendChunk));
+    if (n > 0) {
+        fileOffset_ += n;
+        fileRemaining_ -= n;
+        armIdleTimer();
+        return true;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return false;
+    }
+    // The file ended early or could not be read: the length promised to
+    // the client cannot be delivered
+    log_(n == 0 ? "Cached file ended before the response was complete"
+                : "Failed to send cached file to client");
+    close();
+    return false;
+}
+
+void ClientConnection::closeFile() {
+    if (fileFd_ >= 0) {
+        ::close(fileFd_);
+        fileFd_ = -1;
+    }
+    fileRemaining_ = 0;
+}
+
+void ClientConnection::finish() {
+    finishing_ = true;
+    pump();
+}
+
+void ClientConnection::streamFrom(const std::shared_ptr<InFlightFetch>& fetch, int stallTimeoutMs,
+                                  const std::function<void()>& onStall,
+                                  const std::function<bool(const std::string&)>& acceptHead) {
+    if (state_ == CLOSED) {
+        fetch->leave(0);
+        return;
+    }
+    endStream();
+    stream_ = fetch;
+    streamOffset_ = 0;
+    streamFallback_ = onStall;
+    acceptHead_ = onStall ? acceptHead : std::function<bool(const std::string&)>();
+
+    // Progress notifications arrive on the producer's thread and are
+    // handed over to this connection's reactor, at most one at a time
+    std::weak_ptr<ClientConnection> weak = shared_from_this();
+    Reactor* reactor = &reactor_;
+    fetch->subscribe([weak, reactor]() {
+        std::shared_ptr<ClientConnection> conn = weak.lock();
+        if (!conn || conn->pullScheduled_.exchange(true)) {
+            return;
+        }
+        reactor->post([weak]() {
+            std::shared_ptr<ClientConnection> conn = weak.lock();
+            if (conn) {
+                conn->pullScheduled_ = false;
+                conn->pump();
+            }
+        });
+    });
+
+    if (stallTimeoutMs > 0 && onStall) {
+        InFlightFetch* watched = fetch.get();
+        stallTimer_ = reactor_.runAfter(stallTimeoutMs, [weak, watched, onStall]() {
+            std::shared_ptr<ClientConnection> conn = weak.lock();
+            if (!conn) {
+                return;
+            }
+            conn->stallTimer_ = 0;
+            if (conn->stream_.get() == watched && conn->streamOffset_ == 0) {
+                conn->endStream();
+                onStall();
+            }
+        });
+    }
+
+    pump();
+}
+
+void ClientConnection::endStream() {
+    if (stream_) {
+        stream_->leave(streamOffset_);
+        stream_.reset();
+    }
+}
+
+bool ClientConnection::pullStream() {
+    if (!stream_ || pendingOutput() >= kStreamWindow) {
+        return false;
+    }
+
+    std::string chunk;
+    switch (stream_->read(streamOffset_, chunk, kStreamWindow)) {
+    case InFlightFetch::DATA:
+        if (streamOffset_ == 0 && stallTimer_ != 0) {
+            reactor_.cancelTimer(stallTimer_);
+            stallTimer_ = 0;
+        }
+        if (streamOffset_ == 0 && acceptHead_) {
+            std::function<bool(const std::string&)> accept;
+            accept.swap(acceptHead_);
+            if (!accept(chunk)) {
+                // Nothing was sent yet, so the caller can still serve it
+                std::function<void()> fallback;
+                fallback.swap(streamFallback_);
+                streamOffset_ = chunk.size();
+                endStream();
+                fallback();
+                return true;
+            }
+        }
+        streamOffset_ += chunk.size();
+        queueOutput(chunk.data(), chunk.size());
+        return true;
+    case InFlightFetch::DONE:
+        endStream();
+        finishing_ = true;
+        return true;
+    case InFlightFetch::FAILED:
+        // Part of the response may have been relayed already, so the
+        // connection can only be closed
+        log_("In-flight fetch did not complete, closing connection");
+        endStream();
+        keepAlive_ = false;
+        finishing_ = true;
+        return true;
+    case InFlightFetch::HANDED_OFF:
+        hasTail_ = stream_->takeRelayTail(tail_);
+        endStream();
+        finishing_ = true;
+        return true;
+    default:
+        return false;
+    }
+}
+
+void ClientConnection::pump() {
+    bool progress = true;
+    while (progress && state_ != CLOSED) {
+        progress = pullStream();
+        if (finishing_ && !stream_ && !responseHead_.empty()) {
+            // The response ended inside its head; it goes out as it is
+            output_.append(responseHead_);
+            responseHead_.clear();
+            headSent_ = true;
+            keepAlive_ = false;
+        }
+
+        if (pendingOutput() > 0) {
+            ssize_t n = ::send(fd_, output_.data() + outputOffset_, pendingOutput(), MSG_NOSIGNAL);
+            if (n > 0) {
+                outputOffset_ += n;
+                progress = true;
+                armIdleTimer();
+            } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_("Client disconnected during response");
+                close();
+                return;
+            }
+        }
+
+        if (outputOffset_ == output_.size()) {
+            output_.clear();
+            outputOffset_ = 0;
+        } else if (outputOffset_ > kStreamWindow) {
+            output_.erase(0, outputOffset_);
+            outputOffset_ = 0;
+        }
+
+        if (state_ != CLOSED && sendFromFile()) {
+            progress = true;
+        }
+    }
+
+    if (state_ == CLOSED) {
+        return;
+    }
+    if (hasTail_ && pendingOutput() == 0) {
+        startRelay();
+        return;
+    }
+    if (finishing_ && !stream_ && !hasTail_ && fileFd_ < 0 && pendingOutput() == 0) {
+        log_("Response sent to client");
+        endResponse();
+        return;
+    }
+    if (pendingOutput() == 0 && fileFd_ < 0 && state_ == PROCESSING && !uploading() && idleTimer_ != 0) {
+        reactor_.cancelTimer(idleTimer_);
+        idleTimer_ = 0;
+    }
+    updateEvents();
+}
+
+void ClientConnection::startRelay() {
+    hasTail_ = false;
+    relay_.reset(new SpliceRelay(tail_.sourceFd, fd_, tail_.remaining));
+
+    std::weak_ptr<ClientConnection> weak = shared_from_this();
+    sourceEvents_ = EPOLLIN;
+    reactor_.add(tail_.sourceFd, sourceEvents_, std::make_shared<FunctionEventHandler>([weak](uint32_t) {
+        std::shared_ptr<ClientConnection> conn = weak.lock();
+        if (conn && conn->relay_) {
+            conn->pumpRelay();
+        }
+    }));
+    armIdleTimer();
+    pumpRelay();
+}
+
+void ClientConnection::pumpRelay() {
+    uint64_t before = relay_->bytesRelayed();
+    SpliceRelay::Status status = relay_->pump();
+    if (relay_->bytesRelayed() != before) {
+        armIdleTimer();
+    }
+
+    // Only the side the relay is blocked on is watched
+    uint32_t sourceEvents = 0;
+    switch (status) {
+    case SpliceRelay::WANT_READ:
+        sourceEvents = EPOLLIN;
+        relayWantsWrite_ = false;
+        break;
+    case SpliceRelay::WANT_WRITE:
+        relayWantsWrite_ = true;
+        break;
+    case SpliceRelay::FINISHED:
+        endRelay(true);
+        return;
+    case SpliceRelay::SOURCE_CLOSED:
+        endRelay(tail_.remaining == SpliceRelay::kUnlimited);
+        return;
+    case SpliceRelay::FAILED:
+        endRelay(false);
+        return;
+    }
+    if (sourceEvents != sourceEvents_) {
+        sourceEvents_ = sourceEvents;
+        reactor_.modify(tail_.sourceFd, sourceEvents_);
+    }
+    updateEvents();
+}
+
+void ClientConnection::endRelay(bool complete) {
+    reactor_.remove(tail_.sourceFd);
+    std::unique_ptr<SpliceRelay> relay(relay_.release());
+    RelayTail tail = tail_;
+    tail_ = RelayTail();
+    relayWantsWrite_ = false;
+
+    // The tail's owner pools or closes the origin socket
+    if (tail.done) {
+        tail.done(*relay, complete);
+    } else {
+        ::close(tail.sourceFd);
+    }
+    log_(complete ? "Response sent to client" : "Relay ended before the response was complete");
+    if (complete && state_ != CLOSED) {
+        endResponse();
+    } else {
+        close();
+    }
+}
+
+void ClientConnection::endResponse() {
+    // A response that came before the whole body leaves the rest unread
+    if (!keepAlive_ || (upload_ && !upload_->complete())) {
+        close();
+        return;
+    }
+    finishing_ = false;
+    headSent_ = false;
+    keepAlive_ = false;
+    continueSent_ = false;
+    upload_.reset();
+    if (stallTimer_ != 0) {
+        reactor_.cancelTimer(stallTimer_);
+        stallTimer_ = 0;
+    }
+    parser_.reset();
+
+    if (!input_.empty()) {
+        // Pipelined requests are taken one per turn of the loop, so that a
+        // run of cache hits does not recurse
+        std::weak_ptr<ClientConnection> weak = shared_from_this();
+        reactor_.post([weak]() {
+            std::shared_ptr<ClientConnection> conn = weak.lock();
+            if (conn && conn->state_ == PROCESSING) {
+                conn->readBufferedInput();
+            }
+        });
+        return;
+    }
+    state_ = READING_REQUEST;
+    waitingForRequest_ = true;
+    updateEvents();
+    armIdleTimer();
+}
+
+void ClientConnection::updateEvents() {
+    uint32_t events = 0;
+    if (state_ == READING_REQUEST || (uploading() && !upload_->full())) {
+        events |= EPOLLIN;
+    }
+    if (pendingOutput() > 0 || fileFd_ >= 0 || relayWantsWrite_) {
+        events |= EPOLLOUT;
+    }
+    if (awaitingResponse()) {
+        events |= EPOLLRDHUP;
+    }
+    if (events != events_) {
+        events_ = events;
+        reactor_.modify(fd_, events_);
+    }
+}
+
+void ClientConnection::armIdleTimer() {
+    if (idleTimer_ != 0) {
+        reactor_.cancelTimer(idleTimer_);
+        idleTimer_ = 0;
+    }
+    int timeoutMs = waitingForRequest_ ? keepAliveTimeoutMs_ : idleTimeoutMs_;
+    if (timeoutMs <= 0) {
+        return;
+    }
+    std::weak_ptr<ClientConnection> weak = shared_from_this();
+    idleTimer_ = reactor_.runAfter(timeoutMs, [weak]() {
+        std::shared_ptr<ClientConnection> conn = weak.lock();
+        if (conn) {
+            conn->idleTimer_ = 0;
+            conn->log_(conn->waitingForRequest_ ? "Keep-alive client connection idle, closing"
+                                                : "Client connection idle timeout");
+            conn->close();
+        }
+    });
+}
+
+int ClientConnection::releaseSocket() {
+    int fd = fd_;
+    reactor_.remove(fd_);
+    fd_ = -1;
+    close();
+    return fd;
+}
+
+void ClientConnection::close() {
+    if (state_ == CLOSED) {
+        return;
+    }
+    state_ = CLOSED;
+    if (uploading()) {
+        // The origin must not take a truncated body for a complete one
+        upload_->fail(0);
+    }
+    if (idleTimer_ != 0) {
+        reactor_.cancelTimer(idleTimer_);
+        idleTimer_ = 0;
+    }
+    if (stallTimer_ != 0) {
+        reactor_.cancelTimer(stallTimer_);
+        stallTimer_ = 0;
+    }
+    endStream();
+    streamFallback_ = std::function<void()>();
+    acceptHead_ = std::function<bool(const std::string&)>();
+    closeFile();
+    if (relay_) {
+        endRelay(false);
+    } else if (hasTail_) {
+        hasTail_ = false;
+        ::close(tail_.sourceFd);
+    }
+    if (fd_ >= 0) {
+        reactor_.remove(fd_);
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
@@ -0,0 +1,162 @@
+#ifndef CLIENT_CONNECTION_HPP
+#define CLIENT_CONNECTION_HPP
+
+#include <string>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "reactor.hpp"
+#include "request_coalescer.hpp"
+#include "splice_relay.hpp"
+#include "http_message.hpp"
+#include "upload_stream.hpp"
+
+// Non-blocking client side of a proxied exchange: feeds received bytes to
+// an HttpRequestParser until a request is complete (or rejected), then
+// writes a response that is either queued as a whole or relayed from an
+// InFlightFetch at the client's own pace. If the fetch hands off its
+// relay tail, the rest of the body is moved from the origin socket with a
+// SpliceRelay once the buffered part is written. The connection is
+// idle-timed out while it waits for request bytes or for the client to
+// accept response bytes; while the response is being produced the
+// upstream timeouts apply instead. A client that closes the connection
+// before any of the response exists is dropped at once, so that the work
+// done for it can be released.
+//
+// Connections are persistent: the head of each response is rewritten with
+// Connection: keep-alive if the client allows it and the body is framed
+// by its length or chunked, and once the response is out the next request
+// is read, starting with any pipelined bytes already received. Between
+// requests the shorter keep-alive timeout applies.
+//
+// A request whose body is chunked or larger than kMaxBufferedBody is
+// handed over as soon as its head is complete, with an UploadStream that
+// receives the body while the connection goes on reading it; reading
+// pauses whenever the stream is full. Expect: 100-continue is answered
+// by the connection itself once the head is in.
+class ClientConnection : public EventHandler, public std::enable_shared_from_this<ClientConnection> {
+public:
+    // Receives the parser holding a complete or failed request
+    typedef std::function<void(const std::shared_ptr<ClientConnection>&, HttpRequestParser&)> RequestCallback;
+    typedef std::function<void(const std::string&)> Logger;
+
+    // Request bodies up to this size are received whole before the request is handed over
+    static const uint64_t kMaxBufferedBody = 64 * 1024;
+
+    // `maxRequests` limits the requests served on the connection and
+    // `maxBodyBytes` the size of a request body, 0 = unlimited
+    ClientConnection(Reactor& reactor, int fd, int idleTimeoutMs, int keepAliveTimeoutMs,
+                     size_t maxRequests, uint64_t maxBodyBytes, const RequestCallback& onRequest,
+                     const Logger& log);
+    ~ClientConnection();
+
+    // Registers with the reactor; must be called on its thread.
+    void start();
+
+    // Bytes received after the end of the request, e.g. the start of a
+    // tunnelled stream.
+    std::string takeBufferedInput();
+
+    // Queues response bytes. The head's connection fields are set for this
+    // client with frameResponseHead, so callers need not add their own.
+    void send(const std::string& data);
+    // Sends `length` bytes of a file from `offset` after the queued bytes,
+    // with sendfile; the connection takes ownership of `fileFd`.
+    void sendFile(int fileFd, uint64_t offset, uint64_t length);
+    // Ends the response once all queued bytes are written: the connection
+    // then waits for the next request if it is kept alive, or closes.
+    void finish();
+    // Relays the bytes of a shared fetch and finishes when it completes.
+    // If nothing arrives within `stallTimeoutMs`, or `acceptHead` rejects
+    // the first bytes (the response head), `onStall` is called instead and
+    // the connection is left for the caller to serve.
+    void streamFrom(const std::shared_ptr<InFlightFetch>& fetch, int stallTimeoutMs = 0,
+                    const std::function<void()>& onStall = std::function<void()>(),
+                    const std::function<bool(const std::string&)>& acceptHead =
+                        std::function<bool(const std::string&)>());
+    void close();
+    // Gives up the socket without closing it, e.g. to a Tunnel; pending
+    // output is dropped.
+    int releaseSocket();
+
+    Reactor& reactor() { return reactor_; }
+    bool closed() const { return state_ == CLOSED; }
+    // Requests received so far, including the one being answered
+    size_t requestCount() const { return requests_; }
+    // The body of the current request if it is being streamed, else null
+    const std::shared_ptr<UploadStream>& upload() const { return upload_; }
+
+    void onEvent(uint32_t events) override;
+
+private:
+    enum State { READING_REQUEST, PROCESSING, CLOSED };
+
+    Reactor& reactor_;
+    int fd_;
+    int idleTimeoutMs_;
+    int keepAliveTimeoutMs_;
+    size_t maxRequests_;
+    RequestCallback onRequest_;
+    Logger log_;
+    State state_;
+    HttpRequestParser parser_;
+    std::string input_;             // received past the end of the current request
+    size_t requests_;
+    bool waitingForRequest_;        // kept alive, nothing of the next request yet
+    bool requestKeepAlive_;         // the client allows another request
+    bool headRequest_;
+    std::string responseHead_;      // response head bytes until it is complete
+    bool headSent_;
+    bool keepAlive_;                // the response being sent keeps the connection
+    bool continueSent_;             // 100 Continue went out for the current request
+    std::shared_ptr<UploadStream> upload_;
+    std::string output_;
+    size_t outputOffset_;
+    int fileFd_;
+    uint64_t fileOffset_;
+    uint64_t fileRemaining_;
+    bool finishing_;
+    std::shared_ptr<InFlightFetch> stream_;
+    size_t streamOffset_;
+    std::function<void()> streamFallback_;
+    std::function<bool(const std::string&)> acceptHead_;
+    std::atomic<bool> pullScheduled_;
+    TimerWheel::TimerId idleTimer_;
+    TimerWheel::TimerId stallTimer_;
+    uint32_t events_;
+    RelayTail tail_;
+    bool hasTail_;
+    std::unique_ptr<SpliceRelay> relay_;
+    uint32_t sourceEvents_;
+    bool relayWantsWrite_;
+
+    void readInput();
+    bool takeRequest(const char* data, size_t len);
+    void dispatchRequest();
+    void startUpload();
+    void feedUpload(const char* data, size_t len);
+    bool uploading() const { return upload_ && !upload_->complete() && !upload_->failed(); }
+    // The request is in and nothing of its response has been queued
+    bool awaitingResponse() const {
+        return state_ == PROCESSING && !uploading() && !headSent_ && responseHead_.empty() && !relay_;
+    }
+    void readBufferedInput();
+    void queueOutput(const char* data, size_t len);
+    void endResponse();
+    void pump();
+    bool pullStream();
+    // Stops reading the stream, so that its consumed bytes can be dropped
+    void endStream();
+    bool sendFromFile();
+    void closeFile();
+    void startRelay();
+    void pumpRelay();
+    void endRelay(bool complete);
+    void updateEvents();
+    void armIdleTimer();
+    size_t pendingOutput() const { return output_.size() - outputOffset_; }
+};
+
+#endif // CLIENT_CONNECTION_HPP
@@ -0,0 +1,401 @@
+#include "dns_cache.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <sys/stat.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <resolv.h>
+
+namespace {
+
+struct DnsAnswer {
+    std::vector<ResolvedAddress> addresses;
+    long ttl;           // smallest TTL of the answer records
+    long negativeTtl;   // from the SOA record of a negative answer
+
+    DnsAnswer() : ttl(-1), negativeTtl(-1) {}
+};
+
+bool parseLiteral(const std::string& host, ResolvedAddress& out) {
+    std::memset(&out, 0, sizeof(out));
+    sockaddr_in* v4 = reinterpret_cast<sockaddr_in*>(&out.addr);
+    if (inet_pton(AF_INET, host.c_str(), &v4->sin_addr) == 1) {
+        v4->sin_family = AF_INET;
+        out.length = sizeof(sockaddr_in);
+        return true;
+    }
+    std::string bare = host;
+    if (bare.size() > 2 && bare[0] == '[' && bare[bare.size() - 1] == ']') {
+        bare = bare.substr(1, bare.size() - 2);
+    }
+    sockaddr_in6* v6 = reinterpret_cast<sockaddr_in6*>(&out.addr);
+    if (inet_pton(AF_INET6, bare.c_str(), &v6->sin6_addr) == 1) {
+        v6->sin6_family = AF_INET6;
+        out.length = sizeof(sockaddr_in6);
+        return true;
+    }
+    return false;
+}
+
+std::string lowerName(const std::string& name) {
+    std::string lower = name;
+    for (size_t i = 0; i < lower.size(); ++i) {
+        lower[i] = static_cast<char>(std::tolower(static_cast<unsigned char>(lower[i])));
+    }
+    return lower;
+}
+
+// Addresses of every name in the hosts file, in the order of its lines
+std::map<std::string, std::vector<ResolvedAddress>> parseHostsFile(const char* path) {
+    std::map<std::string, std::vector<ResolvedAddress>> byName;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.resize(comment);
+        }
+        std::istringstream fields(line);
+        std::string literal;
+        std::string name;
+        ResolvedAddress address;
+        if (!(fields >> literal) || !parseLiteral(literal, address)) {
+            continue;
+        }
+        std::set<std::string> names;
+        while (fields >> name) {
+            // A name repeated on one line still gives its address once
+            std::string lower = lowerName(name);
+            if (names.insert(lower).second) {
+                byName[lower].push_back(address);
+            }
+        }
+    }
+    return byName;
+}
+
+// Resolver state of the calling thread; res_n* calls are not safe to
+// share one state between threads
+res_state threadResolverState() {
+    static thread_local struct __res_state state;
+    static thread_local bool initialized = false;
+    if (!initialized) {
+        std::memset(&state, 0, sizeof(state));
+        if (res_ninit(&state) != 0) {
+            return nullptr;
+        }
+        initialized = true;
+    }
+    return &state;
+}
+
+// Sends one query and collects the addresses of the requested type with
+// their TTL, or the negative caching TTL of an answer without them
+void queryDns(res_state state, const std::string& host, int type, DnsAnswer& result) {
+    unsigned char query[NS_PACKETSZ];
+    unsigned char answer[4096];
+    int queryLength = res_nmkquery(state, ns_o_query, host.c_str(), ns_c_in, type,
+                                   nullptr, 0, nullptr, query, sizeof(query));
+    if (queryLength < 0) {
+        return;
+    }
+    int length = res_nsend(state, query, queryLength, answer, sizeof(answer));
+    if (length < 0) {
+        return;
+    }
+
+    ns_msg message;
+    if (ns_initparse(answer, length, &message) < 0) {
+        return;
+    }
+
+    size_t found = 0;
+    for (int i = 0; i < ns_msg_count(message, ns_s_an); ++i) {
+        ns_rr rr;
+        if (ns_parserr(&message, ns_s_an, i, &rr) < 0) {
+            break;
+        }
+        // CNAME records on the way count towards the TTL as well
+        long ttl = static_cast<long>(ns_rr_ttl(rr));
+        result.ttl = result.ttl < 0 ? ttl : std::min(result.ttl, ttl);
+
+        if (ns_rr_type(rr) != type) {
+            continue;
+        }
+        ResolvedAddress address;
+        std::memset(&address, 0, sizeof(address));
+        if (type == ns_t_a && ns_rr_rdlen(rr) == 4) {
+            sockaddr_in* v4 = reinterpret_cast<sockaddr_in*>(&address.addr);
+            v4->sin_family = AF_INET;
+            std::memcpy(&v4->sin_addr, ns_rr_rdata(rr), 4);
+            address.length = sizeof(sockaddr_in);
+        } else if (type == ns_t_aaaa && ns_rr_rdlen(rr) == 16) {
+            sockaddr_in6* v6 = reinterpret_cast<sockaddr_in6*>(&address.addr);
+            v6->sin6_family = AF_INET6;
+            std::memcpy(&v6->sin6_addr, ns_rr_rdata(rr), 16);
+            address.length = sizeof(sockaddr_in6);
+        } else {
+            continue;
+        }
+        result.addresses.push_back(address);
+        found++;
+    }
+
+    if (found > 0) {
+        return;
+    }
+    // RFC 2308: a negative answer is cached for min(SOA TTL, SOA minimum)
+    for (int i = 0; i < ns_msg_count(message, ns_s_ns); ++i) {
+        ns_rr rr;
+        if (ns_parserr(&message, ns_s_ns, i, &rr) < 0) {
+            break;
+        }
+        if (ns_rr_type(rr) == ns_t_soa && ns_rr_rdlen(rr) >= 4) {
+            long minimum = static_cast<long>(ns_get32(ns_rr_rdata(rr) + ns_rr_rdlen(rr) - 4));
+            long negativeTtl = std::min(static_cast<long>(ns_rr_ttl(rr)), minimum);
+            result.negativeTtl = result.negativeTtl < 0 ? negativeTtl
+                                                        : std::min(result.negativeTtl, negativeTtl);
+        }
+    }
+}
+
+} // namespace
+
+DnsCache::DnsCache(WorkerPool& workers, const DnsCacheConfig& config)
+    : workers_(workers), config_(config), hits_(0), misses_(0), negativeHits_(0), refreshes_(0),
+      hostsLoaded_(false), hostsMtime_(0), hostsSize_(0), hostsInode_(0) {}
+
+void DnsCache::resolve(const std::string& host, Reactor& reactor, const Callback& callback) {
+    ResolvedAddress literal;
+    if (parseLiteral(host, literal)) {
+        callback(std::vector<ResolvedAddress>(1, literal));
+        return;
+    }
+
+    time_t now = std::time(nullptr);
+    std::unique_lock<std::mutex> lock(mutex_);
+    Entry& entry = entries_[host];
+
+    if (entry.resolved && now < entry.expiresAt) {
+        std::vector<ResolvedAddress> addresses = entry.addresses;
+        if (addresses.empty()) {
+            negativeHits_++;
+        } else {
+            hits_++;
+        }
+        // Names still in use are looked up again before they expire
+        bool refresh = !addresses.empty() && now >= entry.refreshAt && !entry.lookingUp;
+        if (refresh) {
+            entry.lookingUp = true;
+            refreshes_++;
+        }
+        lock.unlock();
+
+        if (refresh) {
+            startLookup(host);
+        }
+        callback(addresses);
+        return;
+    }
+
+    misses_++;
+    Waiter waiter;
+    waiter.reactor = &reactor;
+    waiter.callback = callback;
+    entry.waiters.push_back(waiter);
+    bool start = !entry.lookingUp;
+    entry.lookingUp = true;
+    if (entries_.size() > config_.maxEntries) {
+        trimEntries(now);
+    }
+    lock.unlock();
+
+    if (start) {
+        startLookup(host);
+    }
+}
+
+void DnsCache::startLookup(const std::string& host) {
+    workers_.submit([this, host]() {
+        finishLookup(host, lookup(host));
+    });
+}
+
+void DnsCache::finishLookup(const std::string& host, const LookupResult& result) {
+    time_t now = std::time(nullptr);
+    long ttl = std::max<long>(config_.minTtl, std::min<long>(result.ttl, config_.maxTtl));
+
+    std::vector<Waiter> waiters;
+    std::vector<ResolvedAddress> addresses;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Entry& entry = entries_[host];
+        if (result.addresses.empty() && !entry.addresses.empty() && now < entry.expiresAt) {
+            // A failed refresh keeps the addresses until they expire; the
+            // next refresh is tried no sooner than a negative entry would be
+            entry.refreshAt = std::min<time_t>(entry.expiresAt, now + ttl);
+        } else {
+            entry.addresses = result.addresses;
+            entry.expiresAt = now + ttl;
+            entry.refreshAt = now + ttl * 3 / 4;
+        }
+        entry.resolved = true;
+        entry.lookingUp = false;
+        waiters.swap(entry.waiters);
+        addresses = entry.addresses;
+    }
+
+    for (size_t i = 0; i < waiters.size(); ++i) {
+        Callback callback = waiters[i].callback;
+        waiters[i].reactor->post([callback, addresses]() {
+            callback(addresses);
+        });
+    }
+}
+
+void DnsCache::trimEntries(time_t now) {
+    // Expired entries first, then arbitrary ones down to 90% of the limit.
+    // Entries with a lookup in progress have waiters and are kept.
+    std::map<std::string, Entry>::iterator it = entries_.begin();
+    while (it != entries_.end()) {
+        if (!it->second.lookingUp && it->second.expiresAt <= now) {
+            entries_.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+    size_t target = config_.maxEntries * 9 / 10;
+    it = entries_.begin();
+    while (entries_.size() > target && it != entries_.end()) {
+        if (!it->second.lookingUp) {
+            entries_.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Addresses the hosts file gives for `host`. The file is parsed again
+// only after it changes, so a lookup costs one stat() call.
+std::vector<ResolvedAddress> DnsCache::hostsFileAddresses(const std::string& host) const {
+    static const char* const kHostsPath = "/etc/hosts";
+    struct stat info;
+    bool present = ::stat(kHostsPath, &info) == 0;
+
+    std::lock_guard<std::mutex> lock(hostsMutex_);
+    if (!present) {
+        hostsByName_.clear();
+        hostsLoaded_ = false;
+    } else if (!hostsLoaded_ || info.st_mtime != hostsMtime_ || info.st_size != hostsSize_ ||
+               info.st_ino != hostsInode_) {
+        hostsByName_ = parseHostsFile(kHostsPath);
+        hostsLoaded_ = true;
+        hostsMtime_ = info.st_mtime;
+        hostsSize_ = info.st_size;
+        hostsInode_ = info.st_ino;
+    }
+    std::map<std::string, std::vector<ResolvedAddress>>::const_iterator it =
+        hostsByName_.find(lowerName(host));
+    return it == hostsByName_.end() ? std::vector<ResolvedAddress>() : it->second;
+}
+
+DnsCache::LookupResult DnsCache::lookup(const std::string& host) const {
+    LookupResult result;
+
+    // The hosts file comes first, as with the usual "files dns" order in
+    // nsswitch.conf; its entries have no TTL
+    result.addresses = hostsFileAddresses(host);
+    if (!result.addresses.empty()) {
+        result.ttl = config_.defaultTtl;
+        return result;
+    }
+
+    // Asking DNS directly gives the TTLs that getaddrinfo does not report
+    DnsAnswer v6;
+    DnsAnswer v4;
+    res_state state = threadResolverState();
+    if (state) {
+        queryDns(state, host, ns_t_aaaa, v6);
+        queryDns(state, host, ns_t_a, v4);
+    }
+
+    if (!v6.addresses.empty() || !v4.addresses.empty()) {
+        // Alternate the families so that a broken one costs one attempt
+        size_t count = std::max(v6.addresses.size(), v4.addresses.size());
+        for (size_t i = 0; i < count; ++i) {
+            if (i < v6.addresses.size()) {
+                result.addresses.push_back(v6.addresses[i]);
+            }
+            if (i < v4.addresses.size()) {
+                result.addresses.push_back(v4.addresses[i]);
+            }
+        }
+        long ttl = -1;
+        if (!v6.addresses.empty()) {
+            ttl = v6.ttl;
+        }
+        if (!v4.addresses.empty()) {
+            ttl = ttl < 0 ? v4.ttl : std::min(ttl, v4.ttl);
+        }
+        result.ttl = ttl;
+        return result;
+    }
+
+    // Not in DNS: the system resolver may know other sources (NIS, mDNS),
+    // which have no TTL either
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+    addrinfo* list = nullptr;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &list) == 0) {
+        for (addrinfo* ai = list; ai; ai = ai->ai_next) {
+            ResolvedAddress address;
+            std::memset(&address, 0, sizeof(address));
+            std::memcpy(&address.addr, ai->ai_addr, ai->ai_addrlen);
+            address.length = ai->ai_addrlen;
+            result.addresses.push_back(address);
+        }
+        freeaddrinfo(list);
+    }
+    if (!result.addresses.empty()) {
+        result.ttl = config_.defaultTtl;
+        return result;
+    }
+
+    long negativeTtl = std::max(v6.negativeTtl, v4.negativeTtl);
+    result.ttl = negativeTtl >= 0 ? negativeTtl : config_.negativeTtl;
+    return result;
+}
+
+size_t DnsCache::hits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hits_;
+}
+
+size_t DnsCache::misses() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return misses_;
+}
+
+size_t DnsCache::negativeHits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return negativeHits_;
+}
+
+size_t DnsCache::refreshes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return refreshes_;
+}
+
+size_t DnsCache::entryCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
@@ -0,0 +1,107 @@
+#ifndef DNS_CACHE_HPP
+#define DNS_CACHE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+#include <ctime>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include "reactor.hpp"
+#include "worker_pool.hpp"
+
+struct DnsCacheConfig {
+    int defaultTtl;         // seconds, for answers without a TTL (hosts file)
+    int negativeTtl;        // seconds, for failures without an SOA record
+    int minTtl;             // TTLs are raised to at least this
+    int maxTtl;             // and capped at this
+    size_t maxEntries;
+
+    DnsCacheConfig() : defaultTtl(60), negativeTtl(30), minTtl(1), maxTtl(3600),
+                       maxEntries(10000) {}
+};
+
+struct ResolvedAddress {
+    sockaddr_storage addr;
+    socklen_t length;
+};
+
+// Thread-safe cache of host name lookups for upstream connections.
+// Answers are kept for their DNS TTL (the smallest TTL of the records
+// used) and failures for the SOA minimum (RFC 2308). Lookups never run on
+// the caller's thread: they go to the worker pool and the result is posted
+// back to the caller's reactor, with concurrent lookups of one name
+// sharing a single query. An entry that is used during the last quarter of
+// its lifetime is refreshed in the background before it expires.
+// Both IPv6 and IPv4 addresses are returned, alternating families.
+class DnsCache {
+public:
+    // Receives the addresses of the host; empty if it could not be resolved
+    typedef std::function<void(const std::vector<ResolvedAddress>&)> Callback;
+
+    DnsCache(WorkerPool& workers, const DnsCacheConfig& config = DnsCacheConfig());
+
+    DnsCache(const DnsCache&) = delete;
+    DnsCache& operator=(const DnsCache&) = delete;
+
+    // Calls back at once on a cache hit, otherwise on `reactor`'s thread.
+    void resolve(const std::string& host, Reactor& reactor, const Callback& callback);
+
+    size_t hits() const;
+    size_t misses() const;
+    size_t negativeHits() const;
+    size_t refreshes() const;
+    size_t entryCount() const;
+
+private:
+    struct Waiter {
+        Reactor* reactor;
+        Callback callback;
+    };
+
+    struct Entry {
+        std::vector<ResolvedAddress> addresses;   // empty = negative entry
+        time_t expiresAt;
+        time_t refreshAt;
+        bool resolved;
+        bool lookingUp;
+        std::vector<Waiter> waiters;
+
+        Entry() : expiresAt(0), refreshAt(0), resolved(false), lookingUp(false) {}
+    };
+
+    struct LookupResult {
+        std::vector<ResolvedAddress> addresses;
+        long ttl;
+    };
+
+    WorkerPool& workers_;
+    DnsCacheConfig config_;
+    mutable std::mutex mutex_;
+    std::map<std::string, Entry> entries_;
+    size_t hits_;
+    size_t misses_;
+    size_t negativeHits_;
+    size_t refreshes_;
+
+    // /etc/hosts as last read, by lower-case name; reloaded when the
+    // file's modification time, size or inode changes
+    mutable std::mutex hostsMutex_;
+    mutable std::map<std::string, std::vector<ResolvedAddress>> hostsByName_;
+    mutable bool hostsLoaded_;
+    mutable time_t hostsMtime_;
+    mutable off_t hostsSize_;
+    mutable ino_t hostsInode_;
+
+    void startLookup(const std::string& host);
+    void finishLookup(const std::string& host, const LookupResult& result);
+    void trimEntries(time_t now);
+    LookupResult lookup(const std::string& host) const;
+    std::vector<ResolvedAddress> hostsFileAddresses(const std::string& host) const;
+};
+
+#endif // DNS_CACHE_HPP
@@ -0,0 +1,196 @@
+#include "hot_cache.hpp"
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+namespace {
+
+const char kHotSetMagic[8] = {'P', 'X', 'Y', 'H', 'O', 'T', 'S', '1'};
+
+#pragma pack(push, 1)
+struct HotSetHeader {
+    char magic[8];
+    uint64_t count;
+};
+
+struct HotSetRecord {
+    uint64_t keyHash;
+    uint32_t hits;
+};
+#pragma pack(pop)
+
+} // namespace
+
+HotObjectCache::HotObjectCache(uint64_t maxBytes, uint64_t maxObjectBytes)
+    : maxBytes_(maxBytes), maxObjectBytes_(std::min(maxObjectBytes, maxBytes)), bytes_(0) {}
+
+uint64_t HotObjectCache::sizeOf(const HotObject& object) {
+    return object.response.size() + object.key.size() + object.etag.size() +
+           object.lastModified.size();
+}
+
+bool HotObjectCache::get(uint64_t keyHash, ObjectPtr& object) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unordered_map<uint64_t, ItemList::iterator>::iterator it = items_.find(keyHash);
+    if (it == items_.end()) {
+        return false;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second);
+    it->second->hits++;
+    object = it->second->object;
+    return true;
+}
+
+void HotObjectCache::put(uint64_t keyHash, const ObjectPtr& object) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t hits = 0;
+    std::unordered_map<uint64_t, ItemList::iterator>::iterator it = items_.find(keyHash);
+    if (it != items_.end()) {
+        // A replaced object keeps its hit count
+        hits = it->second->hits;
+        removeLocked(it);
+    }
+    insertLocked(keyHash, object, hits);
+}
+
+void HotObjectCache::add(uint64_t keyHash, const ObjectPtr& object) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!items_.count(keyHash)) {
+        insertLocked(keyHash, object, 0);
+    }
+}
+
+void HotObjectCache::insertLocked(uint64_t keyHash, const ObjectPtr& object, uint32_t hits) {
+    uint64_t size = sizeOf(*object);
+    if (size > maxObjectBytes_) {
+        return;
+    }
+    while (bytes_ + size > maxBytes_ && !lru_.empty()) {
+        removeLocked(items_.find(lru_.back().keyHash));
+    }
+    Item item = {keyHash, object, hits};
+    lru_.push_front(item);
+    items_[keyHash] = lru_.begin();
+    bytes_ += size;
+}
+
+bool HotObjectCache::preload(uint64_t keyHash, const ObjectPtr& object, uint32_t hits) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t size = sizeOf(*object);
+    if (bytes_ + size > maxBytes_) {
+        return false;
+    }
+    if (size > maxObjectBytes_ || items_.count(keyHash)) {
+        return true;
+    }
+    // Objects used since the start stay ahead; the hot set is preloaded
+    // hottest first, so it keeps its order behind them
+    Item item = {keyHash, object, hits};
+    items_[keyHash] = lru_.insert(lru_.end(), item);
+    bytes_ += size;
+    return true;
+}
+
+void HotObjectCache::erase(uint64_t keyHash) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unordered_map<uint64_t, ItemList::iterator>::iterator it = items_.find(keyHash);
+    if (it != items_.end()) {
+        removeLocked(it);
+    }
+}
+
+void HotObjectCache::removeLocked(std::unordered_map<uint64_t, ItemList::iterator>::iterator it) {
+    bytes_ -= sizeOf(*it->second->object);
+    lru_.erase(it->second);
+    items_.erase(it);
+}
+
+std::vector<HotSetEntry> HotObjectCache::hotSet() const {
+    std::vector<HotSetEntry> hotSet;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        hotSet.reserve(lru_.size());
+        for (ItemList::const_iterator it = lru_.begin(); it != lru_.end(); ++it) {
+            HotSetEntry entry = {it->keyHash, it->hits};
+            hotSet.push_back(entry);
+        }
+    }
+    // Stable, so equally hit objects stay in recency order
+    std::stable_sort(hotSet.begin(), hotSet.end(), [](const HotSetEntry& a, const HotSetEntry& b) {
+        return a.hits > b.hits;
+    });
+    return hotSet;
+}
+
+size_t HotObjectCache::objectCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return items_.size();
+}
+
+uint64_t HotObjectCache::bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+}
+
+bool HotObjectCache::saveHotSet(const std::string& path, const std::vector<HotSetEntry>& hotSet) {
+    HotSetHeader hdr;
+    std::memcpy(hdr.magic, kHotSetMagic, sizeof(kHotSetMagic));
+    hdr.count = hotSet.size();
+
+    std::vector<HotSetRecord> records(hotSet.size());
+    for (size_t i = 0; i < hotSet.size(); ++i) {
+        records[i].keyHash = hotSet[i].keyHash;
+        records[i].hits = hotSet[i].hits;
+    }
+
+    // Write to a temporary file and rename, so a crash leaves the old snapshot
+    std::string tempPath = path + ".tmp." + std::to_string(getpid());
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        if (!records.empty()) {
+            file.write(reinterpret_cast<const char*>(&records[0]), records.size() * sizeof(HotSetRecord));
+        }
+        if (!file.good()) {
+            file.close();
+            std::remove(tempPath.c_str());
+            return false;
+        }
+    }
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool HotObjectCache::loadHotSet(const std::string& path, std::vector<HotSetEntry>& hotSet) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    HotSetHeader hdr;
+    if (!file.read(reinterpret_cast<char*>(&hdr), sizeof(hdr)) ||
+        std::memcmp(hdr.magic, kHotSetMagic, sizeof(kHotSetMagic)) != 0 ||
+        hdr.count > (1ULL << 24)) {
+        return false;
+    }
+
+    std::vector<HotSetRecord> records(static_cast<size_t>(hdr.count));
+    if (!records.empty() &&
+        !file.read(reinterpret_cast<char*>(&records[0]), records.size() * sizeof(HotSetRecord))) {
+        return false;
+    }
+    hotSet.clear();
+    hotSet.reserve(records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        HotSetEntry entry = {records[i].keyHash, records[i].hits};
+        hotSet.push_back(entry);
+    }
+    return true;
+}
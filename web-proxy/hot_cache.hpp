@@ -0,0 +1,93 @@
+#ifndef HOT_CACHE_HPP
+#define HOT_CACHE_HPP
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+// A stored response held in memory, with the parts of its object file
+// that the index does not keep.
+struct HotObject {
+    std::string key;
+    std::string etag;
+    std::string lastModified;
+    std::string response;
+    bool compressed;                // body gzip-encoded, as in the object file
+
+    HotObject() : compressed(false) {}
+};
+
+// One key of the hot set and how often it was hit while in memory
+struct HotSetEntry {
+    uint64_t keyHash;
+    uint32_t hits;
+};
+
+// Memory tier in front of the object files: the most recently used
+// responses up to `maxBytes`, each at most `maxObjectBytes`, evicted in
+// LRU order. The index stays authoritative for metadata and freshness;
+// this only saves the file read on a hit. Objects are shared immutable,
+// so a reader keeps its copy while the entry is replaced or evicted.
+//
+// The keys and hit counts of the resident objects form the hot set,
+// which is snapshotted to disk so that a restarted proxy can preload the
+// same objects instead of starting from an empty memory tier.
+class HotObjectCache {
+public:
+    typedef std::shared_ptr<const HotObject> ObjectPtr;
+
+    HotObjectCache(uint64_t maxBytes, uint64_t maxObjectBytes);
+
+    HotObjectCache(const HotObjectCache&) = delete;
+    HotObjectCache& operator=(const HotObjectCache&) = delete;
+
+    // Counts a hit and marks the object most recently used.
+    bool get(uint64_t keyHash, ObjectPtr& object);
+    // Stores or replaces an object; too large ones only remove the old copy.
+    void put(uint64_t keyHash, const ObjectPtr& object);
+    // Stores an object unless one is already present. Copies read from
+    // disk use this, so that they never replace a newer stored copy.
+    void add(uint64_t keyHash, const ObjectPtr& object);
+    // Like add(), but behind everything else and without evicting
+    // anything; returns false once the cache is full.
+    bool preload(uint64_t keyHash, const ObjectPtr& object, uint32_t hits);
+    void erase(uint64_t keyHash);
+
+    // Resident objects, most hit first; ties are broken by recency.
+    std::vector<HotSetEntry> hotSet() const;
+
+    size_t objectCount() const;
+    uint64_t bytes() const;
+    uint64_t maxObjectBytes() const { return maxObjectBytes_; }
+
+    // Snapshot files are replaced atomically; loading rejects files that
+    // are truncated or of another format.
+    static bool saveHotSet(const std::string& path, const std::vector<HotSetEntry>& hotSet);
+    static bool loadHotSet(const std::string& path, std::vector<HotSetEntry>& hotSet);
+
+private:
+    struct Item {
+        uint64_t keyHash;
+        ObjectPtr object;
+        uint32_t hits;
+    };
+    typedef std::list<Item> ItemList;
+
+    mutable std::mutex mutex_;
+    ItemList lru_;                  // most recently used first
+    std::unordered_map<uint64_t, ItemList::iterator> items_;
+    uint64_t maxBytes_;
+    uint64_t maxObjectBytes_;
+    uint64_t bytes_;
+
+    static uint64_t sizeOf(const HotObject& object);
+    void insertLocked(uint64_t keyHash, const ObjectPtr& object, uint32_t hits);
+    void removeLocked(std::unordered_map<uint64_t, ItemList::iterator>::iterator it);
+};
+
+#endif // HOT_CACHE_HPP
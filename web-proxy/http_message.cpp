@@ -0,0 +1,778 @@
+#include "http_message.hpp"
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+namespace {
+
+// Upper bound on a response header block; larger blocks are rejected.
+const size_t kMaxHeaderBytes = 64 * 1024;
+
+// Largest Content-Length accepted from an origin. No single body comes
+// near 1 TiB; a larger claim comes from a broken or hostile origin.
+const uint64_t kMaxContentLength = 1ULL << 40;
+
+std::string toLower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+    return s;
+}
+
+std::string trim(const std::string& s) {
+    size_t start = s.find_first_not_of(" \t");
+    if (start == std::string::npos) {
+        return "";
+    }
+    size_t end = s.find_last_not_of(" \t");
+    return s.substr(start, end - start + 1);
+}
+
+// Parses a Content-Length value. Repeated fields arrive joined with ", "
+// and must agree; anything but plain digits is rejected.
+bool parseContentLength(const std::string& value, uint64_t& length) {
+    std::istringstream iss(value);
+    std::string item;
+    bool found = false;
+    while (std::getline(iss, item, ',')) {
+        item = trim(item);
+        if (item.empty()) {
+            return false;
+        }
+        uint64_t parsed = 0;
+        for (size_t i = 0; i < item.size(); ++i) {
+            if (!std::isdigit(static_cast<unsigned char>(item[i]))) {
+                return false;
+            }
+            parsed = parsed * 10 + (item[i] - '0');
+            if (parsed > kMaxContentLength) {
+                return false;
+            }
+        }
+        if (found && parsed != length) {
+            return false;
+        }
+        found = true;
+        length = parsed;
+    }
+    return found;
+}
+
+} // namespace
+
+bool hasToken(const std::string& value, const std::string& token) {
+    std::istringstream iss(toLower(value));
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        if (trim(item) == token) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool isHopByHopHeader(const std::string& lowercaseName) {
+    return isHopByHopHeader(StringRef(lowercaseName.data(), lowercaseName.size()));
+}
+
+bool isHopByHopHeader(const StringRef& name) {
+    static const char* const kHopByHop[] = {
+        "connection", "proxy-connection", "keep-alive", "te", "trailer",
+        "transfer-encoding", "upgrade", "proxy-authenticate", "proxy-authorization"
+    };
+    for (size_t i = 0; i < sizeof(kHopByHop) / sizeof(kHopByHop[0]); ++i) {
+        if (name.equalsIgnoreCase(kHopByHop[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool frameResponseHead(std::string& head, bool headRequest, bool keepAlive) {
+    size_t lineEnd = head.find("\r\n");
+    if (lineEnd == std::string::npos) {
+        return false;
+    }
+    size_t space = head.find(' ');
+    int status = space < lineEnd ? std::atoi(head.c_str() + space + 1) : 0;
+    bool framed = headRequest || status == 204 || status == 304 || (status >= 100 && status < 200);
+
+    std::string rewritten = head.substr(0, lineEnd + 2);
+    size_t pos = lineEnd + 2;
+    while (pos < head.size()) {
+        size_t end = head.find("\r\n", pos);
+        if (end == std::string::npos || end == pos) {
+            break;
+        }
+        size_t colon = head.find(':', pos);
+        std::string name = colon < end ? toLower(trim(head.substr(pos, colon - pos))) : "";
+        std::string value = colon < end ? head.substr(colon + 1, end - colon - 1) : "";
+        if (name == "content-length") {
+            framed = true;
+        } else if (name == "transfer-encoding" && hasToken(value, "chunked")) {
+            framed = true;
+        }
+        if (name != "connection" && name != "proxy-connection" && name != "keep-alive") {
+            rewritten.append(head, pos, end + 2 - pos);
+        }
+        pos = end + 2;
+    }
+
+    bool persistent = keepAlive && framed;
+    rewritten += persistent ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    head.swap(rewritten);
+    return persistent;
+}
+
+HttpResponseParser parseResponseHead(const std::string& response) {
+    HttpResponseParser parser;
+    size_t headEnd = response.find("\r\n\r\n");
+    if (headEnd != std::string::npos) {
+        parser.feed(response.data(), headEnd + 4);
+    }
+    return parser;
+}
+
+HttpResponseParser::HttpResponseParser(bool headRequest)
+    : headRequest_(headRequest), state_(HEADERS), statusCode_(0),
+      remaining_(0), headerBytes_(0), closeDelimited_(false) {}
+
+std::string HttpResponseParser::header(const std::string& lowercaseName) const {
+    std::map<std::string, std::string>::const_iterator it = headers_.find(lowercaseName);
+    return it != headers_.end() ? it->second : std::string();
+}
+
+bool HttpResponseParser::takeLine(const char* data, size_t len, size_t& pos, std::string& line) {
+    while (pos < len) {
+        char c = data[pos++];
+        if (c == '\n') {
+            if (!lineBuffer_.empty() && lineBuffer_[lineBuffer_.size() - 1] == '\r') {
+                lineBuffer_.erase(lineBuffer_.size() - 1);
+            }
+            line.swap(lineBuffer_);
+            lineBuffer_.clear();
+            return true;
+        }
+        lineBuffer_ += c;
+        if (lineBuffer_.size() > kMaxHeaderBytes) {
+            state_ = FAILED;
+            return false;
+        }
+    }
+    return false;
+}
+
+size_t HttpResponseParser::feed(const char* data, size_t len) {
+    size_t pos = 0;
+    std::string line;
+
+    while (pos < len && state_ != COMPLETE && state_ != FAILED) {
+        switch (state_) {
+        case HEADERS: {
+            size_t buffered = lineBuffer_.size();
+            size_t searchFrom = buffered >= 3 ? buffered - 3 : 0;
+            lineBuffer_.append(data + pos, len - pos);
+            size_t end = lineBuffer_.find("\r\n\r\n", searchFrom);
+            if (end == std::string::npos) {
+                headerBytes_ += len - pos;
+                pos = len;
+                if (lineBuffer_.size() > kMaxHeaderBytes) {
+                    state_ = FAILED;
+                }
+                break;
+            }
+            pos += end + 4 - buffered;
+            headerBytes_ += end + 4 - buffered;
+            std::string block = lineBuffer_.substr(0, end);
+            lineBuffer_.clear();
+            if (!parseHeaderBlock(block)) {
+                state_ = FAILED;
+                break;
+            }
+            // Interim responses (100 Continue etc.) precede the real one
+            if (statusCode_ >= 100 && statusCode_ < 200 && statusCode_ != 101) {
+                headers_.clear();
+                headerFields_.clear();
+                break;
+            }
+            startBody();
+            break;
+        }
+        case BODY_LENGTH: {
+            size_t chunk = std::min(remaining_, len - pos);
+            body_.append(data + pos, chunk);
+            pos += chunk;
+            remaining_ -= chunk;
+            if (remaining_ == 0) {
+                state_ = COMPLETE;
+            }
+            break;
+        }
+        case CHUNK_SIZE:
+            if (takeLine(data, len, pos, line)) {
+                // Chunk extensions after ';' are ignored
+                std::string sizeStr = trim(line.substr(0, line.find(';')));
+                char* endPtr = nullptr;
+                unsigned long size = std::strtoul(sizeStr.c_str(), &endPtr, 16);
+                if (sizeStr.empty() || *endPtr != '\0') {
+                    state_ = FAILED;
+                } else if (size == 0) {
+                    state_ = TRAILERS;
+                } else {
+                    remaining_ = size;
+                    state_ = CHUNK_DATA;
+                }
+            }
+            break;
+        case CHUNK_DATA: {
+            size_t chunk = std::min(remaining_, len - pos);
+            body_.append(data + pos, chunk);
+            pos += chunk;
+            remaining_ -= chunk;
+            if (remaining_ == 0) {
+                state_ = CHUNK_DATA_END;
+            }
+            break;
+        }
+        case CHUNK_DATA_END:
+            if (takeLine(data, len, pos, line)) {
+                state_ = line.empty() ? CHUNK_SIZE : FAILED;
+            }
+            break;
+        case TRAILERS:
+            // Trailer fields are discarded
+            if (takeLine(data, len, pos, line) && line.empty()) {
+                state_ = COMPLETE;
+            }
+            break;
+        case BODY_UNTIL_CLOSE:
+            body_.append(data + pos, len - pos);
+            pos = len;
+            break;
+        case COMPLETE:
+        case FAILED:
+            break;
+        }
+    }
+
+    return pos;
+}
+
+void HttpResponseParser::finishOnClose() {
+    if (state_ == BODY_UNTIL_CLOSE) {
+        state_ = COMPLETE;
+    } else if (state_ != COMPLETE) {
+        state_ = FAILED;
+    }
+}
+
+bool HttpResponseParser::parseHeaderBlock(const std::string& block) {
+    std::istringstream iss(block);
+    std::string line;
+
+    if (!std::getline(iss, line)) {
+        return false;
+    }
+    if (!line.empty() && line[line.size() - 1] == '\r') {
+        line.erase(line.size() - 1);
+    }
+    statusLine_ = line;
+
+    // Format: "HTTP/1.1 200 OK"
+    size_t space1 = line.find(' ');
+    if (space1 == std::string::npos || line.compare(0, 5, "HTTP/") != 0) {
+        return false;
+    }
+    version_ = line.substr(0, space1);
+    statusCode_ = std::atoi(line.c_str() + space1 + 1);
+    if (statusCode_ < 100 || statusCode_ > 999) {
+        return false;
+    }
+
+    while (std::getline(iss, line)) {
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+        size_t colonPos = line.find(':');
+        if (colonPos == std::string::npos) {
+            continue;
+        }
+        std::string name = trim(line.substr(0, colonPos));
+        std::string value = trim(line.substr(colonPos + 1));
+        headerFields_.push_back(std::make_pair(name, value));
+
+        std::string key = toLower(name);
+        std::map<std::string, std::string>::iterator it = headers_.find(key);
+        if (it == headers_.end()) {
+            headers_[key] = value;
+        } else {
+            it->second += ", " + value;
+        }
+    }
+    return true;
+}
+
+void HttpResponseParser::startBody() {
+    // Responses that never carry a body (RFC 7230, section 3.3.3)
+    if (headRequest_ || statusCode_ == 204 || statusCode_ == 304 ||
+        (statusCode_ >= 100 && statusCode_ < 200)) {
+        state_ = COMPLETE;
+        return;
+    }
+
+    std::string transferEncoding = toLower(header("transfer-encoding"));
+    if (!transferEncoding.empty()) {
+        // Only chunked as the final coding delimits the message
+        size_t lastComma = transferEncoding.find_last_of(',');
+        std::string last = trim(lastComma == std::string::npos
+                                ? transferEncoding : transferEncoding.substr(lastComma + 1));
+        if (last == "chunked") {
+            state_ = CHUNK_SIZE;
+        } else {
+            closeDelimited_ = true;
+            state_ = BODY_UNTIL_CLOSE;
+        }
+        return;
+    }
+
+    std::string contentLength = header("content-length");
+    if (!contentLength.empty()) {
+        // The length is the origin's claim: the body buffer grows with the
+        // bytes that actually arrive rather than being reserved up front
+        uint64_t length = 0;
+        if (!parseContentLength(contentLength, length)) {
+            state_ = FAILED;
+            return;
+        }
+        remaining_ = static_cast<size_t>(length);
+        state_ = remaining_ == 0 ? COMPLETE : BODY_LENGTH;
+        return;
+    }
+
+    closeDelimited_ = true;
+    state_ = BODY_UNTIL_CLOSE;
+}
+
+bool HttpResponseParser::keepAlive() const {
+    return state_ == COMPLETE && !closeDelimited_ && persistentConnection();
+}
+
+bool HttpResponseParser::persistentConnection() const {
+    std::string connection = header("connection");
+    if (hasToken(connection, "close")) {
+        return false;
+    }
+    if (version_ == "HTTP/1.0") {
+        return hasToken(connection, "keep-alive");
+    }
+    return true;
+}
+
+std::string HttpResponseParser::forwardHead() const {
+    std::string connection = header("connection");
+
+    std::ostringstream oss;
+    oss << statusLine_ << "\r\n";
+    for (size_t i = 0; i < headerFields_.size(); ++i) {
+        std::string key = toLower(headerFields_[i].first);
+        if (key != "transfer-encoding" &&
+            (isHopByHopHeader(key) || hasToken(connection, key))) {
+            continue;
+        }
+        oss << headerFields_[i].first << ": " << headerFields_[i].second << "\r\n";
+    }
+    oss << "Connection: close\r\n";
+    oss << "\r\n";
+    return oss.str();
+}
+
+std::string HttpResponseParser::takeBody() {
+    std::string body;
+    body.swap(body_);
+    return body;
+}
+
+std::string HttpResponseParser::normalized() const {
+    return normalizedHead(body_.size()) + body_;
+}
+
+std::string HttpResponseParser::normalizedHead(uint64_t bodyLength) const {
+    std::string connection = header("connection");
+    bool keepLength = headRequest_ || statusCode_ == 304;
+
+    std::ostringstream oss;
+    oss << statusLine_ << "\r\n";
+    for (size_t i = 0; i < headerFields_.size(); ++i) {
+        std::string key = toLower(headerFields_[i].first);
+        if (isHopByHopHeader(key) || hasToken(connection, key)) {
+            continue;
+        }
+        if (key == "content-length" && !keepLength) {
+            continue;
+        }
+        oss << headerFields_[i].first << ": " << headerFields_[i].second << "\r\n";
+    }
+    if (!keepLength && statusCode_ != 204) {
+        oss << "Content-Length: " << bodyLength << "\r\n";
+    }
+    oss << "Connection: close\r\n";
+    oss << "\r\n";
+    return oss.str();
+}
+
+// ==================== Requests ====================
+
+bool StringRef::equalsIgnoreCase(const char* other) const {
+    return std::strlen(other) == size && strncasecmp(data, other, size) == 0;
+}
+
+const size_t HttpRequestHead::kMaxFields;
+
+HttpRequestHead::HttpRequestHead() : fieldCount_(0) {
+    Span empty = {0, 0};
+    method_ = target_ = version_ = empty;
+}
+
+bool HttpRequestHead::has(const char* name) const {
+    for (size_t i = 0; i < fieldCount_; ++i) {
+        if (ref(names_[i]).equalsIgnoreCase(name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+StringRef HttpRequestHead::get(const char* name) const {
+    for (size_t i = 0; i < fieldCount_; ++i) {
+        if (ref(names_[i]).equalsIgnoreCase(name)) {
+            return ref(values_[i]);
+        }
+    }
+    return StringRef();
+}
+
+bool HttpRequestHead::keepAlive() const {
+    std::string connection = get("connection").str();
+    StringRef proxyConnection = get("proxy-connection");
+    if (!proxyConnection.empty()) {
+        connection += "," + proxyConnection.str();
+    }
+    if (hasToken(connection, "close")) {
+        return false;
+    }
+    if (version().equalsIgnoreCase("HTTP/1.0")) {
+        return hasToken(connection, "keep-alive");
+    }
+    return true;
+}
+
+const size_t HttpRequestParser::kMaxHeadBytes;
+
+HttpRequestParser::HttpRequestParser()
+    : state_(HEAD), scanned_(0), remaining_(0), contentLength_(0), chunkedBytes_(0),
+      maxBodyBytes_(0), chunked_(false), errorStatus_(0) {}
+
+void HttpRequestParser::reset() {
+    state_ = HEAD;
+    head_.raw_.clear();
+    head_.fieldCount_ = 0;
+    scanned_ = 0;
+    line_.clear();
+    body_.clear();
+    remaining_ = 0;
+    contentLength_ = 0;
+    chunkedBytes_ = 0;
+    chunked_ = false;
+    errorStatus_ = 0;
+}
+
+HttpRequestHead HttpRequestParser::takeHead() {
+    HttpRequestHead head;
+    std::swap(head, head_);
+    return head;
+}
+
+std::string HttpRequestParser::takeBody() {
+    std::string body;
+    body.swap(body_);
+    return body;
+}
+
+void HttpRequestParser::fail(int status) {
+    state_ = FAILED;
+    errorStatus_ = status;
+}
+
+size_t HttpRequestParser::feed(const char* data, size_t len) {
+    size_t pos = 0;
+
+    while (pos < len && state_ != COMPLETE && state_ != FAILED) {
+        switch (state_) {
+        case HEAD: {
+            std::string& raw = head_.raw_;
+            size_t buffered = raw.size();
+            raw.append(data + pos, len - pos);
+            size_t end = raw.find("\r\n\r\n", scanned_ >= 3 ? scanned_ - 3 : 0);
+            if (end == std::string::npos || end + 4 > kMaxHeadBytes) {
+                scanned_ = raw.size();
+                pos = len;
+                if (raw.size() > kMaxHeadBytes) {
+                    fail(431);
+                }
+                break;
+            }
+            // Whatever follows the head is not part of it
+            pos += end + 4 - buffered;
+            raw.resize(end + 4);
+            if (parseHead(end + 2)) {
+                startBody();
+            }
+            break;
+        }
+        case BODY_LENGTH: {
+            size_t chunk = static_cast<size_t>(std::min<uint64_t>(remaining_, len - pos));
+            body_.append(data + pos, chunk);
+            pos += chunk;
+            remaining_ -= chunk;
+            if (remaining_ == 0) {
+                state_ = COMPLETE;
+            }
+            break;
+        }
+        case CHUNK_SIZE:
+            if (takeLine(data, len, pos)) {
+                // Hex size, optionally followed by extensions after ';'
+                uint64_t size = 0;
+                size_t i = 0;
+                for (; i < line_.size() && std::isxdigit(static_cast<unsigned char>(line_[i])); ++i) {
+                    if (size >> 59) {
+                        fail(400);
+                        break;
+                    }
+                    char c = line_[i];
+                    size = size * 16 + (std::isdigit(static_cast<unsigned char>(c))
+                                        ? c - '0' : (std::tolower(c) - 'a' + 10));
+                }
+                if (state_ == FAILED) {
+                    break;
+                }
+                while (i < line_.size() && (line_[i] == ' ' || line_[i] == '\t')) {
+                    ++i;
+                }
+                bool valid = i > 0 && (i == line_.size() || line_[i] == ';');
+                line_.clear();
+                if (!valid) {
+                    fail(400);
+                } else if (maxBodyBytes_ > 0 && size > maxBodyBytes_ - chunkedBytes_) {
+                    fail(413);
+                } else if (size == 0) {
+                    state_ = TRAILERS;
+                } else {
+                    remaining_ = size;
+                    chunkedBytes_ += size;
+                    state_ = CHUNK_DATA;
+                }
+            }
+            break;
+        case CHUNK_DATA: {
+            size_t chunk = static_cast<size_t>(std::min<uint64_t>(remaining_, len - pos));
+            body_.append(data + pos, chunk);
+            pos += chunk;
+            remaining_ -= chunk;
+            if (remaining_ == 0) {
+                state_ = CHUNK_DATA_END;
+            }
+            break;
+        }
+        case CHUNK_DATA_END:
+            if (takeLine(data, len, pos)) {
+                if (line_.empty()) {
+                    state_ = CHUNK_SIZE;
+                } else {
+                    fail(400);
+                }
+                line_.clear();
+            }
+            break;
+        case TRAILERS:
+            // Trailer fields are discarded
+            if (takeLine(data, len, pos)) {
+                if (line_.empty()) {
+                    state_ = COMPLETE;
+                }
+                line_.clear();
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return pos;
+}
+
+bool HttpRequestParser::takeLine(const char* data, size_t len, size_t& pos) {
+    const char* newline = static_cast<const char*>(std::memchr(data + pos, '\n', len - pos));
+    size_t end = newline ? newline - data : len;
+    line_.append(data + pos, end - pos);
+    pos = newline ? end + 1 : len;
+    if (line_.size() > 4096) {
+        fail(400);
+        return false;
+    }
+    if (!newline) {
+        return false;
+    }
+    if (!line_.empty() && line_[line_.size() - 1] == '\r') {
+        line_.erase(line_.size() - 1);
+    }
+    return true;
+}
+
+bool HttpRequestParser::parseHead(size_t length) {
+    // One pass over the head: every line ends with CRLF (a bare LF is
+    // accepted), the first is the request line, the rest are fields.
+    const char* base = head_.raw_.data();
+    size_t pos = 0;
+    // Empty lines before the request line are ignored (RFC 7230, 3.5)
+    while (pos < length && (base[pos] == '\r' || base[pos] == '\n')) {
+        ++pos;
+    }
+
+    bool requestLine = true;
+    while (pos < length) {
+        const char* newline = static_cast<const char*>(std::memchr(base + pos, '\n', length - pos));
+        size_t lineEnd = newline ? newline - base : length;
+        size_t next = lineEnd + 1;
+        if (lineEnd > pos && base[lineEnd - 1] == '\r') {
+            --lineEnd;
+        }
+
+        if (requestLine) {
+            // method SP request-target SP HTTP-version
+            const char* line = base + pos;
+            size_t lineLength = lineEnd - pos;
+            const char* sp1 = static_cast<const char*>(std::memchr(line, ' ', lineLength));
+            const char* sp2 = sp1 ? static_cast<const char*>(
+                std::memchr(sp1 + 1, ' ', line + lineLength - sp1 - 1)) : nullptr;
+            if (!sp1 || !sp2 || sp1 == line || sp2 == sp1 + 1 ||
+                lineEnd - (sp2 + 1 - base) < 6 || std::strncmp(sp2 + 1, "HTTP/", 5) != 0) {
+                fail(400);
+                return false;
+            }
+            HttpRequestHead::Span method = {static_cast<uint32_t>(pos), static_cast<uint32_t>(sp1 - line)};
+            HttpRequestHead::Span target = {static_cast<uint32_t>(sp1 + 1 - base),
+                                            static_cast<uint32_t>(sp2 - sp1 - 1)};
+            HttpRequestHead::Span version = {static_cast<uint32_t>(sp2 + 1 - base),
+                                             static_cast<uint32_t>(lineEnd - (sp2 + 1 - base))};
+            head_.method_ = method;
+            head_.target_ = target;
+            head_.version_ = version;
+            requestLine = false;
+            pos = next;
+            continue;
+        }
+
+        // Line folding is obsolete and rejected (RFC 7230, 3.2.4)
+        if (base[pos] == ' ' || base[pos] == '\t') {
+            fail(400);
+            return false;
+        }
+        const char* colon = static_cast<const char*>(std::memchr(base + pos, ':', lineEnd - pos));
+        if (!colon || colon == base + pos) {
+            fail(400);
+            return false;
+        }
+        size_t nameEnd = colon - base;
+        for (size_t i = pos; i < nameEnd; ++i) {
+            // No whitespace between the name and the colon
+            if (base[i] == ' ' || base[i] == '\t') {
+                fail(400);
+                return false;
+            }
+        }
+        size_t valueStart = nameEnd + 1;
+        size_t valueEnd = lineEnd;
+        while (valueStart < valueEnd && (base[valueStart] == ' ' || base[valueStart] == '\t')) {
+            ++valueStart;
+        }
+        while (valueEnd > valueStart && (base[valueEnd - 1] == ' ' || base[valueEnd - 1] == '\t')) {
+            --valueEnd;
+        }
+
+        if (head_.fieldCount_ == HttpRequestHead::kMaxFields) {
+            fail(431);
+            return false;
+        }
+        HttpRequestHead::Span name = {static_cast<uint32_t>(pos), static_cast<uint32_t>(nameEnd - pos)};
+        HttpRequestHead::Span value = {static_cast<uint32_t>(valueStart),
+                                       static_cast<uint32_t>(valueEnd - valueStart)};
+        head_.names_[head_.fieldCount_] = name;
+        head_.values_[head_.fieldCount_] = value;
+        head_.fieldCount_++;
+        pos = next;
+    }
+
+    if (requestLine) {
+        fail(400);
+        return false;
+    }
+    return true;
+}
+
+void HttpRequestParser::startBody() {
+    // What follows a CONNECT head belongs to the tunnel
+    if (head_.method().equalsIgnoreCase("CONNECT")) {
+        state_ = COMPLETE;
+        return;
+    }
+
+    // Transfer-Encoding overrides Content-Length (RFC 7230, 3.3.3). Only
+    // plain chunked coding is accepted, since the body is forwarded decoded.
+    StringRef transferEncoding = head_.get("transfer-encoding");
+    if (!transferEncoding.empty()) {
+        if (!transferEncoding.equalsIgnoreCase("chunked")) {
+            fail(501);
+            return;
+        }
+        chunked_ = true;
+        state_ = CHUNK_SIZE;
+        return;
+    }
+
+    // Repeated Content-Length fields must agree
+    bool found = false;
+    uint64_t length = 0;
+    for (size_t i = 0; i < head_.fieldCount(); ++i) {
+        if (!head_.name(i).equalsIgnoreCase("content-length")) {
+            continue;
+        }
+        StringRef value = head_.value(i);
+        uint64_t parsed = 0;
+        if (value.empty() || value.size > 18) {
+            fail(400);
+            return;
+        }
+        for (size_t j = 0; j < value.size; ++j) {
+            if (!std::isdigit(static_cast<unsigned char>(value.data[j]))) {
+                fail(400);
+                return;
+            }
+            parsed = parsed * 10 + (value.data[j] - '0');
+        }
+        if (found && parsed != length) {
+            fail(400);
+            return;
+        }
+        found = true;
+        length = parsed;
+    }
+
+    if (maxBodyBytes_ > 0 && length > maxBodyBytes_) {
+        fail(413);
+        return;
+    }
+    contentLength_ = length;
+    remaining_ = length;
+    state_ = length > 0 ? BODY_LENGTH : COMPLETE;
+}
@@ -0,0 +1,253 @@
+#ifndef HTTP_MESSAGE_HPP
+#define HTTP_MESSAGE_HPP
+
+#include <string>
+#include <map>
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+// Incremental HTTP/1.x response parser.
+// Determines message framing (Content-Length, chunked, read-until-close)
+// so that an upstream connection can be reused once the response is
+// complete, and decodes the body into a contiguous buffer.
+class HttpResponseParser {
+public:
+    explicit HttpResponseParser(bool headRequest = false);
+
+    // Feeds received bytes. Returns the number of bytes consumed; anything
+    // past the end of the message is left unconsumed.
+    size_t feed(const char* data, size_t len);
+
+    // Signals that the peer closed the connection.
+    void finishOnClose();
+
+    bool headersComplete() const { return state_ > HEADERS; }
+    bool complete() const { return state_ == COMPLETE; }
+    bool failed() const { return state_ == FAILED; }
+
+    // Framing of a body that is still being received: a Content-Length
+    // body with remainingBodyBytes() left, or one delimited by close.
+    bool awaitingLengthBody() const { return state_ == BODY_LENGTH; }
+    bool awaitingCloseBody() const { return state_ == BODY_UNTIL_CLOSE; }
+    size_t remainingBodyBytes() const { return state_ == BODY_LENGTH ? remaining_ : 0; }
+
+    int statusCode() const { return statusCode_; }
+    const std::string& version() const { return version_; }
+    const std::string& statusLine() const { return statusLine_; }
+    // Lowercased names; repeated headers are joined with ", ".
+    const std::map<std::string, std::string>& headers() const { return headers_; }
+    // Header fields in their original order and spelling.
+    const std::vector<std::pair<std::string, std::string> >& headerFields() const { return headerFields_; }
+    std::string header(const std::string& lowercaseName) const;
+    // Decoded body, or what is left of it since the last takeBody()
+    const std::string& body() const { return body_; }
+    // Moves out the body decoded so far, so that it can be passed on while
+    // the rest is still arriving.
+    std::string takeBody();
+
+    // Raw bytes consumed by header blocks, including interim responses.
+    // Everything fed past this point is the body as sent on the wire.
+    size_t headerBytes() const { return headerBytes_; }
+
+    // True if the connection may carry another request after this message.
+    bool keepAlive() const;
+    // What the headers say about persistence, whatever the body's state.
+    bool persistentConnection() const;
+
+    // Serializes the response with hop-by-hop headers removed and the
+    // body re-framed with Content-Length (chunked encoding is decoded).
+    std::string normalized() const;
+    // The head of normalized() for a body of `bodyLength` bytes kept
+    // elsewhere.
+    std::string normalizedHead(uint64_t bodyLength) const;
+
+    // Status line and end-to-end headers to forward to a client ahead of
+    // the body as received on the wire (its framing headers are kept).
+    std::string forwardHead() const;
+
+private:
+    enum State {
+        HEADERS,
+        BODY_LENGTH,
+        CHUNK_SIZE,
+        CHUNK_DATA,
+        CHUNK_DATA_END,
+        TRAILERS,
+        BODY_UNTIL_CLOSE,
+        COMPLETE,
+        FAILED
+    };
+
+    bool headRequest_;
+    State state_;
+    std::string lineBuffer_;
+    std::string statusLine_;
+    std::string version_;
+    int statusCode_;
+    std::map<std::string, std::string> headers_;
+    std::vector<std::pair<std::string, std::string> > headerFields_;
+    std::string body_;
+    size_t remaining_;
+    size_t headerBytes_;
+    bool closeDelimited_;
+
+    bool parseHeaderBlock(const std::string& block);
+    void startBody();
+    bool takeLine(const char* data, size_t len, size_t& pos, std::string& line);
+};
+
+// Characters owned by someone else; C++11 has no std::string_view.
+struct StringRef {
+    const char* data;
+    size_t size;
+
+    StringRef() : data(""), size(0) {}
+    StringRef(const char* d, size_t n) : data(d), size(n) {}
+
+    bool empty() const { return size == 0; }
+    std::string str() const { return std::string(data, size); }
+    bool equalsIgnoreCase(const char* other) const;
+};
+
+// Request line and header fields of a request. The fields are recorded as
+// offsets into the raw head in a flat, fixed-size table, so parsing does
+// not allocate per field and copying the head is a single string copy.
+// Names are compared case-insensitively.
+class HttpRequestHead {
+public:
+    static const size_t kMaxFields = 64;
+
+    HttpRequestHead();
+
+    // The head as received, up to and including the blank line
+    const std::string& raw() const { return raw_; }
+    StringRef method() const { return ref(method_); }
+    StringRef target() const { return ref(target_); }
+    StringRef version() const { return ref(version_); }
+
+    size_t fieldCount() const { return fieldCount_; }
+    StringRef name(size_t index) const { return ref(names_[index]); }
+    StringRef value(size_t index) const { return ref(values_[index]); }
+
+    bool has(const char* name) const;
+    // Value of the first field with this name; empty if there is none
+    StringRef get(const char* name) const;
+    // True if the client lets the connection carry another request:
+    // HTTP/1.1 unless Connection (or Proxy-Connection) says close,
+    // HTTP/1.0 only with keep-alive.
+    bool keepAlive() const;
+
+private:
+    friend class HttpRequestParser;
+
+    struct Span {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    std::string raw_;
+    Span method_;
+    Span target_;
+    Span version_;
+    Span names_[kMaxFields];
+    Span values_[kMaxFields];
+    size_t fieldCount_;
+
+    StringRef ref(const Span& span) const { return StringRef(raw_.data() + span.offset, span.length); }
+};
+
+// Incremental HTTP/1.x request parser. Received bytes are buffered only
+// until the blank line ending the head, which is searched for in the new
+// bytes alone, so a head spread over many reads is scanned once. The head
+// is then parsed in a single pass into an HttpRequestHead. A body framed
+// by Content-Length or chunked transfer coding is collected, chunked ones
+// decoded; a body larger than the configured maximum fails the request
+// with 413. The body can be taken out while it is still arriving, to be
+// forwarded in pieces. Bytes past the end of the request (the start of a
+// tunnel or a pipelined request) are left unconsumed.
+class HttpRequestParser {
+public:
+    static const size_t kMaxHeadBytes = 64 * 1024;
+
+    HttpRequestParser();
+
+    // Returns the number of bytes consumed.
+    size_t feed(const char* data, size_t len);
+
+    bool headComplete() const { return state_ != HEAD; }
+    // The head is complete and more body bytes are expected
+    bool bodyPending() const { return state_ != HEAD && state_ != COMPLETE && state_ != FAILED; }
+    bool complete() const { return state_ == COMPLETE; }
+    bool failed() const { return state_ == FAILED; }
+    // Status to reject a failed request with: 400, 413, 431 or 501
+    int errorStatus() const { return errorStatus_; }
+
+    const HttpRequestHead& head() const { return head_; }
+    // Decoded body, or what is left of it since the last takeBody()
+    const std::string& body() const { return body_; }
+    bool chunked() const { return chunked_; }
+    // Content-Length of a body that is not chunked
+    uint64_t contentLength() const { return contentLength_; }
+    // 0 = unlimited; kept across reset()
+    void setMaxBodyBytes(uint64_t maxBytes) { maxBodyBytes_ = maxBytes; }
+
+    // Moving the head or body out leaves the parser to be reset.
+    HttpRequestHead takeHead();
+    std::string takeBody();
+    // Prepares for the next request on the connection.
+    void reset();
+
+private:
+    enum State {
+        HEAD,
+        BODY_LENGTH,
+        CHUNK_SIZE,
+        CHUNK_DATA,
+        CHUNK_DATA_END,
+        TRAILERS,
+        COMPLETE,
+        FAILED
+    };
+
+    State state_;
+    HttpRequestHead head_;
+    size_t scanned_;
+    std::string line_;
+    std::string body_;
+    uint64_t remaining_;
+    uint64_t contentLength_;
+    uint64_t chunkedBytes_;     // decoded so far, checked against the maximum
+    uint64_t maxBodyBytes_;
+    bool chunked_;
+    int errorStatus_;
+
+    bool parseHead(size_t length);
+    void startBody();
+    bool takeLine(const char* data, size_t len, size_t& pos);
+    void fail(int status);
+};
+
+// Parses only the status line and headers of a complete response.
+HttpResponseParser parseResponseHead(const std::string& response);
+
+// Rewrites the head of a response to a client (status line and fields,
+// up to and including the blank line) for the client connection: the
+// connection fields are replaced by Connection: keep-alive if `keepAlive`
+// is asked for and the body is self-delimiting (Content-Length, chunked,
+// or none by status or because `headRequest`), by Connection: close
+// otherwise. Returns whether the connection can stay open.
+bool frameResponseHead(std::string& head, bool headRequest, bool keepAlive);
+
+// Checks whether a comma-separated header value lists `token` (given in
+// lowercase); list items are trimmed and compared without regard to case.
+bool hasToken(const std::string& value, const std::string& token);
+
+// Returns true for headers that apply to a single connection and must not
+// be forwarded by a proxy (RFC 7230, section 6.1).
+bool isHopByHopHeader(const std::string& lowercaseName);
+// The same for a name in any case.
+bool isHopByHopHeader(const StringRef& name);
+
+#endif // HTTP_MESSAGE_HPP
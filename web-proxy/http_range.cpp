@@ -0,0 +1,135 @@
+#include "http_range.hpp"
+#include <sstream>
+#include <cctype>
+#include <strings.h>
+
+namespace {
+
+std::string trim(const std::string& s) {
+    size_t start = s.find_first_not_of(" \t");
+    if (start == std::string::npos) {
+        return "";
+    }
+    size_t end = s.find_last_not_of(" \t");
+    return s.substr(start, end - start + 1);
+}
+
+// Strict decimal without sign or whitespace, at most 18 digits
+bool parseNumber(const std::string& s, uint64_t& value) {
+    if (s.empty() || s.size() > 18) {
+        return false;
+    }
+    value = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (!std::isdigit(static_cast<unsigned char>(s[i]))) {
+            return false;
+        }
+        value = value * 10 + (s[i] - '0');
+    }
+    return true;
+}
+
+} // namespace
+
+bool parseRangeHeader(const std::string& value, std::vector<RangeSpec>& specs) {
+    std::string v = trim(value);
+    if (v.size() < 6 || strncasecmp(v.c_str(), "bytes=", 6) != 0) {
+        return false;
+    }
+
+    specs.clear();
+    std::istringstream iss(v.substr(6));
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        item = trim(item);
+        if (item.empty()) {
+            continue; // empty list elements are allowed
+        }
+        size_t dash = item.find('-');
+        if (dash == std::string::npos) {
+            return false;
+        }
+        RangeSpec spec = {false, false, 0, 0, 0};
+        std::string first = trim(item.substr(0, dash));
+        std::string last = trim(item.substr(dash + 1));
+        if (first.empty()) {
+            spec.suffix = true;
+            if (!parseNumber(last, spec.suffixLength)) {
+                return false;
+            }
+        } else {
+            if (!parseNumber(first, spec.first)) {
+                return false;
+            }
+            if (last.empty()) {
+                spec.openEnded = true;
+            } else if (!parseNumber(last, spec.last) || spec.last < spec.first) {
+                return false;
+            }
+        }
+        specs.push_back(spec);
+    }
+    return !specs.empty();
+}
+
+std::vector<ByteRange> resolveRanges(const std::vector<RangeSpec>& specs, uint64_t length) {
+    std::vector<ByteRange> ranges;
+    for (size_t i = 0; i < specs.size(); ++i) {
+        const RangeSpec& spec = specs[i];
+        ByteRange range;
+        if (spec.suffix) {
+            if (spec.suffixLength == 0 || length == 0) {
+                continue;
+            }
+            range.first = spec.suffixLength >= length ? 0 : length - spec.suffixLength;
+            range.last = length - 1;
+        } else {
+            if (spec.first >= length) {
+                continue;
+            }
+            range.first = spec.first;
+            range.last = spec.openEnded || spec.last >= length ? length - 1 : spec.last;
+        }
+        ranges.push_back(range);
+    }
+    return ranges;
+}
+
+bool parseContentRange(const std::string& value, ByteRange& range, uint64_t& completeLength) {
+    std::string v = trim(value);
+    if (v.size() < 6 || strncasecmp(v.c_str(), "bytes ", 6) != 0) {
+        return false;
+    }
+    size_t dash = v.find('-', 6);
+    size_t slash = v.find('/', 6);
+    if (dash == std::string::npos || slash == std::string::npos || dash > slash) {
+        return false;
+    }
+    return parseNumber(trim(v.substr(6, dash - 6)), range.first) &&
+           parseNumber(v.substr(dash + 1, slash - dash - 1), range.last) &&
+           parseNumber(v.substr(slash + 1), completeLength) &&
+           range.first <= range.last && range.last < completeLength;
+}
+
+std::string formatContentRange(const ByteRange& range, uint64_t completeLength) {
+    std::ostringstream oss;
+    oss << "bytes " << range.first << "-" << range.last << "/" << completeLength;
+    return oss.str();
+}
+
+bool isStrongEtag(const std::string& etag) {
+    return etag.size() >= 2 && etag[0] == '"';
+}
+
+bool ifRangeMatches(const std::string& ifRange, const std::string& etag,
+                    const std::string& lastModified) {
+    std::string condition = trim(ifRange);
+    if (condition.empty()) {
+        return true;
+    }
+    if (condition[0] == '"' || condition.compare(0, 2, "W/") == 0) {
+        // Weak tags never match (strong comparison)
+        return isStrongEtag(condition) && condition == trim(etag);
+    }
+    return !lastModified.empty() && condition == trim(lastModified);
+}
@@ -0,0 +1,48 @@
+#ifndef HTTP_RANGE_HPP
+#define HTTP_RANGE_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// A satisfiable byte range; both ends are inclusive
+struct ByteRange {
+    uint64_t first;
+    uint64_t last;
+
+    uint64_t length() const { return last - first + 1; }
+};
+
+// One range of a Range header as requested: "first-last", "first-" or
+// the last `suffixLength` bytes ("-suffixLength")
+struct RangeSpec {
+    bool suffix;
+    bool openEnded;
+    uint64_t first;
+    uint64_t last;
+    uint64_t suffixLength;
+};
+
+// Parses a Range header value in the bytes unit (RFC 7233, 2.1). Other
+// units and malformed values yield false; such a header is ignored.
+bool parseRangeHeader(const std::string& value, std::vector<RangeSpec>& specs);
+
+// Resolves the specs against a representation of `length` bytes. Ranges
+// that start past the end are dropped; an empty result means the request
+// is unsatisfiable.
+std::vector<ByteRange> resolveRanges(const std::vector<RangeSpec>& specs, uint64_t length);
+
+// Parses a Content-Range value of a single part, "bytes first-last/length".
+// An unknown complete length ("*") is rejected.
+bool parseContentRange(const std::string& value, ByteRange& range, uint64_t& completeLength);
+std::string formatContentRange(const ByteRange& range, uint64_t completeLength);
+
+// Evaluates If-Range (RFC 7233, 3.2): an entity-tag must equal the stored
+// strong ETag, a date the stored Last-Modified.
+bool ifRangeMatches(const std::string& ifRange, const std::string& etag,
+                    const std::string& lastModified);
+
+// True for an ETag that may be used to combine ranges (not W/)
+bool isStrongEtag(const std::string& etag);
+
+#endif // HTTP_RANGE_HPP
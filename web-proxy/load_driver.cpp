@@ -0,0 +1,362 @@
+// Load driver for the proxy: worker threads request objects of the origin
+// simulator through the proxy, picking them with Zipf-distributed
+// popularity, and report the hit ratio, throughput and latency of hits and
+// misses separately.
+//
+//   ./load_driver [options]
+//     --proxy HOST:PORT   proxy to load (127.0.0.1:8080)
+//     --origin HOST:PORT  origin simulator (127.0.0.1:9080)
+//     --threads N         concurrent clients (8)
+//     --requests N        requests in total (20000)
+//     --objects N         distinct objects (1000)
+//     --zipf S            popularity exponent; 0 = uniform (0.9)
+//     --query Q           appended to every URL, e.g. "cc=no-store"
+//     --timeout-ms N      per-request receive timeout (5000)
+//     --keep-alive        reuse each thread's connection to the proxy
+//     --seed N            random seed (1)
+//
+// A response is a hit if the X-Origin-Seq it carries was seen before: the
+// simulator numbers every response it sends, so only a stored copy can
+// repeat a number. A request that joined an in-flight fetch of another
+// therefore counts as a hit too.
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <strings.h>
+
+namespace {
+
+struct DriverConfig {
+    std::string proxyHost;
+    int proxyPort;
+    std::string origin;
+    size_t threads;
+    size_t requests;
+    size_t objects;
+    double zipf;
+    std::string query;
+    int timeoutMs;
+    bool keepAlive;
+    unsigned seed;
+
+    DriverConfig() : proxyHost("127.0.0.1"), proxyPort(8080), origin("127.0.0.1:9080"),
+                     threads(8), requests(20000), objects(1000), zipf(0.9), timeoutMs(5000),
+                     keepAlive(false), seed(1) {}
+};
+
+enum Outcome {
+    HIT,
+    MISS,
+    ERROR_STATUS,       // a complete response other than 200
+    FAILED              // no complete response
+};
+
+struct ThreadResult {
+    std::vector<double> hitMs;
+    std::vector<double> missMs;
+    size_t errorResponses;
+    size_t failures;
+
+    ThreadResult() : errorResponses(0), failures(0) {}
+};
+
+DriverConfig g_config;
+std::mutex g_seenMutex;
+std::unordered_set<uint64_t> g_seen;
+
+bool splitHostPort(const std::string& value, std::string& host, int& port) {
+    size_t colon = value.rfind(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    host = value.substr(0, colon);
+    port = std::atoi(value.c_str() + colon + 1);
+    return !host.empty() && port > 0;
+}
+
+// Cumulative popularity of objects 0..n-1; object i has weight 1/(i+1)^s
+std::vector<double> zipfCdf(size_t n, double s) {
+    std::vector<double> cdf(n);
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += 1.0 / std::pow(static_cast<double>(i + 1), s);
+        cdf[i] = sum;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        cdf[i] /= sum;
+    }
+    return cdf;
+}
+
+std::string headerValue(const std::string& head, const char* name) {
+    size_t nameLength = std::strlen(name);
+    size_t pos = head.find("\r\n");
+    while (pos != std::string::npos && pos + 2 < head.size()) {
+        size_t start = pos + 2;
+        size_t end = head.find("\r\n", start);
+        if (end == std::string::npos) {
+            end = head.size();
+        }
+        if (end - start > nameLength && head[start + nameLength] == ':' &&
+            strncasecmp(head.c_str() + start, name, nameLength) == 0) {
+            size_t value = head.find_first_not_of(" \t", start + nameLength + 1);
+            return value == std::string::npos || value > end ? "" : head.substr(value, end - value);
+        }
+        pos = end;
+    }
+    return "";
+}
+
+int connectTo(const std::string& host, int port, int timeoutMs) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct timeval tv;
+    tv.tv_sec = timeoutMs / 1000;
+    tv.tv_usec = (timeoutMs % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1 ||
+        connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Sends one request on `fd`, or on a new connection if it is -1, and
+// reads the response up to its announced length or until the proxy
+// closes. A connection that can carry another request is left in `fd`.
+Outcome fetch(size_t object, int& fd) {
+    std::string request = "GET http://" + g_config.origin + "/obj/" + std::to_string(object);
+    if (!g_config.query.empty()) {
+        request += "?" + g_config.query;
+    }
+    request += " HTTP/1.1\r\nHost: " + g_config.origin + "\r\n";
+    request += g_config.keepAlive ? "\r\n" : "Connection: close\r\n\r\n";
+
+    // A kept connection may have been closed by the proxy meanwhile
+    bool reused = fd >= 0;
+    if (fd < 0 && (fd = connectTo(g_config.proxyHost, g_config.proxyPort, g_config.timeoutMs)) < 0) {
+        return FAILED;
+    }
+    if (::send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size())) {
+        close(fd);
+        fd = -1;
+        return reused ? fetch(object, fd) : FAILED;
+    }
+
+    std::string response;
+    size_t headEnd = std::string::npos;
+    long long contentLength = -1;
+    bool closedByPeer = false;
+    char buffer[65536];
+    for (;;) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            closedByPeer = true;
+            break;
+        }
+        response.append(buffer, n);
+        if (headEnd == std::string::npos && (headEnd = response.find("\r\n\r\n")) != std::string::npos) {
+            std::string length = headerValue(response.substr(0, headEnd + 2), "Content-Length");
+            contentLength = length.empty() ? -1 : std::atoll(length.c_str());
+        }
+        if (contentLength >= 0 && response.size() >= headEnd + 4 + contentLength) {
+            break;
+        }
+    }
+    if (reused && response.empty()) {
+        close(fd);
+        fd = -1;
+        return fetch(object, fd);
+    }
+
+    std::string head = headEnd == std::string::npos ? "" : response.substr(0, headEnd + 2);
+    if (closedByPeer || !g_config.keepAlive || strcasecmp(headerValue(head, "Connection").c_str(), "close") == 0) {
+        close(fd);
+        fd = -1;
+    }
+    if (headEnd == std::string::npos ||
+        (contentLength >= 0 && response.size() < headEnd + 4 + contentLength)) {
+        return FAILED;
+    }
+    int status = head.size() > 12 ? std::atoi(head.c_str() + 9) : 0;
+    if (status != 200) {
+        return ERROR_STATUS;
+    }
+    std::string seq = headerValue(head, "X-Origin-Seq");
+    if (seq.empty()) {
+        return FAILED;
+    }
+    std::lock_guard<std::mutex> lock(g_seenMutex);
+    return g_seen.insert(std::strtoull(seq.c_str(), nullptr, 10)).second ? MISS : HIT;
+}
+
+void runWorker(size_t index, const std::vector<double>& cdf, std::atomic<size_t>& issued,
+               ThreadResult& result) {
+    std::mt19937 rng(g_config.seed * 7919 + static_cast<unsigned>(index));
+    std::uniform_real_distribution<double> uniform(0, 1);
+    int fd = -1;
+    while (issued.fetch_add(1) < g_config.requests) {
+        size_t object = std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+        object = std::min(object, cdf.size() - 1);
+
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        Outcome outcome = fetch(object, fd);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+        switch (outcome) {
+        case HIT:
+            result.hitMs.push_back(ms);
+            break;
+        case MISS:
+            result.missMs.push_back(ms);
+            break;
+        case ERROR_STATUS:
+            result.errorResponses++;
+            break;
+        case FAILED:
+            result.failures++;
+            break;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(std::ceil(p * sorted.size())) - 1;
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+void printLatency(const char* label, std::vector<double>& samples) {
+    std::sort(samples.begin(), samples.end());
+    std::cout << std::left << std::setw(12) << label << std::right << std::fixed << std::setprecision(2);
+    if (samples.empty()) {
+        std::cout << "none" << std::endl;
+        return;
+    }
+    std::cout << samples.size() << " requests, p50 " << percentile(samples, 0.50)
+              << " ms, p99 " << percentile(samples, 0.99)
+              << " ms, max " << samples.back() << " ms" << std::endl;
+}
+
+bool parseArgs(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--keep-alive") {
+            g_config.keepAlive = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--proxy") {
+            if (!splitHostPort(value, g_config.proxyHost, g_config.proxyPort)) {
+                std::cerr << "Expected HOST:PORT for --proxy" << std::endl;
+                return false;
+            }
+        } else if (arg == "--origin") {
+            g_config.origin = value;
+        } else if (arg == "--threads") {
+            g_config.threads = std::max<size_t>(1, std::strtoul(value.c_str(), nullptr, 10));
+        } else if (arg == "--requests") {
+            g_config.requests = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (arg == "--objects") {
+            g_config.objects = std::max<size_t>(1, std::strtoul(value.c_str(), nullptr, 10));
+        } else if (arg == "--zipf") {
+            g_config.zipf = std::atof(value.c_str());
+        } else if (arg == "--query") {
+            g_config.query = value;
+        } else if (arg == "--timeout-ms") {
+            g_config.timeoutMs = std::atoi(value.c_str());
+        } else if (arg == "--seed") {
+            g_config.seed = static_cast<unsigned>(std::strtoul(value.c_str(), nullptr, 10));
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (!parseArgs(argc, argv)) {
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<double> cdf = zipfCdf(g_config.objects, g_config.zipf);
+    std::atomic<size_t> issued(0);
+    std::vector<ThreadResult> results(g_config.threads);
+    std::vector<std::thread> workers;
+
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < g_config.threads; ++i) {
+        workers.push_back(std::thread(runWorker, i, std::cref(cdf), std::ref(issued), std::ref(results[i])));
+    }
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    ThreadResult total;
+    for (size_t i = 0; i < results.size(); ++i) {
+        total.hitMs.insert(total.hitMs.end(), results[i].hitMs.begin(), results[i].hitMs.end());
+        total.missMs.insert(total.missMs.end(), results[i].missMs.begin(), results[i].missMs.end());
+        total.errorResponses += results[i].errorResponses;
+        total.failures += results[i].failures;
+    }
+    size_t completed = total.hitMs.size() + total.missMs.size();
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Requests:   " << g_config.requests << " by " << g_config.threads << " threads in "
+              << seconds << " s, " << std::setprecision(0) << g_config.requests / seconds << " req/s"
+              << std::endl;
+    std::cout << "Workload:   " << g_config.objects << " objects, Zipf s=" << std::setprecision(2)
+              << g_config.zipf << (g_config.query.empty() ? "" : ", query " + g_config.query)
+              << (g_config.keepAlive ? ", keep-alive" : "") << std::endl;
+    std::cout << "Hit ratio:  " << std::setprecision(1)
+              << (completed ? 100.0 * total.hitMs.size() / completed : 0.0) << "% of "
+              << completed << " successful responses" << std::endl;
+    std::cout << "Errors:     " << total.errorResponses << " error responses, "
+              << total.failures << " failed requests" << std::endl;
+    printLatency("Hits:", total.hitMs);
+    printLatency("Misses:", total.missMs);
+    return 0;
+}
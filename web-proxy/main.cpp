@@ -1,21 +1,55 @@
 #include "proxy_server.hpp"
 #include <iostream>
 #include <csignal>
-#include <cstdlib>
+#include <cstdio>
+#include <sys/resource.h>
 
 ProxyServer* g_proxyServer = nullptr;
 
-void signalHandler(int signal) {
-    if (g_proxyServer && signal == SIGINT) {
-        std::cout << "\nShutting down proxy server..." << std::endl;
-        g_proxyServer->stop();
-        exit(0);
+// Only wakes the server: the event loops end, start() returns, and the
+// state is saved by main outside of the handler
+void signalHandler(int) {
+    if (g_proxyServer) {
+        g_proxyServer->requestStop();
     }
 }
 
+// Descriptors held by one CONNECT tunnel: both sockets and a splice pipe
+// per direction
+const rlim_t kTunnelDescriptors = 6;
+
+// Raises the soft limit on open descriptors to the hard limit; the usual
+// soft limit of 1024 is reached at about 170 tunnels. Returns the limit
+// now in force and sets `previous` to the one before.
+rlim_t raiseFileLimit(rlim_t& previous) {
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        perror("getrlimit");
+        previous = 0;
+        return 0;
+    }
+    previous = limit.rlim_cur;
+    if (limit.rlim_cur == limit.rlim_max) {
+        return limit.rlim_cur;
+    }
+    limit.rlim_cur = limit.rlim_max;
+    bool raised = setrlimit(RLIMIT_NOFILE, &limit) == 0;
+    if (!raised && limit.rlim_max == RLIM_INFINITY) {
+        // An unlimited hard limit is still capped by fs.nr_open
+        limit.rlim_cur = 1024 * 1024;
+        raised = setrlimit(RLIMIT_NOFILE, &limit) == 0;
+    }
+    if (!raised) {
+        perror("setrlimit");
+        return previous;
+    }
+    return limit.rlim_cur;
+}
+
 int main(int argc, char* argv[]) {
     int port = 8080;
     std::string cacheDir = "./cache";
+    ProxyConfig config;
     
     // Parse command line arguments
     if (argc > 1) {
@@ -24,20 +58,45 @@ int main(int argc, char* argv[]) {
     if (argc > 2) {
         cacheDir = argv[2];
     }
+    if (argc > 3) {
+        config.cacheMaxBytes = std::stoull(argv[3]) * 1024 * 1024;
+    }
+    if (argc > 4) {
+        config.cacheMaxEntries = std::stoul(argv[4]);
+    }
+    
+    rlim_t previousFiles = 0;
+    rlim_t openFiles = raiseFileLimit(previousFiles);
     
     try {
-        ProxyServer server(port, cacheDir);
+        ProxyServer server(port, cacheDir, config);
         g_proxyServer = &server;
         
-        // Set up signal handler for graceful shutdown
+        // Set up signal handlers for graceful shutdown
         signal(SIGINT, signalHandler);
+        signal(SIGTERM, signalHandler);
+        // sendfile and splice have no MSG_NOSIGNAL; a client that went away
+        // must surface as EPIPE rather than end the process
+        signal(SIGPIPE, SIG_IGN);
         
         std::cout << "Starting HTTP Proxy Server..." << std::endl;
         std::cout << "Port: " << port << std::endl;
         std::cout << "Cache directory: " << cacheDir << std::endl;
+        std::cout << "Cache limits: " << config.cacheMaxBytes / (1024 * 1024) << " MB, "
+                  << config.cacheMaxEntries << " objects" << std::endl;
+        if (openFiles > 0) {
+            std::cout << "Open file limit: " << previousFiles;
+            if (openFiles != previousFiles) {
+                std::cout << " -> " << openFiles;
+            }
+            std::cout << " (about " << openFiles / kTunnelDescriptors << " CONNECT tunnels)" << std::endl;
+        }
         std::cout << "Press Ctrl+C to stop the server" << std::endl;
         
         server.start();
+        g_proxyServer = nullptr;
+        std::cout << "Shutting down proxy server..." << std::endl;
+        server.stop();
         
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
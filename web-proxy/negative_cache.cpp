@@ -0,0 +1,107 @@
+#include "negative_cache.hpp"
+#include "cache_policy.hpp"
+#include <algorithm>
+
+namespace {
+
+const std::string& headerValue(const std::map<std::string, std::string>& headers, const char* name) {
+    static const std::string empty;
+    std::map<std::string, std::string>::const_iterator it = headers.find(name);
+    return it == headers.end() ? empty : it->second;
+}
+
+} // namespace
+
+NegativeCache::NegativeCache(const NegativeCacheConfig& config) : config_(config), bytes_(0) {}
+
+bool NegativeCache::isNegativeStatus(int statusCode) {
+    return statusCode == 301 || statusCode == 302 || statusCode == 404 ||
+           statusCode == 410 || statusCode == 502;
+}
+
+long NegativeCache::lifetime(int statusCode, const std::map<std::string, std::string>& headers,
+                             time_t now) const {
+    if (config_.maxEntries == 0 || !isNegativeStatus(statusCode)) {
+        return 0;
+    }
+    CacheControl cc = CacheControl::parse(headerValue(headers, "cache-control"));
+    if (cc.noStore || cc.noCache || cc.isPrivate) {
+        return 0;
+    }
+    // Entries are kept per URL, whatever the request's fields were
+    if (!headerValue(headers, "vary").empty()) {
+        return 0;
+    }
+
+    long ttl;
+    if (cc.sMaxAge >= 0 || cc.maxAge >= 0 || headers.count("expires")) {
+        ttl = static_cast<long>(computeFreshness(headers, now).expiresAt - now);
+    } else if (statusCode == 301 || statusCode == 302) {
+        ttl = config_.redirectTtl;
+    } else if (statusCode == 502) {
+        ttl = config_.errorTtl;
+    } else {
+        ttl = config_.notFoundTtl;
+    }
+    return std::max(0L, std::min(ttl, config_.maxTtl));
+}
+
+bool NegativeCache::lookup(const std::string& key, std::string& response, time_t now) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unordered_map<std::string, Entry>::iterator it = entries_.find(key);
+    if (it == entries_.end()) {
+        return false;
+    }
+    if (now >= it->second.expiresAt) {
+        removeLocked(it);
+        return false;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+    response = it->second.response;
+    return true;
+}
+
+void NegativeCache::put(const std::string& key, const std::string& response, time_t expiresAt) {
+    uint64_t size = key.size() + response.size();
+    if (config_.maxEntries == 0 || size > config_.maxObjectBytes || size > config_.maxBytes) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unordered_map<std::string, Entry>::iterator it = entries_.find(key);
+    if (it != entries_.end()) {
+        removeLocked(it);
+    }
+    while (!lru_.empty() && (entries_.size() >= config_.maxEntries || bytes_ + size > config_.maxBytes)) {
+        removeLocked(entries_.find(lru_.back()));
+    }
+    lru_.push_front(key);
+    Entry& entry = entries_[key];
+    entry.response = response;
+    entry.expiresAt = expiresAt;
+    entry.lru = lru_.begin();
+    bytes_ += size;
+}
+
+void NegativeCache::erase(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unordered_map<std::string, Entry>::iterator it = entries_.find(key);
+    if (it != entries_.end()) {
+        removeLocked(it);
+    }
+}
+
+void NegativeCache::removeLocked(std::unordered_map<std::string, Entry>::iterator it) {
+    bytes_ -= it->first.size() + it->second.response.size();
+    lru_.erase(it->second.lru);
+    entries_.erase(it);
+}
+
+size_t NegativeCache::entryCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+uint64_t NegativeCache::bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+}
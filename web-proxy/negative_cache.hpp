@@ -0,0 +1,72 @@
+#ifndef NEGATIVE_CACHE_HPP
+#define NEGATIVE_CACHE_HPP
+
+#include <string>
+#include <map>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+#include <ctime>
+
+struct NegativeCacheConfig {
+    long redirectTtl;       // seconds, for 301 and 302 without a lifetime of their own
+    long notFoundTtl;       // for 404 and 410
+    long errorTtl;          // for 502, from the origin or for a failed fetch
+    long maxTtl;            // explicit lifetimes are capped at this
+    size_t maxEntries;      // 0 = disabled
+    uint64_t maxBytes;
+    uint64_t maxObjectBytes; // larger responses are not kept
+
+    NegativeCacheConfig() : redirectTtl(60), notFoundTtl(30), errorTtl(5), maxTtl(300),
+                            maxEntries(1024), maxBytes(4 * 1024 * 1024),
+                            maxObjectBytes(64 * 1024) {}
+};
+
+// Small in-memory cache of redirects, "not found" answers and upstream
+// failures, kept apart from the object cache so that they neither take
+// its space nor outlive a short lifetime. A response is kept for what its
+// Cache-Control or Expires allows, capped at `maxTtl`, or else for the
+// configured lifetime of its status; no-store, no-cache and private
+// responses are not kept. Entries are evicted in LRU order beyond
+// `maxEntries` or `maxBytes`.
+class NegativeCache {
+public:
+    explicit NegativeCache(const NegativeCacheConfig& config = NegativeCacheConfig());
+
+    NegativeCache(const NegativeCache&) = delete;
+    NegativeCache& operator=(const NegativeCache&) = delete;
+
+    static bool isNegativeStatus(int statusCode);
+
+    // Seconds a response with this status and these (lowercased) headers
+    // may be kept, or 0 if it may not.
+    long lifetime(int statusCode, const std::map<std::string, std::string>& headers,
+                  time_t now) const;
+
+    // Copies the response if it has not expired; expired entries are removed.
+    bool lookup(const std::string& key, std::string& response, time_t now);
+    void put(const std::string& key, const std::string& response, time_t expiresAt);
+    void erase(const std::string& key);
+
+    size_t entryCount() const;
+    uint64_t bytes() const;
+
+private:
+    struct Entry {
+        std::string response;
+        time_t expiresAt;
+        std::list<std::string>::iterator lru;
+    };
+
+    NegativeCacheConfig config_;
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+    std::list<std::string> lru_;    // most recently used first
+    uint64_t bytes_;
+
+    void removeLocked(std::unordered_map<std::string, Entry>::iterator it);
+};
+
+#endif // NEGATIVE_CACHE_HPP
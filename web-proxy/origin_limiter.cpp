@@ -0,0 +1,181 @@
+#include "origin_limiter.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Origins without exchanges are forgotten once there are this many
+const size_t kSweepThreshold = 1024;
+
+} // namespace
+
+OriginSlot::~OriginSlot() {
+    limiter_.release(origin_);
+}
+
+OriginLimiter::OriginLimiter(const OriginLimitConfig& config)
+    : config_(config), waiting_(0), nextTicket_(1), queued_(0), rejected_(0), withdrawn_(0),
+      throttled_(0) {}
+
+double OriginLimiter::burst() const {
+    return static_cast<double>(config_.burstBytes > 0 ? config_.burstBytes : config_.bytesPerSecond);
+}
+
+OriginLimiter::Origin& OriginLimiter::originLocked(const std::string& origin) {
+    std::map<std::string, Origin>::iterator it = origins_.find(origin);
+    if (it == origins_.end()) {
+        it = origins_.insert(std::make_pair(origin, Origin())).first;
+        it->second.tokens = burst();
+        it->second.refilledMs = Reactor::nowMs();
+    }
+    return it->second;
+}
+
+void OriginLimiter::refillLocked(Origin& state, uint64_t nowMs) const {
+    if (nowMs > state.refilledMs) {
+        double refill = static_cast<double>(nowMs - state.refilledMs) * config_.bytesPerSecond / 1000.0;
+        state.tokens = std::min(burst(), state.tokens + refill);
+        state.refilledMs = nowMs;
+    }
+}
+
+OriginLimiter::Admission OriginLimiter::acquire(const std::string& origin, Reactor& reactor,
+                                                const GrantCallback& granted, Ticket& ticket) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Origin& state = originLocked(origin);
+        if (config_.maxConcurrent > 0 && state.active >= config_.maxConcurrent) {
+            if (config_.maxQueued > 0 && state.waiters.size() >= config_.maxQueued) {
+                rejected_++;
+                return REJECTED;
+            }
+            Waiter waiter;
+            waiter.ticket = ticket = nextTicket_++;
+            waiter.reactor = &reactor;
+            waiter.granted = granted;
+            state.waiters.push_back(waiter);
+            waiting_++;
+            queued_++;
+            return QUEUED;
+        }
+        state.active++;
+    }
+    granted(std::make_shared<OriginSlot>(*this, origin));
+    return GRANTED;
+}
+
+void OriginLimiter::withdraw(const std::string& origin, Ticket ticket) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<std::string, Origin>::iterator it = origins_.find(origin);
+    if (it == origins_.end()) {
+        return;
+    }
+    std::deque<Waiter>& waiters = it->second.waiters;
+    for (std::deque<Waiter>::iterator w = waiters.begin(); w != waiters.end(); ++w) {
+        if (w->ticket == ticket) {
+            waiters.erase(w);
+            waiting_--;
+            withdrawn_++;
+            pruneLocked(it);
+            return;
+        }
+    }
+}
+
+void OriginLimiter::release(const std::string& origin) {
+    Waiter next;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::map<std::string, Origin>::iterator it = origins_.find(origin);
+        if (it == origins_.end()) {
+            return;
+        }
+        Origin& state = it->second;
+        if (state.waiters.empty()) {
+            state.active--;
+            pruneLocked(it);
+            return;
+        }
+        // The slot passes to the first in line; the count stays the same
+        next = state.waiters.front();
+        state.waiters.pop_front();
+        waiting_--;
+    }
+    std::shared_ptr<OriginSlot> slot = std::make_shared<OriginSlot>(*this, origin);
+    GrantCallback granted = next.granted;
+    next.reactor->post([granted, slot]() {
+        granted(slot);
+    });
+}
+
+void OriginLimiter::pruneLocked(std::map<std::string, Origin>::iterator it) {
+    // An origin whose bucket is still refilling is kept, so that a new
+    // exchange does not start with a full burst
+    uint64_t now = Reactor::nowMs();
+    refillLocked(it->second, now);
+    if (it->second.active == 0 && it->second.waiters.empty() && it->second.tokens >= burst()) {
+        origins_.erase(it);
+    }
+    if (origins_.size() < kSweepThreshold) {
+        return;
+    }
+    for (std::map<std::string, Origin>::iterator i = origins_.begin(); i != origins_.end();) {
+        refillLocked(i->second, now);
+        if (i->second.active == 0 && i->second.waiters.empty() && i->second.tokens >= burst()) {
+            origins_.erase(i++);
+        } else {
+            ++i;
+        }
+    }
+}
+
+size_t OriginLimiter::allowance(const std::string& origin, size_t wanted, int& waitMs) {
+    waitMs = 0;
+    if (config_.bytesPerSecond == 0) {
+        return wanted;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    Origin& state = originLocked(origin);
+    refillLocked(state, Reactor::nowMs());
+    if (state.tokens >= 1.0) {
+        return static_cast<size_t>(std::min(static_cast<double>(wanted), state.tokens));
+    }
+    // Concurrent readers may have overdrawn the bucket
+    throttled_++;
+    waitMs = static_cast<int>(std::ceil((1.0 - state.tokens) * 1000.0 / config_.bytesPerSecond));
+    waitMs = std::max(waitMs, 1);
+    return 0;
+}
+
+void OriginLimiter::consume(const std::string& origin, size_t bytes) {
+    if (config_.bytesPerSecond == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    originLocked(origin).tokens -= static_cast<double>(bytes);
+}
+
+uint64_t OriginLimiter::queuedExchanges() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queued_;
+}
+
+uint64_t OriginLimiter::rejectedExchanges() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return rejected_;
+}
+
+uint64_t OriginLimiter::withdrawnExchanges() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return withdrawn_;
+}
+
+uint64_t OriginLimiter::throttledReads() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return throttled_;
+}
+
+size_t OriginLimiter::waitingExchanges() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return waiting_;
+}
@@ -0,0 +1,126 @@
+#ifndef ORIGIN_LIMITER_HPP
+#define ORIGIN_LIMITER_HPP
+
+#include <string>
+#include <map>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+#include "reactor.hpp"
+
+struct OriginLimitConfig {
+    size_t maxConcurrent;       // exchanges in progress per origin, 0 = unlimited
+    size_t maxQueued;           // exchanges waiting per origin, 0 = unlimited
+    int maxQueueWaitMs;         // how long one may wait for a slot, 0 = unlimited
+    uint64_t bytesPerSecond;    // response bytes read per origin, 0 = unlimited
+    uint64_t burstBytes;        // bucket size, 0 = one second's worth
+
+    OriginLimitConfig() : maxConcurrent(32), maxQueued(256), maxQueueWaitMs(10000),
+                          bytesPerSecond(0), burstBytes(0) {}
+};
+
+class OriginLimiter;
+
+// The right to run one exchange with an origin; it goes back to the
+// origin's queue when the last copy of the pointer is gone, so it can
+// travel with a relayed body.
+class OriginSlot {
+public:
+    OriginSlot(OriginLimiter& limiter, const std::string& origin)
+        : limiter_(limiter), origin_(origin) {}
+    ~OriginSlot();
+
+    OriginSlot(const OriginSlot&) = delete;
+    OriginSlot& operator=(const OriginSlot&) = delete;
+
+private:
+    OriginLimiter& limiter_;
+    std::string origin_;
+};
+
+// Shapes the traffic to each origin ("host:port"), shared by all event
+// loops. At most `maxConcurrent` exchanges run at a time; further ones
+// wait in a queue of their own origin and are started in arrival order,
+// on their own loop, as slots are given back, so a saturated origin holds
+// up neither other origins nor cache hits. A queue holds at most
+// `maxQueued` exchanges; the caller enforces `maxQueueWaitMs` and takes a
+// waiter out with withdraw(). Response bytes are metered by a token
+// bucket refilled at `bytesPerSecond`.
+class OriginLimiter {
+public:
+    typedef std::function<void(const std::shared_ptr<OriginSlot>&)> GrantCallback;
+    typedef uint64_t Ticket;
+
+    enum Admission {
+        GRANTED,    // `granted` has been called
+        QUEUED,     // `granted` will be posted once a slot is free
+        REJECTED    // the origin's queue is full
+    };
+
+    explicit OriginLimiter(const OriginLimitConfig& config = OriginLimitConfig());
+
+    OriginLimiter(const OriginLimiter&) = delete;
+    OriginLimiter& operator=(const OriginLimiter&) = delete;
+
+    bool enabled() const { return config_.maxConcurrent > 0 || config_.bytesPerSecond > 0; }
+    bool shapesBandwidth() const { return config_.bytesPerSecond > 0; }
+
+    int maxQueueWaitMs() const { return config_.maxQueueWaitMs; }
+
+    // Calls `granted` at once if the origin has a free slot; otherwise
+    // queues it to be posted to `reactor` later and sets `ticket`.
+    Admission acquire(const std::string& origin, Reactor& reactor, const GrantCallback& granted,
+                      Ticket& ticket);
+    // Takes a queued exchange out of line; does nothing if it got a slot.
+    void withdraw(const std::string& origin, Ticket ticket);
+
+    // Bytes that may be read from the origin now, up to `wanted`. If none,
+    // `waitMs` is how long until some may.
+    size_t allowance(const std::string& origin, size_t wanted, int& waitMs);
+    void consume(const std::string& origin, size_t bytes);
+
+    uint64_t queuedExchanges() const;   // had to wait for a slot
+    uint64_t rejectedExchanges() const; // found the queue full
+    uint64_t withdrawnExchanges() const; // left the queue without a slot
+    uint64_t throttledReads() const;    // reads put off by the bucket
+    size_t waitingExchanges() const;    // in the queues now
+
+private:
+    friend class OriginSlot;
+
+    struct Waiter {
+        Ticket ticket;
+        Reactor* reactor;
+        GrantCallback granted;
+    };
+
+    struct Origin {
+        size_t active;
+        std::deque<Waiter> waiters;
+        double tokens;
+        uint64_t refilledMs;
+
+        Origin() : active(0), tokens(0), refilledMs(0) {}
+    };
+
+    OriginLimitConfig config_;
+    mutable std::mutex mutex_;
+    std::map<std::string, Origin> origins_;
+    size_t waiting_;
+    Ticket nextTicket_;
+    uint64_t queued_;
+    uint64_t rejected_;
+    uint64_t withdrawn_;
+    uint64_t throttled_;
+
+    void release(const std::string& origin);
+    Origin& originLocked(const std::string& origin);
+    void refillLocked(Origin& state, uint64_t nowMs) const;
+    double burst() const;
+    void pruneLocked(std::map<std::string, Origin>::iterator it);
+};
+
+#endif // ORIGIN_LIMITER_HPP
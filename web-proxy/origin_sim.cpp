@@ -0,0 +1,355 @@
+// Origin stand-in for benchmarking the proxy offline. Serves synthetic
+// objects over HTTP/1.1 with keep-alive, one thread per connection.
+//
+//   ./origin_sim [options]
+//     --port N           listen port (9080)
+//     --size-min N       smallest object, bytes (1024)
+//     --size-max N       largest object, bytes (65536)
+//     --delay-ms N       latency added to every response (20)
+//     --jitter-ms N      random extra latency up to N ms (0)
+//     --cache-control S  Cache-Control of objects ("max-age=300"; "" = none)
+//     --etag             send ETag and answer If-None-Match with 304
+//     --fail-rate P      fraction of requests that fail (0)
+//     --fail-mode M      error | reset | truncate | stall (error)
+//     --stall-ms N       extra latency of a stalled response (2000)
+//
+// Objects are /obj/<id>. The size of an object is fixed by its id, spread
+// log-uniformly between the limits. Query parameters override the options
+// for one request: size, delay, cc, etag=0|1, fail=<mode>, status=<code>,
+// and type, the Content-Type of the object (application/octet-stream).
+// Every response carries X-Origin-Seq, a number no other response has, so
+// a client can tell a stored copy from a fresh one.
+
+#include <iostream>
+#include <string>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <strings.h>
+
+namespace {
+
+struct OriginConfig {
+    int port;
+    uint64_t sizeMin;
+    uint64_t sizeMax;
+    int delayMs;
+    int jitterMs;
+    std::string cacheControl;
+    bool etag;
+    double failRate;
+    std::string failMode;
+    int stallMs;
+
+    OriginConfig() : port(9080), sizeMin(1024), sizeMax(65536), delayMs(20), jitterMs(0),
+                     cacheControl("max-age=300"), etag(false), failRate(0), failMode("error"),
+                     stallMs(2000) {}
+};
+
+OriginConfig g_config;
+std::atomic<uint64_t> g_sequence(0);
+
+std::map<std::string, std::string> parseQuery(const std::string& query) {
+    std::map<std::string, std::string> params;
+    std::istringstream iss(query);
+    std::string item;
+    while (std::getline(iss, item, '&')) {
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            params[item] = "";
+        } else {
+            params[item.substr(0, eq)] = item.substr(eq + 1);
+        }
+    }
+    return params;
+}
+
+std::string param(const std::map<std::string, std::string>& params, const char* name,
+                  const std::string& fallback) {
+    std::map<std::string, std::string>::const_iterator it = params.find(name);
+    return it == params.end() ? fallback : it->second;
+}
+
+// Log-uniform between the limits, the same for an id on every request
+uint64_t objectSize(uint64_t id) {
+    if (g_config.sizeMax <= g_config.sizeMin) {
+        return g_config.sizeMin;
+    }
+    uint64_t h = id * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 29;
+    double u = static_cast<double>(h % 1000003) / 1000003.0;
+    double logMin = std::log(static_cast<double>(g_config.sizeMin));
+    double logMax = std::log(static_cast<double>(g_config.sizeMax));
+    return static_cast<uint64_t>(std::exp(logMin + u * (logMax - logMin)));
+}
+
+std::string headerValue(const std::string& head, const char* name) {
+    size_t nameLength = std::strlen(name);
+    size_t pos = head.find("\r\n");
+    while (pos != std::string::npos && pos + 2 < head.size()) {
+        size_t start = pos + 2;
+        size_t end = head.find("\r\n", start);
+        if (end == std::string::npos) {
+            end = head.size();
+        }
+        if (end - start > nameLength && head[start + nameLength] == ':' &&
+            strncasecmp(head.c_str() + start, name, nameLength) == 0) {
+            size_t value = head.find_first_not_of(" \t", start + nameLength + 1);
+            return value == std::string::npos || value > end ? "" : head.substr(value, end - value);
+        }
+        pos = end;
+    }
+    return "";
+}
+
+bool sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+// Closes with a RST rather than a FIN
+void resetConnection(int fd) {
+    struct linger lg;
+    lg.l_onoff = 1;
+    lg.l_linger = 0;
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    close(fd);
+}
+
+// Answers one request. Returns false if the connection must be dropped.
+bool respond(int fd, const std::string& head, std::mt19937& rng) {
+    std::string line = head.substr(0, head.find("\r\n"));
+    size_t sp1 = line.find(' ');
+    size_t sp2 = line.find(' ', sp1 + 1);
+    if (sp1 == std::string::npos || sp2 == std::string::npos) {
+        return false;
+    }
+    std::string target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    size_t schemeEnd = target.find("://");
+    if (schemeEnd != std::string::npos) {
+        size_t pathStart = target.find('/', schemeEnd + 3);
+        target = pathStart == std::string::npos ? "/" : target.substr(pathStart);
+    }
+    size_t queryStart = target.find('?');
+    std::string path = target.substr(0, queryStart);
+    std::map<std::string, std::string> params =
+        parseQuery(queryStart == std::string::npos ? "" : target.substr(queryStart + 1));
+
+    uint64_t id = path.compare(0, 5, "/obj/") == 0 ? std::strtoull(path.c_str() + 5, nullptr, 10) : 0;
+    uint64_t size = std::strtoull(param(params, "size", std::to_string(objectSize(id))).c_str(), nullptr, 10);
+    int delayMs = std::atoi(param(params, "delay", std::to_string(g_config.delayMs)).c_str());
+    std::string cacheControl = param(params, "cc", g_config.cacheControl);
+    bool etag = param(params, "etag", g_config.etag ? "1" : "0") == "1";
+    int status = std::atoi(param(params, "status", "200").c_str());
+    std::string contentType = param(params, "type", "application/octet-stream");
+
+    std::string failMode = param(params, "fail", "");
+    if (failMode.empty() && g_config.failRate > 0 &&
+        std::uniform_real_distribution<double>(0, 1)(rng) < g_config.failRate) {
+        failMode = g_config.failMode;
+    }
+    if (g_config.jitterMs > 0) {
+        delayMs += std::uniform_int_distribution<int>(0, g_config.jitterMs)(rng);
+    }
+    if (failMode == "stall") {
+        delayMs += g_config.stallMs;
+    }
+    if (delayMs > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+    }
+
+    if (failMode == "reset") {
+        return false;
+    }
+    if (failMode == "error") {
+        status = 503;
+    }
+
+    // The validator changes only with the object's size
+    std::string tag = "\"" + std::to_string(id) + "-" + std::to_string(size) + "\"";
+    std::ostringstream oss;
+    if (status == 200 && etag && headerValue(head, "If-None-Match") == tag) {
+        oss << "HTTP/1.1 304 Not Modified\r\n"
+            << "ETag: " << tag << "\r\n";
+        if (!cacheControl.empty()) {
+            oss << "Cache-Control: " << cacheControl << "\r\n";
+        }
+        oss << "X-Origin-Seq: " << ++g_sequence << "\r\n\r\n";
+        return sendAll(fd, oss.str());
+    }
+
+    std::string body;
+    if (status == 200) {
+        body.resize(size);
+        for (uint64_t i = 0; i < size; ++i) {
+            body[i] = static_cast<char>('a' + (id + i) % 26);
+        }
+    } else {
+        body = "simulated failure\n";
+    }
+    oss << "HTTP/1.1 " << status << (status == 200 ? " OK" : " Error") << "\r\n"
+        << "Content-Type: " << (status == 200 ? contentType : "text/plain") << "\r\n"
+        << "Content-Length: " << body.size() << "\r\n";
+    if (status != 200) {
+        oss << "Cache-Control: no-store\r\n";
+    } else if (!cacheControl.empty()) {
+        oss << "Cache-Control: " << cacheControl << "\r\n";
+    }
+    if (status == 200 && etag) {
+        oss << "ETag: " << tag << "\r\n";
+    }
+    oss << "X-Origin-Seq: " << ++g_sequence << "\r\n\r\n";
+
+    if (failMode == "truncate") {
+        // The promised length is never delivered
+        sendAll(fd, oss.str() + body.substr(0, body.size() / 2));
+        return false;
+    }
+    return sendAll(fd, oss.str() + body);
+}
+
+void serveConnection(int fd) {
+    std::mt19937 rng(static_cast<unsigned>(fd) ^ static_cast<unsigned>(
+        std::chrono::steady_clock::now().time_since_epoch().count()));
+    std::string input;
+    char buffer[16384];
+    for (;;) {
+        size_t headEnd;
+        while ((headEnd = input.find("\r\n\r\n")) == std::string::npos) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n <= 0) {
+                close(fd);
+                return;
+            }
+            input.append(buffer, n);
+        }
+        std::string head = input.substr(0, headEnd + 2);
+        // Request bodies are read and ignored
+        uint64_t bodyLength = std::strtoull(headerValue(head, "Content-Length").c_str(), nullptr, 10);
+        while (input.size() < headEnd + 4 + bodyLength) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n <= 0) {
+                close(fd);
+                return;
+            }
+            input.append(buffer, n);
+        }
+        input.erase(0, headEnd + 4 + bodyLength);
+
+        if (!respond(fd, head, rng)) {
+            resetConnection(fd);
+            return;
+        }
+        if (strcasecmp(headerValue(head, "Connection").c_str(), "close") == 0) {
+            close(fd);
+            return;
+        }
+    }
+}
+
+bool parseArgs(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--etag") {
+            g_config.etag = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--port") {
+            g_config.port = std::atoi(value.c_str());
+        } else if (arg == "--size-min") {
+            g_config.sizeMin = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--size-max") {
+            g_config.sizeMax = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--delay-ms") {
+            g_config.delayMs = std::atoi(value.c_str());
+        } else if (arg == "--jitter-ms") {
+            g_config.jitterMs = std::atoi(value.c_str());
+        } else if (arg == "--cache-control") {
+            g_config.cacheControl = value;
+        } else if (arg == "--fail-rate") {
+            g_config.failRate = std::atof(value.c_str());
+        } else if (arg == "--fail-mode") {
+            g_config.failMode = value;
+        } else if (arg == "--stall-ms") {
+            g_config.stallMs = std::atoi(value.c_str());
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    if (g_config.failMode != "error" && g_config.failMode != "reset" &&
+        g_config.failMode != "truncate" && g_config.failMode != "stall") {
+        std::cerr << "Unknown failure mode " << g_config.failMode << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (!parseArgs(argc, argv)) {
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(g_config.port);
+    if (bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        listen(listener, 1024) < 0) {
+        std::cerr << "Cannot listen on port " << g_config.port << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    std::cout << "Origin simulator on 127.0.0.1:" << g_config.port << ", objects "
+              << g_config.sizeMin << "-" << g_config.sizeMax << " bytes, delay "
+              << g_config.delayMs << " ms, failure rate " << g_config.failRate << std::endl;
+
+    for (;;) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EMFILE || errno == ENFILE) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        std::thread(serveConnection, fd).detach();
+    }
+    close(listener);
+    return 0;
+}
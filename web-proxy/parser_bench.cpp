@@ -0,0 +1,174 @@
+// Request parsing throughput: HttpRequestParser against the previous
+// istringstream/std::map parser, on whole heads, on heads arriving in
+// small reads and on chunked bodies.
+//
+//   make parser-bench && ./parser_bench [iterations]
+
+#include "http_message.hpp"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <map>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+
+const char kBrowserHead[] =
+    "GET http://www.example.com/assets/app/main.9f3c2a.js?v=20240101 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:121.0) Gecko/20100101 Firefox/121.0\r\n"
+    "Accept: */*\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Referer: http://www.example.com/\r\n"
+    "Cookie: session=4f1b9c0e7d2a4e6f8a1b3c5d7e9f0a2b; theme=dark; consent=1\r\n"
+    "Connection: keep-alive\r\n"
+    "Proxy-Connection: keep-alive\r\n"
+    "Sec-Fetch-Dest: script\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "If-None-Match: \"5e1f-17a3b2c4d5e\"\r\n"
+    "\r\n";
+
+const char kMinimalHead[] =
+    "GET http://127.0.0.1:9001/ HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9001\r\n"
+    "\r\n";
+
+struct BaselineRequest {
+    std::string method;
+    std::string url;
+    std::string version;
+    std::map<std::string, std::string> headers;
+};
+
+// The parser the proxy used before HttpRequestParser: one istringstream
+// for the head, another for the request line, a lowercased std::map entry
+// per field
+BaselineRequest baselineParse(const std::string& rawRequest) {
+    BaselineRequest request;
+    std::istringstream iss(rawRequest);
+    std::string line;
+    if (!std::getline(iss, line)) {
+        return request;
+    }
+    std::istringstream requestLine(line);
+    requestLine >> request.method >> request.url >> request.version;
+    if (!request.version.empty() && request.version.back() == '\r') {
+        request.version.pop_back();
+    }
+    while (std::getline(iss, line) && line != "\r" && !line.empty()) {
+        if (line.back() == '\r') {
+            line.pop_back();
+        }
+        size_t colonPos = line.find(':');
+        if (colonPos != std::string::npos) {
+            std::string key = line.substr(0, colonPos);
+            std::string value = line.substr(colonPos + 1);
+            value.erase(0, value.find_first_not_of(" \t"));
+            value.erase(value.find_last_not_of(" \t") + 1);
+            std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+            request.headers[key] = value;
+        }
+    }
+    return request;
+}
+
+// Previous receive path: the whole buffer was searched for the blank line
+// after every read, then parsed
+size_t baselineFeed(const std::string& input, size_t readSize) {
+    std::string buffer;
+    for (size_t pos = 0; pos < input.size(); pos += readSize) {
+        buffer.append(input, pos, readSize);
+        if (buffer.find("\r\n\r\n") != std::string::npos) {
+            return baselineParse(buffer).headers.size();
+        }
+    }
+    return 0;
+}
+
+size_t parserFeed(HttpRequestParser& parser, const std::string& input, size_t readSize) {
+    parser.reset();
+    for (size_t pos = 0; pos < input.size() && !parser.complete(); pos += readSize) {
+        parser.feed(input.data() + pos, std::min(readSize, input.size() - pos));
+    }
+    return parser.head().fieldCount() + parser.body().size();
+}
+
+std::string chunkedRequest(size_t bodySize, size_t chunkSize) {
+    std::ostringstream oss;
+    oss << "POST http://127.0.0.1:9001/upload HTTP/1.1\r\n"
+        << "Host: 127.0.0.1:9001\r\n"
+        << "Content-Type: application/octet-stream\r\n"
+        << "Transfer-Encoding: chunked\r\n\r\n";
+    std::string chunk(chunkSize, 'x');
+    for (size_t sent = 0; sent < bodySize; sent += chunkSize) {
+        size_t n = std::min(chunkSize, bodySize - sent);
+        oss << std::hex << n << "\r\n" << chunk.substr(0, n) << "\r\n";
+    }
+    oss << "0\r\n\r\n";
+    return oss.str();
+}
+
+template <typename Body>
+void measure(const std::string& name, const std::string& input, size_t iterations, Body body) {
+    size_t sink = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        sink += body();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << std::left << std::setw(44) << name << std::right << std::fixed
+              << std::setw(10) << std::setprecision(0) << iterations / seconds << " req/s"
+              << std::setw(10) << std::setprecision(1)
+              << input.size() * iterations / seconds / (1024 * 1024) << " MB/s"
+              << std::setw(9) << std::setprecision(0) << seconds * 1e9 / iterations << " ns/req"
+              << (sink == 0 ? " (no result)" : "") << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+    HttpRequestParser parser;
+
+    struct Case {
+        const char* name;
+        std::string input;
+    };
+    std::vector<Case> heads;
+    Case browser = {"browser head", kBrowserHead};
+    Case minimal = {"minimal head", kMinimalHead};
+    heads.push_back(browser);
+    heads.push_back(minimal);
+
+    for (size_t i = 0; i < heads.size(); ++i) {
+        const std::string& input = heads[i].input;
+        std::string name = heads[i].name;
+        std::cout << name << " (" << input.size() << " bytes)" << std::endl;
+        measure("  istringstream, one read", input, iterations,
+                [&]() { return baselineFeed(input, input.size()); });
+        measure("  HttpRequestParser, one read", input, iterations,
+                [&]() { return parserFeed(parser, input, input.size()); });
+        measure("  istringstream, 16-byte reads", input, iterations / 4,
+                [&]() { return baselineFeed(input, 16); });
+        measure("  HttpRequestParser, 16-byte reads", input, iterations / 4,
+                [&]() { return parserFeed(parser, input, 16); });
+    }
+
+    std::string upload = chunkedRequest(64 * 1024, 4096);
+    std::cout << "chunked upload (64 KB body in 4 KB chunks)" << std::endl;
+    measure("  HttpRequestParser, 16 KB reads", upload, iterations / 100,
+            [&]() { return parserFeed(parser, upload, 16384); });
+    std::string small = chunkedRequest(64 * 1024, 64);
+    std::cout << "chunked upload (64 KB body in 64-byte chunks)" << std::endl;
+    measure("  HttpRequestParser, 16 KB reads", small, iterations / 100,
+            [&]() { return parserFeed(parser, small, 16384); });
+    return 0;
+}
@@ -0,0 +1,351 @@
+#include "partial_cache.hpp"
+#include "cache_index.hpp"
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace {
+
+const char kMetaMagic[4] = {'P', 'X', 'P', '1'};
+
+#pragma pack(push, 1)
+// Metadata file: this header, then the key, header fields, ETag,
+// Last-Modified and the chunk bitmap (one bit per chunk)
+struct PartialMetaHeader {
+    char magic[4];
+    uint32_t keyLength;
+    uint32_t fieldsLength;
+    uint16_t etagLength;
+    uint16_t lastModifiedLength;
+    uint64_t totalLength;
+    int64_t expiresAt;
+    uint64_t chunkBytes;
+};
+#pragma pack(pop)
+
+bool endsWith(const std::string& s, const char* suffix) {
+    size_t n = std::strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+bool writeAll(int fd, const char* data, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+} // namespace
+
+bool PartialObject::complete() const {
+    return !chunks.empty() && std::find(chunks.begin(), chunks.end(), false) == chunks.end();
+}
+
+PartialObjectStore::PartialObjectStore(const std::string& dir, uint64_t chunkBytes, uint64_t maxBytes)
+    : dir_(dir), chunkBytes_(std::max<uint64_t>(chunkBytes, 4096)), maxBytes_(maxBytes), bytes_(0) {
+    if (mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Failed to create partial object directory: " + dir_);
+    }
+    loadAll();
+}
+
+std::string PartialObjectStore::basePath(const std::string& key) const {
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx",
+                  static_cast<unsigned long long>(CacheIndex::hashKey(key)));
+    return dir_ + "/" + name;
+}
+
+uint64_t PartialObjectStore::chunkLength(const PartialObject& object, size_t chunk) const {
+    uint64_t start = chunk * chunkBytes_;
+    return std::min(chunkBytes_, object.totalLength - start);
+}
+
+bool PartialObjectStore::lookup(const std::string& key, PartialObject& object) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unordered_map<std::string, Entry>::iterator it = entries_.find(key);
+    if (it == entries_.end()) {
+        return false;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+    object = it->second.object;
+    return true;
+}
+
+bool PartialObjectStore::store(const PartialObject& description, uint64_t offset, const std::string& data) {
+    if (description.totalLength == 0 || offset + data.size() > description.totalLength) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unordered_map<std::string, Entry>::iterator it = entries_.find(description.key);
+    if (it != entries_.end()) {
+        PartialObject& stored = it->second.object;
+        if (stored.etag == description.etag && stored.lastModified == description.lastModified &&
+            stored.totalLength == description.totalLength) {
+            stored.fields = description.fields;
+            stored.expiresAt = description.expiresAt;
+        } else {
+            // Another version: bytes of the two must never be combined
+            removeLocked(it);
+            it = entries_.end();
+        }
+    }
+
+    if (it == entries_.end()) {
+        std::string base = basePath(description.key);
+        // A different key with the same file name gives way
+        for (it = entries_.begin(); it != entries_.end(); ++it) {
+            if (it->second.object.dataPath == base + ".data") {
+                removeLocked(it);
+                break;
+            }
+        }
+        Entry entry;
+        entry.object = description;
+        entry.object.chunks.assign((description.totalLength + chunkBytes_ - 1) / chunkBytes_, false);
+        entry.object.dataPath = base + ".data";
+        entry.presentBytes = 0;
+        lru_.push_front(description.key);
+        entry.lru = lru_.begin();
+        it = entries_.insert(std::make_pair(description.key, entry)).first;
+        // A fresh file, so that readers of a replaced version keep theirs
+        std::remove(entry.object.dataPath.c_str());
+    } else {
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+    }
+
+    Entry& entry = it->second;
+    PartialObject& object = entry.object;
+    int fd = open(object.dataPath.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool written = writeAll(fd, data.data(), data.size(), offset);
+    ::close(fd);
+    if (!written) {
+        return false;
+    }
+
+    // Only chunks the new bytes cover entirely become present
+    uint64_t end = offset + data.size();
+    for (uint64_t chunk = (offset + chunkBytes_ - 1) / chunkBytes_;
+         chunk < object.chunks.size() && chunk * chunkBytes_ < end; ++chunk) {
+        uint64_t length = chunkLength(object, chunk);
+        if (!object.chunks[chunk] && chunk * chunkBytes_ + length <= end) {
+            object.chunks[chunk] = true;
+            entry.presentBytes += length;
+            bytes_ += length;
+        }
+    }
+    saveMetadata(object);
+
+    // The object just stored is at the front and stays
+    while (maxBytes_ > 0 && bytes_ > maxBytes_ && lru_.size() > 1) {
+        removeLocked(entries_.find(lru_.back()));
+    }
+    return true;
+}
+
+int PartialObjectStore::openRange(const std::string& key, const ByteRange& range, PartialObject& object) {
+    // Under the lock, so the file cannot be replaced by another version
+    // between the check and the open
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unordered_map<std::string, Entry>::iterator it = entries_.find(key);
+    if (it == entries_.end() || range.last >= it->second.object.totalLength ||
+        !missing(it->second.object, range).empty()) {
+        return -1;
+    }
+    int fd = open(it->second.object.dataPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+        object = it->second.object;
+    }
+    return fd;
+}
+
+void PartialObjectStore::erase(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unordered_map<std::string, Entry>::iterator it = entries_.find(key);
+    if (it != entries_.end()) {
+        removeLocked(it);
+    }
+}
+
+void PartialObjectStore::removeLocked(std::unordered_map<std::string, Entry>::iterator it) {
+    const std::string& dataPath = it->second.object.dataPath;
+    std::remove(dataPath.c_str());
+    std::remove((dataPath.substr(0, dataPath.size() - 5) + ".meta").c_str());
+    bytes_ -= it->second.presentBytes;
+    lru_.erase(it->second.lru);
+    entries_.erase(it);
+}
+
+std::vector<ByteRange> PartialObjectStore::missing(const PartialObject& object, const ByteRange& range) const {
+    std::vector<ByteRange> runs;
+    if (object.chunks.empty()) {
+        return runs;
+    }
+    uint64_t lastChunk = std::min<uint64_t>(range.last / chunkBytes_, object.chunks.size() - 1);
+    for (uint64_t chunk = range.first / chunkBytes_; chunk <= lastChunk; ++chunk) {
+        if (object.chunks[chunk]) {
+            continue;
+        }
+        uint64_t first = chunk * chunkBytes_;
+        uint64_t last = first + chunkLength(object, chunk) - 1;
+        if (!runs.empty() && runs.back().last + 1 == first) {
+            runs.back().last = last;
+        } else {
+            ByteRange run = {first, last};
+            runs.push_back(run);
+        }
+    }
+    return runs;
+}
+
+ByteRange PartialObjectStore::align(const ByteRange& range, uint64_t totalLength) const {
+    ByteRange aligned;
+    aligned.first = range.first / chunkBytes_ * chunkBytes_;
+    aligned.last = (range.last / chunkBytes_ + 1) * chunkBytes_ - 1;
+    if (totalLength > 0) {
+        aligned.last = std::min(aligned.last, totalLength - 1);
+    }
+    return aligned;
+}
+
+size_t PartialObjectStore::objectCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+uint64_t PartialObjectStore::bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+}
+
+bool PartialObjectStore::saveMetadata(const PartialObject& object) const {
+    PartialMetaHeader hdr;
+    std::memcpy(hdr.magic, kMetaMagic, sizeof(kMetaMagic));
+    hdr.keyLength = static_cast<uint32_t>(object.key.size());
+    hdr.fieldsLength = static_cast<uint32_t>(object.fields.size());
+    hdr.etagLength = static_cast<uint16_t>(std::min<size_t>(object.etag.size(), 0xFFFF));
+    hdr.lastModifiedLength = static_cast<uint16_t>(std::min<size_t>(object.lastModified.size(), 0xFFFF));
+    hdr.totalLength = object.totalLength;
+    hdr.expiresAt = object.expiresAt;
+    hdr.chunkBytes = chunkBytes_;
+
+    std::string bitmap((object.chunks.size() + 7) / 8, '\0');
+    for (size_t i = 0; i < object.chunks.size(); ++i) {
+        if (object.chunks[i]) {
+            bitmap[i / 8] = static_cast<char>(bitmap[i / 8] | (1 << (i % 8)));
+        }
+    }
+
+    // Write to a temporary file and rename, so a crash leaves the old metadata
+    std::string path = object.dataPath.substr(0, object.dataPath.size() - 5) + ".meta";
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        file.write(object.key.data(), object.key.size());
+        file.write(object.fields.data(), object.fields.size());
+        file.write(object.etag.data(), hdr.etagLength);
+        file.write(object.lastModified.data(), hdr.lastModifiedLength);
+        file.write(bitmap.data(), bitmap.size());
+        if (!file.good()) {
+            file.close();
+            std::remove(tempPath.c_str());
+            return false;
+        }
+    }
+    return std::rename(tempPath.c_str(), path.c_str()) == 0;
+}
+
+void PartialObjectStore::loadAll() {
+    DIR* dir = opendir(dir_.c_str());
+    if (!dir) {
+        return;
+    }
+    std::vector<std::string> names;
+    while (dirent* item = readdir(dir)) {
+        names.push_back(item->d_name);
+    }
+    closedir(dir);
+
+    for (size_t i = 0; i < names.size(); ++i) {
+        std::string path = dir_ + "/" + names[i];
+        if (endsWith(names[i], ".tmp")) {
+            std::remove(path.c_str());
+            continue;
+        }
+        if (!endsWith(names[i], ".meta")) {
+            continue;
+        }
+
+        PartialObject object;
+        object.dataPath = path.substr(0, path.size() - 5) + ".data";
+        std::ifstream file(path, std::ios::binary);
+        PartialMetaHeader hdr;
+        bool valid = file.read(reinterpret_cast<char*>(&hdr), sizeof(hdr)) &&
+                     std::memcmp(hdr.magic, kMetaMagic, sizeof(kMetaMagic)) == 0 &&
+                     hdr.chunkBytes == chunkBytes_ && hdr.totalLength > 0 &&
+                     hdr.keyLength < (1U << 20) && hdr.fieldsLength < (1U << 20);
+        std::string bitmap;
+        if (valid) {
+            object.key.resize(hdr.keyLength);
+            object.fields.resize(hdr.fieldsLength);
+            object.etag.resize(hdr.etagLength);
+            object.lastModified.resize(hdr.lastModifiedLength);
+            object.totalLength = hdr.totalLength;
+            object.expiresAt = static_cast<time_t>(hdr.expiresAt);
+            object.chunks.assign((hdr.totalLength + chunkBytes_ - 1) / chunkBytes_, false);
+            bitmap.resize((object.chunks.size() + 7) / 8);
+            valid = file.read(&object.key[0], object.key.size()) &&
+                    file.read(&object.fields[0], object.fields.size()) &&
+                    file.read(&object.etag[0], object.etag.size()) &&
+                    file.read(&object.lastModified[0], object.lastModified.size()) &&
+                    file.read(&bitmap[0], bitmap.size()) &&
+                    access(object.dataPath.c_str(), R_OK) == 0 &&
+                    basePath(object.key) + ".data" == object.dataPath;
+        }
+        file.close();
+        if (!valid || entries_.count(object.key)) {
+            std::remove(path.c_str());
+            std::remove(object.dataPath.c_str());
+            continue;
+        }
+
+        Entry entry;
+        entry.presentBytes = 0;
+        for (size_t c = 0; c < object.chunks.size(); ++c) {
+            object.chunks[c] = (bitmap[c / 8] >> (c % 8)) & 1;
+            if (object.chunks[c]) {
+                entry.presentBytes += chunkLength(object, c);
+            }
+        }
+        entry.object = object;
+        lru_.push_back(object.key);
+        entry.lru = --lru_.end();
+        bytes_ += entry.presentBytes;
+        entries_.insert(std::make_pair(object.key, entry));
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef PARTIAL_CACHE_HPP
+#define PARTIAL_CACHE_HPP
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+#include <ctime>
+#include "http_range.hpp"
+
+// What is known about an object of which only some byte ranges are
+// stored, and which of its fixed-size chunks are present.
+struct PartialObject {
+    std::string key;
+    std::string fields;             // end-to-end header fields, CRLF-terminated, no framing
+    std::string etag;
+    std::string lastModified;
+    uint64_t totalLength;
+    time_t expiresAt;
+    std::vector<bool> chunks;       // present chunks
+    std::string dataPath;           // sparse file holding the present bytes at their offsets
+
+    PartialObject() : totalLength(0), expiresAt(0) {}
+
+    bool complete() const;
+};
+
+// Partially cached objects (from 206 responses), stored in <dir> as a
+// sparse data file and a metadata file each. Only whole chunks count as
+// present, tracked in a bitmap per object, so that a range request needs
+// the origin only for the chunks it lacks. Objects are evicted whole in
+// LRU order beyond `maxBytes` of present chunks. Metadata survives
+// restarts: it is rewritten after every store and loaded at startup.
+class PartialObjectStore {
+public:
+    PartialObjectStore(const std::string& dir, uint64_t chunkBytes, uint64_t maxBytes);
+
+    PartialObjectStore(const PartialObjectStore&) = delete;
+    PartialObjectStore& operator=(const PartialObjectStore&) = delete;
+
+    uint64_t chunkBytes() const { return chunkBytes_; }
+
+    // Copies the metadata and marks the object most recently used.
+    bool lookup(const std::string& key, PartialObject& object);
+    // Writes `data` at `offset` into the object `description` stands for
+    // (its key, fields, validators, length and lifetime) and marks the
+    // chunks it covers entirely. An object stored with other validators
+    // or another length is replaced; one with the same validators only
+    // takes the new lifetime and fields.
+    bool store(const PartialObject& description, uint64_t offset, const std::string& data);
+    void erase(const std::string& key);
+    // Opens the data file if every chunk of `range` is present and copies
+    // the metadata it belongs to. Returns the descriptor, or -1.
+    int openRange(const std::string& key, const ByteRange& range, PartialObject& object);
+
+    // Chunks overlapping `range` that are not present, as byte ranges
+    // aligned to chunk boundaries; adjacent chunks are merged.
+    std::vector<ByteRange> missing(const PartialObject& object, const ByteRange& range) const;
+    // The chunk-aligned span around `range`, capped at `totalLength` if
+    // it is known (non-zero)
+    ByteRange align(const ByteRange& range, uint64_t totalLength) const;
+
+    size_t objectCount() const;
+    uint64_t bytes() const;
+
+private:
+    struct Entry {
+        PartialObject object;
+        uint64_t presentBytes;
+        std::list<std::string>::iterator lru;
+    };
+
+    std::string dir_;
+    uint64_t chunkBytes_;
+    uint64_t maxBytes_;
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+    std::list<std::string> lru_;    // most recently used first
+    uint64_t bytes_;
+
+    std::string basePath(const std::string& key) const;
+    uint64_t chunkLength(const PartialObject& object, size_t chunk) const;
+    void loadAll();
+    bool saveMetadata(const PartialObject& object) const;
+    void removeLocked(std::unordered_map<std::string, Entry>::iterator it);
+};
+
+#endif // PARTIAL_CACHE_HPP
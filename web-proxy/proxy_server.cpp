@@ -8,9 +8,198 @@
 #include <cstring>
 #include <stdexcept>
 #include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "body_compression.hpp"
 
-ProxyServer::ProxyServer(int port, const std::string& cacheDir)
-    : port_(port), cacheDir_(cacheDir), isRunning_(false) {
+namespace {
+
+// Label values of the metrics export may come from request headers
+std::string escapeLabel(const std::string& value) {
+    std::string escaped;
+    for (size_t i = 0; i < value.size(); ++i) {
+        if (value[i] == '\\' || value[i] == '"') {
+            escaped += '\\';
+            escaped += value[i];
+        } else if (value[i] == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped += value[i];
+        }
+    }
+    return escaped;
+}
+
+// More ranges than this, or more bytes in several ranges, get the whole
+// response instead (RFC 7233, 4.1 leaves that to the server)
+const size_t kMaxRanges = 16;
+const uint64_t kMaxMultipartBytes = 16 * 1024 * 1024;
+// Range requests sent to the origin for one client request before the
+// rest is passed through as it is
+const size_t kMaxRangeFetches = 8;
+// Longest stored response head read to answer a range request
+const size_t kMaxStoredHead = 64 * 1024;
+// Smaller bodies are stored as they are; a compressed body is only kept
+// if it saves at least a tenth
+const size_t kMinCompressBytes = 1024;
+const double kMaxCompressRatio = 0.9;
+
+uint64_t threadCpuNanos() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// Header fields describing the representation, for a response with other
+// framing: hop-by-hop fields, the framing and Content-Range are left out
+std::string representationFields(const std::vector<std::pair<std::string, std::string> >& fields,
+                                 bool withContentType) {
+    std::string out;
+    for (size_t i = 0; i < fields.size(); ++i) {
+        std::string name = fields[i].first;
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        if (name == "content-length" || name == "transfer-encoding" || name == "content-range" ||
+            (!withContentType && name == "content-type") || isHopByHopHeader(name)) {
+            continue;
+        }
+        out += fields[i].first + ": " + fields[i].second + "\r\n";
+    }
+    return out;
+}
+
+std::string rangeNotSatisfiable(uint64_t length) {
+    std::ostringstream oss;
+    oss << "HTTP/1.1 416 Range Not Satisfiable\r\n";
+    oss << "Content-Range: bytes */" << length << "\r\n";
+    oss << "Content-Length: 0\r\n";
+    oss << "\r\n";
+    return oss.str();
+}
+
+bool readFully(int fd, char* data, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pread(fd, data, len, static_cast<off_t>(offset));
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+void writeLatency(std::ostringstream& oss, const char* kind, const LatencyHistogram& histogram) {
+    static const double kQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+    for (size_t i = 0; i < sizeof(kQuantiles) / sizeof(kQuantiles[0]); ++i) {
+        oss << "proxy_latency_seconds{kind=\"" << kind << "\",quantile=\"" << kQuantiles[i]
+            << "\"} " << histogram.percentile(kQuantiles[i]) / 1e6 << "\n";
+    }
+    oss << "proxy_latency_seconds_sum{kind=\"" << kind << "\"} " << histogram.sumMicros / 1e6 << "\n";
+    oss << "proxy_latency_seconds_count{kind=\"" << kind << "\"} " << histogram.count << "\n";
+}
+
+// The gzip form is another representation, so a strong entity tag must
+// not be shared with the identity form: it gets a suffix inside the
+// quotes, which is taken off again when the body is decoded
+const char kGzipEtagSuffix[] = "-gzip";
+
+std::string gzipEtag(const std::string& etag) {
+    if (etag.size() < 2 || etag[etag.size() - 1] != '"') {
+        return etag;
+    }
+    return etag.substr(0, etag.size() - 1) + kGzipEtagSuffix + "\"";
+}
+
+std::string identityEtag(const std::string& etag) {
+    std::string suffix = std::string(kGzipEtagSuffix) + "\"";
+    if (etag.size() < suffix.size() + 1 || etag.compare(etag.size() - suffix.size(), suffix.size(), suffix) != 0) {
+        return etag;
+    }
+    return etag.substr(0, etag.size() - suffix.size()) + "\"";
+}
+
+// Head of the stored gzip form of a response with a body of
+// `bodyLength` bytes: the response's own fields with Content-Encoding,
+// Content-Length, Vary and the entity tag set.
+std::string gzipHead(const HttpResponseParser& head, uint64_t bodyLength) {
+    std::ostringstream oss;
+    oss << head.statusLine() << "\r\n";
+    std::string vary = head.header("vary");
+    const std::vector<std::pair<std::string, std::string> >& fields = head.headerFields();
+    for (size_t i = 0; i < fields.size(); ++i) {
+        std::string name = fields[i].first;
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        if (name == "etag") {
+            oss << fields[i].first << ": " << gzipEtag(fields[i].second) << "\r\n";
+        } else if (name != "content-length" && name != "vary") {
+            oss << fields[i].first << ": " << fields[i].second << "\r\n";
+        }
+    }
+    if (vary.empty()) {
+        oss << "Vary: Accept-Encoding\r\n";
+    } else if (!hasToken(vary, "accept-encoding")) {
+        oss << "Vary: " << vary << ", Accept-Encoding\r\n";
+    } else {
+        oss << "Vary: " << vary << "\r\n";
+    }
+    oss << "Content-Encoding: gzip\r\n";
+    oss << "Content-Length: " << bodyLength << "\r\n";
+    oss << "\r\n";
+    return oss.str();
+}
+
+// Whether the response the leader's request selected, given its head, is
+// also the one this request would get: every field named by Vary matches
+bool sameVariant(const ParsedRequest& request, const InFlightFetch& fetch, const std::string& head) {
+    HttpResponseParser parser = parseResponseHead(head);
+    if (!parser.headersComplete()) {
+        return false;
+    }
+    std::vector<std::string> names = parseVary(parser.header("vary"));
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (names[i] == "*" ||
+            normalizeVaryValue(names[i], request.head.get(names[i].c_str()).str()) !=
+                normalizeVaryValue(names[i], fetch.requestHeader(names[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A copy of the request for a storage pool task; the upload stream, if
+// any, stays with the client's event loop
+ParsedRequest storageCopy(const ParsedRequest& request) {
+    ParsedRequest copy = request;
+    copy.upload.reset();
+    return copy;
+}
+
+} // namespace
+
+ProxyServer::ProxyServer(int port, const std::string& cacheDir, const ProxyConfig& config)
+    : stopEvent_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), stopped_(false),
+      port_(port), cacheDir_(cacheDir), config_(config), isRunning_(false),
+      admissionFilter_(config.cacheMaxEntries > 0 ? config.cacheMaxEntries : 100000),
+      evictionStop_(false),
+      hotCache_(config.memoryCacheBytes, config.memoryCacheMaxObjectBytes),
+      negativeCache_(config.negativeCache),
+      warmupStop_(false), warmupDone_(false), originLimiter_(config.originLimits),
+      upstreamPool_(config.poolMaxIdlePerHost, config.poolMaxIdleSeconds),
+      nextReactor_(0), resolverPool_(std::max<size_t>(config.resolverThreads, 1)),
+      storagePool_(std::max<size_t>(config.storageThreads, 1)),
+      dnsCache_(resolverPool_, config.dnsCache) {
+    if (!stopEvent_.valid()) {
+        throw std::runtime_error("Failed to create eventfd");
+    }
+    
     // Create cache directory if it doesn't exist
     struct stat info;
     if (stat(cacheDir_.c_str(), &info) != 0) {
@@ -20,10 +209,35 @@ ProxyServer::ProxyServer(int port, const std::string& cacheDir)
     } else if (!(info.st_mode & S_IFDIR)) {
         throw std::runtime_error("Cache path exists but is not a directory: " + cacheDir_);
     }
+    
+    cacheIndex_.reset(new CacheIndex(cacheDir_));
+    partialCache_.reset(new PartialObjectStore(cacheDir_ + "/partial", config_.rangeChunkBytes,
+                                               config_.partialCacheMaxBytes));
+    
+    // The replacement policy is seeded from the index, not from the directory
+    cacheIndex_->forEach([this](uint64_t keyHash, uint64_t size, uint32_t frequency) {
+        evictionPolicy_.insert(keyHash, size, frequency);
+    });
+    evictionThread_ = std::thread(&ProxyServer::evictionLoop, this);
+    // Runs alongside serving; until an object is preloaded it is read from disk
+    warmupThread_ = std::thread(&ProxyServer::warmUp, this);
+    
+    upstreamContext_.pool = &upstreamPool_;
+    upstreamContext_.dns = &dnsCache_;
+    upstreamContext_.limiter = originLimiter_.enabled() ? &originLimiter_ : nullptr;
+    upstreamContext_.timeouts = config_.upstreamTimeouts;
+    upstreamContext_.log = [this](const std::string& message) { log(message); };
 }
 
 ProxyServer::~ProxyServer() {
     stop();
+    for (size_t i = 0; i < reactorThreads_.size(); ++i) {
+        if (reactorThreads_[i].joinable()) {
+            reactorThreads_[i].join();
+        }
+    }
+    // Lookups still running report to the DNS cache, which goes first
+    resolverPool_.stop();
 }
 
 void ProxyServer::start() {
@@ -48,227 +262,310 @@ void ProxyServer::start() {
         throw std::runtime_error("Failed to bind to port " + std::to_string(port_));
     }
     
-    if (listen(serverSocket_.get(), 10) < 0) {
+    if (listen(serverSocket_.get(), SOMAXCONN) < 0) {
         throw std::runtime_error("Failed to listen on socket");
     }
+    fcntl(serverSocket_.get(), F_SETFL, fcntl(serverSocket_.get(), F_GETFL, 0) | O_NONBLOCK);
     
     isRunning_ = true;
     log("Proxy server started on port " + std::to_string(port_));
     log("Cache directory: " + cacheDir_);
+    if (cacheIndex_->rebuiltFrom() > 0) {
+        log("Cache index rebuilt from " + std::to_string(cacheIndex_->rebuiltFrom()) + " object files");
+    }
+    log("Cache index: " + std::to_string(cacheIndex_->entryCount()) + " entries, " +
+        std::to_string(cacheIndex_->totalBytes()) + " bytes");
     
-    while (isRunning_) {
-        sockaddr_in clientAddr;
-        socklen_t clientLen = sizeof(clientAddr);
-        int clientSocket = accept(serverSocket_.get(), (struct sockaddr*)&clientAddr, &clientLen);
-        
+    // Connections are spread over a few event loops; the first one also
+    // accepts and runs on the calling thread
+    size_t reactorCount = std::max<size_t>(config_.reactorThreads, 1);
+    for (size_t i = 0; i < reactorCount; ++i) {
+        reactors_.push_back(std::unique_ptr<Reactor>(new Reactor()));
+    }
+    reactors_[0]->add(serverSocket_.get(), EPOLLIN,
+                      std::make_shared<FunctionEventHandler>([this](uint32_t) { acceptClients(); }));
+    // A stop requested before this point leaves the eventfd readable
+    reactors_[0]->add(stopEvent_.get(), EPOLLIN,
+                      std::make_shared<FunctionEventHandler>([this](uint32_t) { stopLoops(); }));
+    log("Serving clients on " + std::to_string(reactorCount) + " event loops");
+    
+    for (size_t i = 1; i < reactorCount; ++i) {
+        reactorThreads_.push_back(std::thread(&Reactor::run, reactors_[i].get()));
+    }
+    reactors_[0]->run();
+    
+    for (size_t i = 0; i < reactorThreads_.size(); ++i) {
+        reactorThreads_[i].join();
+    }
+    reactorThreads_.clear();
+}
+
+void ProxyServer::acceptClients() {
+    while (true) {
+        int clientSocket = accept4(serverSocket_.get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (clientSocket < 0) {
-            if (isRunning_) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK && isRunning_) {
                 log("Failed to accept connection");
             }
-            continue;
+            return;
         }
         
-        // Handle each client in a separate thread
-        std::thread(&ProxyServer::handleClient, this, clientSocket).detach();
+        // Round-robin over the event loops; the connection is created on
+        // the loop that will own it
+        Reactor* reactor = reactors_[nextReactor_++ % reactors_.size()].get();
+        reactor->post([this, reactor, clientSocket]() {
+            ClientPtr client = std::make_shared<ClientConnection>(
+                *reactor, clientSocket, config_.clientIdleTimeoutMs,
+                config_.clientKeepAliveTimeoutMs, config_.clientMaxRequests,
+                config_.maxRequestBodyBytes,
+                [this](const ClientPtr& conn, HttpRequestParser& parser) {
+                    handleRequest(conn, parser);
+                },
+                [this](const std::string& message) { log(message); });
+            client->start();
+        });
+    }
+}
+
+void ProxyServer::requestStop() {
+    uint64_t one = 1;
+    ssize_t ignored = write(stopEvent_.get(), &one, sizeof(one));
+    (void)ignored;
+}
+
+// Runs on the accepting event loop
+void ProxyServer::stopLoops() {
+    uint64_t value;
+    while (read(stopEvent_.get(), &value, sizeof(value)) > 0) {
+    }
+    isRunning_ = false;
+    for (size_t i = 0; i < reactors_.size(); ++i) {
+        reactors_[i]->stop();
     }
 }
 
 void ProxyServer::stop() {
+    if (stopped_.exchange(true)) {
+        return;
+    }
     isRunning_ = false;
+    for (size_t i = 0; i < reactors_.size(); ++i) {
+        reactors_[i]->stop();
+    }
     serverSocket_.close();
+    if (!reactors_.empty()) {
+        logStats();
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(evictionMutex_);
+        evictionStop_ = true;
+    }
+    evictionCond_.notify_all();
+    if (evictionThread_.joinable() && evictionThread_.get_id() != std::this_thread::get_id()) {
+        evictionThread_.join();
+    }
+    warmupStop_ = true;
+    if (warmupThread_.joinable()) {
+        warmupThread_.join();
+    }
+    // Objects still being stored are indexed before the flush
+    storagePool_.stop();
+    saveHotSet();
+    cacheIndex_->flush();
 }
 
-void ProxyServer::handleClient(int clientSocket) {
-    Socket clientSocketWrapper(clientSocket);
-    
+void ProxyServer::handleRequest(const ClientPtr& client, HttpRequestParser& parser) {
     try {
-        // Read request headers first
-        std::string rawRequest;
-        char buffer[8192] = {0};
-        ssize_t totalRead = 0;
-        
-        // Read until we get headers (empty line)
-        while (true) {
-            ssize_t bytesRead = recv(clientSocketWrapper.get(), buffer + totalRead, 
-                                     sizeof(buffer) - totalRead - 1, 0);
-            if (bytesRead <= 0) {
-                break;
-            }
-            totalRead += bytesRead;
-            buffer[totalRead] = '\0';
-            
-            // Check if we have complete headers
-            std::string temp(buffer, totalRead);
-            if (temp.find("\r\n\r\n") != std::string::npos) {
-                break;
-            }
-            
-            // Prevent buffer overflow
-            if (totalRead >= static_cast<ssize_t>(sizeof(buffer) - 1)) {
-                break;
-            }
+        if (client->requestCount() > 1) {
+            stats_.add(STAT_KEEPALIVE_REQUESTS);
         }
-        
-        if (totalRead <= 0) {
+        if (parser.failed()) {
+            int status = parser.errorStatus();
+            log("Rejecting malformed request (" + std::to_string(status) + ")");
+            stats_.add(STAT_ERRORS);
+            if (status == 431) {
+                sendResponse(client, createErrorResponse(431, "Request Header Fields Too Large",
+                                                         "Request head is too large"));
+            } else if (status == 413) {
+                sendResponse(client, createErrorResponse(413, "Payload Too Large",
+                                                         "Request body is too large"));
+            } else if (status == 501) {
+                sendResponse(client, createErrorResponse(501, "Not Implemented",
+                                                         "Unsupported transfer coding"));
+            } else {
+                sendResponse(client, createErrorResponse(400, "Bad Request", "Malformed request"));
+            }
             return;
         }
         
-        rawRequest.assign(buffer, totalRead);
-        log("Received request from client (" + std::to_string(totalRead) + " bytes)");
+        log("Received request from client (" + std::to_string(parser.head().raw().size()) +
+            " byte head, " + (client->upload() ? std::string("streamed body")
+                              : std::to_string(parser.body().size()) + " byte body") +
+            (parser.chunked() ? ", chunked" : "") + ")");
         
-        // Debug: print first line of request
-        size_t firstLineEnd = rawRequest.find("\r\n");
-        if (firstLineEnd != std::string::npos) {
-            log("Request line: " + rawRequest.substr(0, firstLineEnd));
-        }
-        
-        // Parse headers first to check if there's a body
-        ParsedRequest request = parseRequest(rawRequest);
+        ParsedRequest request = parseRequest(parser);
+        request.upload = client->upload();
+        log("Request line: " + request.method + " " + request.url + " " + request.version);
         
-        // Read body if Content-Length is specified
-        if (request.method == "POST" && request.headers.find("content-length") != request.headers.end()) {
-            int contentLength = std::stoi(request.headers["content-length"]);
-            if (contentLength > 0) {
-                // Find where headers end
-                size_t headerEnd = rawRequest.find("\r\n\r\n");
-                if (headerEnd != std::string::npos) {
-                    headerEnd += 4;
-                    size_t bodyRead = rawRequest.length() - headerEnd;
-                    
-                    // Read remaining body if needed
-                    if (bodyRead < static_cast<size_t>(contentLength)) {
-                        std::vector<char> bodyBuffer(contentLength - bodyRead);
-                        ssize_t bytesRead = recv(clientSocketWrapper.get(), bodyBuffer.data(), 
-                                                 bodyBuffer.size(), 0);
-                        if (bytesRead > 0) {
-                            rawRequest.append(bodyBuffer.data(), bytesRead);
-                        }
-                    }
-                }
-            }
+        // After a CONNECT head the bytes already received belong to the tunnel
+        if (request.method == "CONNECT") {
+            request.body = client->takeBufferedInput();
         }
         
-        // Re-parse with full request including body
-        request = parseRequest(rawRequest);
-        
-        if (request.method.empty()) {
-            log("Failed to parse request - method is empty");
-            log("Raw request (first 200 chars): " + rawRequest.substr(0, 200));
-            sendResponse(clientSocketWrapper.get(), createErrorResponse(400, "Bad Request", "Failed to parse request"));
-            return;
-        }
+        processRequest(client, request);
+    } catch (const std::exception& e) {
+        log("Error handling client: " + std::string(e.what()));
+        stats_.add(STAT_ERRORS);
+        sendResponse(client, createErrorResponse(500, "Internal Server Error", "Proxy server error: " + std::string(e.what())));
+    }
+}
+
+void ProxyServer::processRequest(const ClientPtr& client, const ParsedRequest& request) {
+    uint64_t startedUs = ProxyStats::nowMicros();
+    
+    if (request.method.empty()) {
+        log("Failed to parse request - method is empty");
+        sendResponse(client, createErrorResponse(400, "Bad Request", "Failed to parse request"));
+        return;
+    }
+    
+    // A request for the proxy itself rather than through it
+    if (!config_.statsPath.empty() && request.method == "GET" && request.url == config_.statsPath) {
+        serveStats(client);
+        return;
+    }
+    
+    stats_.add(STAT_REQUESTS);
+    
+    // CONNECT (HTTPS): bytes are relayed blindly, nothing is cached
+    if (request.method == "CONNECT") {
+        openTunnel(client, request);
+        return;
+    }
+    
+    if (request.host.empty()) {
+        log("Failed to parse request - host is empty");
+        sendResponse(client, createErrorResponse(400, "Bad Request", "Host header is missing"));
+        return;
+    }
+    
+    log("Request: " + request.method + " http://" + request.host + ":" + std::to_string(request.port) + request.path);
+    
+    std::string cacheKey = generateCacheKey(request);
+    // The key the response is stored under: the URL's own, or that of the
+    // variant this request selects if the URL's responses vary
+    std::string objectKey = cacheKey;
+    
+    // Check cache for GET requests
+    CacheEntry entry;
+    bool found = request.method == "GET" && lookupObject(request, cacheKey, objectKey, entry);
+    if (request.method == "GET") {
+        // Hits and misses alike count towards admission
+        admissionFilter_.record(CacheIndex::hashKey(objectKey));
+    }
+    if (found && entry.statusCode == 200) {
+        time_t now = std::time(nullptr);
+        bool usable = clientAcceptsStoredCopy(request);
+        bool fresh = usable && now < entry.expiresAt;
+        bool staleWhileRevalidate = usable && !fresh &&
+                                    now < entry.expiresAt + entry.staleWhileRevalidate;
         
-        // Handle CONNECT method for HTTPS (basic support)
-        if (request.method == "CONNECT") {
-            log("CONNECT request received (HTTPS tunneling not fully supported)");
-            sendResponse(clientSocketWrapper.get(), createErrorResponse(501, "Not Implemented", "HTTPS tunneling (CONNECT) is not supported"));
+        if (!fresh && !staleWhileRevalidate) {
+            // The origin decides; the client is answered when it replied
+            revalidate(client->reactor(), client, request, objectKey, entry);
             return;
         }
         
-        if (request.host.empty()) {
-            log("Failed to parse request - host is empty");
-            log("Raw request (first 200 chars): " + rawRequest.substr(0, 200));
-            sendResponse(clientSocketWrapper.get(), createErrorResponse(400, "Bad Request", "Host header is missing"));
+        if (request.head.has("range") && serveCachedRange(client, request, objectKey, entry)) {
+            recordCacheHit(objectKey);
+            if (fresh) {
+                log("Cache HIT (range): " + request.host + request.path);
+            } else {
+                log("Cache HIT (range, stale, revalidating in background): " + request.host + request.path);
+                startBackgroundRevalidation(client->reactor(), request, objectKey);
+            }
+            stats_.add(STAT_CACHE_HITS);
+            stats_.add(STAT_RANGE_HITS);
+            stats_.recordLatency(LATENCY_CACHE_HIT, ProxyStats::nowMicros() - startedUs);
             return;
         }
         
-        log("Request: " + request.method + " http://" + request.host + ":" + std::to_string(request.port) + request.path);
-        
-        updateStats(false, false);
-        
-        std::string cacheKey = generateCacheKey(request);
-        std::string response;
-        bool cacheHit = false;
-        
-        // Check cache for GET requests
-        if (request.method == "GET" && isCached(cacheKey)) {
-            CacheEntry entry = getCacheEntry(cacheKey);
-            if (entry.statusCode == 200) {
-                std::ifstream file(entry.filePath, std::ios::binary);
-                if (file.is_open()) {
-                    std::stringstream buffer;
-                    buffer << file.rdbuf();
-                    response = buffer.str();
-                    cacheHit = true;
-                    log("Cache HIT: " + request.host + request.path);
-                    updateStats(true, false);
-                }
+        // An object too large for the memory cache is sent from its file
+        bool served = false;
+        if (entry.size > hotCache_.maxObjectBytes()) {
+            served = sendObjectFile(client, request, objectKey, entry);
+        } else {
+            std::string response = readCachedResponse(objectKey, entry);
+            if (!response.empty()) {
+                sendStored(client, request, response, entry.compressed);
+                served = true;
             }
         }
-        
-        // Cache miss or POST request - fetch from server
-        if (!cacheHit) {
-            log("Cache MISS: " + request.host + request.path);
-            updateStats(false, false);
-            
-            response = fetchFromServer(request);
-            
-            // Cache successful responses (not 404)
-            if (!response.empty() && shouldCache(extractStatusCode(response))) {
-                saveToCache(cacheKey, response, extractStatusCode(response));
+        if (served) {
+            recordCacheHit(objectKey);
+            if (fresh) {
+                log("Cache HIT: " + request.host + request.path);
+            } else {
+                log("Cache HIT (stale, revalidating in background): " + request.host + request.path);
+                startBackgroundRevalidation(client->reactor(), request, objectKey);
             }
-        }
-        
-        if (response.empty()) {
-            log("Warning: Empty response generated");
-            response = createErrorResponse(500, "Internal Server Error", "Proxy server error");
-        }
-        
-        sendResponse(clientSocketWrapper.get(), response);
-        log("Response sent to client");
-        
-    } catch (const std::exception& e) {
-        log("Error handling client: " + std::string(e.what()));
-        updateStats(false, true);
-        try {
-            sendResponse(clientSocketWrapper.get(), createErrorResponse(500, "Internal Server Error", "Proxy server error: " + std::string(e.what())));
-        } catch (...) {
-            // Ignore errors when sending error response
+            stats_.add(STAT_CACHE_HITS);
+            stats_.recordLatency(LATENCY_CACHE_HIT, ProxyStats::nowMicros() - startedUs);
+            return;
         }
     }
-}
-
-ParsedRequest ProxyServer::parseRequest(const std::string& rawRequest) {
-    ParsedRequest request;
-    std::istringstream iss(rawRequest);
-    std::string line;
     
-    // Parse request line
-    if (!std::getline(iss, line)) {
-        return request;
+    // Redirects, missing objects and upstream failures seen recently
+    std::string negative;
+    if (request.method == "GET" && !request.head.has("authorization") &&
+        clientAcceptsStoredCopy(request) &&
+        negativeCache_.lookup(cacheKey, negative, std::time(nullptr))) {
+        log("Cache HIT (negative): " + request.host + request.path);
+        stats_.add(STAT_CACHE_HITS);
+        stats_.add(STAT_NEGATIVE_HITS);
+        stats_.recordLatency(LATENCY_CACHE_HIT, ProxyStats::nowMicros() - startedUs);
+        sendResponse(client, negative);
+        return;
     }
     
-    std::istringstream requestLine(line);
-    requestLine >> request.method >> request.url >> request.version;
-    
-    // Remove trailing \r
-    if (!request.version.empty() && request.version.back() == '\r') {
-        request.version.pop_back();
+    // Objects of which only byte ranges are stored, and range requests
+    if (request.method == "GET" && servePartial(client, request, cacheKey, startedUs)) {
+        return;
     }
     
-    // Parse headers
-    while (std::getline(iss, line) && line != "\r" && !line.empty()) {
-        if (line.back() == '\r') {
-            line.pop_back();
-        }
-        
-        size_t colonPos = line.find(':');
-        if (colonPos != std::string::npos) {
-            std::string key = line.substr(0, colonPos);
-            std::string value = line.substr(colonPos + 1);
-            
-            // Trim whitespace
-            value.erase(0, value.find_first_not_of(" \t"));
-            value.erase(value.find_last_not_of(" \t") + 1);
-            
-            // Convert to lowercase for consistency
-            std::transform(key.begin(), key.end(), key.begin(), ::tolower);
-            request.headers[key] = value;
-        }
+    // Cache miss or POST request - fetch from server
+    log("Cache MISS: " + request.host + request.path);
+    stats_.add(STAT_CACHE_MISSES);
+    
+    // Concurrent misses for the same object share one upstream fetch.
+    // Requests with credentials may get per-user responses, and range
+    // requests other parts of it, so they always fetch on their own.
+    if (request.method == "GET" && !request.head.has("authorization") && !request.head.has("range") &&
+        !request.upload) {
+        relayCoalesced(client, request, objectKey);
+        return;
     }
     
+    std::shared_ptr<InFlightFetch> response = std::make_shared<InFlightFetch>();
+    startFetch(client->reactor(), request, cacheKey, response, false);
+    client->streamFrom(response);
+}
+
+ParsedRequest ProxyServer::parseRequest(HttpRequestParser& parser) {
+    ParsedRequest request;
+    request.head = parser.takeHead();
+    request.body = parser.takeBody();
+    request.method = request.head.method().str();
+    request.url = request.head.target().str();
+    request.version = request.head.version().str();
+    
     // Extract host and port
     // First, try to extract from URL (for proxy requests, URL contains full URL)
+    StringRef hostField = request.head.get("host");
     if (request.url.find("http://") == 0 || request.url.find("https://") == 0) {
         size_t protocolEnd = request.url.find("://") + 3;
         size_t pathStart = request.url.find('/', protocolEnd);
@@ -290,9 +587,9 @@ ParsedRequest ProxyServer::parseRequest(const std::string& rawRequest) {
             request.port = (request.url.find("https://") == 0) ? 443 : 80;
         }
         request.path = request.url.substr(pathStart);
-    } else if (request.headers.find("host") != request.headers.end()) {
+    } else if (!hostField.empty()) {
         // Extract from Host header
-        std::string hostHeader = request.headers["host"];
+        std::string hostHeader = hostField.str();
         size_t colonPos = hostHeader.find(':');
         if (colonPos != std::string::npos) {
             request.host = hostHeader.substr(0, colonPos);
@@ -322,18 +619,6 @@ ParsedRequest ProxyServer::parseRequest(const std::string& rawRequest) {
         request.path = "/";
     }
     
-    // Read body for POST requests
-    if (request.method == "POST") {
-        // Find where headers end
-        size_t headerEnd = rawRequest.find("\r\n\r\n");
-        if (headerEnd != std::string::npos) {
-            headerEnd += 4; // Skip "\r\n\r\n"
-            if (headerEnd < rawRequest.length()) {
-                request.body = rawRequest.substr(headerEnd);
-            }
-        }
-    }
-    
     return request;
 }
 
@@ -342,204 +627,1652 @@ std::string ProxyServer::generateCacheKey(const ParsedRequest& request) {
 }
 
 std::string ProxyServer::getCacheFilePath(const std::string& cacheKey) {
-    std::string safeKey = sanitizeFilename(cacheKey);
-    return cacheDir_ + "/" + safeKey;
+    return cacheIndex_->objectPath(CacheIndex::hashKey(cacheKey));
 }
 
-std::string ProxyServer::sanitizeFilename(const std::string& filename) const {
-    std::string result;
-    for (char c : filename) {
-        if (std::isalnum(c) || c == '.' || c == '-' || c == '_' || c == '/') {
-            if (c == '/') {
-                result += '_';
-            } else {
-                result += c;
-            }
-        } else {
-            result += '_';
+bool ProxyServer::getCacheEntry(const std::string& cacheKey, CacheEntry& entry) {
+    // Answered from the memory-mapped index alone
+    return cacheIndex_->lookup(CacheIndex::hashKey(cacheKey), entry);
+}
+
+bool ProxyServer::lookupObject(const ParsedRequest& request, const std::string& cacheKey,
+                               std::string& objectKey, CacheEntry& entry) {
+    objectKey = cacheKey;
+    if (!getCacheEntry(cacheKey, entry)) {
+        return false;
+    }
+    if (!entry.isVaryMarker()) {
+        return true;
+    }
+    // The marker is consulted by every request for the URL, so it ages
+    // with all of them rather than with any one variant
+    recordCacheHit(cacheKey);
+    
+    std::vector<std::string> names;
+    if (!varyNames(cacheKey, entry, names)) {
+        return false;
+    }
+    uint64_t varyHash = entry.varyHash;
+    objectKey = variantKey(request, cacheKey, names);
+    return getCacheEntry(objectKey, entry) && entry.varyHash == varyHash;
+}
+
+bool ProxyServer::varyNames(const std::string& cacheKey, const CacheEntry& marker,
+                            std::vector<std::string>& names) {
+    {
+        std::lock_guard<std::mutex> lock(varyMutex_);
+        std::map<uint64_t, std::vector<std::string> >::const_iterator it = varySpecs_.find(marker.varyHash);
+        if (it != varySpecs_.end()) {
+            names = it->second;
+            return true;
         }
     }
-    return result;
+    
+    // Not seen since startup: the marker object holds the field names
+    CacheEntry stored;
+    std::string spec;
+    if (!CacheIndex::readObject(marker.filePath, stored, &spec) || stored.key != cacheKey ||
+        CacheIndex::hashKey(spec) != marker.varyHash) {
+        return false;
+    }
+    names = parseVary(spec);
+    std::lock_guard<std::mutex> lock(varyMutex_);
+    varySpecs_[marker.varyHash] = names;
+    return true;
 }
 
-bool ProxyServer::isCached(const std::string& cacheKey) {
-    std::lock_guard<std::mutex> lock(cacheMutex_);
-    std::string filePath = getCacheFilePath(cacheKey);
-    std::ifstream file(filePath);
-    return file.good();
+std::string ProxyServer::variantKey(const ParsedRequest& request, const std::string& cacheKey,
+                                    const std::vector<std::string>& names) const {
+    std::string key = cacheKey;
+    for (size_t i = 0; i < names.size(); ++i) {
+        key += "\n" + names[i] + ":" + normalizeVaryValue(names[i], request.head.get(names[i].c_str()).str());
+    }
+    return key;
 }
 
-CacheEntry ProxyServer::getCacheEntry(const std::string& cacheKey) {
-    std::lock_guard<std::mutex> lock(cacheMutex_);
+// Compression and the object write run on the storage pool; until they
+// are done, requests for the object miss.
+void ProxyServer::saveToCache(const ParsedRequest& request, const std::string& response) {
+    ParsedRequest copy = storageCopy(request);
+    storagePool_.submit([this, copy, response]() {
+        storeResponse(copy, response);
+    });
+}
+
+// The same for a response whose body was spooled as it arrived; the spool
+// is kept until the task is done with it.
+void ProxyServer::saveToCache(const ParsedRequest& request, const HttpResponseParser& received,
+                              const std::shared_ptr<BodySpool>& body) {
+    ParsedRequest copy = storageCopy(request);
+    std::string identityHead = received.normalizedHead(body->size());
+    storagePool_.submit([this, copy, identityHead, body]() {
+        storeSpooled(copy, identityHead, *body);
+    });
+}
+
+// Runs on the storage pool.
+void ProxyServer::storeResponse(const ParsedRequest& request, const std::string& response) {
+    HttpResponseParser head = parseResponseHead(response);
+    std::string cacheKey;
     CacheEntry entry;
-    entry.filePath = getCacheFilePath(cacheKey);
+    std::string spec;
+    if (!prepareEntry(request, head, response.size(), cacheKey, entry, spec)) {
+        return;
+    }
     
-    struct stat fileInfo;
-    if (stat(entry.filePath.c_str(), &fileInfo) == 0) {
-        entry.timestamp = fileInfo.st_mtime;
+    // Compressed outside the lock; the object is stored in whichever form
+    std::string compressed;
+    entry.compressed = compressResponse(response, compressed);
+    const std::string& stored = entry.compressed ? compressed : response;
+    entry.size = stored.size();
+    storeObject(cacheKey, spec, CacheIndex::hashKey(entry.key), entry, [&entry, &stored](const std::string& path) {
+        return CacheIndex::writeObject(path, entry, stored);
+    }, stored);
+}
+
+// storeResponse for a spooled body: it is compressed and copied into the
+// object file in pieces, and only read back if it is small enough for the
+// memory cache.
+void ProxyServer::storeSpooled(const ParsedRequest& request, const std::string& identityHead,
+                               const BodySpool& body) {
+    HttpResponseParser head = parseResponseHead(identityHead);
+    std::string cacheKey;
+    CacheEntry entry;
+    std::string spec;
+    if (!prepareEntry(request, head, identityHead.size() + body.size(), cacheKey, entry, spec)) {
+        return;
     }
     
-    // Try to read status code from metadata file
-    std::string metaPath = entry.filePath + ".meta";
-    std::ifstream metaFile(metaPath);
-    if (metaFile.is_open()) {
-        std::string line;
-        if (std::getline(metaFile, line)) {
-            entry.statusCode = std::stoi(line);
-        }
-        if (std::getline(metaFile, line)) {
-            entry.lastModified = line;
-        }
+    std::string storedHead = identityHead;
+    std::unique_ptr<BodySpool> compressed;
+    entry.compressed = compressSpooled(head, body, storedHead, compressed);
+    const BodySpool& storedBody = entry.compressed ? *compressed : body;
+    entry.size = storedHead.size() + storedBody.size();
+    std::string response;
+    if (entry.size <= hotCache_.maxObjectBytes() && storedBody.readAll(response)) {
+        response.insert(0, storedHead);
     } else {
-        entry.statusCode = 200; // Assume 200 if no metadata
+        response.clear();
     }
-    
-    return entry;
+    storeObject(cacheKey, spec, CacheIndex::hashKey(entry.key), entry,
+                [&entry, &storedHead, &storedBody](const std::string& path) {
+        return CacheIndex::writeObject(path, entry, storedHead, storedBody.fd(), storedBody.size());
+    }, response);
 }
 
-void ProxyServer::saveToCache(const std::string& cacheKey, const std::string& response, int statusCode) {
-    std::lock_guard<std::mutex> lock(cacheMutex_);
-    
-    std::string filePath = getCacheFilePath(cacheKey);
+// Fills in the entry for a response of `size` bytes about to be stored.
+// Returns false if admission turns it away.
+bool ProxyServer::prepareEntry(const ParsedRequest& request, const HttpResponseParser& head, uint64_t size,
+                               std::string& cacheKey, CacheEntry& entry, std::string& spec) {
+    cacheKey = generateCacheKey(request);
+    entry.key = cacheKey;
+    entry.statusCode = head.statusCode();
+    entry.timestamp = std::time(nullptr);
+    Freshness freshness = computeFreshness(head.headers(), entry.timestamp);
+    entry.expiresAt = freshness.expiresAt;
+    entry.staleWhileRevalidate = freshness.staleWhileRevalidate;
+    entry.etag = head.header("etag");
+    entry.lastModified = head.header("last-modified");
     
-    // Create directory structure if needed
-    size_t lastSlash = filePath.find_last_of('/');
-    if (lastSlash != std::string::npos) {
-        std::string dir = filePath.substr(0, lastSlash);
-        struct stat info;
-        if (stat(dir.c_str(), &info) != 0) {
-            // Create directory recursively would be better, but for simplicity...
-            // For now, just use flat structure
+    // A response that varies is stored as the variant the request selects,
+    // behind a marker under the URL's own key that lists the fields. The
+    // origin's Vary is used, not the one compression adds.
+    std::vector<std::string> names = parseVary(head.header("vary"));
+    if (!names.empty()) {
+        for (size_t i = 0; i < names.size(); ++i) {
+            spec += (i == 0 ? "" : ", ") + names[i];
         }
+        entry.varyHash = CacheIndex::hashKey(spec);
+        entry.key = variantKey(request, cacheKey, names);
+        std::lock_guard<std::mutex> lock(varyMutex_);
+        varySpecs_[entry.varyHash] = names;
     }
     
-    // Save response to file
-    std::ofstream file(filePath, std::ios::binary);
-    if (file.is_open()) {
-        file.write(response.c_str(), response.size());
-        file.close();
-        
-        // Save metadata
-        std::string metaPath = filePath + ".meta";
-        std::ofstream metaFile(metaPath);
-        if (metaFile.is_open()) {
-            metaFile << statusCode << "\n";
-            metaFile << std::time(nullptr) << "\n";
-            metaFile.close();
-        }
+    if (!admitToCache(CacheIndex::hashKey(entry.key))) {
+        stats_.add(STAT_ADMISSION_REJECTS);
+        stats_.add(STAT_ADMISSION_REJECTED_BYTES, size);
+        return false;
     }
+    return true;
 }
 
-std::string ProxyServer::fetchFromServer(const ParsedRequest& request) {
-    Socket serverSocket;
-    
-    // Resolve hostname
-    struct hostent* hostEntry = gethostbyname(request.host.c_str());
-    if (!hostEntry) {
-        log("Failed to resolve hostname: " + request.host);
-        return createErrorResponse(502, "Bad Gateway", "Failed to resolve hostname");
+// Writes the object with `write` to a staging file, then renames it into
+// place and indexes it under cacheMutex_, so the lock is not held while
+// the body is copied. `response` is the stored form for the memory cache,
+// or empty if it is not to be kept there.
+void ProxyServer::storeObject(const std::string& cacheKey, const std::string& spec, uint64_t keyHash,
+                              const CacheEntry& entry, const std::function<bool(const std::string&)>& write,
+                              const std::string& response) {
+    // An object that alone exceeds the size limit would evict everything
+    if (config_.cacheMaxBytes > 0 && entry.size > config_.cacheMaxBytes) {
+        return;
     }
     
-    // Create socket
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd < 0) {
-        log("Failed to create socket for server connection");
-        return createErrorResponse(502, "Bad Gateway", "Failed to create socket");
+    std::string path = cacheIndex_->objectPath(keyHash);
+    std::string staged = CacheIndex::stagingPath(path);
+    if (!write(staged)) {
+        log("Failed to write cache object for " + entry.key);
+        return;
     }
-    serverSocket = Socket(fd);
-    
-    // Connect to server
-    sockaddr_in serverAddr;
-    std::memset(&serverAddr, 0, sizeof(serverAddr));
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(request.port);
-    std::memcpy(&serverAddr.sin_addr, hostEntry->h_addr_list[0], hostEntry->h_length);
-    
-    if (connect(serverSocket.get(), (struct sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
-        log("Failed to connect to server: " + request.host + ":" + std::to_string(request.port));
-        return createErrorResponse(502, "Bad Gateway", "Failed to connect to server");
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex_);
+        if (entry.varyHash != 0 && !storeVaryMarker(cacheKey, entry.varyHash, spec)) {
+            log("Failed to write Vary marker for " + cacheKey);
+            std::remove(staged.c_str());
+            return;
+        }
+        if (std::rename(staged.c_str(), path.c_str()) != 0) {
+            log("Failed to write cache object for " + entry.key);
+            std::remove(staged.c_str());
+            return;
+        }
+        cacheIndex_->put(keyHash, entry);
+        evictionPolicy_.insert(keyHash, entry.size);
+        // Ranges are served from the full response from now on
+        partialCache_->erase(cacheKey);
+        negativeCache_.erase(cacheKey);
+        if (!response.empty() && response.size() <= hotCache_.maxObjectBytes()) {
+            std::shared_ptr<HotObject> object = std::make_shared<HotObject>();
+            object->key = entry.key;
+            object->etag = entry.etag;
+            object->lastModified = entry.lastModified;
+            object->response = response;
+            object->compressed = entry.compressed;
+            hotCache_.put(keyHash, object);
+        }
     }
     
-    // Build request to forward
-    std::ostringstream requestStream;
-    requestStream << request.method << " " << request.path << " " << request.version << "\r\n";
-    
-    // Forward headers, but modify Host header
-    for (const auto& header : request.headers) {
-        if (header.first != "host" && header.first != "connection" && 
-            header.first != "proxy-connection") {
-            requestStream << header.first << ": " << header.second << "\r\n";
-        }
+    if (overCacheLimits(1.0)) {
+        evictionCond_.notify_one();
     }
-    requestStream << "Host: " << request.host;
-    if (request.port != 80) {
-        requestStream << ":" << request.port;
+}
+
+// Called with cacheMutex_ held. The marker is only rewritten when the URL
+// has none yet or its responses now vary on other fields; the variants
+// stored for other fields stay until evicted, as no lookup reaches them.
+bool ProxyServer::storeVaryMarker(const std::string& cacheKey, uint64_t varyHash, const std::string& spec) {
+    uint64_t keyHash = CacheIndex::hashKey(cacheKey);
+    CacheEntry current;
+    if (cacheIndex_->lookup(keyHash, current) && current.varyHash == varyHash) {
+        return true;
     }
-    requestStream << "\r\n";
-    requestStream << "Connection: close\r\n";
-    requestStream << "\r\n";
-    
-    // Add body for POST requests
-    if (request.method == "POST" && !request.body.empty()) {
-        requestStream << request.body;
+    CacheEntry marker;
+    marker.key = cacheKey;
+    marker.timestamp = std::time(nullptr);
+    marker.varyHash = varyHash;
+    marker.size = spec.size();
+    if (!CacheIndex::writeObject(cacheIndex_->objectPath(keyHash), marker, spec)) {
+        return false;
     }
-    
-    std::string requestStr = requestStream.str();
-    
-    // Send request
-    if (send(serverSocket.get(), requestStr.c_str(), requestStr.size(), 0) < 0) {
-        log("Failed to send request to server");
-        return createErrorResponse(502, "Bad Gateway", "Failed to send request");
+    cacheIndex_->put(keyHash, marker);
+    evictionPolicy_.insert(keyHash, marker.size);
+    // A full response stored before the URL varied is replaced
+    hotCache_.erase(keyHash);
+    partialCache_->erase(cacheKey);
+    return true;
+}
+
+// Until the cache nears its limits everything is admitted; from then on
+// each new object would soon push out the policy's next victim, so it has
+// to have been requested more often recently. Replacing a stored object
+// never changes what is cached, and is always allowed.
+bool ProxyServer::admitToCache(uint64_t keyHash) {
+    if (!config_.cacheAdmission || !overCacheLimits(0.9)) {
+        return true;
     }
-    
-    // Read response
-    std::string response = readFullResponse(serverSocket);
-    
-    if (response.empty()) {
-        return createErrorResponse(502, "Bad Gateway", "Empty response from server");
+    CacheEntry current;
+    if (cacheIndex_->lookup(keyHash, current)) {
+        return true;
     }
-    
-    return response;
+    uint64_t victimHash;
+    if (!evictionPolicy_.peekVictim(victimHash)) {
+        return true;
+    }
+    return admissionFilter_.admit(keyHash, victimHash);
 }
 
-std::string ProxyServer::readFullResponse(Socket& socket) {
-    std::string response;
-    char buffer[8192];
-    
-    while (true) {
-        ssize_t bytesRead = recv(socket.get(), buffer, sizeof(buffer), 0);
-        if (bytesRead <= 0) {
+void ProxyServer::recordCacheHit(const std::string& cacheKey) {
+    uint64_t keyHash = CacheIndex::hashKey(cacheKey);
+    cacheIndex_->touch(keyHash, std::time(nullptr));
+    evictionPolicy_.access(keyHash);
+}
+
+bool ProxyServer::overCacheLimits(double fraction) const {
+    return (config_.cacheMaxBytes > 0 &&
+            cacheIndex_->totalBytes() > config_.cacheMaxBytes * fraction) ||
+           (config_.cacheMaxEntries > 0 &&
+            cacheIndex_->entryCount() > config_.cacheMaxEntries * fraction);
+}
+
+// Also saves the hot set every hotSetSnapshotSeconds
+void ProxyServer::evictionLoop() {
+    time_t nextSnapshot = std::time(nullptr) + config_.hotSetSnapshotSeconds;
+    std::unique_lock<std::mutex> lock(evictionMutex_);
+    while (!evictionStop_) {
+        // Woken by saveToCache when a limit is exceeded; the timeout also
+        // catches limits that were already exceeded at startup
+        evictionCond_.wait_for(lock, std::chrono::seconds(5), [this] {
+            return evictionStop_ || overCacheLimits(1.0);
+        });
+        if (evictionStop_) {
             break;
         }
-        response.append(buffer, bytesRead);
-        
-        // Check if we've received the full response
-        // For HTTP/1.0 or Connection: close, we read until EOF
-        // For HTTP/1.1 with Content-Length, we could parse it, but for simplicity
-        // we'll just read until connection closes
+        lock.unlock();
+        evictEntries();
+        if (config_.hotSetSnapshotSeconds > 0 && std::time(nullptr) >= nextSnapshot) {
+            saveHotSet();
+            nextSnapshot = std::time(nullptr) + config_.hotSetSnapshotSeconds;
+        }
+        lock.lock();
     }
-    
-    return response;
 }
 
-void ProxyServer::sendResponse(int clientSocket, const std::string& response) {
-    if (response.empty()) {
-        return;
-    }
-    
-    ssize_t sent = 0;
-    size_t total = response.size();
-    const char* data = response.c_str();
+void ProxyServer::evictEntries() {
+    size_t evicted = 0;
+    uint64_t evictedBytes = 0;
     
-    while (sent < static_cast<ssize_t>(total)) {
-        ssize_t bytesSent = send(clientSocket, data + sent, total - sent, 0);
-        if (bytesSent < 0) {
-            log("Failed to send response to client");
+    // Evict down to 90% of the limits so that eviction does not run on
+    // every insert. cacheMutex_ is taken per object, so cache hits and
+    // stores are only held up for one removal at a time.
+    while (overCacheLimits(0.9)) {
+        uint64_t keyHash;
+        if (!evictionPolicy_.popVictim(keyHash)) {
             break;
         }
-        sent += bytesSent;
-    }
-}
+        
+        std::lock_guard<std::mutex> lock(cacheMutex_);
+        CacheEntry entry;
+        if (!cacheIndex_->lookup(keyHash, entry)) {
+            continue;
+        }
+        cacheIndex_->erase(keyHash);
+        hotCache_.erase(keyHash);
+        std::remove(entry.filePath.c_str());
+        evicted++;
+        evictedBytes += entry.size;
+    }
+    
+    if (evicted > 0) {
+        stats_.add(STAT_EVICTIONS, evicted);
+        stats_.add(STAT_EVICTED_BYTES, evictedBytes);
+        log("Evicted " + std::to_string(evicted) + " cached objects (" +
+            std::to_string(evictedBytes) + " bytes)");
+    }
+}
+
+std::string ProxyServer::hotSetPath() const {
+    return cacheDir_ + "/hotset.bin";
+}
+
+// Preloads the objects of the last hot-set snapshot into memory, hottest
+// first, until the memory tier is full. Each object is read under
+// cacheMutex_, so an object that is evicted or replaced meanwhile is
+// never loaded stale.
+void ProxyServer::warmUp() {
+    std::vector<HotSetEntry> hotSet;
+    if (config_.memoryCacheBytes == 0 || !HotObjectCache::loadHotSet(hotSetPath(), hotSet)) {
+        warmupDone_ = true;
+        return;
+    }
+    
+    uint64_t startedMs = Reactor::nowMs();
+    size_t loaded = 0;
+    uint64_t loadedBytes = 0;
+    for (size_t i = 0; i < hotSet.size() && !warmupStop_; ++i) {
+        std::lock_guard<std::mutex> lock(cacheMutex_);
+        CacheEntry entry;
+        if (!cacheIndex_->lookup(hotSet[i].keyHash, entry) || entry.isVaryMarker() ||
+            entry.size > hotCache_.maxObjectBytes()) {
+            continue;
+        }
+        std::shared_ptr<HotObject> object = std::make_shared<HotObject>();
+        CacheEntry stored;
+        if (!CacheIndex::readObject(entry.filePath, stored, &object->response)) {
+            continue;
+        }
+        object->key = stored.key;
+        object->etag = stored.etag;
+        object->lastModified = stored.lastModified;
+        object->compressed = stored.compressed;
+        if (!hotCache_.preload(hotSet[i].keyHash, object, hotSet[i].hits)) {
+            break;
+        }
+        loaded++;
+        loadedBytes += object->response.size();
+    }
+    
+    stats_.add(STAT_WARMUP_OBJECTS, loaded);
+    stats_.add(STAT_WARMUP_BYTES, loadedBytes);
+    log("Warm-up: preloaded " + std::to_string(loaded) + " of " + std::to_string(hotSet.size()) +
+        " hot objects (" + std::to_string(loadedBytes) + " bytes) in " +
+        std::to_string(Reactor::nowMs() - startedMs) + " ms");
+    warmupDone_ = !warmupStop_;
+}
+
+void ProxyServer::saveHotSet() {
+    // An interrupted warm-up would otherwise shrink the snapshot to what
+    // it managed to load
+    if (config_.memoryCacheBytes == 0 || !warmupDone_) {
+        return;
+    }
+    if (!HotObjectCache::saveHotSet(hotSetPath(), hotCache_.hotSet())) {
+        log("Failed to save the hot-set snapshot to " + hotSetPath());
+    }
+}
+
+std::string ProxyServer::readCachedResponse(const std::string& cacheKey, CacheEntry& entry) {
+    uint64_t keyHash = CacheIndex::hashKey(cacheKey);
+    HotObjectCache::ObjectPtr hot;
+    if (hotCache_.get(keyHash, hot) && hot->key == cacheKey) {
+        stats_.add(STAT_MEMORY_READS);
+        entry.key = hot->key;
+        entry.etag = hot->etag;
+        entry.lastModified = hot->lastModified;
+        entry.compressed = hot->compressed;
+        return hot->response;
+    }
+    
+    std::shared_ptr<HotObject> object = std::make_shared<HotObject>();
+    CacheEntry stored;
+    if (!CacheIndex::readObject(entry.filePath, stored, &object->response)) {
+        return std::string();
+    }
+    // Different keys can share a hash; the object file records its key
+    if (stored.key != cacheKey) {
+        return std::string();
+    }
+    stats_.add(STAT_DISK_READS);
+    entry.key = stored.key;
+    entry.etag = stored.etag;
+    entry.lastModified = stored.lastModified;
+    entry.compressed = stored.compressed;
+    
+    object->key = stored.key;
+    object->etag = stored.etag;
+    object->lastModified = stored.lastModified;
+    object->compressed = stored.compressed;
+    hotCache_.add(keyHash, object);
+    return object->response;
+}
+
+// Whether a response is stored compressed: a text-like body without a
+// content coding of its own, large enough to be worth it and small enough
+// that decoding it for one range costs little.
+bool ProxyServer::worthCompressing(const HttpResponseParser& head, uint64_t bodyLength) const {
+    return config_.compressCache && bodyLength >= kMinCompressBytes &&
+           (config_.compressMaxObjectBytes == 0 || bodyLength <= config_.compressMaxObjectBytes) &&
+           head.header("content-encoding").empty() && isCompressibleType(head.header("content-type"));
+}
+
+// Produces the form in which a response is stored if it is worth
+// compressing: the body gzip-encoded, with Content-Encoding,
+// Content-Length and Vary set.
+bool ProxyServer::compressResponse(const std::string& response, std::string& compressed) {
+    size_t headEnd = response.find("\r\n\r\n");
+    if (headEnd == std::string::npos) {
+        return false;
+    }
+    HttpResponseParser head = parseResponseHead(response);
+    if (!worthCompressing(head, response.size() - (headEnd + 4))) {
+        return false;
+    }
+    
+    uint64_t startedNanos = threadCpuNanos();
+    std::string body;
+    bool worthIt = gzipCompress(response.substr(headEnd + 4), config_.cacheCompressionLevel, body) &&
+                   body.size() <= (response.size() - (headEnd + 4)) * kMaxCompressRatio;
+    stats_.add(STAT_COMPRESS_CPU_NANOS, threadCpuNanos() - startedNanos);
+    if (!worthIt) {
+        return false;
+    }
+    
+    compressed = gzipHead(head, body.size());
+    compressed += body;
+    
+    stats_.add(STAT_COMPRESSED_OBJECTS);
+    stats_.add(STAT_COMPRESSION_IN_BYTES, response.size());
+    stats_.add(STAT_COMPRESSION_OUT_BYTES, compressed.size());
+    return true;
+}
+
+// compressResponse for a spooled body; the gzip body is spooled as well,
+// and given up as soon as it would not save enough.
+bool ProxyServer::compressSpooled(const HttpResponseParser& head, const BodySpool& body,
+                                  std::string& compressedHead, std::unique_ptr<BodySpool>& compressed) {
+    if (!worthCompressing(head, body.size())) {
+        return false;
+    }
+    
+    uint64_t startedNanos = threadCpuNanos();
+    std::unique_ptr<BodySpool> out(new BodySpool(cacheDir_, static_cast<uint64_t>(body.size() * kMaxCompressRatio)));
+    BodySpool* sink = out.get();
+    bool worthIt = gzipCompressFile(body.fd(), body.size(), config_.cacheCompressionLevel,
+                                    [sink](const char* data, size_t len) {
+        return sink->append(data, len);
+    });
+    stats_.add(STAT_COMPRESS_CPU_NANOS, threadCpuNanos() - startedNanos);
+    if (!worthIt) {
+        return false;
+    }
+    
+    uint64_t inBytes = compressedHead.size() + body.size();
+    compressedHead = gzipHead(head, out->size());
+    compressed.swap(out);
+    
+    stats_.add(STAT_COMPRESSED_OBJECTS);
+    stats_.add(STAT_COMPRESSION_IN_BYTES, inBytes);
+    stats_.add(STAT_COMPRESSION_OUT_BYTES, compressedHead.size() + compressed->size());
+    return true;
+}
+
+// Sends a stored response: compressed objects go out as they are to
+// clients accepting gzip; for the others the body is decoded on the
+// storage pool and the result sent from the client's event loop.
+void ProxyServer::sendStored(const ClientPtr& client, const ParsedRequest& request, const std::string& stored,
+                             bool compressed) {
+    std::string origin = request.host + ":" + std::to_string(request.port);
+    if (!compressed || acceptsGzip(request.head.get("accept-encoding").str())) {
+        if (compressed) {
+            stats_.add(STAT_COMPRESSED_HITS);
+        }
+        stats_.addHostBytes(origin, stored.size());
+        sendResponse(client, stored);
+        return;
+    }
+    
+    sendDecoded(client, origin, [stored]() {
+        return stored;
+    });
+}
+
+// Sends a stored response too large for the memory cache: only its head
+// is read here, the body goes out from the object file with sendfile.
+// Returns false if the object cannot be read.
+bool ProxyServer::sendObjectFile(const ClientPtr& client, const ParsedRequest& request,
+                                 const std::string& cacheKey, const CacheEntry& entry) {
+    CacheEntry stored;
+    uint64_t responseOffset = 0;
+    Socket file(CacheIndex::openObject(entry.filePath, stored, responseOffset));
+    if (!file.valid() || stored.key != cacheKey) {
+        return false;
+    }
+    stats_.add(STAT_DISK_READS);
+    std::string origin = request.host + ":" + std::to_string(request.port);
+    if (stored.compressed && !acceptsGzip(request.head.get("accept-encoding").str())) {
+        std::string filePath = entry.filePath;
+        sendDecoded(client, origin, [filePath, cacheKey]() {
+            CacheEntry object;
+            std::string response;
+            if (!CacheIndex::readObject(filePath, object, &response) || object.key != cacheKey) {
+                response.clear();
+            }
+            return response;
+        });
+        return true;
+    }
+    
+    std::string head(std::min<uint64_t>(stored.size, kMaxStoredHead), '\0');
+    size_t headEnd = std::string::npos;
+    if (readFully(file.get(), &head[0], head.size(), responseOffset)) {
+        headEnd = head.find("\r\n\r\n");
+    }
+    if (headEnd == std::string::npos) {
+        return false;
+    }
+    head.resize(headEnd + 4);
+    if (stored.compressed) {
+        stats_.add(STAT_COMPRESSED_HITS);
+    }
+    stats_.addHostBytes(origin, stored.size);
+    client->send(head);
+    client->sendFile(file.release(), responseOffset + head.size(), stored.size - head.size());
+    client->finish();
+    return true;
+}
+
+// Decodes a compressed stored response on the storage pool, where `load`
+// produces it (empty if it cannot be read), and sends the identity form
+// from the client's event loop.
+void ProxyServer::sendDecoded(const ClientPtr& client, const std::string& origin,
+                              const std::function<std::string()>& load) {
+    Reactor* reactor = &client->reactor();
+    std::weak_ptr<ClientConnection> weak = client;
+    storagePool_.submit([this, reactor, weak, origin, load]() {
+        std::string stored = load();
+        std::string response = stored.empty() ? std::string() : decodeStored(stored);
+        reactor->post([this, weak, origin, response]() {
+            ClientPtr conn = weak.lock();
+            if (!conn) {
+                return;
+            }
+            if (response.empty()) {
+                sendResponse(conn, createErrorResponse(502, "Bad Gateway", "Stored response is corrupt"));
+                return;
+            }
+            stats_.addHostBytes(origin, response.size());
+            sendResponse(conn, response);
+        });
+    });
+}
+
+// The identity form of a compressed stored response, or an empty string
+// if its body cannot be decoded.
+std::string ProxyServer::decodeStored(const std::string& stored) {
+    size_t headEnd = stored.find("\r\n\r\n");
+    if (headEnd == std::string::npos) {
+        return std::string();
+    }
+    uint64_t startedNanos = threadCpuNanos();
+    std::string body;
+    bool decoded = gzipDecompress(stored.data() + headEnd + 4, stored.size() - (headEnd + 4), body);
+    stats_.add(STAT_DECOMPRESS_CPU_NANOS, threadCpuNanos() - startedNanos);
+    if (!decoded) {
+        log("Failed to decompress stored response");
+        return std::string();
+    }
+    
+    HttpResponseParser head = parseResponseHead(stored);
+    std::ostringstream oss;
+    oss << head.statusLine() << "\r\n";
+    const std::vector<std::pair<std::string, std::string> >& fields = head.headerFields();
+    for (size_t i = 0; i < fields.size(); ++i) {
+        std::string name = fields[i].first;
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        if (name == "etag") {
+            oss << fields[i].first << ": " << identityEtag(fields[i].second) << "\r\n";
+        } else if (name != "content-length" && name != "content-encoding") {
+            oss << fields[i].first << ": " << fields[i].second << "\r\n";
+        }
+    }
+    oss << "Content-Length: " << body.size() << "\r\n";
+    oss << "\r\n";
+    stats_.add(STAT_DECOMPRESSED_HITS);
+    return oss.str() + body;
+}
+
+bool ProxyServer::clientAcceptsStoredCopy(const ParsedRequest& request) const {
+    StringRef cacheControl = request.head.get("cache-control");
+    if (!cacheControl.empty()) {
+        CacheControl cc = CacheControl::parse(cacheControl.str());
+        if (cc.noCache || cc.maxAge == 0) {
+            return false;
+        }
+    }
+    return request.head.get("pragma").str().find("no-cache") == std::string::npos;
+}
+
+void ProxyServer::revalidate(Reactor& reactor, const ClientPtr& client, const ParsedRequest& request,
+                             const std::string& cacheKey, CacheEntry entry) {
+    // Loads the validators along with the stored response; one too large
+    // for the memory cache is sent from its file after a 304
+    std::string cached;
+    bool haveCopy = false;
+    if (entry.size > hotCache_.maxObjectBytes()) {
+        CacheEntry object;
+        haveCopy = CacheIndex::readObject(entry.filePath, object, nullptr) && object.key == cacheKey;
+        if (haveCopy) {
+            entry.key = object.key;
+            entry.etag = object.etag;
+            entry.lastModified = object.lastModified;
+            entry.compressed = object.compressed;
+        }
+    } else {
+        cached = readCachedResponse(cacheKey, entry);
+        haveCopy = !cached.empty();
+    }
+    
+    // Ask the origin whether the stored copy is still valid. The whole
+    // response is revalidated, so a range request is sent without its range
+    // and its ranges are cut from the copy that is then current.
+    ParsedRequest conditional = request;
+    conditional.overrides.push_back(std::make_pair("If-None-Match", entry.etag));
+    conditional.overrides.push_back(std::make_pair("If-Modified-Since", entry.lastModified));
+    conditional.overrides.push_back(std::make_pair("Range", std::string()));
+    conditional.overrides.push_back(std::make_pair("If-Range", std::string()));
+    
+    // Without a client this is a stale-while-revalidate refresh
+    bool background = !client;
+    std::weak_ptr<ClientConnection> weak = client;
+    std::shared_ptr<UpstreamFetch> fetch = createUpstreamFetch(reactor, haveCopy ? conditional : request);
+    uint64_t startedUs = ProxyStats::nowMicros();
+    fetch->onComplete([this, weak, background, request, cacheKey, entry, cached, haveCopy,
+                       startedUs](UpstreamFetch& done) {
+        stats_.recordLatency(LATENCY_UPSTREAM_FETCH, ProxyStats::nowMicros() - startedUs);
+        bool notModified = false;
+        std::string response;
+        if (!done.succeeded()) {
+            response = fetchErrorResponse(done);
+        } else if (done.parser().statusCode() == 304 && haveCopy) {
+            // Rewriting the object file for new validators is left to the storage pool
+            HttpResponseParser validators = done.parser();
+            storagePool_.submit([this, entry, cached, validators]() {
+                refreshCacheEntry(entry, cached, validators);
+            });
+            notModified = true;
+        } else {
+            response = done.parser().normalized();
+            if (shouldCache(request, response)) {
+                saveToCache(request, response);
+            }
+        }
+        
+        if (background) {
+            if (done.succeeded()) {
+                log("Background revalidation of " + cacheKey + ": " +
+                    (notModified ? "not modified" : "updated"));
+                stats_.add(STAT_BACKGROUND_REVALIDATIONS);
+            } else {
+                log("Background revalidation of " + cacheKey + " failed: " + done.error());
+            }
+            std::lock_guard<std::mutex> lock(revalidateMutex_);
+            revalidating_.erase(cacheKey);
+            return;
+        }
+        
+        if (notModified) {
+            recordCacheHit(cacheKey);
+            log("Cache REVALIDATED: " + request.host + request.path);
+            stats_.add(STAT_CACHE_HITS);
+        } else if (done.succeeded()) {
+            // The object changed; the new version was fetched and cached
+            log("Cache MISS (modified): " + request.host + request.path);
+            stats_.add(STAT_CACHE_MISSES);
+        } else {
+            stats_.add(STAT_ERRORS);
+        }
+        ClientPtr conn = weak.lock();
+        bool ranged = conn && request.head.has("range");
+        if (notModified) {
+            if (ranged && serveCachedRange(conn, request, cacheKey, entry)) {
+                stats_.add(STAT_RANGE_HITS);
+            } else if (conn && !cached.empty()) {
+                sendStored(conn, request, cached, entry.compressed);
+            } else if (conn && !sendObjectFile(conn, request, cacheKey, entry)) {
+                sendResponse(conn, createErrorResponse(502, "Bad Gateway", "Stored response is corrupt"));
+            }
+            return;
+        }
+        // The new version is sent from the fetched copy, which is the one being stored
+        if (ranged && done.succeeded() && serveRangesFrom(conn, request, response)) {
+            return;
+        }
+        stats_.addHostBytes(done.origin(), response.size());
+        if (conn) {
+            sendResponse(conn, response);
+        }
+    });
+    fetch->start();
+}
+
+// Runs on the storage pool.
+void ProxyServer::refreshCacheEntry(const CacheEntry& entry, const std::string& cachedResponse,
+                                    const HttpResponseParser& notModified) {
+    // A 304 only renews the metadata; the stored response is kept as is.
+    // If it carries no freshness information the previous lifetime is reused.
+    CacheEntry refreshed = entry;
+    refreshed.timestamp = std::time(nullptr);
+    
+    const std::map<std::string, std::string>& headers = notModified.headers();
+    if (headers.count("cache-control") || headers.count("expires")) {
+        Freshness freshness = computeFreshness(headers, refreshed.timestamp);
+        refreshed.expiresAt = freshness.expiresAt;
+        refreshed.staleWhileRevalidate = freshness.staleWhileRevalidate;
+    } else {
+        refreshed.expiresAt = refreshed.timestamp + std::max<time_t>(0, entry.expiresAt - entry.timestamp);
+    }
+    if (!notModified.header("etag").empty()) {
+        refreshed.etag = notModified.header("etag");
+    }
+    if (!notModified.header("last-modified").empty()) {
+        refreshed.lastModified = notModified.header("last-modified");
+    }
+    
+    // The object file only has to be rewritten when the validators changed;
+    // the new copy is written before the lock is taken
+    uint64_t keyHash = CacheIndex::hashKey(entry.key);
+    bool rewrite = refreshed.etag != entry.etag || refreshed.lastModified != entry.lastModified;
+    std::string staged;
+    std::string loaded;
+    if (rewrite && cachedResponse.empty()) {
+        // A copy too large for the memory cache is read back from its file
+        CacheEntry object;
+        rewrite = CacheIndex::readObject(entry.filePath, object, &loaded) && object.key == entry.key;
+    }
+    const std::string& response = cachedResponse.empty() ? loaded : cachedResponse;
+    if (rewrite) {
+        staged = CacheIndex::stagingPath(entry.filePath);
+        if (!CacheIndex::writeObject(staged, refreshed, response)) {
+            log("Failed to rewrite cache object for " + entry.key);
+            rewrite = false;
+        }
+    }
+    std::lock_guard<std::mutex> lock(cacheMutex_);
+    if (rewrite && std::rename(staged.c_str(), entry.filePath.c_str()) != 0) {
+        std::remove(staged.c_str());
+        rewrite = false;
+    }
+    if (rewrite) {
+        if (!cachedResponse.empty() && cachedResponse.size() <= hotCache_.maxObjectBytes()) {
+            std::shared_ptr<HotObject> object = std::make_shared<HotObject>();
+            object->key = entry.key;
+            object->etag = refreshed.etag;
+            object->lastModified = refreshed.lastModified;
+            object->response = cachedResponse;
+            object->compressed = refreshed.compressed;
+            hotCache_.put(keyHash, object);
+        }
+    }
+    cacheIndex_->put(keyHash, refreshed);
+}
+
+void ProxyServer::startBackgroundRevalidation(Reactor& reactor, const ParsedRequest& request,
+                                              const std::string& cacheKey) {
+    {
+        std::lock_guard<std::mutex> lock(revalidateMutex_);
+        if (!revalidating_.insert(cacheKey).second) {
+            return; // Already being refreshed
+        }
+    }
+    
+    CacheEntry entry;
+    if (!getCacheEntry(cacheKey, entry)) {
+        log("Background revalidation of " + cacheKey + " failed: entry was removed");
+        std::lock_guard<std::mutex> lock(revalidateMutex_);
+        revalidating_.erase(cacheKey);
+        return;
+    }
+    revalidate(reactor, ClientPtr(), request, cacheKey, entry);
+}
+
+// A range request being completed from the partial store and the origin
+struct ProxyServer::RangeFill {
+    std::weak_ptr<ClientConnection> client;
+    ParsedRequest request;
+    std::string cacheKey;
+    RangeSpec spec;
+    ByteRange range;            // the client's range, once the length is known
+    bool lengthKnown;
+    std::string validator;      // sent as If-Range
+    size_t fetches;
+    
+    RangeFill() : lengthKnown(false), fetches(0) {
+        range.first = range.last = 0;
+    }
+};
+
+// Answers a range request from a stored full response: a single range is
+// sent from the object file with sendfile (or cut out of the memory copy),
+// several as multipart/byteranges. Ranges of a compressed object refer to
+// its decoded body, which is produced on the storage pool. Returns false
+// if the whole response is to be sent instead: the Range header is not
+// understood, If-Range does not match or the ranges are too many.
+bool ProxyServer::serveCachedRange(const ClientPtr& client, const ParsedRequest& request,
+                                   const std::string& cacheKey, const CacheEntry& entry) {
+    std::vector<RangeSpec> specs;
+    if (!parseRangeHeader(request.head.get("range").str(), specs) || specs.size() > kMaxRanges) {
+        return false;
+    }
+    
+    // From memory if the response is there; otherwise the ranges come
+    // from the file
+    uint64_t keyHash = CacheIndex::hashKey(cacheKey);
+    HotObjectCache::ObjectPtr hot;
+    CacheEntry stored;
+    Socket file;
+    uint64_t responseOffset = 0;
+    if (hotCache_.get(keyHash, hot) && hot->key == cacheKey) {
+        stored.etag = hot->etag;
+        stored.lastModified = hot->lastModified;
+        stored.compressed = hot->compressed;
+        stats_.add(STAT_MEMORY_READS);
+    } else {
+        hot.reset();
+        file = Socket(CacheIndex::openObject(entry.filePath, stored, responseOffset));
+        if (!file.valid() || stored.key != cacheKey) {
+            return false;
+        }
+        stats_.add(STAT_DISK_READS);
+    }
+    
+    StringRef ifRange = request.head.get("if-range");
+    if (!ifRange.empty() && !ifRangeMatches(ifRange.str(), stored.etag, stored.lastModified)) {
+        return false;
+    }
+    
+    if (stored.compressed) {
+        // Bodies are only stored compressed up to compressMaxObjectBytes, so
+        // decoding a whole one for its ranges stays cheap
+        file.close();
+        Reactor* reactor = &client->reactor();
+        std::weak_ptr<ClientConnection> weak = client;
+        ParsedRequest copy = storageCopy(request);
+        std::string filePath = entry.filePath;
+        storagePool_.submit([this, reactor, weak, copy, specs, cacheKey, hot, filePath]() {
+            std::string loaded;
+            CacheEntry object;
+            if (!hot && (!CacheIndex::readObject(filePath, object, &loaded) || object.key != cacheKey)) {
+                loaded.clear();
+            }
+            const std::string& compressed = hot ? hot->response : loaded;
+            std::string decoded = compressed.empty() ? std::string() : decodeStored(compressed);
+            reactor->post([this, weak, copy, specs, decoded]() {
+                ClientPtr conn = weak.lock();
+                if (!conn) {
+                    return;
+                }
+                size_t headEnd = decoded.find("\r\n\r\n");
+                if (headEnd == std::string::npos) {
+                    sendResponse(conn, createErrorResponse(502, "Bad Gateway", "Stored response is corrupt"));
+                    return;
+                }
+                Socket none;
+                if (!sendRanges(conn, copy, specs, decoded.substr(0, headEnd + 4), &decoded, none,
+                                headEnd + 4, decoded.size() - (headEnd + 4))) {
+                    stats_.addHostBytes(copy.host + ":" + std::to_string(copy.port), decoded.size());
+                    sendResponse(conn, decoded);
+                }
+            });
+        });
+        return true;
+    }
+    
+    std::string head;
+    uint64_t bodyOffset = 0;    // in the memory copy or the file
+    uint64_t bodyLength = 0;
+    if (hot) {
+        size_t headEnd = hot->response.find("\r\n\r\n");
+        if (headEnd == std::string::npos) {
+            return false;
+        }
+        head = hot->response.substr(0, headEnd + 4);
+        bodyOffset = headEnd + 4;
+        bodyLength = hot->response.size() - bodyOffset;
+    } else {
+        head.resize(std::min<uint64_t>(stored.size, kMaxStoredHead));
+        size_t headEnd = std::string::npos;
+        if (readFully(file.get(), &head[0], head.size(), responseOffset)) {
+            headEnd = head.find("\r\n\r\n");
+        }
+        if (headEnd == std::string::npos) {
+            return false;
+        }
+        head.resize(headEnd + 4);
+        bodyOffset = responseOffset + head.size();
+        bodyLength = stored.size - head.size();
+    }
+    return sendRanges(client, request, specs, head, hot ? &hot->response : nullptr, file, bodyOffset, bodyLength);
+}
+
+// Answers a range request from a complete response in memory, such as
+// one just fetched to replace a stale copy. Returns false if the whole
+// response is to be sent instead.
+bool ProxyServer::serveRangesFrom(const ClientPtr& client, const ParsedRequest& request,
+                                  const std::string& response) {
+    std::vector<RangeSpec> specs;
+    if (!parseRangeHeader(request.head.get("range").str(), specs) || specs.size() > kMaxRanges) {
+        return false;
+    }
+    size_t headEnd = response.find("\r\n\r\n");
+    if (headEnd == std::string::npos) {
+        return false;
+    }
+    std::string head = response.substr(0, headEnd + 4);
+    HttpResponseParser parsed = parseResponseHead(head);
+    if (parsed.statusCode() != 200) {
+        return false;
+    }
+    StringRef ifRange = request.head.get("if-range");
+    if (!ifRange.empty() && !ifRangeMatches(ifRange.str(), parsed.header("etag"), parsed.header("last-modified"))) {
+        return false;
+    }
+    Socket none;
+    return sendRanges(client, request, specs, head, &response, none, headEnd + 4, response.size() - (headEnd + 4));
+}
+
+// Sends the ranges of a body that starts at `bodyOffset` in `memory`, or
+// in `file` if there is no memory copy; `head` is the stored response's.
+// Returns false without sending anything if the whole response is to be
+// sent instead.
+bool ProxyServer::sendRanges(const ClientPtr& client, const ParsedRequest& request,
+                             const std::vector<RangeSpec>& specs, const std::string& head,
+                             const std::string* memory, Socket& file, uint64_t bodyOffset, uint64_t bodyLength) {
+    std::string origin = request.host + ":" + std::to_string(request.port);
+    std::vector<ByteRange> ranges = resolveRanges(specs, bodyLength);
+    if (ranges.empty()) {
+        sendResponse(client, rangeNotSatisfiable(bodyLength));
+        return true;
+    }
+    uint64_t rangeBytes = 0;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        rangeBytes += ranges[i].length();
+    }
+    if (ranges.size() > 1 && rangeBytes > kMaxMultipartBytes) {
+        return false;
+    }
+    
+    HttpResponseParser storedHead = parseResponseHead(head);
+    std::ostringstream oss;
+    oss << "HTTP/1.1 206 Partial Content\r\n";
+    if (ranges.size() == 1) {
+        const ByteRange& range = ranges[0];
+        oss << representationFields(storedHead.headerFields(), true);
+        oss << "Content-Range: " << formatContentRange(range, bodyLength) << "\r\n";
+        oss << "Content-Length: " << range.length() << "\r\n";
+        oss << "\r\n";
+        stats_.addHostBytes(origin, range.length());
+        if (memory) {
+            oss.write(memory->data() + bodyOffset + range.first, range.length());
+            sendResponse(client, oss.str());
+        } else {
+            client->send(oss.str());
+            client->sendFile(file.release(), bodyOffset + range.first, range.length());
+            client->finish();
+        }
+        return true;
+    }
+    
+    // Several ranges: each part repeats the content type and names its range
+    char boundary[32];
+    std::snprintf(boundary, sizeof(boundary), "byteranges_%016llx",
+                  static_cast<unsigned long long>(CacheIndex::hashKey(head) ^ ProxyStats::nowMicros()));
+    std::string contentType = storedHead.header("content-type");
+    std::string body;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        body += "\r\n--" + std::string(boundary) + "\r\n";
+        if (!contentType.empty()) {
+            body += "Content-Type: " + contentType + "\r\n";
+        }
+        body += "Content-Range: " + formatContentRange(ranges[i], bodyLength) + "\r\n\r\n";
+        if (memory) {
+            body.append(*memory, bodyOffset + ranges[i].first, ranges[i].length());
+        } else {
+            size_t at = body.size();
+            body.resize(at + ranges[i].length());
+            if (!readFully(file.get(), &body[at], ranges[i].length(), bodyOffset + ranges[i].first)) {
+                return false;
+            }
+        }
+    }
+    body += "\r\n--" + std::string(boundary) + "--\r\n";
+    
+    oss << representationFields(storedHead.headerFields(), false);
+    oss << "Content-Type: multipart/byteranges; boundary=" << boundary << "\r\n";
+    oss << "Content-Length: " << body.size() << "\r\n";
+    oss << "\r\n";
+    oss << body;
+    stats_.addHostBytes(origin, body.size());
+    sendResponse(client, oss.str());
+    return true;
+}
+
+// Serves GET requests from partially stored objects: a complete one as a
+// whole, a single range once its chunks are present. Missing chunks are
+// fetched with range requests and stored on the way. Returns false if the
+// request has to go to the origin as it is.
+bool ProxyServer::servePartial(const ClientPtr& client, const ParsedRequest& request,
+                               const std::string& cacheKey, uint64_t startedUs) {
+    if (config_.rangeMaxBytes == 0 || request.head.has("authorization") ||
+        !clientAcceptsStoredCopy(request)) {
+        return false;
+    }
+    
+    PartialObject object;
+    bool known = partialCache_->lookup(cacheKey, object);
+    bool fresh = known && std::time(nullptr) < object.expiresAt;
+    std::string origin = request.host + ":" + std::to_string(request.port);
+    
+    if (!request.head.has("range")) {
+        ByteRange whole = {0, object.totalLength - 1};
+        if (!fresh || !object.complete() || !sendPartialObject(client, cacheKey, whole, false)) {
+            return false;
+        }
+        log("Cache HIT (assembled from ranges): " + request.host + request.path);
+        stats_.add(STAT_CACHE_HITS);
+        stats_.add(STAT_PARTIAL_HITS);
+        stats_.addHostBytes(origin, whole.length());
+        stats_.recordLatency(LATENCY_CACHE_HIT, ProxyStats::nowMicros() - startedUs);
+        return true;
+    }
+    
+    // Only a single range is assembled; a client's own If-Range is left
+    // to the origin
+    std::vector<RangeSpec> specs;
+    if (!parseRangeHeader(request.head.get("range").str(), specs) || specs.size() != 1 ||
+        request.head.has("if-range")) {
+        return false;
+    }
+    
+    std::shared_ptr<RangeFill> fill = std::make_shared<RangeFill>();
+    fill->client = client;
+    fill->request = request;
+    fill->cacheKey = cacheKey;
+    fill->spec = specs[0];
+    ByteRange run;
+    if (known) {
+        std::vector<ByteRange> ranges = resolveRanges(specs, object.totalLength);
+        if (ranges.empty()) {
+            log("Cache HIT (range not satisfiable): " + request.host + request.path);
+            stats_.add(STAT_CACHE_HITS);
+            sendResponse(client, rangeNotSatisfiable(object.totalLength));
+            return true;
+        }
+        fill->range = ranges[0];
+        fill->lengthKnown = true;
+        fill->validator = isStrongEtag(object.etag) ? object.etag : object.lastModified;
+    } else {
+        // Without the complete length a suffix cannot be placed
+        if (fill->spec.suffix) {
+            return false;
+        }
+        fill->range.first = fill->spec.first;
+        fill->range.last = fill->spec.openEnded ? fill->spec.first + config_.rangeMaxBytes - 1
+                                                : fill->spec.last;
+    }
+    // An open-ended range is answered with its first rangeMaxBytes (the
+    // Content-Range tells the client); larger closed ranges pass through
+    if (fill->range.length() > config_.rangeMaxBytes) {
+        if (!fill->spec.openEnded) {
+            return false;
+        }
+        fill->range.last = fill->range.first + config_.rangeMaxBytes - 1;
+    }
+    
+    if (fresh) {
+        std::vector<ByteRange> missing = partialCache_->missing(object, fill->range);
+        if (missing.empty() && sendPartialObject(client, cacheKey, fill->range, true)) {
+            log("Cache HIT (partial): " + request.host + request.path);
+            stats_.add(STAT_CACHE_HITS);
+            stats_.add(STAT_PARTIAL_HITS);
+            stats_.addHostBytes(origin, fill->range.length());
+            stats_.recordLatency(LATENCY_CACHE_HIT, ProxyStats::nowMicros() - startedUs);
+            return true;
+        }
+        run = missing.empty() ? partialCache_->align(fill->range, object.totalLength) : missing[0];
+    } else {
+        // A stale object is fetched again where the range lies; the If-Range
+        // answer also tells whether its other chunks are still valid
+        run = partialCache_->align(fill->range, object.totalLength);
+    }
+    
+    log("Cache MISS (partial): " + request.host + request.path);
+    stats_.add(STAT_CACHE_MISSES);
+    fillRange(client->reactor(), fill, run);
+    return true;
+}
+
+// Sends a range of a partial object (206) or all of it (200) from its
+// data file, if every chunk of the range is present
+bool ProxyServer::sendPartialObject(const ClientPtr& client, const std::string& cacheKey,
+                                    const ByteRange& range, bool partialContent) {
+    PartialObject object;
+    Socket file(partialCache_->openRange(cacheKey, range, object));
+    if (!file.valid()) {
+        return false;
+    }
+    
+    std::ostringstream oss;
+    oss << (partialContent ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n");
+    oss << object.fields;
+    if (partialContent) {
+        oss << "Content-Range: " << formatContentRange(range, object.totalLength) << "\r\n";
+    }
+    oss << "Content-Length: " << range.length() << "\r\n";
+    oss << "\r\n";
+    client->send(oss.str());
+    client->sendFile(file.release(), range.first, range.length());
+    client->finish();
+    return true;
+}
+
+// Fetches one run of missing chunks. A usable 206 is stored and the fill
+// goes on; any other answer is passed to the client as it is.
+void ProxyServer::fillRange(Reactor& reactor, const std::shared_ptr<RangeFill>& fill, const ByteRange& run) {
+    fill->fetches++;
+    ParsedRequest partial = fill->request;
+    partial.overrides.push_back(std::make_pair(
+        "Range", "bytes=" + std::to_string(run.first) + "-" + std::to_string(run.last)));
+    // Bytes of another version must not be combined with the stored ones
+    partial.overrides.push_back(std::make_pair("If-Range", fill->validator));
+    partial.overrides.push_back(std::make_pair("If-None-Match", std::string()));
+    partial.overrides.push_back(std::make_pair("If-Modified-Since", std::string()));
+    stats_.add(STAT_PARTIAL_FETCHES);
+    log("Fetching bytes " + std::to_string(run.first) + "-" + std::to_string(run.last) +
+        " of " + fill->cacheKey);
+    
+    std::shared_ptr<UpstreamFetch> fetch = createUpstreamFetch(reactor, partial);
+    // A full response that will not be cached is relayed to the client
+    fetch->allowRelay([this, fill](const HttpResponseParser& head) {
+        return head.statusCode() != 206 && !shouldCache(fill->request, head);
+    });
+    
+    Reactor* loop = &reactor;
+    uint64_t startedUs = ProxyStats::nowMicros();
+    fetch->onComplete([this, fill, loop, startedUs](UpstreamFetch& done) {
+        stats_.recordLatency(LATENCY_UPSTREAM_FETCH, ProxyStats::nowMicros() - startedUs);
+        ClientPtr conn = fill->client.lock();
+        if (done.relayed()) {
+            // A full response to If-Range: the stored chunks are outdated
+            if (done.parser().statusCode() == 200) {
+                partialCache_->erase(fill->cacheKey);
+            }
+            if (!conn || conn->closed()) {
+                ::close(done.releaseSocket());
+                return;
+            }
+            std::shared_ptr<InFlightFetch> response = std::make_shared<InFlightFetch>();
+            std::string head = done.parser().forwardHead();
+            response->append(head.data(), head.size());
+            response->append(done.parser().body().data(), done.parser().body().size());
+            stats_.addHostBytes(done.origin(), response->size());
+            response->handOff(createRelayTail(done));
+            conn->streamFrom(response);
+            return;
+        }
+        if (!done.succeeded()) {
+            stats_.add(STAT_ERRORS);
+            if (conn) {
+                sendResponse(conn, fetchErrorResponse(done));
+            }
+            return;
+        }
+        
+        const HttpResponseParser& response = done.parser();
+        stats_.addHostBytes(done.origin(), response.body().size());
+        if (response.statusCode() == 206) {
+            if (storeRangeResponse(fill, response)) {
+                continueRangeFill(*loop, fill);
+            } else {
+                // E.g. no validators: the client's request goes through unchanged
+                passThroughRange(fill);
+            }
+            return;
+        }
+        
+        if (response.statusCode() == 200) {
+            partialCache_->erase(fill->cacheKey);
+        }
+        std::string normalized = response.normalized();
+        if (shouldCache(fill->request, response)) {
+            saveToCache(fill->request, normalized);
+        }
+        if (conn) {
+            sendResponse(conn, normalized);
+        }
+    });
+    fetch->start();
+}
+
+// Stores a 206 if it can be combined with other ranges later: a single
+// part with a known complete length, storable, with a strong ETag or a
+// Last-Modified date, and exactly as long as its Content-Range says.
+bool ProxyServer::storeRangeResponse(const std::shared_ptr<RangeFill>& fill,
+                                     const HttpResponseParser& response) {
+    ByteRange range;
+    uint64_t totalLength = 0;
+    if (!parseContentRange(response.header("content-range"), range, totalLength) ||
+        response.body().size() != range.length() ||
+        !isStorableResponse(response.headers(), false) || !response.header("vary").empty()) {
+        // Partial objects are kept per URL, so a response that varies is not stored
+        return false;
+    }
+    PartialObject description;
+    description.key = fill->cacheKey;
+    description.etag = response.header("etag");
+    description.lastModified = response.header("last-modified");
+    if (!isStrongEtag(description.etag) && description.lastModified.empty()) {
+        return false;
+    }
+    description.fields = representationFields(response.headerFields(), true);
+    description.totalLength = totalLength;
+    description.expiresAt = computeFreshness(response.headers(), std::time(nullptr)).expiresAt;
+    if (!partialCache_->store(description, range.first, response.body())) {
+        return false;
+    }
+    stats_.add(STAT_PARTIAL_FETCHED_BYTES, range.length());
+    fill->validator = isStrongEtag(description.etag) ? description.etag : description.lastModified;
+    return true;
+}
+
+// After a stored 206: serves the range if it is complete now, otherwise
+// fetches the next missing run
+void ProxyServer::continueRangeFill(Reactor& reactor, const std::shared_ptr<RangeFill>& fill) {
+    ClientPtr conn = fill->client.lock();
+    if (!conn || conn->closed()) {
+        return; // the chunks fetched so far stay stored
+    }
+    PartialObject object;
+    if (!partialCache_->lookup(fill->cacheKey, object)) {
+        passThroughRange(fill);
+        return;
+    }
+    
+    if (!fill->lengthKnown) {
+        std::vector<ByteRange> ranges = resolveRanges(std::vector<RangeSpec>(1, fill->spec),
+                                                      object.totalLength);
+        if (ranges.empty()) {
+            sendResponse(conn, rangeNotSatisfiable(object.totalLength));
+            return;
+        }
+        fill->range = ranges[0];
+        fill->range.last = std::min(fill->range.last, fill->range.first + config_.rangeMaxBytes - 1);
+        fill->lengthKnown = true;
+    }
+    
+    std::vector<ByteRange> missing = partialCache_->missing(object, fill->range);
+    if (missing.empty()) {
+        if (!sendPartialObject(conn, fill->cacheKey, fill->range, true)) {
+            passThroughRange(fill);
+        }
+        return;
+    }
+    if (fill->fetches >= kMaxRangeFetches) {
+        passThroughRange(fill);
+        return;
+    }
+    fillRange(reactor, fill, missing[0]);
+}
+
+void ProxyServer::passThroughRange(const std::shared_ptr<RangeFill>& fill) {
+    ClientPtr conn = fill->client.lock();
+    if (!conn || conn->closed()) {
+        return;
+    }
+    log("Passing range request through: " + fill->cacheKey);
+    std::shared_ptr<InFlightFetch> response = std::make_shared<InFlightFetch>();
+    startFetch(conn->reactor(), fill->request, fill->cacheKey, response, false);
+    conn->streamFrom(response);
+}
+
+void ProxyServer::openTunnel(const ClientPtr& client, const ParsedRequest& request) {
+    // The target is given in authority form, host:port
+    std::string host;
+    int port = 0;
+    size_t colonPos = request.url.rfind(':');
+    if (colonPos != std::string::npos && colonPos > 0) {
+        host = request.url.substr(0, colonPos);
+        try {
+            port = std::stoi(request.url.substr(colonPos + 1));
+        } catch (...) {
+            port = 0;
+        }
+    }
+    if (host.size() > 2 && host[0] == '[' && host[host.size() - 1] == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    if (host.empty() || port <= 0 || port > 65535) {
+        log("Invalid CONNECT target: " + request.url);
+        sendResponse(client, createErrorResponse(400, "Bad Request", "CONNECT requires host:port"));
+        return;
+    }
+    
+    log("Tunnel: CONNECT " + host + ":" + std::to_string(port));
+    
+    // An upstream fetch without a request only connects (through the DNS
+    // cache, with the connect timeout) and hands the socket over
+    Reactor& reactor = client->reactor();
+    std::shared_ptr<UpstreamFetch> fetch = std::make_shared<UpstreamFetch>(
+        reactor, upstreamContext_, host, port, std::string(), false, false);
+    std::weak_ptr<ClientConnection> weak = client;
+    std::string prefix = request.body;
+    fetch->onComplete([this, weak, &reactor, prefix](UpstreamFetch& done) {
+        ClientPtr conn = weak.lock();
+        if (!done.relayed()) {
+            if (conn) {
+                sendResponse(conn, createErrorResponse(502, "Bad Gateway", done.error()));
+            }
+            return;
+        }
+        int originFd = done.releaseSocket();
+        if (!conn || conn->closed()) {
+            ::close(originFd);
+            return;
+        }
+        
+        int clientFd = conn->releaseSocket();
+        // Nothing has been written to the client yet, so the short reply
+        // fits into the empty socket buffer
+        static const char kEstablished[] = "HTTP/1.1 200 Connection Established\r\n\r\n";
+        ssize_t sent = ::send(clientFd, kEstablished, sizeof(kEstablished) - 1, MSG_NOSIGNAL);
+        if (sent != static_cast<ssize_t>(sizeof(kEstablished) - 1)) {
+            log("Client disconnected before the tunnel was established");
+            ::close(clientFd);
+            ::close(originFd);
+            return;
+        }
+        
+        std::shared_ptr<Tunnel> tunnel = std::make_shared<Tunnel>(
+            reactor, clientFd, originFd, done.origin(), config_.tunnelIdleTimeoutMs, prefix);
+        tunnel->onClose([this](const Tunnel& closed) {
+            std::ostringstream oss;
+            oss << "Tunnel to " << closed.origin() << " closed after " << closed.durationMs()
+                << " ms: " << closed.bytesUp() << " bytes up, " << closed.bytesDown()
+                << " bytes down" << (closed.idleTimedOut() ? " (idle timeout)" : "");
+            log(oss.str());
+            
+            stats_.add(STAT_TUNNELS_CLOSED);
+            stats_.add(STAT_TUNNEL_BYTES_UP, closed.bytesUp());
+            stats_.add(STAT_TUNNEL_BYTES_DOWN, closed.bytesDown());
+            stats_.addHostBytes(closed.origin(), closed.bytesUp() + closed.bytesDown());
+            if (closed.idleTimedOut()) {
+                stats_.add(STAT_TUNNEL_IDLE_TIMEOUTS);
+            }
+        });
+        stats_.add(STAT_TUNNELS_OPENED);
+        log("Tunnel established to " + done.origin());
+        tunnel->start();
+    });
+    fetch->start();
+}
+
+void ProxyServer::relayCoalesced(const ClientPtr& client, const ParsedRequest& request,
+                                 const std::string& cacheKey) {
+    bool leader = false;
+    std::shared_ptr<InFlightFetch> fetch = coalescer_.join(cacheKey, leader);
+    
+    // The leader's client reads the shared response like every follower,
+    // so a slow or vanished client does not hold the others back
+    if (leader) {
+        std::map<std::string, std::string> headers;
+        for (size_t i = 0; i < request.head.fieldCount(); ++i) {
+            std::string name = request.head.name(i).str();
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            headers[name] = request.head.get(name.c_str()).str();
+        }
+        fetch->setRequestHeaders(headers);
+        startFetch(client->reactor(), request, cacheKey, fetch, true);
+        client->streamFrom(fetch);
+        return;
+    }
+    
+    log("Coalesced with in-flight fetch: " + cacheKey);
+    
+    // If the leader stalls before anything was relayed, or its response
+    // varies on a field this request sends differently, fetch directly.
+    // Until a URL's Vary marker is stored the key is the same for every
+    // variant, so the check waits for the response head.
+    std::weak_ptr<ClientConnection> weak = client;
+    std::shared_ptr<bool> mismatch = std::make_shared<bool>(false);
+    std::weak_ptr<InFlightFetch> weakFetch = fetch;
+    client->streamFrom(fetch, config_.coalesceTimeoutMs, [this, weak, request, cacheKey, mismatch]() {
+        ClientPtr conn = weak.lock();
+        if (!conn) {
+            return;
+        }
+        if (*mismatch) {
+            log("In-flight fetch for " + cacheKey + " is another variant, fetching independently");
+        } else {
+            log("In-flight fetch for " + cacheKey + " stalled, fetching independently");
+            stats_.add(STAT_COALESCE_FALLBACKS);
+        }
+        std::shared_ptr<InFlightFetch> own = std::make_shared<InFlightFetch>();
+        startFetch(conn->reactor(), request, cacheKey, own, false);
+        conn->streamFrom(own);
+    }, [request, mismatch, weakFetch](const std::string& head) {
+        std::shared_ptr<InFlightFetch> shared = weakFetch.lock();
+        *mismatch = !shared || !sameVariant(request, *shared, head);
+        return !*mismatch;
+    });
+}
+
+std::shared_ptr<UpstreamFetch> ProxyServer::createUpstreamFetch(Reactor& reactor, const ParsedRequest& request) {
+    std::shared_ptr<UpstreamFetch> fetch = std::make_shared<UpstreamFetch>(
+        reactor, upstreamContext_, request.host, request.port, buildUpstreamRequest(request),
+        request.method == "HEAD", request.method == "GET" || request.method == "HEAD");
+    if (request.upload) {
+        fetch->sendBody(request.upload);
+    }
+    return fetch;
+}
+
+// Streams the client-facing bytes of the upstream response into `response`
+// as they arrive and caches the complete response, whose body is spooled
+// to a file meanwhile rather than collected in memory. If the fetch fails
+// before anything was streamed an error response is published instead;
+// if it fails midway the stream is finished as incomplete.
+void ProxyServer::startFetch(Reactor& reactor, const ParsedRequest& request, const std::string& cacheKey,
+                             const std::shared_ptr<InFlightFetch>& response, bool coalesced) {
+    std::shared_ptr<UpstreamFetch> fetch = createUpstreamFetch(reactor, request);
+    fetch->onData([response](const char* data, size_t len) {
+        response->append(data, len);
+    });
+    // A consumer that falls behind holds the origin back (by the TCP window)
+    // rather than the unread bytes piling up in the shared buffer
+    fetch->holdWhile([response]() {
+        return response->full();
+    });
+    std::weak_ptr<UpstreamFetch> weakFetch = fetch;
+    Reactor* loop = &reactor;
+    response->onDrain([weakFetch, loop]() {
+        loop->post([weakFetch]() {
+            std::shared_ptr<UpstreamFetch> held = weakFetch.lock();
+            if (held) {
+                held->resume();
+            }
+        });
+    });
+    // A fetch still waiting for a slot of its origin is dropped once every
+    // client reading it has gone; none can join after it left the table
+    std::weak_ptr<InFlightFetch> weakResponse = response;
+    response->onAbandon([this, weakFetch, weakResponse, loop, cacheKey]() {
+        loop->post([this, weakFetch, weakResponse, cacheKey]() {
+            std::shared_ptr<UpstreamFetch> queued = weakFetch.lock();
+            std::shared_ptr<InFlightFetch> stream = weakResponse.lock();
+            if (!queued || !stream || !queued->queued()) {
+                return;
+            }
+            coalescer_.remove(cacheKey, stream);
+            if (stream->abandoned()) {
+                queued->abandon();
+            }
+        });
+    });
+    std::shared_ptr<BodySpool> spool = std::make_shared<BodySpool>(cacheDir_, config_.cacheMaxObjectBytes);
+    fetch->takeBody([this, request](const HttpResponseParser& head) {
+        return shouldCache(request, head);
+    }, [spool](const char* data, size_t len) {
+        spool->append(data, len);
+    });
+    
+    // A body that will not be cached does not need to pass through the
+    // shared buffer; if only one client reads it, it is relayed directly
+    fetch->allowRelay([this, request, cacheKey, response, coalesced](const HttpResponseParser& head) {
+        if (shouldCache(request, head) || shouldCacheNegative(request, head)) {
+            return false;
+        }
+        if (coalesced) {
+            // Later misses fetch on their own, so the reader count is final
+            coalescer_.remove(cacheKey, response);
+        }
+        return response->readers() == 1;
+    });
+    
+    uint64_t startedUs = ProxyStats::nowMicros();
+    fetch->onComplete([this, request, cacheKey, response, coalesced, startedUs, spool](UpstreamFetch& done) {
+        // A relayed body is still on its way; its bytes are counted by the tail
+        stats_.recordLatency(LATENCY_UPSTREAM_FETCH, ProxyStats::nowMicros() - startedUs);
+        if (done.relayed()) {
+            response->handOff(createRelayTail(done));
+        } else if (done.succeeded()) {
+            if (done.parser().statusCode() == 200) {
+                // A body that outgrew the object size limit was given up
+                if (shouldCache(request, done.parser()) && spool->ok()) {
+                    saveToCache(request, done.parser(), spool);
+                }
+            } else if (shouldCacheNegative(request, done.parser())) {
+                storeNegative(request, done.parser().normalized());
+            }
+            response->finish(true);
+        } else if (!done.streamed()) {
+            stats_.add(STAT_ERRORS);
+            // A body that broke off at the client is answered as the client's fault
+            std::string errorResponse;
+            if (request.upload && request.upload->errorStatus() == 413) {
+                errorResponse = createErrorResponse(413, "Payload Too Large", "Request body is too large");
+            } else if (request.upload && request.upload->errorStatus() != 0) {
+                errorResponse = createErrorResponse(400, "Bad Request", "Malformed request body");
+            } else {
+                errorResponse = fetchErrorResponse(done);
+            }
+            if (shouldCacheNegative(request, parseResponseHead(errorResponse))) {
+                storeNegative(request, errorResponse);
+            }
+            response->append(errorResponse.data(), errorResponse.size());
+            response->finish(true);
+        } else {
+            stats_.add(STAT_ERRORS);
+            response->finish(false);
+        }
+        stats_.addHostBytes(done.origin(), response->size());
+        if (request.upload) {
+            stats_.add(STAT_STREAMED_UPLOADS);
+            stats_.add(STAT_STREAMED_UPLOAD_BYTES, request.upload->taken());
+        }
+        if (coalesced) {
+            coalescer_.remove(cacheKey, response);
+        }
+    });
+    fetch->start();
+}
+
+std::string ProxyServer::buildUpstreamRequest(const ParsedRequest& request) const {
+    std::ostringstream requestStream;
+    // Always speak HTTP/1.1 upstream so that the connection can be kept alive
+    requestStream << request.method << " " << request.path << " HTTP/1.1\r\n";
+    
+    // Forward end-to-end headers, but modify Host header. A chunked body
+    // has been decoded, so the framing is replaced by Content-Length, or
+    // re-chunked if it is streamed. Expect has been answered by the proxy.
+    const HttpRequestHead& head = request.head;
+    for (size_t i = 0; i < head.fieldCount(); ++i) {
+        StringRef name = head.name(i);
+        if (name.equalsIgnoreCase("host") || name.equalsIgnoreCase("content-length") ||
+            name.equalsIgnoreCase("expect") || isHopByHopHeader(name)) {
+            continue;
+        }
+        bool overridden = false;
+        for (size_t j = 0; j < request.overrides.size() && !overridden; ++j) {
+            overridden = name.equalsIgnoreCase(request.overrides[j].first.c_str());
+        }
+        if (!overridden) {
+            requestStream.write(name.data, name.size);
+            requestStream << ": ";
+            requestStream.write(head.value(i).data, head.value(i).size);
+            requestStream << "\r\n";
+        }
+    }
+    for (size_t j = 0; j < request.overrides.size(); ++j) {
+        if (!request.overrides[j].second.empty()) {
+            requestStream << request.overrides[j].first << ": " << request.overrides[j].second << "\r\n";
+        }
+    }
+    requestStream << "Host: " << request.host;
+    if (request.port != 80) {
+        requestStream << ":" << request.port;
+    }
+    requestStream << "\r\n";
+    if (request.upload && request.upload->chunked()) {
+        requestStream << "Transfer-Encoding: chunked\r\n";
+    } else if (request.upload) {
+        requestStream << "Content-Length: " << request.upload->length() << "\r\n";
+    } else if (!request.body.empty() || head.has("content-length") || head.has("transfer-encoding")) {
+        requestStream << "Content-Length: " << request.body.size() << "\r\n";
+    }
+    requestStream << "Connection: keep-alive\r\n";
+    requestStream << "\r\n";
+    requestStream << request.body;
+    
+    return requestStream.str();
+}
+
+RelayTail ProxyServer::createRelayTail(UpstreamFetch& fetch) {
+    RelayTail tail;
+    tail.sourceFd = fetch.releaseSocket();
+    tail.remaining = fetch.relayRemaining();
+    
+    std::string origin = fetch.origin();
+    bool reusable = fetch.relayReusable();
+    // The origin's slot is held until the remainder has been relayed
+    std::shared_ptr<OriginSlot> slot = fetch.takeSlot();
+    tail.done = [this, origin, reusable, slot](const SpliceRelay& relay, bool complete) {
+        if (complete && reusable) {
+            upstreamPool_.release(origin, relay.source());
+        } else {
+            ::close(relay.source());
+        }
+        
+        stats_.add(STAT_RELAYED_RESPONSES);
+        stats_.add(relay.zeroCopy() ? STAT_SPLICED_BYTES : STAT_BUFFERED_RELAY_BYTES,
+                   relay.bytesRelayed());
+        stats_.add(STAT_RELAY_CPU_NANOS, relay.cpuNanos());
+        stats_.addHostBytes(origin, relay.bytesRelayed());
+    };
+    return tail;
+}
+
+void ProxyServer::sendResponse(const ClientPtr& client, const std::string& response) {
+    client->send(response);
+    client->finish();
+}
 
 int ProxyServer::extractStatusCode(const std::string& response) {
     // Extract status code from HTTP response
@@ -561,6 +2294,15 @@ int ProxyServer::extractStatusCode(const std::string& response) {
     }
 }
 
+// A fetch that got no slot of its busy origin is answered with 503, one
+// that failed at the origin with 502.
+std::string ProxyServer::fetchErrorResponse(const UpstreamFetch& done) {
+    if (done.unavailable()) {
+        return createErrorResponse(503, "Service Unavailable", done.error());
+    }
+    return createErrorResponse(502, "Bad Gateway", done.error());
+}
+
 std::string ProxyServer::createErrorResponse(int statusCode, const std::string& statusText, 
                                              const std::string& message) {
     std::ostringstream oss;
@@ -573,9 +2315,39 @@ std::string ProxyServer::createErrorResponse(int statusCode, const std::string&
     return oss.str();
 }
 
-bool ProxyServer::shouldCache(int statusCode) const {
-    // Don't cache 404 errors and other error responses
-    return statusCode == 200;
+bool ProxyServer::shouldCache(const ParsedRequest& request, const std::string& response) const {
+    return shouldCache(request, parseResponseHead(response));
+}
+
+bool ProxyServer::shouldCache(const ParsedRequest& request, const HttpResponseParser& head) const {
+    // Only successful responses whose headers permit storing are cached
+    if (head.statusCode() != 200) {
+        return false;
+    }
+    // saveToCache skips objects that alone exceed the size limits
+    std::string contentLength = head.header("content-length");
+    uint64_t length = contentLength.empty() ? 0 : std::strtoull(contentLength.c_str(), nullptr, 10);
+    if ((config_.cacheMaxBytes > 0 && length > config_.cacheMaxBytes) ||
+        (config_.cacheMaxObjectBytes > 0 && length > config_.cacheMaxObjectBytes)) {
+        return false;
+    }
+    return isStorableResponse(head.headers(), request.head.has("authorization"));
+}
+
+bool ProxyServer::shouldCacheNegative(const ParsedRequest& request, const HttpResponseParser& head) const {
+    return request.method == "GET" && !request.head.has("authorization") &&
+           negativeCache_.lifetime(head.statusCode(), head.headers(), std::time(nullptr)) > 0;
+}
+
+void ProxyServer::storeNegative(const ParsedRequest& request, const std::string& response) {
+    HttpResponseParser head = parseResponseHead(response);
+    time_t now = std::time(nullptr);
+    long ttl = negativeCache_.lifetime(head.statusCode(), head.headers(), now);
+    if (ttl <= 0) {
+        return;
+    }
+    negativeCache_.put(generateCacheKey(request), response, now + ttl);
+    stats_.add(STAT_NEGATIVE_STORES);
 }
 
 void ProxyServer::log(const std::string& message) const {
@@ -586,21 +2358,289 @@ void ProxyServer::log(const std::string& message) const {
               << message << std::endl;
 }
 
-void ProxyServer::updateStats(bool cacheHit, bool error) {
-    std::lock_guard<std::mutex> lock(statsMutex_);
-    stats_.totalRequests++;
-    if (cacheHit) {
-        stats_.cacheHits++;
-    } else {
-        stats_.cacheMisses++;
+ProxyServer::Stats ProxyServer::getStats() const {
+    Stats stats;
+    stats.totalRequests = stats_.get(STAT_REQUESTS);
+    stats.cacheHits = stats_.get(STAT_CACHE_HITS);
+    stats.cacheMisses = stats_.get(STAT_CACHE_MISSES);
+    stats.errors = stats_.get(STAT_ERRORS);
+    stats.keepAliveRequests = stats_.get(STAT_KEEPALIVE_REQUESTS);
+    stats.streamedUploads = stats_.get(STAT_STREAMED_UPLOADS);
+    stats.streamedUploadBytes = stats_.get(STAT_STREAMED_UPLOAD_BYTES);
+    stats.coalesceFallbacks = stats_.get(STAT_COALESCE_FALLBACKS);
+    stats.backgroundRevalidations = stats_.get(STAT_BACKGROUND_REVALIDATIONS);
+    stats.evictions = stats_.get(STAT_EVICTIONS);
+    stats.evictedBytes = stats_.get(STAT_EVICTED_BYTES);
+    stats.admissionRejects = stats_.get(STAT_ADMISSION_REJECTS);
+    stats.admissionRejectedBytes = stats_.get(STAT_ADMISSION_REJECTED_BYTES);
+    stats.relayedResponses = stats_.get(STAT_RELAYED_RESPONSES);
+    stats.splicedBytes = stats_.get(STAT_SPLICED_BYTES);
+    stats.bufferedRelayBytes = stats_.get(STAT_BUFFERED_RELAY_BYTES);
+    stats.relayCpuNanos = stats_.get(STAT_RELAY_CPU_NANOS);
+    // Closed tunnels are read first, so that one closing meanwhile cannot
+    // be counted as closed but not yet as opened
+    size_t tunnelsClosed = stats_.get(STAT_TUNNELS_CLOSED);
+    stats.tunnelsOpened = stats_.get(STAT_TUNNELS_OPENED);
+    stats.tunnelsActive = stats.tunnelsOpened - std::min(tunnelsClosed, stats.tunnelsOpened);
+    stats.tunnelIdleTimeouts = stats_.get(STAT_TUNNEL_IDLE_TIMEOUTS);
+    stats.tunnelBytesUp = stats_.get(STAT_TUNNEL_BYTES_UP);
+    stats.tunnelBytesDown = stats_.get(STAT_TUNNEL_BYTES_DOWN);
+    stats.hitLatency = stats_.latency(LATENCY_CACHE_HIT);
+    stats.fetchLatency = stats_.latency(LATENCY_UPSTREAM_FETCH);
+    stats.topHosts = stats_.topHosts(config_.statsTopHosts);
+    stats.upstreamPoolHits = upstreamPool_.hits();
+    stats.upstreamPoolMisses = upstreamPool_.misses();
+    stats.originQueuedFetches = originLimiter_.queuedExchanges();
+    stats.originWaitingFetches = originLimiter_.waitingExchanges();
+    stats.originRejectedFetches = originLimiter_.rejectedExchanges();
+    stats.originWithdrawnFetches = originLimiter_.withdrawnExchanges();
+    stats.originThrottledReads = originLimiter_.throttledReads();
+    stats.coalescedRequests = coalescer_.coalescedRequests();
+    stats.cacheEntries = cacheIndex_->entryCount();
+    stats.cacheBytes = cacheIndex_->totalBytes();
+    stats.memoryObjects = hotCache_.objectCount();
+    stats.memoryBytes = hotCache_.bytes();
+    stats.memoryReads = stats_.get(STAT_MEMORY_READS);
+    stats.diskReads = stats_.get(STAT_DISK_READS);
+    stats.warmupObjects = stats_.get(STAT_WARMUP_OBJECTS);
+    stats.warmupBytes = stats_.get(STAT_WARMUP_BYTES);
+    stats.rangeHits = stats_.get(STAT_RANGE_HITS);
+    stats.partialHits = stats_.get(STAT_PARTIAL_HITS);
+    stats.partialFetches = stats_.get(STAT_PARTIAL_FETCHES);
+    stats.partialFetchedBytes = stats_.get(STAT_PARTIAL_FETCHED_BYTES);
+    stats.partialObjects = partialCache_->objectCount();
+    stats.partialBytes = partialCache_->bytes();
+    stats.negativeHits = stats_.get(STAT_NEGATIVE_HITS);
+    stats.negativeStores = stats_.get(STAT_NEGATIVE_STORES);
+    stats.negativeEntries = negativeCache_.entryCount();
+    stats.negativeBytes = negativeCache_.bytes();
+    stats.compressedObjects = stats_.get(STAT_COMPRESSED_OBJECTS);
+    stats.compressionInBytes = stats_.get(STAT_COMPRESSION_IN_BYTES);
+    stats.compressionOutBytes = stats_.get(STAT_COMPRESSION_OUT_BYTES);
+    stats.compressCpuNanos = stats_.get(STAT_COMPRESS_CPU_NANOS);
+    stats.compressedHits = stats_.get(STAT_COMPRESSED_HITS);
+    stats.decompressedHits = stats_.get(STAT_DECOMPRESSED_HITS);
+    stats.decompressCpuNanos = stats_.get(STAT_DECOMPRESS_CPU_NANOS);
+    return stats;
+}
+
+void ProxyServer::logStats() const {
+    Stats stats = getStats();
+    size_t poolRequests = stats.upstreamPoolHits + stats.upstreamPoolMisses;
+    double poolHitRate = poolRequests > 0
+        ? 100.0 * stats.upstreamPoolHits / poolRequests : 0.0;
+    
+    std::ostringstream oss;
+    oss << "Stats: " << stats.totalRequests << " requests, "
+        << stats.cacheHits << " cache hits, "
+        << stats.cacheMisses << " cache misses, "
+        << stats.errors << " errors; "
+        << stats.keepAliveRequests << " on reused client connections; "
+        << stats.streamedUploads << " request bodies streamed (" << stats.streamedUploadBytes << " bytes)";
+    log(oss.str());
+    
+    oss.str("");
+    oss << "Upstream pool: " << stats.upstreamPoolHits << "/" << poolRequests
+        << " connections reused (hit rate " << std::fixed << std::setprecision(1)
+        << poolHitRate << "%)";
+    log(oss.str());
+    
+    oss.str("");
+    oss << "Origin limits: " << stats.originQueuedFetches << " fetches queued ("
+        << stats.originWaitingFetches << " waiting, " << stats.originRejectedFetches
+        << " rejected, " << stats.originWithdrawnFetches << " withdrawn), "
+        << stats.originThrottledReads << " reads throttled";
+    log(oss.str());
+    
+    oss.str("");
+    oss << "Cache: " << stats.cacheEntries << " objects, " << stats.cacheBytes << " bytes; "
+        << stats.evictions << " evicted (" << stats.evictedBytes << " bytes); "
+        << stats.admissionRejects << " not admitted (" << stats.admissionRejectedBytes << " bytes)";
+    log(oss.str());
+    
+    oss.str("");
+    oss << "Memory tier: " << stats.memoryObjects << " objects, " << stats.memoryBytes << " bytes; "
+        << stats.memoryReads << " reads from memory, " << stats.diskReads << " from disk; "
+        << stats.warmupObjects << " objects (" << stats.warmupBytes << " bytes) preloaded";
+    log(oss.str());
+    
+    oss.str("");
+    oss << "Ranges: " << stats.rangeHits << " served from stored responses, " << stats.partialHits
+        << " from partial objects; " << stats.partialFetches << " range fetches ("
+        << stats.partialFetchedBytes << " bytes); partial objects: " << stats.partialObjects
+        << " (" << stats.partialBytes << " bytes)";
+    log(oss.str());
+    
+    oss.str("");
+    oss << "Negative cache: " << stats.negativeHits << " hits, " << stats.negativeStores
+        << " responses stored; " << stats.negativeEntries << " entries (" << stats.negativeBytes
+        << " bytes)";
+    log(oss.str());
+    
+    oss.str("");
+    uint64_t compressedHits = stats.compressedHits + stats.decompressedHits;
+    oss << "Compression: " << stats.compressedObjects << " objects stored gzip-encoded, ratio "
+        << std::fixed << std::setprecision(2)
+        << (stats.compressionOutBytes > 0 ? double(stats.compressionInBytes) / stats.compressionOutBytes : 1.0)
+        << " (" << stats.compressionInBytes << " -> " << stats.compressionOutBytes << " bytes), "
+        << std::setprecision(1) << stats.compressCpuNanos / 1e6 << " ms CPU; hits: "
+        << stats.compressedHits << " sent compressed, " << stats.decompressedHits
+        << " decompressed, " << (compressedHits > 0 ? stats.decompressCpuNanos / 1e3 / compressedHits : 0.0)
+        << " us extra CPU per hit";
+    log(oss.str());
+    
+    oss.str("");
+    oss << "Revalidation: " << stats.backgroundRevalidations << " background refreshes";
+    log(oss.str());
+    
+    oss.str("");
+    oss << "Tunnels: " << stats.tunnelsOpened << " opened, " << stats.tunnelsActive
+        << " active, " << stats.tunnelIdleTimeouts << " idle timeouts; "
+        << stats.tunnelBytesUp << " bytes up, " << stats.tunnelBytesDown << " bytes down";
+    log(oss.str());
+    
+    oss.str("");
+    oss << "DNS cache: " << dnsCache_.entryCount() << " entries, " << dnsCache_.hits()
+        << " hits, " << dnsCache_.misses() << " misses (" << dnsCache_.negativeHits()
+        << " negative hits), " << dnsCache_.refreshes() << " background refreshes";
+    log(oss.str());
+    
+    oss.str("");
+    uint64_t relayedBytes = stats.splicedBytes + stats.bufferedRelayBytes;
+    double relayCpuSeconds = stats.relayCpuNanos / 1e9;
+    oss << "Relay: " << stats.relayedResponses << " uncached responses, "
+        << stats.splicedBytes << " bytes spliced, " << stats.bufferedRelayBytes
+        << " bytes through the fallback buffer";
+    if (relayCpuSeconds > 0) {
+        oss << ", " << std::fixed << std::setprecision(1)
+            << relayedBytes / relayCpuSeconds / (1024 * 1024) << " MB per CPU-second";
     }
-    if (error) {
-        stats_.errors++;
+    log(oss.str());
+    
+    oss.str("");
+    oss << "Coalescing: " << stats.coalescedRequests << " requests joined an in-flight fetch, "
+        << stats.coalesceFallbacks << " fell back to their own fetch";
+    log(oss.str());
+    
+    oss.str("");
+    oss << "Latency: cache hits p50 " << stats.hitLatency.percentile(0.5) / 1000.0
+        << " ms, p99 " << stats.hitLatency.percentile(0.99) / 1000.0 << " ms ("
+        << stats.hitLatency.count << "); upstream fetches p50 "
+        << stats.fetchLatency.percentile(0.5) / 1000.0 << " ms, p99 "
+        << stats.fetchLatency.percentile(0.99) / 1000.0 << " ms (" << stats.fetchLatency.count << ")";
+    log(oss.str());
+    
+    if (!stats.topHosts.empty()) {
+        oss.str("");
+        oss << "Top origins by bytes:";
+        for (size_t i = 0; i < stats.topHosts.size(); ++i) {
+            oss << (i == 0 ? " " : ", ") << stats.topHosts[i].host << " " << stats.topHosts[i].bytes;
+        }
+        log(oss.str());
     }
 }
 
-ProxyServer::Stats ProxyServer::getStats() const {
-    std::lock_guard<std::mutex> lock(statsMutex_);
-    return stats_;
+// Prometheus text exposition of the counters, latencies and top origins
+std::string ProxyServer::formatMetrics() const {
+    Stats stats = getStats();
+    std::ostringstream oss;
+    
+    struct Metric {
+        const char* name;
+        const char* type;
+        uint64_t value;
+    };
+    const Metric metrics[] = {
+        {"proxy_requests_total", "counter", stats.totalRequests},
+        {"proxy_cache_hits_total", "counter", stats.cacheHits},
+        {"proxy_cache_misses_total", "counter", stats.cacheMisses},
+        {"proxy_errors_total", "counter", stats.errors},
+        {"proxy_keepalive_requests_total", "counter", stats.keepAliveRequests},
+        {"proxy_streamed_uploads_total", "counter", stats.streamedUploads},
+        {"proxy_streamed_upload_bytes_total", "counter", stats.streamedUploadBytes},
+        {"proxy_upstream_pool_hits_total", "counter", stats.upstreamPoolHits},
+        {"proxy_upstream_pool_misses_total", "counter", stats.upstreamPoolMisses},
+        {"proxy_origin_queued_fetches_total", "counter", stats.originQueuedFetches},
+        {"proxy_origin_waiting_fetches", "gauge", stats.originWaitingFetches},
+        {"proxy_origin_rejected_fetches_total", "counter", stats.originRejectedFetches},
+        {"proxy_origin_withdrawn_fetches_total", "counter", stats.originWithdrawnFetches},
+        {"proxy_origin_throttled_reads_total", "counter", stats.originThrottledReads},
+        {"proxy_coalesced_requests_total", "counter", stats.coalescedRequests},
+        {"proxy_coalesce_fallbacks_total", "counter", stats.coalesceFallbacks},
+        {"proxy_background_revalidations_total", "counter", stats.backgroundRevalidations},
+        {"proxy_evictions_total", "counter", stats.evictions},
+        {"proxy_evicted_bytes_total", "counter", stats.evictedBytes},
+        {"proxy_admission_rejects_total", "counter", stats.admissionRejects},
+        {"proxy_admission_rejected_bytes_total", "counter", stats.admissionRejectedBytes},
+        {"proxy_cache_objects", "gauge", stats.cacheEntries},
+        {"proxy_cache_bytes", "gauge", stats.cacheBytes},
+        {"proxy_memory_cache_objects", "gauge", stats.memoryObjects},
+        {"proxy_memory_cache_bytes", "gauge", stats.memoryBytes},
+        {"proxy_memory_cache_reads_total", "counter", stats.memoryReads},
+        {"proxy_disk_cache_reads_total", "counter", stats.diskReads},
+        {"proxy_warmup_objects_total", "counter", stats.warmupObjects},
+        {"proxy_warmup_bytes_total", "counter", stats.warmupBytes},
+        {"proxy_range_hits_total", "counter", stats.rangeHits},
+        {"proxy_partial_hits_total", "counter", stats.partialHits},
+        {"proxy_partial_fetches_total", "counter", stats.partialFetches},
+        {"proxy_partial_fetched_bytes_total", "counter", stats.partialFetchedBytes},
+        {"proxy_partial_objects", "gauge", stats.partialObjects},
+        {"proxy_partial_bytes", "gauge", stats.partialBytes},
+        {"proxy_negative_hits_total", "counter", stats.negativeHits},
+        {"proxy_negative_stores_total", "counter", stats.negativeStores},
+        {"proxy_negative_entries", "gauge", stats.negativeEntries},
+        {"proxy_negative_bytes", "gauge", stats.negativeBytes},
+        {"proxy_compressed_objects_total", "counter", stats.compressedObjects},
+        {"proxy_compression_input_bytes_total", "counter", stats.compressionInBytes},
+        {"proxy_compression_output_bytes_total", "counter", stats.compressionOutBytes},
+        {"proxy_compress_cpu_nanoseconds_total", "counter", stats.compressCpuNanos},
+        {"proxy_compressed_hits_total", "counter", stats.compressedHits},
+        {"proxy_decompressed_hits_total", "counter", stats.decompressedHits},
+        {"proxy_decompress_cpu_nanoseconds_total", "counter", stats.decompressCpuNanos},
+        {"proxy_relayed_responses_total", "counter", stats.relayedResponses},
+        {"proxy_spliced_bytes_total", "counter", stats.splicedBytes},
+        {"proxy_buffered_relay_bytes_total", "counter", stats.bufferedRelayBytes},
+        {"proxy_tunnels_opened_total", "counter", stats.tunnelsOpened},
+        {"proxy_tunnels_active", "gauge", stats.tunnelsActive},
+        {"proxy_tunnel_idle_timeouts_total", "counter", stats.tunnelIdleTimeouts},
+        {"proxy_tunnel_bytes_up_total", "counter", stats.tunnelBytesUp},
+        {"proxy_tunnel_bytes_down_total", "counter", stats.tunnelBytesDown},
+        {"proxy_dns_cache_hits_total", "counter", dnsCache_.hits()},
+        {"proxy_dns_cache_misses_total", "counter", dnsCache_.misses()},
+    };
+    for (size_t i = 0; i < sizeof(metrics) / sizeof(metrics[0]); ++i) {
+        oss << "# TYPE " << metrics[i].name << " " << metrics[i].type << "\n"
+            << metrics[i].name << " " << metrics[i].value << "\n";
+    }
+    
+    oss << "# TYPE proxy_latency_seconds summary\n";
+    writeLatency(oss, "cache_hit", stats.hitLatency);
+    writeLatency(oss, "upstream_fetch", stats.fetchLatency);
+    
+    // Approximate: counts may exceed the true value by at most the error
+    oss << "# TYPE proxy_origin_bytes gauge\n";
+    for (size_t i = 0; i < stats.topHosts.size(); ++i) {
+        oss << "proxy_origin_bytes{origin=\"" << escapeLabel(stats.topHosts[i].host) << "\"} "
+            << stats.topHosts[i].bytes << "\n";
+    }
+    oss << "# TYPE proxy_origin_bytes_error gauge\n";
+    for (size_t i = 0; i < stats.topHosts.size(); ++i) {
+        oss << "proxy_origin_bytes_error{origin=\"" << escapeLabel(stats.topHosts[i].host) << "\"} "
+            << stats.topHosts[i].error << "\n";
+    }
+    return oss.str();
+}
+
+void ProxyServer::serveStats(const ClientPtr& client) {
+    std::string body = formatMetrics();
+    std::ostringstream oss;
+    oss << "HTTP/1.1 200 OK\r\n";
+    oss << "Content-Type: text/plain; version=0.0.4\r\n";
+    oss << "Content-Length: " << body.size() << "\r\n";
+    oss << "Cache-Control: no-store\r\n";
+    oss << "Connection: close\r\n";
+    oss << "\r\n";
+    oss << body;
+    sendResponse(client, oss.str());
 }
 
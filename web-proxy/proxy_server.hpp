@@ -14,6 +14,32 @@
 #include <iomanip>
 #include <algorithm>
 #include <cctype>
+#include <functional>
+#include <set>
+#include <vector>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include "http_message.hpp"
+#include "cache_policy.hpp"
+#include "cache_index.hpp"
+#include "cache_eviction.hpp"
+#include "cache_admission.hpp"
+#include "hot_cache.hpp"
+#include "partial_cache.hpp"
+#include "negative_cache.hpp"
+#include "http_range.hpp"
+#include "upstream_pool.hpp"
+#include "request_coalescer.hpp"
+#include "reactor.hpp"
+#include "worker_pool.hpp"
+#include "dns_cache.hpp"
+#include "upstream_fetch.hpp"
+#include "origin_limiter.hpp"
+#include "client_connection.hpp"
+#include "tunnel.hpp"
+#include "proxy_stats.hpp"
+#include "body_spool.hpp"
 
 // RAII wrapper for socket
 class Socket {
@@ -63,27 +89,79 @@ struct ParsedRequest {
     std::string path;
     int port;
     std::string version;
-    std::map<std::string, std::string> headers;
-    std::string body;
+    HttpRequestHead head;
+    // Fields sent upstream in place of the client's fields of the same name
+    std::vector<std::pair<std::string, std::string>> overrides;
+    std::string body;                // decoded, if the client sent it chunked
+    // A body too large to buffer, still arriving; `body` is then empty
+    std::shared_ptr<UploadStream> upload;
     
     ParsedRequest() : port(80) {}
 };
 
-struct CacheEntry {
-    std::string filePath;
-    std::string lastModified;
-    time_t timestamp;
-    int statusCode;
+struct ProxyConfig {
+    size_t poolMaxIdlePerHost;   // idle keep-alive connections kept per origin
+    int poolMaxIdleSeconds;      // idle connections older than this are closed
+    int coalesceTimeoutMs;       // how long a coalesced request waits for progress
+    uint64_t cacheMaxBytes;      // total size of cached objects, 0 = unlimited
+    uint64_t cacheMaxObjectBytes; // larger responses are relayed, not cached; 0 = unlimited
+    size_t cacheMaxEntries;      // number of cached objects, 0 = unlimited
+    bool cacheAdmission;         // once the cache is nearly full, admit only objects
+                                 // requested more often than the next victim
+    uint64_t memoryCacheBytes;   // responses kept in memory as well, 0 = disabled
+    uint64_t memoryCacheMaxObjectBytes; // larger responses are only read from disk
+    int hotSetSnapshotSeconds;   // how often the hot set is saved, 0 = only at stop
+    bool compressCache;          // store text-like bodies gzip-encoded
+    int cacheCompressionLevel;   // zlib level, 1 (fast) to 9 (small)
+    uint64_t compressMaxObjectBytes; // larger bodies are stored as they are, so their
+                                 // ranges are sent from the file; 0 = unlimited
+    uint64_t rangeChunkBytes;    // unit in which partial objects are fetched and stored
+    uint64_t partialCacheMaxBytes; // stored chunks of partial objects, 0 = unlimited
+    uint64_t rangeMaxBytes;      // largest range fetched into the partial store, 0 = disabled
+    NegativeCacheConfig negativeCache; // short-lived redirects, 404s and upstream failures
+    size_t reactorThreads;       // event loops serving client connections
+    size_t resolverThreads;      // threads running blocking DNS lookups
+    size_t storageThreads;       // threads compressing, decoding and writing cached objects
+    DnsCacheConfig dnsCache;     // TTL bounds and size of the upstream DNS cache
+    int clientIdleTimeoutMs;     // client sends nothing or accepts no bytes
+    int clientKeepAliveTimeoutMs; // persistent client connection waits for its next request
+    size_t clientMaxRequests;    // requests per client connection, 0 = unlimited
+    uint64_t maxRequestBodyBytes; // larger request bodies are refused with 413, 0 = unlimited
+    int tunnelIdleTimeoutMs;     // CONNECT tunnel without traffic in either direction
+    UpstreamTimeouts upstreamTimeouts; // connect, first byte and idle limits
+    OriginLimitConfig originLimits; // concurrent exchanges and read rate per origin
+    std::string statsPath;       // served on the proxy port; empty = disabled
+    size_t statsTopHosts;        // origins listed by bytes
     
-    CacheEntry() : timestamp(0), statusCode(0) {}
+    ProxyConfig() : poolMaxIdlePerHost(8), poolMaxIdleSeconds(30),
+                    coalesceTimeoutMs(5000), cacheMaxBytes(1024ULL * 1024 * 1024),
+                    cacheMaxObjectBytes(64ULL * 1024 * 1024),
+                    cacheMaxEntries(100000), cacheAdmission(true), memoryCacheBytes(64ULL * 1024 * 1024),
+                    memoryCacheMaxObjectBytes(1024 * 1024), hotSetSnapshotSeconds(60),
+                    compressCache(true), cacheCompressionLevel(6),
+                    compressMaxObjectBytes(1024 * 1024),
+                    rangeChunkBytes(256 * 1024), partialCacheMaxBytes(512ULL * 1024 * 1024),
+                    rangeMaxBytes(8 * 1024 * 1024),
+                    reactorThreads(4), resolverThreads(4), storageThreads(2),
+                    clientIdleTimeoutMs(30000), clientKeepAliveTimeoutMs(15000),
+                    clientMaxRequests(1000), maxRequestBodyBytes(100ULL * 1024 * 1024),
+                    tunnelIdleTimeoutMs(300000),
+                    statsPath("/proxy-stats"), statsTopHosts(10) {}
 };
 
 class ProxyServer {
 public:
-    ProxyServer(int port, const std::string& cacheDir = "./cache");
+    ProxyServer(int port, const std::string& cacheDir = "./cache",
+                const ProxyConfig& config = ProxyConfig());
     ~ProxyServer();
     
+    // Serves on the calling thread and reactorThreads - 1 more until
+    // requestStop(); returns once every event loop has ended.
     void start();
+    // Async-signal-safe: only wakes the accepting event loop, which then
+    // ends them all.
+    void requestStop();
+    // Saves the hot set and flushes the index; called after start() returned.
     void stop();
     
     // Statistics
@@ -92,39 +170,216 @@ public:
         size_t cacheHits;
         size_t cacheMisses;
         size_t errors;
+        size_t keepAliveRequests;    // requests that arrived on a reused client connection
+        uint64_t streamedUploads;    // request bodies forwarded while they arrived
+        uint64_t streamedUploadBytes;
+        size_t upstreamPoolHits;     // requests sent over a reused connection
+        size_t upstreamPoolMisses;   // requests that needed a new connection
+        uint64_t originQueuedFetches; // fetches that waited for a slot of their origin
+        size_t originWaitingFetches; // waiting now
+        uint64_t originRejectedFetches; // turned away with 503: the queue was full
+        uint64_t originWithdrawnFetches; // left the queue: waited too long or no client was left
+        uint64_t originThrottledReads; // reads put off by an origin's bandwidth limit
+        size_t coalescedRequests;    // misses served from another request's fetch
+        size_t coalesceFallbacks;    // coalesced requests that had to fetch themselves
+        size_t backgroundRevalidations; // stale-while-revalidate refreshes
+        size_t evictions;            // objects removed to stay within the cache limits
+        uint64_t evictedBytes;
+        uint64_t admissionRejects;   // fetched objects not stored by the admission filter
+        uint64_t admissionRejectedBytes;
+        size_t cacheEntries;         // current number of cached objects
+        uint64_t cacheBytes;         // current size of cached objects
+        size_t memoryObjects;        // responses held in memory
+        uint64_t memoryBytes;
+        uint64_t memoryReads;        // stored responses read from memory
+        uint64_t diskReads;          // stored responses read from their files
+        size_t warmupObjects;        // preloaded from the hot-set snapshot
+        uint64_t warmupBytes;
+        uint64_t rangeHits;          // ranges cut out of stored full responses
+        uint64_t partialHits;        // served from partial objects without the origin
+        uint64_t partialFetches;     // range requests sent to fill partial objects
+        uint64_t partialFetchedBytes;
+        size_t partialObjects;       // objects of which only some chunks are stored
+        uint64_t partialBytes;
+        uint64_t negativeHits;       // redirects, 404s and failures answered from memory
+        uint64_t negativeStores;
+        size_t negativeEntries;
+        uint64_t negativeBytes;
+        uint64_t compressedObjects;  // responses stored gzip-encoded
+        uint64_t compressionInBytes; // their size before and after compression
+        uint64_t compressionOutBytes;
+        uint64_t compressCpuNanos;   // CPU time spent compressing
+        uint64_t compressedHits;     // compressed objects sent as they are
+        uint64_t decompressedHits;   // compressed objects decoded for the client
+        uint64_t decompressCpuNanos;
+        size_t relayedResponses;     // bodies moved socket-to-socket, bypassing the cache
+        uint64_t splicedBytes;       // relayed with splice()
+        uint64_t bufferedRelayBytes; // relayed through the fallback buffer
+        uint64_t relayCpuNanos;      // CPU time spent relaying
+        size_t tunnelsOpened;        // CONNECT tunnels established
+        size_t tunnelsActive;
+        size_t tunnelIdleTimeouts;   // tunnels closed for lack of traffic
+        uint64_t tunnelBytesUp;      // client to origin, over closed tunnels
+        uint64_t tunnelBytesDown;    // origin to client, over closed tunnels
+        LatencyHistogram hitLatency;
+        LatencyHistogram fetchLatency;
+        std::vector<HostBytes> topHosts; // response and tunnel bytes per origin
         
-        Stats() : totalRequests(0), cacheHits(0), cacheMisses(0), errors(0) {}
+        Stats() : totalRequests(0), cacheHits(0), cacheMisses(0), errors(0), keepAliveRequests(0),
+                  streamedUploads(0), streamedUploadBytes(0),
+                  upstreamPoolHits(0), upstreamPoolMisses(0),
+                  originQueuedFetches(0), originWaitingFetches(0),
+                  originRejectedFetches(0), originWithdrawnFetches(0), originThrottledReads(0),
+                  coalescedRequests(0), coalesceFallbacks(0),
+                  backgroundRevalidations(0), evictions(0), evictedBytes(0),
+                  admissionRejects(0), admissionRejectedBytes(0),
+                  cacheEntries(0), cacheBytes(0), memoryObjects(0), memoryBytes(0),
+                  memoryReads(0), diskReads(0), warmupObjects(0), warmupBytes(0),
+                  rangeHits(0), partialHits(0), partialFetches(0), partialFetchedBytes(0),
+                  partialObjects(0), partialBytes(0), negativeHits(0), negativeStores(0),
+                  negativeEntries(0), negativeBytes(0), compressedObjects(0),
+                  compressionInBytes(0), compressionOutBytes(0), compressCpuNanos(0),
+                  compressedHits(0), decompressedHits(0), decompressCpuNanos(0),
+                  relayedResponses(0), splicedBytes(0),
+                  bufferedRelayBytes(0), relayCpuNanos(0), tunnelsOpened(0),
+                  tunnelsActive(0), tunnelIdleTimeouts(0), tunnelBytesUp(0),
+                  tunnelBytesDown(0) {}
     };
     
     Stats getStats() const;
 
 private:
     Socket serverSocket_;
+    Socket stopEvent_;              // eventfd written by requestStop()
+    std::atomic<bool> stopped_;
     int port_;
     std::string cacheDir_;
+    ProxyConfig config_;
     bool isRunning_;
     mutable std::mutex logMutex_;
     mutable std::mutex cacheMutex_;
-    mutable std::mutex statsMutex_;
-    mutable Stats stats_;
+    std::unique_ptr<CacheIndex> cacheIndex_;
+    std::unique_ptr<PartialObjectStore> partialCache_;
+    // Vary field names by their hash; sites use few distinct lists
+    std::mutex varyMutex_;
+    std::map<uint64_t, std::vector<std::string> > varySpecs_;
+    GdsfPolicy evictionPolicy_;
+    AdmissionFilter admissionFilter_;
+    std::thread evictionThread_;
+    std::mutex evictionMutex_;
+    std::condition_variable evictionCond_;
+    bool evictionStop_;
+    HotObjectCache hotCache_;
+    NegativeCache negativeCache_;
+    std::thread warmupThread_;
+    std::atomic<bool> warmupStop_;
+    // The snapshot is only rewritten once the previous one was preloaded
+    std::atomic<bool> warmupDone_;
+    ProxyStats stats_;
+    // Declared before everything that may hold a slot of it
+    OriginLimiter originLimiter_;
+    UpstreamPool upstreamPool_;
+    RequestCoalescer coalescer_;
+    std::mutex revalidateMutex_;
+    std::set<std::string> revalidating_;
+    std::vector<std::unique_ptr<Reactor> > reactors_;
+    std::vector<std::thread> reactorThreads_;
+    size_t nextReactor_;
+    // Declared after the reactors: lookups in progress post to them
+    WorkerPool resolverPool_;
+    // Compression, decoding and object writes; finished ones post to the reactors
+    WorkerPool storagePool_;
+    DnsCache dnsCache_;
+    UpstreamContext upstreamContext_;
     
-    void handleClient(int clientSocket);
-    ParsedRequest parseRequest(const std::string& rawRequest);
+    typedef std::shared_ptr<ClientConnection> ClientPtr;
+    struct RangeFill;
+    
+    void acceptClients();
+    void stopLoops();
+    void handleRequest(const ClientPtr& client, HttpRequestParser& parser);
+    void processRequest(const ClientPtr& client, const ParsedRequest& request);
+    ParsedRequest parseRequest(HttpRequestParser& parser);
     std::string generateCacheKey(const ParsedRequest& request);
     std::string getCacheFilePath(const std::string& cacheKey);
-    bool isCached(const std::string& cacheKey);
-    CacheEntry getCacheEntry(const std::string& cacheKey);
-    void saveToCache(const std::string& cacheKey, const std::string& response, int statusCode);
-    std::string fetchFromServer(const ParsedRequest& request);
-    void sendResponse(int clientSocket, const std::string& response);
-    std::string readFullResponse(Socket& socket);
+    bool getCacheEntry(const std::string& cacheKey, CacheEntry& entry);
+    bool lookupObject(const ParsedRequest& request, const std::string& cacheKey,
+                      std::string& objectKey, CacheEntry& entry);
+    bool varyNames(const std::string& cacheKey, const CacheEntry& marker, std::vector<std::string>& names);
+    std::string variantKey(const ParsedRequest& request, const std::string& cacheKey,
+                           const std::vector<std::string>& names) const;
+    void saveToCache(const ParsedRequest& request, const std::string& response);
+    void saveToCache(const ParsedRequest& request, const HttpResponseParser& received,
+                     const std::shared_ptr<BodySpool>& body);
+    void storeResponse(const ParsedRequest& request, const std::string& response);
+    void storeSpooled(const ParsedRequest& request, const std::string& identityHead, const BodySpool& body);
+    bool prepareEntry(const ParsedRequest& request, const HttpResponseParser& head, uint64_t size,
+                      std::string& cacheKey, CacheEntry& entry, std::string& spec);
+    void storeObject(const std::string& cacheKey, const std::string& spec, uint64_t keyHash,
+                     const CacheEntry& entry, const std::function<bool(const std::string&)>& write,
+                     const std::string& response);
+    bool storeVaryMarker(const std::string& cacheKey, uint64_t varyHash, const std::string& spec);
+    std::string readCachedResponse(const std::string& cacheKey, CacheEntry& entry);
+    bool worthCompressing(const HttpResponseParser& head, uint64_t bodyLength) const;
+    bool compressResponse(const std::string& response, std::string& compressed);
+    bool compressSpooled(const HttpResponseParser& head, const BodySpool& body,
+                         std::string& compressedHead, std::unique_ptr<BodySpool>& compressed);
+    void sendStored(const ClientPtr& client, const ParsedRequest& request, const std::string& stored,
+                    bool compressed);
+    bool sendObjectFile(const ClientPtr& client, const ParsedRequest& request, const std::string& cacheKey,
+                        const CacheEntry& entry);
+    void sendDecoded(const ClientPtr& client, const std::string& origin,
+                     const std::function<std::string()>& load);
+    std::string decodeStored(const std::string& stored);
+    bool clientAcceptsStoredCopy(const ParsedRequest& request) const;
+    void revalidate(Reactor& reactor, const ClientPtr& client, const ParsedRequest& request,
+                    const std::string& cacheKey, CacheEntry entry);
+    void refreshCacheEntry(const CacheEntry& entry, const std::string& cachedResponse,
+                           const HttpResponseParser& notModified);
+    void startBackgroundRevalidation(Reactor& reactor, const ParsedRequest& request,
+                                     const std::string& cacheKey);
+    bool serveCachedRange(const ClientPtr& client, const ParsedRequest& request,
+                          const std::string& cacheKey, const CacheEntry& entry);
+    bool serveRangesFrom(const ClientPtr& client, const ParsedRequest& request, const std::string& response);
+    bool sendRanges(const ClientPtr& client, const ParsedRequest& request, const std::vector<RangeSpec>& specs,
+                    const std::string& head, const std::string* memory, Socket& file,
+                    uint64_t bodyOffset, uint64_t bodyLength);
+    bool servePartial(const ClientPtr& client, const ParsedRequest& request,
+                      const std::string& cacheKey, uint64_t startedUs);
+    bool sendPartialObject(const ClientPtr& client, const std::string& cacheKey,
+                           const ByteRange& range, bool partialContent);
+    void fillRange(Reactor& reactor, const std::shared_ptr<RangeFill>& fill, const ByteRange& run);
+    bool storeRangeResponse(const std::shared_ptr<RangeFill>& fill, const HttpResponseParser& response);
+    void continueRangeFill(Reactor& reactor, const std::shared_ptr<RangeFill>& fill);
+    void passThroughRange(const std::shared_ptr<RangeFill>& fill);
+    bool admitToCache(uint64_t keyHash);
+    void recordCacheHit(const std::string& cacheKey);
+    bool overCacheLimits(double fraction) const;
+    void evictionLoop();
+    void evictEntries();
+    std::string hotSetPath() const;
+    void warmUp();
+    void saveHotSet();
+    std::shared_ptr<UpstreamFetch> createUpstreamFetch(Reactor& reactor, const ParsedRequest& request);
+    void startFetch(Reactor& reactor, const ParsedRequest& request, const std::string& cacheKey,
+                    const std::shared_ptr<InFlightFetch>& response, bool coalesced);
+    void openTunnel(const ClientPtr& client, const ParsedRequest& request);
+    void relayCoalesced(const ClientPtr& client, const ParsedRequest& request, const std::string& cacheKey);
+    std::string buildUpstreamRequest(const ParsedRequest& request) const;
+    void sendResponse(const ClientPtr& client, const std::string& response);
     int extractStatusCode(const std::string& response);
+    std::string fetchErrorResponse(const UpstreamFetch& done);
     std::string createErrorResponse(int statusCode, const std::string& statusText, 
                                     const std::string& message);
     void log(const std::string& message) const;
-    void updateStats(bool cacheHit, bool error = false);
-    bool shouldCache(int statusCode) const;
-    std::string sanitizeFilename(const std::string& filename) const;
+    void logStats() const;
+    void serveStats(const ClientPtr& client);
+    std::string formatMetrics() const;
+    bool shouldCache(const ParsedRequest& request, const std::string& response) const;
+    bool shouldCache(const ParsedRequest& request, const HttpResponseParser& head) const;
+    bool shouldCacheNegative(const ParsedRequest& request, const HttpResponseParser& head) const;
+    void storeNegative(const ParsedRequest& request, const std::string& response);
+    RelayTail createRelayTail(UpstreamFetch& fetch);
 };
 
 #endif // PROXY_SERVER_HPP
@@ -0,0 +1,172 @@
+#include "proxy_stats.hpp"
+#include <algorithm>
+#include <chrono>
+
+// ==================== LatencyHistogram ====================
+
+const size_t LatencyHistogram::kSubBuckets;
+const size_t LatencyHistogram::kBucketCount;
+
+size_t LatencyHistogram::bucketOf(uint64_t micros) {
+    if (micros < kSubBuckets) {
+        return static_cast<size_t>(micros);
+    }
+    // Position of the highest bit picks the power of two, the three bits
+    // below it the sub-bucket
+    size_t exponent = 63 - __builtin_clzll(micros);
+    size_t bucket = kSubBuckets + (exponent - 3) * kSubBuckets +
+                    static_cast<size_t>((micros >> (exponent - 3)) & (kSubBuckets - 1));
+    return std::min(bucket, kBucketCount - 1);
+}
+
+uint64_t LatencyHistogram::bucketLimit(size_t bucket) {
+    if (bucket < kSubBuckets) {
+        return bucket + 1;
+    }
+    size_t exponent = 3 + (bucket - kSubBuckets) / kSubBuckets;
+    uint64_t sub = (bucket - kSubBuckets) % kSubBuckets;
+    return ((kSubBuckets + sub) << (exponent - 3)) + (1ULL << (exponent - 3));
+}
+
+uint64_t LatencyHistogram::percentile(double quantile) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(quantile * count + 0.5);
+    rank = std::max<uint64_t>(1, std::min(rank, count));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return bucketLimit(i);
+        }
+    }
+    return bucketLimit(buckets.size() - 1);
+}
+
+// ==================== ProxyStats ====================
+
+const size_t ProxyStats::kShards;
+
+namespace {
+
+std::atomic<size_t> nextShard(0);
+
+} // namespace
+
+ProxyStats::ProxyStats(size_t hostCapacity) : hostCapacity_(std::max<size_t>(hostCapacity, 1)) {
+    for (size_t s = 0; s < kShards; ++s) {
+        Shard& shard = shards_[s];
+        for (size_t i = 0; i < STAT_COUNTER_COUNT; ++i) {
+            shard.counters[i].store(0, std::memory_order_relaxed);
+        }
+        for (size_t k = 0; k < LATENCY_KIND_COUNT; ++k) {
+            for (size_t i = 0; i < LatencyHistogram::kBucketCount; ++i) {
+                shard.latencyBuckets[k][i].store(0, std::memory_order_relaxed);
+            }
+            shard.latencyCount[k].store(0, std::memory_order_relaxed);
+            shard.latencySum[k].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+uint64_t ProxyStats::nowMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ProxyStats::Shard& ProxyStats::localShard() {
+    // Threads are spread over the shards in the order they first record
+    // something; beyond kShards threads two may share one (still atomic)
+    static thread_local size_t index = nextShard.fetch_add(1) % kShards;
+    return shards_[index];
+}
+
+void ProxyStats::add(StatCounter counter, uint64_t value) {
+    localShard().counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+void ProxyStats::recordLatency(LatencyKind kind, uint64_t micros) {
+    Shard& shard = localShard();
+    shard.latencyBuckets[kind][LatencyHistogram::bucketOf(micros)].fetch_add(1, std::memory_order_relaxed);
+    shard.latencyCount[kind].fetch_add(1, std::memory_order_relaxed);
+    shard.latencySum[kind].fetch_add(micros, std::memory_order_relaxed);
+}
+
+void ProxyStats::addHostBytes(const std::string& host, uint64_t bytes) {
+    if (bytes == 0) {
+        return;
+    }
+    Shard& shard = localShard();
+    std::lock_guard<std::mutex> lock(shard.hostsMutex);
+    std::unordered_map<std::string, HostCount>::iterator it = shard.hosts.find(host);
+    if (it != shard.hosts.end()) {
+        it->second.bytes += bytes;
+        return;
+    }
+    if (shard.hosts.size() < hostCapacity_) {
+        HostCount count = {bytes, 0};
+        shard.hosts[host] = count;
+        return;
+    }
+
+    std::unordered_map<std::string, HostCount>::iterator smallest = shard.hosts.begin();
+    for (it = shard.hosts.begin(); it != shard.hosts.end(); ++it) {
+        if (it->second.bytes < smallest->second.bytes) {
+            smallest = it;
+        }
+    }
+    HostCount count = {smallest->second.bytes + bytes, smallest->second.bytes};
+    shard.hosts.erase(smallest);
+    shard.hosts[host] = count;
+}
+
+uint64_t ProxyStats::get(StatCounter counter) const {
+    uint64_t total = 0;
+    for (size_t s = 0; s < kShards; ++s) {
+        total += shards_[s].counters[counter].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+LatencyHistogram ProxyStats::latency(LatencyKind kind) const {
+    LatencyHistogram histogram;
+    for (size_t s = 0; s < kShards; ++s) {
+        const Shard& shard = shards_[s];
+        for (size_t i = 0; i < LatencyHistogram::kBucketCount; ++i) {
+            histogram.buckets[i] += shard.latencyBuckets[kind][i].load(std::memory_order_relaxed);
+        }
+        histogram.count += shard.latencyCount[kind].load(std::memory_order_relaxed);
+        histogram.sumMicros += shard.latencySum[kind].load(std::memory_order_relaxed);
+    }
+    return histogram;
+}
+
+std::vector<HostBytes> ProxyStats::topHosts(size_t limit) const {
+    std::unordered_map<std::string, HostCount> merged;
+    for (size_t s = 0; s < kShards; ++s) {
+        Shard& shard = const_cast<Shard&>(shards_[s]);
+        std::lock_guard<std::mutex> lock(shard.hostsMutex);
+        for (std::unordered_map<std::string, HostCount>::const_iterator it = shard.hosts.begin();
+             it != shard.hosts.end(); ++it) {
+            HostCount& total = merged[it->first];
+            total.bytes += it->second.bytes;
+            total.error += it->second.error;
+        }
+    }
+
+    std::vector<HostBytes> hosts;
+    hosts.reserve(merged.size());
+    for (std::unordered_map<std::string, HostCount>::const_iterator it = merged.begin();
+         it != merged.end(); ++it) {
+        HostBytes entry = {it->first, it->second.bytes, it->second.error};
+        hosts.push_back(entry);
+    }
+    std::sort(hosts.begin(), hosts.end(), [](const HostBytes& a, const HostBytes& b) {
+        return a.bytes > b.bytes;
+    });
+    if (hosts.size() > limit) {
+        hosts.resize(limit);
+    }
+    return hosts;
+}
@@ -0,0 +1,135 @@
+#ifndef PROXY_STATS_HPP
+#define PROXY_STATS_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+enum StatCounter {
+    STAT_REQUESTS,
+    STAT_CACHE_HITS,
+    STAT_CACHE_MISSES,
+    STAT_ERRORS,
+    STAT_KEEPALIVE_REQUESTS,
+    STAT_STREAMED_UPLOADS,
+    STAT_STREAMED_UPLOAD_BYTES,
+    STAT_COALESCE_FALLBACKS,
+    STAT_BACKGROUND_REVALIDATIONS,
+    STAT_EVICTIONS,
+    STAT_EVICTED_BYTES,
+    STAT_ADMISSION_REJECTS,
+    STAT_ADMISSION_REJECTED_BYTES,
+    STAT_RELAYED_RESPONSES,
+    STAT_SPLICED_BYTES,
+    STAT_BUFFERED_RELAY_BYTES,
+    STAT_RELAY_CPU_NANOS,
+    STAT_TUNNELS_OPENED,
+    STAT_TUNNELS_CLOSED,
+    STAT_TUNNEL_IDLE_TIMEOUTS,
+    STAT_TUNNEL_BYTES_UP,
+    STAT_TUNNEL_BYTES_DOWN,
+    STAT_MEMORY_READS,
+    STAT_DISK_READS,
+    STAT_WARMUP_OBJECTS,
+    STAT_WARMUP_BYTES,
+    STAT_RANGE_HITS,
+    STAT_PARTIAL_HITS,
+    STAT_PARTIAL_FETCHES,
+    STAT_PARTIAL_FETCHED_BYTES,
+    STAT_NEGATIVE_HITS,
+    STAT_NEGATIVE_STORES,
+    STAT_COMPRESSED_OBJECTS,
+    STAT_COMPRESSION_IN_BYTES,
+    STAT_COMPRESSION_OUT_BYTES,
+    STAT_COMPRESS_CPU_NANOS,
+    STAT_COMPRESSED_HITS,
+    STAT_DECOMPRESSED_HITS,
+    STAT_DECOMPRESS_CPU_NANOS,
+    STAT_COUNTER_COUNT
+};
+
+enum LatencyKind {
+    LATENCY_CACHE_HIT,       // request to response queued, served from the cache
+    LATENCY_UPSTREAM_FETCH,  // fetch started to response complete or handed off
+    LATENCY_KIND_COUNT
+};
+
+// Latency distribution in microseconds. Buckets are log-linear: eight per
+// power of two, so a percentile is accurate to within 12.5%.
+struct LatencyHistogram {
+    static const size_t kSubBuckets = 8;
+    static const size_t kBucketCount = kSubBuckets + 29 * kSubBuckets;
+
+    std::vector<uint64_t> buckets;
+    uint64_t count;
+    uint64_t sumMicros;
+
+    LatencyHistogram() : buckets(kBucketCount, 0), count(0), sumMicros(0) {}
+
+    static size_t bucketOf(uint64_t micros);
+    // Smallest value of the next bucket
+    static uint64_t bucketLimit(size_t bucket);
+    // Upper bound of the bucket holding the given quantile (0..1)
+    uint64_t percentile(double quantile) const;
+};
+
+struct HostBytes {
+    std::string host;
+    uint64_t bytes;
+    uint64_t error;     // by how much `bytes` may overestimate
+};
+
+// Lock-free proxy counters. Every thread adds to one of kShards shards,
+// each on cache lines of its own, with relaxed atomic increments, so
+// request threads never contend on a lock or a shared line; readers sum
+// the shards. Latencies are recorded the same way. Bytes per origin go
+// into a space-saving sketch per shard (Metwally et al.): it tracks at
+// most `hostCapacity` origins, and an untracked origin replaces the
+// smallest one, inheriting its count as the error bound. Its mutex is
+// only shared by threads that map to the same shard.
+class ProxyStats {
+public:
+    static const size_t kShards = 32;
+
+    explicit ProxyStats(size_t hostCapacity = 64);
+
+    ProxyStats(const ProxyStats&) = delete;
+    ProxyStats& operator=(const ProxyStats&) = delete;
+
+    void add(StatCounter counter, uint64_t value = 1);
+    void recordLatency(LatencyKind kind, uint64_t micros);
+    void addHostBytes(const std::string& host, uint64_t bytes);
+
+    uint64_t get(StatCounter counter) const;
+    LatencyHistogram latency(LatencyKind kind) const;
+    // The `limit` origins with the most bytes, largest first
+    std::vector<HostBytes> topHosts(size_t limit) const;
+
+    static uint64_t nowMicros();
+
+private:
+    struct HostCount {
+        uint64_t bytes;
+        uint64_t error;
+    };
+
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> counters[STAT_COUNTER_COUNT];
+        std::atomic<uint64_t> latencyBuckets[LATENCY_KIND_COUNT][LatencyHistogram::kBucketCount];
+        std::atomic<uint64_t> latencyCount[LATENCY_KIND_COUNT];
+        std::atomic<uint64_t> latencySum[LATENCY_KIND_COUNT];
+        std::mutex hostsMutex;
+        std::unordered_map<std::string, HostCount> hosts;
+    };
+
+    size_t hostCapacity_;
+    Shard shards_[kShards];
+
+    Shard& localShard();
+};
+
+#endif // PROXY_STATS_HPP
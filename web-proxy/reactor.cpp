@@ -0,0 +1,218 @@
+#include "reactor.hpp"
+#include <iostream>
+#include <stdexcept>
+#include <chrono>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+// ==================== TimerWheel ====================
+
+TimerWheel::TimerWheel(int tickMs, size_t slotCount)
+    : tickMs_(tickMs), slots_(slotCount), currentTick_(0),
+      startMs_(Reactor::nowMs()), nextId_(1) {}
+
+TimerWheel::TimerId TimerWheel::schedule(int delayMs, const std::function<void()>& callback,
+                                         uint64_t nowMs) {
+    if (timers_.empty()) {
+        // Nothing pending: jump straight to the present instead of walking idle ticks
+        currentTick_ = (nowMs - startMs_) / tickMs_;
+    }
+
+    uint64_t ticks = (static_cast<uint64_t>(delayMs > 0 ? delayMs : 0) + tickMs_ - 1) / tickMs_;
+    if (ticks == 0) {
+        ticks = 1;
+    }
+    size_t slot = (currentTick_ + ticks) % slots_.size();
+
+    Timer timer;
+    timer.id = nextId_++;
+    timer.rounds = (ticks - 1) / slots_.size();
+    timer.callback = callback;
+    slots_[slot].push_back(timer);
+    timers_[timer.id] = std::make_pair(slot, std::prev(slots_[slot].end()));
+    return timer.id;
+}
+
+void TimerWheel::cancel(TimerId id) {
+    std::unordered_map<TimerId, std::pair<size_t, std::list<Timer>::iterator> >::iterator it = timers_.find(id);
+    if (it != timers_.end()) {
+        slots_[it->second.first].erase(it->second.second);
+        timers_.erase(it);
+    }
+}
+
+void TimerWheel::advance(uint64_t nowMs) {
+    uint64_t targetTick = (nowMs - startMs_) / tickMs_;
+    if (timers_.empty()) {
+        currentTick_ = targetTick;
+        return;
+    }
+
+    std::vector<std::function<void()> > due;
+    while (currentTick_ < targetTick) {
+        currentTick_++;
+        std::list<Timer>& slot = slots_[currentTick_ % slots_.size()];
+        for (std::list<Timer>::iterator it = slot.begin(); it != slot.end(); ) {
+            if (it->rounds > 0) {
+                it->rounds--;
+                ++it;
+                continue;
+            }
+            due.push_back(it->callback);
+            timers_.erase(it->id);
+            it = slot.erase(it);
+        }
+    }
+
+    // Callbacks run after the wheel is consistent, so they may re-arm timers
+    for (size_t i = 0; i < due.size(); ++i) {
+        try {
+            due[i]();
+        } catch (const std::exception& e) {
+            std::cerr << "Timer callback failed: " << e.what() << std::endl;
+        }
+    }
+}
+
+int TimerWheel::msUntilNextTick(uint64_t nowMs) const {
+    if (timers_.empty()) {
+        return -1;
+    }
+    uint64_t elapsed = nowMs - startMs_;
+    uint64_t nextTickMs = (elapsed / tickMs_ + 1) * tickMs_;
+    return static_cast<int>(nextTickMs - elapsed);
+}
+
+// ==================== Reactor ====================
+
+Reactor::Reactor() : epollFd_(-1), wakeFd_(-1), running_(true) {
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd_ < 0) {
+        throw std::runtime_error("Failed to create epoll instance");
+    }
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd_ < 0) {
+        ::close(epollFd_);
+        throw std::runtime_error("Failed to create eventfd");
+    }
+
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = wakeFd_;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &event);
+}
+
+Reactor::~Reactor() {
+    handlers_.clear();
+    ::close(wakeFd_);
+    ::close(epollFd_);
+}
+
+uint64_t Reactor::nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Reactor::run() {
+    const int kMaxEvents = 256;
+    epoll_event events[kMaxEvents];
+
+    while (running_) {
+        int timeout = timers_.msUntilNextTick(nowMs());
+        int ready = epoll_wait(epollFd_, events, kMaxEvents, timeout);
+        if (ready < 0 && errno != EINTR) {
+            break;
+        }
+
+        for (int i = 0; i < ready; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == wakeFd_) {
+                uint64_t value;
+                while (read(wakeFd_, &value, sizeof(value)) > 0) {
+                }
+                continue;
+            }
+            // Hold a reference: the handler may unregister itself
+            std::unordered_map<int, std::shared_ptr<EventHandler> >::iterator it = handlers_.find(fd);
+            if (it != handlers_.end()) {
+                std::shared_ptr<EventHandler> handler = it->second;
+                try {
+                    handler->onEvent(events[i].events);
+                } catch (const std::exception& e) {
+                    // Only this descriptor's exchange is lost: drop the
+                    // handler so a level-triggered event cannot fail again
+                    std::cerr << "Handler for fd " << fd << " failed: " << e.what() << std::endl;
+                    if (handlers_.count(fd) && handlers_[fd] == handler) {
+                        remove(fd);
+                    }
+                }
+            }
+        }
+
+        runTasks();
+        timers_.advance(nowMs());
+    }
+}
+
+void Reactor::stop() {
+    running_ = false;
+    uint64_t one = 1;
+    ssize_t ignored = write(wakeFd_, &one, sizeof(one));
+    (void)ignored;
+}
+
+void Reactor::post(const std::function<void()>& task) {
+    {
+        std::lock_guard<std::mutex> lock(tasksMutex_);
+        tasks_.push_back(task);
+    }
+    uint64_t one = 1;
+    ssize_t ignored = write(wakeFd_, &one, sizeof(one));
+    (void)ignored;
+}
+
+void Reactor::runTasks() {
+    std::vector<std::function<void()> > tasks;
+    {
+        std::lock_guard<std::mutex> lock(tasksMutex_);
+        tasks.swap(tasks_);
+    }
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        try {
+            tasks[i]();
+        } catch (const std::exception& e) {
+            std::cerr << "Posted task failed: " << e.what() << std::endl;
+        }
+    }
+}
+
+void Reactor::add(int fd, uint32_t events, const std::shared_ptr<EventHandler>& handler) {
+    epoll_event event;
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event) == 0) {
+        handlers_[fd] = handler;
+    }
+}
+
+void Reactor::modify(int fd, uint32_t events) {
+    epoll_event event;
+    event.events = events;
+    event.data.fd = fd;
+    epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &event);
+}
+
+void Reactor::remove(int fd) {
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+    handlers_.erase(fd);
+}
+
+TimerWheel::TimerId Reactor::runAfter(int delayMs, const std::function<void()>& callback) {
+    return timers_.schedule(delayMs, callback, nowMs());
+}
+
+void Reactor::cancelTimer(TimerWheel::TimerId id) {
+    timers_.cancel(id);
+}
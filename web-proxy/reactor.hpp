@@ -0,0 +1,111 @@
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <cstddef>
+
+// Receives readiness events for a descriptor registered with a Reactor
+class EventHandler {
+public:
+    virtual ~EventHandler() {}
+    virtual void onEvent(uint32_t events) = 0;
+};
+
+// Adapts a callable to EventHandler
+class FunctionEventHandler : public EventHandler {
+public:
+    explicit FunctionEventHandler(const std::function<void(uint32_t)>& callback)
+        : callback_(callback) {}
+    void onEvent(uint32_t events) override { callback_(events); }
+
+private:
+    std::function<void(uint32_t)> callback_;
+};
+
+// Hashed timer wheel. Deadlines are rounded up to whole ticks; timers
+// further away than one revolution wait for the required number of rounds.
+// Scheduling and cancelling are O(1), so timeouts can be re-armed on every
+// I/O event.
+class TimerWheel {
+public:
+    typedef uint64_t TimerId;
+
+    TimerWheel(int tickMs = 100, size_t slotCount = 512);
+
+    TimerId schedule(int delayMs, const std::function<void()>& callback, uint64_t nowMs);
+    void cancel(TimerId id);
+
+    // Runs the callbacks of all timers that are due at `nowMs`.
+    void advance(uint64_t nowMs);
+
+    // Milliseconds until the next tick, or -1 when no timer is pending.
+    int msUntilNextTick(uint64_t nowMs) const;
+
+private:
+    struct Timer {
+        TimerId id;
+        uint64_t rounds;
+        std::function<void()> callback;
+    };
+
+    int tickMs_;
+    std::vector<std::list<Timer> > slots_;
+    std::unordered_map<TimerId, std::pair<size_t, std::list<Timer>::iterator> > timers_;
+    uint64_t currentTick_;
+    uint64_t startMs_;
+    TimerId nextId_;
+};
+
+// Event loop around epoll(7), driven by a single thread. Other threads
+// interact with it through post(), which wakes the loop via an eventfd.
+// Descriptors are level-triggered; handlers stay alive while registered.
+class Reactor {
+public:
+    Reactor();
+    ~Reactor();
+
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    // Runs the loop on the calling thread until stop() is called. A loop
+    // that was stopped before it ran returns at once.
+    void run();
+    void stop();
+
+    // Queues a task to run on the loop thread. Safe from any thread.
+    void post(const std::function<void()>& task);
+
+    // Registration; must be called on the loop thread.
+    void add(int fd, uint32_t events, const std::shared_ptr<EventHandler>& handler);
+    void modify(int fd, uint32_t events);
+    void remove(int fd);
+
+    // Timers; must be called on the loop thread.
+    TimerWheel::TimerId runAfter(int delayMs, const std::function<void()>& callback);
+    void cancelTimer(TimerWheel::TimerId id);
+
+    size_t handlerCount() const { return handlers_.size(); }
+
+    static uint64_t nowMs();
+
+private:
+    int epollFd_;
+    int wakeFd_;
+    std::atomic<bool> running_;
+    std::mutex tasksMutex_;
+    std::vector<std::function<void()> > tasks_;
+    std::unordered_map<int, std::shared_ptr<EventHandler> > handlers_;
+    TimerWheel timers_;
+
+    void runTasks();
+};
+
+#endif // REACTOR_HPP
@@ -0,0 +1,222 @@
+#include "request_coalescer.hpp"
+#include <unistd.h>
+
+const size_t InFlightFetch::kDropBytes;
+const size_t InFlightFetch::kMaxUnreadBytes;
+
+InFlightFetch::InFlightFetch()
+    : dropped_(0), draining_(false), done_(false), complete_(false), handedOff_(false), readers_(1) {
+    positions_.insert(0);
+}
+
+InFlightFetch::~InFlightFetch() {
+    // A tail nobody took (the reader went away) still owns its socket
+    if (tail_.sourceFd >= 0) {
+        ::close(tail_.sourceFd);
+    }
+}
+
+void InFlightFetch::append(const char* data, size_t len) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    data_.append(data, len);
+    dropConsumed();
+    notify(lock);
+}
+
+void InFlightFetch::finish(bool complete) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_ = true;
+    complete_ = complete;
+    notify(lock);
+}
+
+void InFlightFetch::handOff(const RelayTail& tail) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    tail_ = tail;
+    handedOff_ = true;
+    done_ = true;
+    complete_ = true;
+    notify(lock);
+}
+
+bool InFlightFetch::takeRelayTail(RelayTail& tail) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tail_.sourceFd < 0) {
+        return false;
+    }
+    tail = tail_;
+    tail_ = RelayTail();
+    return true;
+}
+
+bool InFlightFetch::addReader() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (dropped_ > 0) {
+        return false;
+    }
+    readers_++;
+    positions_.insert(0);
+    return true;
+}
+
+size_t InFlightFetch::readers() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return readers_;
+}
+
+void InFlightFetch::notify(std::unique_lock<std::mutex>& lock) {
+    // Listeners run without the lock so that they may read right away
+    std::vector<Listener> listeners = listeners_;
+    if (done_) {
+        listeners_.clear();
+    }
+    lock.unlock();
+    for (size_t i = 0; i < listeners.size(); ++i) {
+        listeners[i]();
+    }
+}
+
+InFlightFetch::ReadResult InFlightFetch::read(size_t offset, std::string& out, size_t maxBytes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (offset < dropped_) {
+        return FAILED;
+    }
+    if (dropped_ + data_.size() > offset) {
+        out.assign(data_, offset - dropped_, maxBytes);
+        std::multiset<size_t>::iterator it = positions_.find(offset);
+        if (it != positions_.end()) {
+            positions_.erase(it);
+        }
+        positions_.insert(offset + out.size());
+        Listener drained = dropConsumed();
+        lock.unlock();
+        if (drained) {
+            drained();
+        }
+        return DATA;
+    }
+    if (!done_) {
+        return PENDING;
+    }
+    if (handedOff_) {
+        return HANDED_OFF;
+    }
+    return complete_ ? DONE : FAILED;
+}
+
+void InFlightFetch::leave(size_t offset) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::multiset<size_t>::iterator it = positions_.find(offset);
+    if (it == positions_.end()) {
+        return;
+    }
+    positions_.erase(it);
+    Listener drained = dropConsumed();
+    Listener abandoned = positions_.empty() && !done_ ? abandonListener_ : Listener();
+    lock.unlock();
+    if (drained) {
+        drained();
+    }
+    if (abandoned) {
+        abandoned();
+    }
+}
+
+// Called with mutex_ held. Without readers left everything may go.
+InFlightFetch::Listener InFlightFetch::dropConsumed() {
+    size_t reached = positions_.empty() ? dropped_ + data_.size() : *positions_.begin();
+    if (reached - dropped_ >= kDropBytes) {
+        data_.erase(0, reached - dropped_);
+        dropped_ = reached;
+    }
+    if (draining_ && unread() <= kMaxUnreadBytes / 2) {
+        draining_ = false;
+        return drainListener_;
+    }
+    return Listener();
+}
+
+// Called with mutex_ held: what the slowest reader has left to read
+size_t InFlightFetch::unread() const {
+    return positions_.empty() ? 0 : dropped_ + data_.size() - *positions_.begin();
+}
+
+void InFlightFetch::subscribe(const Listener& listener) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!done_) {
+        listeners_.push_back(listener);
+        return;
+    }
+    lock.unlock();
+    listener();
+}
+
+void InFlightFetch::setRequestHeaders(const std::map<std::string, std::string>& headers) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    requestHeaders_ = headers;
+}
+
+std::string InFlightFetch::requestHeader(const std::string& lowercaseName) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<std::string, std::string>::const_iterator it = requestHeaders_.find(lowercaseName);
+    return it != requestHeaders_.end() ? it->second : std::string();
+}
+
+size_t InFlightFetch::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dropped_ + data_.size();
+}
+
+bool InFlightFetch::full() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (unread() < kMaxUnreadBytes) {
+        return false;
+    }
+    draining_ = true;
+    return true;
+}
+
+void InFlightFetch::onDrain(const Listener& listener) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    drainListener_ = listener;
+}
+
+bool InFlightFetch::abandoned() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return positions_.empty() && !done_;
+}
+
+void InFlightFetch::onAbandon(const Listener& listener) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    abandonListener_ = listener;
+}
+
+RequestCoalescer::RequestCoalescer() : coalesced_(0) {}
+
+std::shared_ptr<InFlightFetch> RequestCoalescer::join(const std::string& key, bool& leader) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<std::string, std::shared_ptr<InFlightFetch> >::iterator it = inFlight_.find(key);
+    if (it != inFlight_.end() && it->second->addReader()) {
+        leader = false;
+        coalesced_++;
+        return it->second;
+    }
+
+    leader = true;
+    std::shared_ptr<InFlightFetch> fetch = std::make_shared<InFlightFetch>();
+    inFlight_[key] = fetch;
+    return fetch;
+}
+
+void RequestCoalescer::remove(const std::string& key, const std::shared_ptr<InFlightFetch>& fetch) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<std::string, std::shared_ptr<InFlightFetch> >::iterator it = inFlight_.find(key);
+    if (it != inFlight_.end() && it->second == fetch) {
+        inFlight_.erase(it);
+    }
+}
+
+size_t RequestCoalescer::coalescedRequests() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return coalesced_;
+}
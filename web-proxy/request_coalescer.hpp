@@ -0,0 +1,138 @@
+#ifndef REQUEST_COALESCER_HPP
+#define REQUEST_COALESCER_HPP
+
+#include <string>
+#include <map>
+#include <set>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+#include "splice_relay.hpp"
+
+// The rest of a response, left on the origin socket for the reader to
+// relay socket-to-socket instead of passing through the shared buffer
+struct RelayTail {
+    int sourceFd;
+    uint64_t remaining;     // SpliceRelay::kUnlimited: until the origin closes
+    // Called once the relay ended; takes back ownership of sourceFd
+    std::function<void(const SpliceRelay& relay, bool complete)> done;
+
+    RelayTail() : sourceFd(-1), remaining(0) {}
+};
+
+// Response bytes of one upstream fetch, shared between the request that
+// started it (the leader) and concurrent requests for the same cache key.
+// Readers keep their own offset and pull at their own pace; they are told
+// about progress through listeners instead of blocking on the fetch.
+// Bytes every reader has consumed are dropped in steps of kDropBytes; a
+// fetch that has dropped any can no longer be joined. The producer holds
+// off while the slowest reader is kMaxUnreadBytes behind, until the drain
+// listener tells it that the readers have caught up halfway.
+class InFlightFetch {
+public:
+    enum ReadResult {
+        DATA,       // new bytes were copied out
+        PENDING,    // no new bytes yet
+        DONE,       // the fetch finished and all bytes were consumed
+        FAILED,     // the fetch gave up; the stream is incomplete
+        HANDED_OFF  // all bytes were consumed; the rest is in the relay tail
+    };
+
+    // Called on the producing thread after every change, so it should
+    // only hand the notification over (e.g. post to a reactor).
+    typedef std::function<void()> Listener;
+
+    InFlightFetch();
+    ~InFlightFetch();
+
+    void append(const char* data, size_t len);
+    void finish(bool complete);
+    // Finishes the stream; its reader relays the remainder from the socket.
+    void handOff(const RelayTail& tail);
+    // Ownership of the tail's descriptor passes to the caller.
+    bool takeRelayTail(RelayTail& tail);
+
+    static const size_t kDropBytes = 1024 * 1024;
+    static const size_t kMaxUnreadBytes = 4 * 1024 * 1024;
+
+    // Requests reading this fetch: the one that created it plus those that
+    // joined. A tail can only be handed off to a single reader. Returns
+    // false if the start of the response is gone.
+    bool addReader();
+    size_t readers() const;
+
+    // Copies up to `maxBytes` past `offset` into `out`. Each reader passes
+    // the offset it has reached, starting from 0, and calls leave() with
+    // it once it stops reading, whether or not the stream has ended.
+    ReadResult read(size_t offset, std::string& out, size_t maxBytes);
+    void leave(size_t offset);
+
+    // Registers a listener; it fires at once if the fetch already finished.
+    void subscribe(const Listener& listener);
+
+    // Header fields of the request that started the fetch (lowercased
+    // names), so that a joining request can check that it selects the same
+    // variant once the response's Vary is known.
+    void setRequestHeaders(const std::map<std::string, std::string>& headers);
+    std::string requestHeader(const std::string& lowercaseName) const;
+
+    // Bytes appended so far, including dropped ones.
+    size_t size() const;
+    // True while a reader has kMaxUnreadBytes or more left to read; the
+    // drain listener then fires once that is down to half.
+    bool full();
+    // Called like a listener, on the reading thread.
+    void onDrain(const Listener& listener);
+    // True while no reader is left and the fetch has not finished; the
+    // abandon listener fires, on the reading thread, as that happens.
+    bool abandoned() const;
+    void onAbandon(const Listener& listener);
+
+private:
+    mutable std::mutex mutex_;
+    std::string data_;
+    size_t dropped_;                    // offset of data_'s first byte
+    std::multiset<size_t> positions_;   // offsets reached by the readers
+    std::vector<Listener> listeners_;
+    Listener drainListener_;
+    Listener abandonListener_;
+    bool draining_;                     // the producer waits for the drain listener
+    std::map<std::string, std::string> requestHeaders_;
+    bool done_;
+    bool complete_;
+    bool handedOff_;
+    RelayTail tail_;
+    size_t readers_;
+
+    void notify(std::unique_lock<std::mutex>& lock);
+    // Both return the drain listener if it is due, to be run unlocked
+    Listener dropConsumed();
+    size_t unread() const;
+};
+
+// Table of in-flight upstream fetches keyed by cache key (collapsed
+// forwarding): the first miss for a key fetches, later misses attach.
+class RequestCoalescer {
+public:
+    RequestCoalescer();
+
+    // Returns the in-flight fetch for the key. `leader` is set when the
+    // caller created it and is responsible for fetching and finishing it,
+    // also when one is in flight but can no longer be joined.
+    std::shared_ptr<InFlightFetch> join(const std::string& key, bool& leader);
+
+    // Removes a finished fetch so that later requests start a new one.
+    void remove(const std::string& key, const std::shared_ptr<InFlightFetch>& fetch);
+
+    size_t coalescedRequests() const;
+
+private:
+    mutable std::mutex mutex_;
+    std::map<std::string, std::shared_ptr<InFlightFetch> > inFlight_;
+    size_t coalesced_;
+};
+
+#endif // REQUEST_COALESCER_HPP
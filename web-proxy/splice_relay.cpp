@@ -0,0 +1,101 @@
+#include "splice_relay.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+namespace {
+
+// Largest chunk moved at once; matches the default pipe capacity
+const size_t kChunkSize = 64 * 1024;
+
+uint64_t threadCpuNanos() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+} // namespace
+
+const uint64_t SpliceRelay::kUnlimited;
+
+SpliceRelay::SpliceRelay(int from, int to, uint64_t limit)
+    : from_(from), to_(to), remaining_(limit), bufferOffset_(0), pending_(0),
+      relayed_(0), cpuNanos_(0) {
+    if (pipe2(pipe_, O_NONBLOCK | O_CLOEXEC) < 0) {
+        pipe_[0] = pipe_[1] = -1;
+        useBuffer();
+    }
+}
+
+SpliceRelay::~SpliceRelay() {
+    if (pipe_[0] >= 0) {
+        ::close(pipe_[0]);
+        ::close(pipe_[1]);
+    }
+}
+
+void SpliceRelay::useBuffer() {
+    if (pipe_[0] >= 0) {
+        ::close(pipe_[0]);
+        ::close(pipe_[1]);
+        pipe_[0] = pipe_[1] = -1;
+    }
+    buffer_.resize(kChunkSize);
+}
+
+SpliceRelay::Status SpliceRelay::pump() {
+    uint64_t started = threadCpuNanos();
+    Status status = transfer();
+    cpuNanos_ += threadCpuNanos() - started;
+    return status;
+}
+
+SpliceRelay::Status SpliceRelay::transfer() {
+    while (true) {
+        // Drain what was already read before reading more
+        while (pending_ > 0) {
+            ssize_t n = zeroCopy()
+                ? splice(pipe_[0], nullptr, to_, nullptr, pending_, SPLICE_F_MOVE | SPLICE_F_NONBLOCK)
+                : send(to_, buffer_.data() + bufferOffset_, pending_, MSG_NOSIGNAL);
+            if (n < 0) {
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? WANT_WRITE : FAILED;
+            }
+            pending_ -= n;
+            bufferOffset_ += n;
+            relayed_ += n;
+        }
+
+        if (remaining_ == 0) {
+            return FINISHED;
+        }
+
+        size_t want = static_cast<size_t>(std::min<uint64_t>(remaining_, kChunkSize));
+        ssize_t n = zeroCopy()
+            ? splice(from_, nullptr, pipe_[1], nullptr, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK)
+            : recv(from_, buffer_.data(), want, 0);
+        if (n == 0) {
+            return SOURCE_CLOSED;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return WANT_READ;
+            }
+            if (zeroCopy() && errno == EINVAL) {
+                // The descriptors cannot be spliced; nothing is buffered in
+                // the pipe at this point, so switching over loses no data
+                useBuffer();
+                continue;
+            }
+            return FAILED;
+        }
+
+        pending_ = n;
+        bufferOffset_ = 0;
+        if (remaining_ != kUnlimited) {
+            remaining_ -= n;
+        }
+    }
+}
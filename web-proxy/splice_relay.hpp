@@ -0,0 +1,60 @@
+#ifndef SPLICE_RELAY_HPP
+#define SPLICE_RELAY_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Moves bytes from one non-blocking socket to another without copying
+// them through user space: splice(2) from the source into a pipe and from
+// the pipe into the destination. Where splice is unavailable (no pipe
+// could be created, or the descriptors do not support it) the relay falls
+// back to recv/send through one fixed buffer that is reused for every
+// chunk. The descriptors are not owned by the relay.
+class SpliceRelay {
+public:
+    enum Status {
+        WANT_READ,      // the source has no data; wait for it to become readable
+        WANT_WRITE,     // the destination is full; wait for it to become writable
+        FINISHED,       // the byte limit was reached
+        SOURCE_CLOSED,  // the source reached end of file
+        FAILED          // a socket error occurred
+    };
+
+    static const uint64_t kUnlimited = ~0ULL;
+
+    SpliceRelay(int from, int to, uint64_t limit = kUnlimited);
+    ~SpliceRelay();
+
+    SpliceRelay(const SpliceRelay&) = delete;
+    SpliceRelay& operator=(const SpliceRelay&) = delete;
+
+    // Relays as much as possible without blocking.
+    Status pump();
+
+    int source() const { return from_; }
+    int destination() const { return to_; }
+    bool zeroCopy() const { return pipe_[0] >= 0; }
+    // Bytes written to the destination
+    uint64_t bytesRelayed() const { return relayed_; }
+    // Bytes read from the source but not yet written
+    size_t bytesPending() const { return pending_; }
+    // Thread CPU time spent inside pump()
+    uint64_t cpuNanos() const { return cpuNanos_; }
+
+private:
+    int from_;
+    int to_;
+    uint64_t remaining_;
+    int pipe_[2];
+    std::vector<char> buffer_;
+    size_t bufferOffset_;
+    size_t pending_;
+    uint64_t relayed_;
+    uint64_t cpuNanos_;
+
+    Status transfer();
+    void useBuffer();
+};
+
+#endif // SPLICE_RELAY_HPP
@@ -2,6 +2,8 @@
 
 # Simple test script for proxy server
 # Usage: ./test_proxy.sh [proxy_host] [proxy_port]
+# Needs network access; tests/offline_test.sh (make test-offline) checks
+# the proxy against the local origin simulator instead.
 
 PROXY_HOST=${1:-localhost}
 PROXY_PORT=${2:-8080}
@@ -0,0 +1,128 @@
+#!/bin/bash
+
+# Offline end-to-end test: starts the origin simulator and the proxy with
+# an empty cache and checks keep-alive, cache hits, byte ranges, gzip
+# storage and CONNECT tunnels through the proxy. Needs curl.
+# Usage: ./tests/offline_test.sh  (or make test-offline)
+#   PROXY                    proxy binary (./proxy_server)
+#   ORIGIN_SIM               origin simulator binary (./origin_sim)
+#   PROXY_PORT, ORIGIN_PORT  ports to use (18180, 19180)
+
+PROXY_PORT=${PROXY_PORT:-18180}
+ORIGIN_PORT=${ORIGIN_PORT:-19180}
+PROXY=${PROXY:-./proxy_server}
+ORIGIN_SIM=${ORIGIN_SIM:-./origin_sim}
+CACHE_DIR=$(mktemp -d /tmp/proxy-test-cache.XXXXXX)
+WORK_DIR=$(mktemp -d /tmp/proxy-test.XXXXXX)
+ORIGIN="http://127.0.0.1:$ORIGIN_PORT"
+FAILED=0
+
+cleanup() {
+    [ -n "$PROXY_PID" ] && kill -INT "$PROXY_PID" 2>/dev/null
+    [ -n "$ORIGIN_PID" ] && kill "$ORIGIN_PID" 2>/dev/null
+    wait 2>/dev/null
+    rm -rf "$CACHE_DIR" "$WORK_DIR"
+}
+trap cleanup EXIT
+
+wait_for_port() {
+    for _ in $(seq 50); do
+        (echo > /dev/tcp/127.0.0.1/$1) 2>/dev/null && return 0
+        sleep 0.1
+    done
+    echo "Nothing is listening on port $1" >&2
+    return 1
+}
+
+check() {
+    if [ "$2" = "$3" ]; then
+        echo "PASS: $1"
+    else
+        echo "FAIL: $1 (expected '$3', got '$2')"
+        FAILED=1
+    fi
+}
+
+proxy_curl() {
+    curl -s -x "127.0.0.1:$PROXY_PORT" "$@"
+}
+
+origin_seq() {
+    proxy_curl -o /dev/null -D - "$@" | tr -d '\r' | sed -n 's/^X-Origin-Seq: //p'
+}
+
+# Fetches a URL until the copy stored by its first fetch is served;
+# objects are written to the cache off the event loop
+fetch_and_store() {
+    local first
+    first=$(origin_seq "$1")
+    for _ in $(seq 50); do
+        [ "$(origin_seq "$1")" = "$first" ] && return 0
+        sleep 0.1
+    done
+    return 1
+}
+
+"$ORIGIN_SIM" --port "$ORIGIN_PORT" --delay-ms 0 > "$WORK_DIR/origin.log" 2>&1 &
+ORIGIN_PID=$!
+"$PROXY" "$PROXY_PORT" "$CACHE_DIR" > "$WORK_DIR/proxy.log" 2>&1 &
+PROXY_PID=$!
+wait_for_port "$ORIGIN_PORT" && wait_for_port "$PROXY_PORT" || exit 1
+
+# Cache hits
+fetch_and_store "$ORIGIN/obj/1?size=5000"
+check "stored object served from cache" "$?" "0"
+
+# Keep-alive: several requests, one connection to the proxy
+CONNECTS=$(proxy_curl -w "%{num_connects}\n" \
+    -o /dev/null "$ORIGIN/obj/1?size=5000" \
+    -o /dev/null "$ORIGIN/obj/2?size=3000" \
+    -o /dev/null "$ORIGIN/obj/3?status=503" \
+    -o /dev/null "$ORIGIN/obj/1?size=5000" | awk '{ sum += $1 } END { print sum }')
+check "keep-alive across hits, misses and errors" "$CONNECTS" "1"
+
+# Byte ranges from the stored copy
+proxy_curl -o "$WORK_DIR/full" "$ORIGIN/obj/1?size=5000"
+proxy_curl -o "$WORK_DIR/range" -D "$WORK_DIR/range.head" -r 100-199 "$ORIGIN/obj/1?size=5000"
+check "single range status" "$(head -1 "$WORK_DIR/range.head" | tr -d '\r')" "HTTP/1.1 206 Partial Content"
+check "single range Content-Range" \
+    "$(tr -d '\r' < "$WORK_DIR/range.head" | sed -n 's/^Content-Range: //p')" "bytes 100-199/5000"
+check "single range body" "$(cmp -s "$WORK_DIR/range" <(tail -c +101 "$WORK_DIR/full" | head -c 100) && echo same)" "same"
+
+proxy_curl -o "$WORK_DIR/range" -D "$WORK_DIR/range.head" -r -50 "$ORIGIN/obj/1?size=5000"
+check "suffix range body" "$(cmp -s "$WORK_DIR/range" <(tail -c 50 "$WORK_DIR/full") && echo same)" "same"
+
+check "multipart ranges" "$(proxy_curl -o /dev/null -D - -r 0-9,20-29 "$ORIGIN/obj/1?size=5000" |
+    tr -d '\r' | sed -n 's/^Content-Type: \(multipart\/byteranges\).*/\1/p')" "multipart/byteranges"
+check "range past the end" "$(proxy_curl -o /dev/null -w "%{http_code}" -r 6000- "$ORIGIN/obj/1?size=5000")" "416"
+
+CONNECTS=$(proxy_curl -w "%{num_connects}\n" \
+    -o /dev/null -r 0-9 "$ORIGIN/obj/1?size=5000" \
+    -o /dev/null -r 6000- "$ORIGIN/obj/1?size=5000" \
+    -o /dev/null "$ORIGIN/obj/1?size=5000" | awk '{ sum += $1 } END { print sum }')
+check "keep-alive after range responses" "$CONNECTS" "1"
+
+# Text is stored gzip-encoded and decoded for clients without gzip
+TEXT="$ORIGIN/obj/4?size=20000&type=text/plain"
+fetch_and_store "$TEXT"
+proxy_curl -o "$WORK_DIR/identity" -D "$WORK_DIR/identity.head" "$TEXT"
+proxy_curl -o "$WORK_DIR/gzip" -D "$WORK_DIR/gzip.head" --compressed "$TEXT"
+check "gzip hit Content-Encoding" \
+    "$(tr -d '\r' < "$WORK_DIR/gzip.head" | sed -n 's/^Content-Encoding: //p')" "gzip"
+check "identity hit without Content-Encoding" "$(grep -ci '^Content-Encoding' "$WORK_DIR/identity.head")" "0"
+check "gzip and identity bodies match" "$(cmp -s "$WORK_DIR/gzip" "$WORK_DIR/identity" && echo same)" "same"
+check "identity body length" "$(wc -c < "$WORK_DIR/identity" | tr -d ' ')" "20000"
+check "range of a gzip-stored object" \
+    "$(proxy_curl -r 10-19 "$TEXT" | cmp -s - <(tail -c +11 "$WORK_DIR/identity" | head -c 10) && echo same)" "same"
+
+# CONNECT tunnel to the origin
+check "CONNECT tunnel" "$(proxy_curl -p -o "$WORK_DIR/tunneled" -w "%{http_connect} %{http_code}" \
+    "$ORIGIN/obj/5?size=4000")" "200 200"
+check "tunneled body length" "$(wc -c < "$WORK_DIR/tunneled" | tr -d ' ')" "4000"
+
+if [ "$FAILED" -ne 0 ]; then
+    echo "Some tests failed. Proxy log:"
+    cat "$WORK_DIR/proxy.log"
+    exit 1
+fi
+echo "All offline tests passed!"
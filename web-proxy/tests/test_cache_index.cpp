@@ -0,0 +1,260 @@
+#include "../cache_index.hpp"
+#include <iostream>
+#include <cassert>
+#include <cstdlib>
+#include <string>
+#include <fstream>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+namespace {
+
+std::string makeCacheDir() {
+    char path[] = "/tmp/cache_index_test.XXXXXX";
+    assert(mkdtemp(path) != nullptr);
+    return path;
+}
+
+void removeCacheDir(const std::string& dir) {
+    std::string command = "rm -rf '" + dir + "'";
+    assert(std::system(command.c_str()) == 0);
+}
+
+CacheEntry makeEntry(const std::string& key, uint64_t size) {
+    CacheEntry entry;
+    entry.key = key;
+    entry.statusCode = 200;
+    entry.timestamp = 1000;
+    entry.expiresAt = 2000;
+    entry.size = size;
+    return entry;
+}
+
+bool fileExists(const std::string& path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0;
+}
+
+off_t fileSize(const std::string& path) {
+    struct stat info;
+    assert(stat(path.c_str(), &info) == 0);
+    return info.st_size;
+}
+
+off_t indexSizeFor(uint64_t capacity) {
+    return sizeof(CacheIndexHeader) + capacity * sizeof(CacheIndexSlot);
+}
+
+} // namespace
+
+void test_putLookupErase() {
+    std::cout << "Running test_putLookupErase..." << std::endl;
+    std::string dir = makeCacheDir();
+    {
+        CacheIndex index(dir);
+        uint64_t a = CacheIndex::hashKey("example.com:80/a");
+        uint64_t b = CacheIndex::hashKey("example.com:80/b");
+        index.put(a, makeEntry("example.com:80/a", 100));
+        index.put(b, makeEntry("example.com:80/b", 50));
+        assert(index.entryCount() == 2);
+        assert(index.totalBytes() == 150);
+
+        CacheEntry entry;
+        assert(index.lookup(a, entry));
+        assert(entry.size == 100 && entry.statusCode == 200 && entry.expiresAt == 2000);
+        assert(entry.filePath == index.objectPath(a));
+
+        // A replaced object keeps its hit count; its size is replaced
+        index.touch(a, 1500);
+        index.touch(a, 1600);
+        index.put(a, makeEntry("example.com:80/a", 300));
+        assert(index.lookup(a, entry));
+        assert(entry.size == 300 && entry.frequency == 2);
+        assert(index.entryCount() == 2);
+        assert(index.totalBytes() == 350);
+
+        assert(index.erase(b));
+        assert(!index.erase(b));
+        assert(!index.lookup(b, entry));
+        assert(index.entryCount() == 1);
+        assert(index.totalBytes() == 300);
+    }
+    removeCacheDir(dir);
+    std::cout << "test_putLookupErase PASSED" << std::endl;
+}
+
+void test_growKeepsEntries() {
+    std::cout << "Running test_growKeepsEntries..." << std::endl;
+    std::string dir = makeCacheDir();
+    {
+        CacheIndex index(dir);
+        off_t initial = fileSize(dir + "/index.bin");
+        const int count = 3000;
+        for (int i = 0; i < count; ++i) {
+            std::string key = "host:80/object" + std::to_string(i);
+            index.put(CacheIndex::hashKey(key), makeEntry(key, i + 1));
+        }
+        assert(index.entryCount() == static_cast<size_t>(count));
+        assert(index.totalBytes() == static_cast<uint64_t>(count) * (count + 1) / 2);
+        assert(fileSize(dir + "/index.bin") > initial);
+        for (int i = 0; i < count; ++i) {
+            CacheEntry entry;
+            assert(index.lookup(CacheIndex::hashKey("host:80/object" + std::to_string(i)), entry));
+            assert(entry.size == static_cast<uint64_t>(i + 1));
+        }
+    }
+    removeCacheDir(dir);
+    std::cout << "test_growKeepsEntries PASSED" << std::endl;
+}
+
+void test_tombstonesReclaimed() {
+    std::cout << "Running test_tombstonesReclaimed..." << std::endl;
+    std::string dir = makeCacheDir();
+    {
+        CacheIndex index(dir);
+        off_t initial = fileSize(dir + "/index.bin");
+        assert(initial == indexSizeFor(1024));
+        // Constant churn with few live entries: the tombstones left by
+        // erase are rehashed away instead of growing the table
+        const int live = 50;
+        const int total = 20000;
+        for (int i = 0; i < total; ++i) {
+            std::string key = "host:80/churn" + std::to_string(i);
+            index.put(CacheIndex::hashKey(key), makeEntry(key, 10));
+            if (i >= live) {
+                std::string old = "host:80/churn" + std::to_string(i - live);
+                assert(index.erase(CacheIndex::hashKey(old)));
+            }
+        }
+        assert(index.entryCount() == static_cast<size_t>(live));
+        assert(index.totalBytes() == static_cast<uint64_t>(live) * 10);
+        assert(fileSize(dir + "/index.bin") == initial);
+
+        CacheEntry entry;
+        for (int i = 0; i < total; ++i) {
+            bool found = index.lookup(CacheIndex::hashKey("host:80/churn" + std::to_string(i)), entry);
+            assert(found == (i >= total - live));
+        }
+    }
+    removeCacheDir(dir);
+    std::cout << "test_tombstonesReclaimed PASSED" << std::endl;
+}
+
+void test_objectFileRoundTrip() {
+    std::cout << "Running test_objectFileRoundTrip..." << std::endl;
+    std::string dir = makeCacheDir();
+    {
+        CacheIndex index(dir);
+        CacheEntry entry = makeEntry("host:80/page", 0);
+        entry.etag = "\"v1-gzip\"";
+        entry.lastModified = "Wed, 21 Oct 2015 07:28:00 GMT";
+        entry.compressed = true;
+        std::string response = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello";
+        std::string path = index.objectPath(CacheIndex::hashKey(entry.key));
+        assert(CacheIndex::writeObject(path, entry, response));
+
+        CacheEntry stored;
+        std::string read;
+        assert(CacheIndex::readObject(path, stored, &read));
+        assert(read == response);
+        assert(stored.key == entry.key && stored.etag == entry.etag);
+        assert(stored.lastModified == entry.lastModified);
+        assert(stored.compressed && stored.size == response.size());
+
+        uint64_t offset = 0;
+        int fd = CacheIndex::openObject(path, stored, offset);
+        assert(fd >= 0);
+        std::string head(4, '\0');
+        assert(pread(fd, &head[0], head.size(), offset) == 4);
+        assert(head == "HTTP");
+        close(fd);
+    }
+    removeCacheDir(dir);
+    std::cout << "test_objectFileRoundTrip PASSED" << std::endl;
+}
+
+void test_reopenAfterCleanShutdown() {
+    std::cout << "Running test_reopenAfterCleanShutdown..." << std::endl;
+    std::string dir = makeCacheDir();
+    uint64_t hash = CacheIndex::hashKey("host:80/kept");
+    {
+        CacheIndex index(dir);
+        index.put(hash, makeEntry("host:80/kept", 42));
+    }
+    {
+        // The index is used as it is, without a scan of the object files
+        CacheIndex index(dir);
+        assert(index.rebuiltFrom() == 0);
+        CacheEntry entry;
+        assert(index.lookup(hash, entry));
+        assert(entry.size == 42);
+    }
+    removeCacheDir(dir);
+    std::cout << "test_reopenAfterCleanShutdown PASSED" << std::endl;
+}
+
+void test_rebuildAfterDirtyShutdown() {
+    std::cout << "Running test_rebuildAfterDirtyShutdown..." << std::endl;
+    std::string dir = makeCacheDir();
+    const int objects = 20;
+    std::string response = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+
+    pid_t child = fork();
+    assert(child >= 0);
+    if (child == 0) {
+        // Ends without the destructor's flush, like a crash
+        CacheIndex index(dir);
+        for (int i = 0; i < objects; ++i) {
+            CacheEntry entry = makeEntry("host:80/saved" + std::to_string(i), response.size());
+            uint64_t hash = CacheIndex::hashKey(entry.key);
+            if (!CacheIndex::writeObject(index.objectPath(hash), entry, response)) {
+                _exit(1);
+            }
+            index.put(hash, entry);
+        }
+        // Indexed, but its file never written
+        index.put(CacheIndex::hashKey("host:80/lost"), makeEntry("host:80/lost", 99));
+        // A write cut short, and an object stored under another key's name
+        uint64_t saved = CacheIndex::hashKey("host:80/saved0");
+        std::ofstream((index.objectPath(saved) + ".tmp.1.0").c_str()) << "partial";
+        CacheEntry entry = makeEntry("host:80/saved1", response.size());
+        if (!CacheIndex::writeObject(index.objectPath(saved ^ 1), entry, response)) {
+            _exit(1);
+        }
+        _exit(0);
+    }
+    int status = 0;
+    assert(waitpid(child, &status, 0) == child);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    {
+        CacheIndex index(dir);
+        assert(index.rebuiltFrom() == static_cast<size_t>(objects) + 1);
+        assert(index.entryCount() == static_cast<size_t>(objects));
+        assert(index.totalBytes() == objects * response.size());
+        CacheEntry entry;
+        for (int i = 0; i < objects; ++i) {
+            assert(index.lookup(CacheIndex::hashKey("host:80/saved" + std::to_string(i)), entry));
+            assert(entry.size == response.size() && entry.statusCode == 200);
+        }
+        assert(!index.lookup(CacheIndex::hashKey("host:80/lost"), entry));
+        uint64_t saved = CacheIndex::hashKey("host:80/saved0");
+        assert(!fileExists(index.objectPath(saved) + ".tmp.1.0"));
+        assert(!fileExists(index.objectPath(saved ^ 1)));
+    }
+    removeCacheDir(dir);
+    std::cout << "test_rebuildAfterDirtyShutdown PASSED" << std::endl;
+}
+
+int main() {
+    test_putLookupErase();
+    test_growKeepsEntries();
+    test_tombstonesReclaimed();
+    test_objectFileRoundTrip();
+    test_reopenAfterCleanShutdown();
+    test_rebuildAfterDirtyShutdown();
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
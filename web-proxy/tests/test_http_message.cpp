@@ -0,0 +1,216 @@
+#include "../http_message.hpp"
+#include <iostream>
+#include <cassert>
+#include <string>
+#include <algorithm>
+
+namespace {
+
+// Feeds `data` in pieces of `step` bytes; returns the bytes consumed
+size_t feedInPieces(HttpRequestParser& parser, const std::string& data, size_t step) {
+    size_t consumed = 0;
+    for (size_t pos = 0; pos < data.size() && !parser.complete() && !parser.failed(); pos += step) {
+        consumed += parser.feed(data.data() + pos, std::min(step, data.size() - pos));
+    }
+    return consumed;
+}
+
+} // namespace
+
+void test_headSplitAcrossReads() {
+    std::cout << "Running test_headSplitAcrossReads..." << std::endl;
+    std::string raw = "GET http://example.com/a?b=1 HTTP/1.1\r\n"
+                      "Host: example.com\r\n"
+                      "Accept-Encoding: gzip\r\n"
+                      "\r\n";
+    // Every split point, including inside the final CRLF CRLF
+    for (size_t step = 1; step <= raw.size(); ++step) {
+        HttpRequestParser parser;
+        assert(feedInPieces(parser, raw, step) == raw.size());
+        assert(parser.complete());
+        const HttpRequestHead& head = parser.head();
+        assert(head.method().str() == "GET");
+        assert(head.target().str() == "http://example.com/a?b=1");
+        assert(head.version().str() == "HTTP/1.1");
+        assert(head.fieldCount() == 2);
+        assert(head.get("host").str() == "example.com");
+        assert(head.get("ACCEPT-ENCODING").str() == "gzip");
+        assert(head.keepAlive());
+    }
+    std::cout << "test_headSplitAcrossReads PASSED" << std::endl;
+}
+
+void test_pipelinedBytesLeftUnconsumed() {
+    std::cout << "Running test_pipelinedBytesLeftUnconsumed..." << std::endl;
+    std::string first = "POST /upload HTTP/1.1\r\nHost: a\r\nContent-Length: 5\r\n\r\nhello";
+    std::string second = "GET /next HTTP/1.1\r\nHost: a\r\n\r\n";
+    std::string both = first + second;
+
+    HttpRequestParser parser;
+    size_t consumed = parser.feed(both.data(), both.size());
+    assert(consumed == first.size());
+    assert(parser.complete());
+    assert(parser.contentLength() == 5);
+    assert(parser.body() == "hello");
+
+    parser.reset();
+    assert(parser.feed(both.data() + consumed, both.size() - consumed) == second.size());
+    assert(parser.complete());
+    assert(parser.head().target().str() == "/next");
+    assert(parser.body().empty());
+    std::cout << "test_pipelinedBytesLeftUnconsumed PASSED" << std::endl;
+}
+
+void test_chunkedBodyDecoded() {
+    std::cout << "Running test_chunkedBodyDecoded..." << std::endl;
+    std::string raw = "POST / HTTP/1.1\r\n"
+                      "Host: a\r\n"
+                      "Transfer-Encoding: chunked\r\n"
+                      "\r\n"
+                      "5;name=value\r\nhello\r\n"
+                      "1A\r\nabcdefghijklmnopqrstuvwxyz\r\n"
+                      "0\r\n"
+                      "Trailer-Field: ignored\r\n"
+                      "\r\n";
+    for (size_t step = 1; step <= raw.size(); step += 3) {
+        HttpRequestParser parser;
+        assert(feedInPieces(parser, raw, step) == raw.size());
+        assert(parser.complete());
+        assert(parser.chunked());
+        assert(parser.body() == "helloabcdefghijklmnopqrstuvwxyz");
+    }
+    std::cout << "test_chunkedBodyDecoded PASSED" << std::endl;
+}
+
+void test_chunkedBodyTakenInPieces() {
+    std::cout << "Running test_chunkedBodyTakenInPieces..." << std::endl;
+    std::string head = "POST / HTTP/1.1\r\nHost: a\r\nTransfer-Encoding: chunked\r\n\r\n";
+    HttpRequestParser parser;
+    parser.feed(head.data(), head.size());
+    assert(parser.headComplete());
+    assert(parser.bodyPending());
+
+    std::string part = "3\r\nabc\r\n";
+    parser.feed(part.data(), part.size());
+    assert(parser.takeBody() == "abc");
+    std::string rest = "2\r\nde\r\n0\r\n\r\n";
+    parser.feed(rest.data(), rest.size());
+    assert(parser.complete());
+    assert(parser.takeBody() == "de");
+    std::cout << "test_chunkedBodyTakenInPieces PASSED" << std::endl;
+}
+
+void test_malformedChunkSize() {
+    std::cout << "Running test_malformedChunkSize..." << std::endl;
+    std::string raw = "POST / HTTP/1.1\r\nHost: a\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n";
+    HttpRequestParser parser;
+    parser.feed(raw.data(), raw.size());
+    assert(parser.failed());
+    assert(parser.errorStatus() == 400);
+    std::cout << "test_malformedChunkSize PASSED" << std::endl;
+}
+
+void test_bodyOverLimit413() {
+    std::cout << "Running test_bodyOverLimit413..." << std::endl;
+    {
+        HttpRequestParser parser;
+        parser.setMaxBodyBytes(10);
+        std::string raw = "POST / HTTP/1.1\r\nHost: a\r\nContent-Length: 11\r\n\r\n";
+        parser.feed(raw.data(), raw.size());
+        assert(parser.failed());
+        assert(parser.errorStatus() == 413);
+    }
+    {
+        // Exactly at the limit is accepted
+        HttpRequestParser parser;
+        parser.setMaxBodyBytes(10);
+        std::string raw = "POST / HTTP/1.1\r\nHost: a\r\nContent-Length: 10\r\n\r\n0123456789";
+        parser.feed(raw.data(), raw.size());
+        assert(parser.complete());
+    }
+    {
+        // A chunked body is refused once its chunks add up to more
+        HttpRequestParser parser;
+        parser.setMaxBodyBytes(10);
+        std::string raw = "POST / HTTP/1.1\r\nHost: a\r\nTransfer-Encoding: chunked\r\n\r\n"
+                          "6\r\nabcdef\r\n5\r\n";
+        parser.feed(raw.data(), raw.size());
+        assert(parser.failed());
+        assert(parser.errorStatus() == 413);
+    }
+    std::cout << "test_bodyOverLimit413 PASSED" << std::endl;
+}
+
+void test_headTooLarge431() {
+    std::cout << "Running test_headTooLarge431..." << std::endl;
+    {
+        HttpRequestParser parser;
+        std::string raw = "GET / HTTP/1.1\r\nHost: a\r\nX-Long: " +
+                          std::string(HttpRequestParser::kMaxHeadBytes, 'x');
+        feedInPieces(parser, raw, 4096);
+        assert(parser.failed());
+        assert(parser.errorStatus() == 431);
+    }
+    {
+        HttpRequestParser parser;
+        std::string raw = "GET / HTTP/1.1\r\n";
+        for (size_t i = 0; i <= HttpRequestHead::kMaxFields; ++i) {
+            raw += "X-Field-" + std::to_string(i) + ": v\r\n";
+        }
+        raw += "\r\n";
+        parser.feed(raw.data(), raw.size());
+        assert(parser.failed());
+        assert(parser.errorStatus() == 431);
+    }
+    std::cout << "test_headTooLarge431 PASSED" << std::endl;
+}
+
+void test_keepAliveByVersion() {
+    std::cout << "Running test_keepAliveByVersion..." << std::endl;
+    const char* cases[][2] = {
+        {"GET / HTTP/1.1\r\nHost: a\r\n\r\n", "1"},
+        {"GET / HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n", "0"},
+        {"GET / HTTP/1.1\r\nHost: a\r\nProxy-Connection: close\r\n\r\n", "0"},
+        {"GET / HTTP/1.0\r\nHost: a\r\n\r\n", "0"},
+        {"GET / HTTP/1.0\r\nHost: a\r\nConnection: Keep-Alive\r\n\r\n", "1"},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        HttpRequestParser parser;
+        std::string raw = cases[i][0];
+        parser.feed(raw.data(), raw.size());
+        assert(parser.complete());
+        assert(parser.head().keepAlive() == (cases[i][1][0] == '1'));
+    }
+    std::cout << "test_keepAliveByVersion PASSED" << std::endl;
+}
+
+void test_frameResponseHead() {
+    std::cout << "Running test_frameResponseHead..." << std::endl;
+    std::string head = "HTTP/1.1 200 OK\r\nContent-Length: 3\r\nConnection: close\r\nKeep-Alive: timeout=5\r\n\r\n";
+    assert(frameResponseHead(head, false, true));
+    assert(head == "HTTP/1.1 200 OK\r\nContent-Length: 3\r\nConnection: keep-alive\r\n\r\n");
+
+    // A body delimited by the end of the connection closes it
+    std::string unframed = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\n";
+    assert(!frameResponseHead(unframed, false, true));
+    assert(unframed.find("Connection: close\r\n") != std::string::npos);
+
+    std::string notModified = "HTTP/1.1 304 Not Modified\r\nETag: \"x\"\r\n\r\n";
+    assert(frameResponseHead(notModified, false, true));
+    std::cout << "test_frameResponseHead PASSED" << std::endl;
+}
+
+int main() {
+    test_headSplitAcrossReads();
+    test_pipelinedBytesLeftUnconsumed();
+    test_chunkedBodyDecoded();
+    test_chunkedBodyTakenInPieces();
+    test_malformedChunkSize();
+    test_bodyOverLimit413();
+    test_headTooLarge431();
+    test_keepAliveByVersion();
+    test_frameResponseHead();
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include "../http_range.hpp"
+#include <iostream>
+#include <cassert>
+#include <string>
+#include <vector>
+
+void test_parseSimpleRanges() {
+    std::cout << "Running test_parseSimpleRanges..." << std::endl;
+    std::vector<RangeSpec> specs;
+    assert(parseRangeHeader("bytes=0-499", specs));
+    assert(specs.size() == 1);
+    assert(!specs[0].suffix && !specs[0].openEnded);
+    assert(specs[0].first == 0 && specs[0].last == 499);
+
+    // The unit is not case-sensitive; blanks and empty list elements are allowed
+    assert(parseRangeHeader(" Bytes=500- , -200,, 10-10 ", specs));
+    assert(specs.size() == 3);
+    assert(specs[0].openEnded && specs[0].first == 500);
+    assert(specs[1].suffix && specs[1].suffixLength == 200);
+    assert(specs[2].first == 10 && specs[2].last == 10);
+    std::cout << "test_parseSimpleRanges PASSED" << std::endl;
+}
+
+void test_parseMalformedRanges() {
+    std::cout << "Running test_parseMalformedRanges..." << std::endl;
+    const char* malformed[] = {
+        "",
+        "bytes=",
+        "bytes=,",
+        "items=0-1",
+        "bytes=5",
+        "bytes=9-3",
+        "bytes=a-b",
+        "bytes=-",
+        "bytes=1-2-3",
+        "bytes=0-1,x",
+        "bytes=99999999999999999999999-",
+    };
+    for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i) {
+        std::vector<RangeSpec> specs;
+        assert(!parseRangeHeader(malformed[i], specs));
+    }
+    std::cout << "test_parseMalformedRanges PASSED" << std::endl;
+}
+
+void test_resolveSuffixRanges() {
+    std::cout << "Running test_resolveSuffixRanges..." << std::endl;
+    std::vector<RangeSpec> specs;
+    assert(parseRangeHeader("bytes=-100", specs));
+    std::vector<ByteRange> ranges = resolveRanges(specs, 1000);
+    assert(ranges.size() == 1);
+    assert(ranges[0].first == 900 && ranges[0].last == 999);
+
+    // A suffix longer than the representation selects all of it
+    ranges = resolveRanges(specs, 40);
+    assert(ranges.size() == 1);
+    assert(ranges[0].first == 0 && ranges[0].last == 39);
+
+    // -0 and an empty representation select nothing
+    assert(parseRangeHeader("bytes=-0", specs));
+    assert(resolveRanges(specs, 1000).empty());
+    assert(parseRangeHeader("bytes=-5", specs));
+    assert(resolveRanges(specs, 0).empty());
+    std::cout << "test_resolveSuffixRanges PASSED" << std::endl;
+}
+
+void test_resolveRangesPastEnd() {
+    std::cout << "Running test_resolveRangesPastEnd..." << std::endl;
+    std::vector<RangeSpec> specs;
+    assert(parseRangeHeader("bytes=990-2000", specs));
+    std::vector<ByteRange> ranges = resolveRanges(specs, 1000);
+    assert(ranges.size() == 1);
+    assert(ranges[0].first == 990 && ranges[0].last == 999);
+    assert(ranges[0].length() == 10);
+
+    assert(parseRangeHeader("bytes=500-", specs));
+    ranges = resolveRanges(specs, 1000);
+    assert(ranges.size() == 1 && ranges[0].last == 999);
+
+    // Ranges starting at or past the end are dropped, the others kept
+    assert(parseRangeHeader("bytes=1000-1001,0-0,5000-", specs));
+    ranges = resolveRanges(specs, 1000);
+    assert(ranges.size() == 1);
+    assert(ranges[0].first == 0 && ranges[0].last == 0);
+
+    assert(parseRangeHeader("bytes=1000-", specs));
+    assert(resolveRanges(specs, 1000).empty());
+    std::cout << "test_resolveRangesPastEnd PASSED" << std::endl;
+}
+
+void test_parseContentRange() {
+    std::cout << "Running test_parseContentRange..." << std::endl;
+    ByteRange range;
+    uint64_t length = 0;
+    assert(parseContentRange("bytes 0-99/1000", range, length));
+    assert(range.first == 0 && range.last == 99 && length == 1000);
+    assert(formatContentRange(range, length) == "bytes 0-99/1000");
+
+    assert(parseContentRange("  bytes 999-999/1000 ", range, length));
+    assert(range.first == 999 && length == 1000);
+
+    const char* malformed[] = {
+        "bytes 0-99/*",
+        "bytes */1000",
+        "bytes 100-99/1000",
+        "bytes 0-1000/1000",
+        "bytes 0-99",
+        "items 0-99/1000",
+        "bytes 0/99-1000",
+        "bytes a-b/c",
+    };
+    for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i) {
+        assert(!parseContentRange(malformed[i], range, length));
+    }
+    std::cout << "test_parseContentRange PASSED" << std::endl;
+}
+
+void test_ifRangeMatches() {
+    std::cout << "Running test_ifRangeMatches..." << std::endl;
+    const std::string date = "Wed, 21 Oct 2015 07:28:00 GMT";
+    assert(ifRangeMatches("\"v1\"", "\"v1\"", date));
+    assert(!ifRangeMatches("\"v2\"", "\"v1\"", date));
+    // Weak tags never match
+    assert(!ifRangeMatches("W/\"v1\"", "W/\"v1\"", date));
+    assert(ifRangeMatches(date, "\"v1\"", date));
+    assert(!ifRangeMatches(date, "\"v1\"", ""));
+    assert(ifRangeMatches("", "\"v1\"", date));
+    std::cout << "test_ifRangeMatches PASSED" << std::endl;
+}
+
+int main() {
+    test_parseSimpleRanges();
+    test_parseMalformedRanges();
+    test_resolveSuffixRanges();
+    test_resolveRangesPastEnd();
+    test_parseContentRange();
+    test_ifRangeMatches();
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
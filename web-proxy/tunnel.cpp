@@ -0,0 +1,233 @@
+#include "tunnel.hpp"
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+Tunnel::Tunnel(Reactor& reactor, int clientFd, int originFd, const std::string& origin,
+               int idleTimeoutMs, const std::string& clientPrefix)
+    : reactor_(reactor), clientFd_(clientFd), originFd_(originFd), origin_(origin),
+      idleTimeoutMs_(idleTimeoutMs), prefix_(clientPrefix), prefixSent_(0),
+      clientEvents_(0), originEvents_(0), startedMs_(Reactor::nowMs()),
+      lastActivityMs_(startedMs_), closedMs_(0), idleTimedOut_(false), closed_(false),
+      idleTimer_(0) {
+    up_.relay.reset(new SpliceRelay(clientFd_, originFd_));
+    up_.status = SpliceRelay::WANT_READ;
+    up_.ended = false;
+    down_.relay.reset(new SpliceRelay(originFd_, clientFd_));
+    down_.status = SpliceRelay::WANT_READ;
+    down_.ended = false;
+}
+
+Tunnel::~Tunnel() {
+    if (clientFd_ >= 0) {
+        ::close(clientFd_);
+    }
+    if (originFd_ >= 0) {
+        ::close(originFd_);
+    }
+}
+
+void Tunnel::start() {
+    self_ = shared_from_this();
+
+    std::weak_ptr<Tunnel> weak = self_;
+    reactor_.add(clientFd_, 0, std::make_shared<FunctionEventHandler>([weak](uint32_t events) {
+        std::shared_ptr<Tunnel> tunnel = weak.lock();
+        if (tunnel) {
+            tunnel->onEvent(true, events);
+        }
+    }));
+    reactor_.add(originFd_, 0, std::make_shared<FunctionEventHandler>([weak](uint32_t events) {
+        std::shared_ptr<Tunnel> tunnel = weak.lock();
+        if (tunnel) {
+            tunnel->onEvent(false, events);
+        }
+    }));
+    armIdleTimer(idleTimeoutMs_);
+
+    pumpUp();
+    pumpDown();
+    if (!closed_) {
+        updateEvents();
+    }
+}
+
+void Tunnel::onEvent(bool clientSide, uint32_t events) {
+    std::shared_ptr<Tunnel> guard = shared_from_this();
+
+    // Readability of a side feeds the relay reading from it, writability
+    // the relay writing to it; errors are reported by whichever runs
+    bool error = (events & (EPOLLERR | EPOLLHUP)) != 0;
+    bool readable = (events & EPOLLIN) || error;
+    bool writable = (events & EPOLLOUT) || error;
+    if (clientSide ? readable : writable) {
+        pumpUp();
+    }
+    if (!closed_ && (clientSide ? writable : readable)) {
+        pumpDown();
+    }
+    if (closed_) {
+        return;
+    }
+    if (up_.ended && down_.ended) {
+        close();
+        return;
+    }
+    updateEvents();
+}
+
+void Tunnel::pumpUp() {
+    if (up_.ended || closed_) {
+        return;
+    }
+    if (!sendPrefix()) {
+        return;
+    }
+    pump(up_, originFd_);
+}
+
+void Tunnel::pumpDown() {
+    if (down_.ended || closed_) {
+        return;
+    }
+    pump(down_, clientFd_);
+}
+
+void Tunnel::pump(Direction& direction, int destination) {
+    uint64_t before = direction.relay->bytesRelayed();
+    direction.status = direction.relay->pump();
+    if (direction.relay->bytesRelayed() != before) {
+        lastActivityMs_ = Reactor::nowMs();
+    }
+
+    switch (direction.status) {
+    case SpliceRelay::SOURCE_CLOSED:
+    case SpliceRelay::FINISHED:
+        // Half-close: the peer sees end of file, the other direction goes on
+        direction.ended = true;
+        shutdown(destination, SHUT_WR);
+        break;
+    case SpliceRelay::FAILED:
+        close();
+        break;
+    default:
+        break;
+    }
+}
+
+bool Tunnel::sendPrefix() {
+    while (prefixSent_ < prefix_.size()) {
+        ssize_t n = send(originFd_, prefix_.data() + prefixSent_, prefix_.size() - prefixSent_,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                up_.status = SpliceRelay::WANT_WRITE;
+            } else {
+                close();
+            }
+            return false;
+        }
+        prefixSent_ += n;
+        lastActivityMs_ = Reactor::nowMs();
+    }
+    return true;
+}
+
+void Tunnel::updateEvents() {
+    // Only the side each relay is blocked on is watched
+    uint32_t clientEvents = 0;
+    uint32_t originEvents = 0;
+    if (!up_.ended) {
+        if (up_.status == SpliceRelay::WANT_WRITE) {
+            originEvents |= EPOLLOUT;
+        } else {
+            clientEvents |= EPOLLIN;
+        }
+    }
+    if (!down_.ended) {
+        if (down_.status == SpliceRelay::WANT_WRITE) {
+            clientEvents |= EPOLLOUT;
+        } else {
+            originEvents |= EPOLLIN;
+        }
+    }
+    if (clientEvents != clientEvents_) {
+        clientEvents_ = clientEvents;
+        reactor_.modify(clientFd_, clientEvents_);
+    }
+    if (originEvents != originEvents_) {
+        originEvents_ = originEvents;
+        reactor_.modify(originFd_, originEvents_);
+    }
+}
+
+void Tunnel::armIdleTimer(int delayMs) {
+    if (idleTimeoutMs_ <= 0) {
+        return;
+    }
+    // Traffic only records a timestamp; the timer re-arms itself for the
+    // remaining time instead of being rescheduled on every chunk
+    std::weak_ptr<Tunnel> weak = shared_from_this();
+    idleTimer_ = reactor_.runAfter(delayMs, [weak]() {
+        std::shared_ptr<Tunnel> tunnel = weak.lock();
+        if (tunnel) {
+            tunnel->idleTimer_ = 0;
+            tunnel->checkIdle();
+        }
+    });
+}
+
+void Tunnel::checkIdle() {
+    uint64_t idleMs = Reactor::nowMs() - lastActivityMs_;
+    if (idleMs >= static_cast<uint64_t>(idleTimeoutMs_)) {
+        idleTimedOut_ = true;
+        close();
+        return;
+    }
+    armIdleTimer(static_cast<int>(idleTimeoutMs_ - idleMs));
+}
+
+void Tunnel::close() {
+    if (closed_) {
+        return;
+    }
+    closed_ = true;
+    closedMs_ = Reactor::nowMs();
+    if (idleTimer_ != 0) {
+        reactor_.cancelTimer(idleTimer_);
+        idleTimer_ = 0;
+    }
+    reactor_.remove(clientFd_);
+    reactor_.remove(originFd_);
+    ::close(clientFd_);
+    ::close(originFd_);
+    clientFd_ = -1;
+    originFd_ = -1;
+
+    std::shared_ptr<Tunnel> self = self_;
+    self_.reset();
+    if (closeCallback_) {
+        closeCallback_(*this);
+    }
+}
+
+uint64_t Tunnel::bytesUp() const {
+    return up_.relay->bytesRelayed() + prefixSent_;
+}
+
+uint64_t Tunnel::bytesDown() const {
+    return down_.relay->bytesRelayed();
+}
+
+bool Tunnel::zeroCopy() const {
+    return up_.relay->zeroCopy() && down_.relay->zeroCopy();
+}
+
+uint64_t Tunnel::cpuNanos() const {
+    return up_.relay->cpuNanos() + down_.relay->cpuNanos();
+}
+
+uint64_t Tunnel::durationMs() const {
+    return (closed_ ? closedMs_ : Reactor::nowMs()) - startedMs_;
+}
@@ -0,0 +1,87 @@
+#ifndef TUNNEL_HPP
+#define TUNNEL_HPP
+
+#include <string>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+#include "reactor.hpp"
+#include "splice_relay.hpp"
+
+// Established CONNECT tunnel: relays bytes in both directions between the
+// client and the origin with one SpliceRelay per direction, on the reactor
+// that owns the client. Each socket is registered once and watched only
+// for what the two relays are blocked on. End of file in one direction is
+// passed on with shutdown(SHUT_WR) while the other keeps flowing; the
+// tunnel closes when both directions have ended, on a socket error, or
+// after `idleTimeoutMs` without traffic in either direction. The tunnel
+// owns both sockets and keeps itself alive until it is closed.
+class Tunnel : public std::enable_shared_from_this<Tunnel> {
+public:
+    typedef std::function<void(const Tunnel&)> CloseCallback;
+
+    // `clientPrefix` holds bytes the client sent right after its request
+    // head; they are forwarded to the origin first.
+    Tunnel(Reactor& reactor, int clientFd, int originFd, const std::string& origin,
+           int idleTimeoutMs, const std::string& clientPrefix = std::string());
+    ~Tunnel();
+
+    Tunnel(const Tunnel&) = delete;
+    Tunnel& operator=(const Tunnel&) = delete;
+
+    // Called once when the tunnel has closed, on the reactor thread.
+    void onClose(const CloseCallback& callback) { closeCallback_ = callback; }
+
+    // Must be called on the reactor thread.
+    void start();
+    void close();
+
+    const std::string& origin() const { return origin_; }
+    // Bytes delivered to the origin and to the client
+    uint64_t bytesUp() const;
+    uint64_t bytesDown() const;
+    bool zeroCopy() const;
+    uint64_t cpuNanos() const;
+    uint64_t durationMs() const;
+    bool idleTimedOut() const { return idleTimedOut_; }
+
+private:
+    // One side of the tunnel and the relay that reads from it
+    struct Direction {
+        std::unique_ptr<SpliceRelay> relay;
+        SpliceRelay::Status status;
+        bool ended;
+    };
+
+    Reactor& reactor_;
+    int clientFd_;
+    int originFd_;
+    std::string origin_;
+    int idleTimeoutMs_;
+    std::string prefix_;
+    size_t prefixSent_;
+    Direction up_;      // client -> origin
+    Direction down_;    // origin -> client
+    uint32_t clientEvents_;
+    uint32_t originEvents_;
+    uint64_t startedMs_;
+    uint64_t lastActivityMs_;
+    uint64_t closedMs_;
+    bool idleTimedOut_;
+    bool closed_;
+    TimerWheel::TimerId idleTimer_;
+    CloseCallback closeCallback_;
+    std::shared_ptr<Tunnel> self_;
+
+    void onEvent(bool clientSide, uint32_t events);
+    void pumpUp();
+    void pumpDown();
+    void pump(Direction& direction, int destination);
+    bool sendPrefix();
+    void updateEvents();
+    void armIdleTimer(int delayMs);
+    void checkIdle();
+};
+
+#endif // TUNNEL_HPP
@@ -0,0 +1,91 @@
+#include "upload_stream.hpp"
+#include <algorithm>
+#include <cstdio>
+
+const uint64_t UploadStream::kUnknownLength;
+
+UploadStream::UploadStream(uint64_t length, size_t window)
+    : length_(length), window_(std::max<size_t>(window, 1)), offset_(0), received_(0), taken_(0),
+      complete_(false), failed_(false), ended_(false), waiting_(false), wasFull_(false),
+      errorStatus_(0) {}
+
+void UploadStream::append(const char* data, size_t len) {
+    if (len == 0 || complete_ || failed_) {
+        return;
+    }
+    buffer_.append(data, len);
+    received_ += len;
+    if (full()) {
+        wasFull_ = true;
+    }
+    notifyReadable();
+}
+
+void UploadStream::finish() {
+    complete_ = true;
+    notifyReadable();
+}
+
+void UploadStream::fail(int errorStatus) {
+    if (complete_ || failed_) {
+        return;
+    }
+    failed_ = true;
+    errorStatus_ = errorStatus;
+    notifyReadable();
+}
+
+void UploadStream::notifyReadable() {
+    if (waiting_ && readable_) {
+        waiting_ = false;
+        readable_();
+    }
+}
+
+UploadStream::Status UploadStream::read(std::string& out, size_t max) {
+    if (failed_) {
+        return FAILED;
+    }
+    size_t available = buffer_.size() - offset_;
+    if (available == 0) {
+        if (!complete_) {
+            waiting_ = true;
+            return WAIT;
+        }
+        if (chunked() && !ended_) {
+            ended_ = true;
+            out += "0\r\n\r\n";
+            return DATA;
+        }
+        return DONE;
+    }
+
+    size_t n = std::min(available, max);
+    if (chunked()) {
+        char size[20];
+        std::snprintf(size, sizeof(size), "%zx\r\n", n);
+        out += size;
+        out.append(buffer_, offset_, n);
+        out += "\r\n";
+    } else {
+        out.append(buffer_, offset_, n);
+    }
+    offset_ += n;
+    taken_ += n;
+
+    if (offset_ == buffer_.size()) {
+        buffer_.clear();
+        offset_ = 0;
+    } else if (offset_ >= window_) {
+        buffer_.erase(0, offset_);
+        offset_ = 0;
+    }
+    // The client side stopped reading when the window filled up
+    if (wasFull_ && !full()) {
+        wasFull_ = false;
+        if (drained_) {
+            drained_();
+        }
+    }
+    return DATA;
+}
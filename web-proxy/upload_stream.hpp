@@ -0,0 +1,70 @@
+#ifndef UPLOAD_STREAM_HPP
+#define UPLOAD_STREAM_HPP
+
+#include <string>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+// Body of a client request that is forwarded to the origin while it is
+// still being received. The client connection appends the decoded body
+// as it arrives; the upstream fetch reads it as wire bytes, as they are
+// for a body of known length and re-chunked otherwise. At most `window`
+// bytes are held: a full stream makes the client connection stop reading
+// until the fetch has sent some, so a slow origin slows the client down
+// instead of growing the buffer. Both sides run on the same reactor.
+class UploadStream {
+public:
+    enum Status { DATA, WAIT, DONE, FAILED };
+
+    static const uint64_t kUnknownLength = ~0ULL;
+
+    UploadStream(uint64_t length, size_t window);
+
+    UploadStream(const UploadStream&) = delete;
+    UploadStream& operator=(const UploadStream&) = delete;
+
+    // Client side. `errorStatus` is what to answer if the origin got no
+    // response out (413 for a body over the limit), 0 if the client left.
+    void append(const char* data, size_t len);
+    void finish();
+    void fail(int errorStatus);
+    bool full() const { return buffer_.size() - offset_ >= window_; }
+    // Called when a full stream has room again
+    void onDrained(const std::function<void()>& callback) { drained_ = callback; }
+
+    // Origin side: appends up to `max` body bytes, with their chunk
+    // framing, to `out`. WAIT means the client has sent nothing more yet;
+    // the readable callback is called once it has.
+    Status read(std::string& out, size_t max);
+    void onReadable(const std::function<void()>& callback) { readable_ = callback; }
+
+    bool chunked() const { return length_ == kUnknownLength; }
+    uint64_t length() const { return length_; }
+    bool complete() const { return complete_; }
+    bool failed() const { return failed_; }
+    int errorStatus() const { return errorStatus_; }
+    // Body bytes received from the client and taken by the origin side
+    uint64_t received() const { return received_; }
+    uint64_t taken() const { return taken_; }
+
+private:
+    uint64_t length_;
+    size_t window_;
+    std::string buffer_;
+    size_t offset_;
+    uint64_t received_;
+    uint64_t taken_;
+    bool complete_;
+    bool failed_;
+    bool ended_;            // the last chunk was read
+    bool waiting_;          // the origin side got WAIT
+    bool wasFull_;
+    int errorStatus_;
+    std::function<void()> drained_;
+    std::function<void()> readable_;
+
+    void notifyReadable();
+};
+
+#endif // UPLOAD_STREAM_HPP
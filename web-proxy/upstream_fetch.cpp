@@ -0,0 +1,576 @@
+#include "upstream_fetch.hpp"
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+
+namespace {
+
+void setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags >= 0) {
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    }
+}
+
+} // namespace
+
+const size_t UpstreamFetch::kUploadChunk;
+
+UpstreamFetch::UpstreamFetch(Reactor& reactor, const UpstreamContext& context,
+                             const std::string& host, int port, const std::string& request,
+                             bool headRequest, bool idempotent)
+    : reactor_(reactor), context_(context), host_(host), port_(port),
+      origin_(host + ":" + std::to_string(port)), request_(request),
+      headRequest_(headRequest), idempotent_(idempotent), phase_(IDLE), fd_(-1), nextAddress_(0),
+      reused_(false), attempt_(0), sent_(0), uploadSent_(0), uploadStarted_(false),
+      uploadWakeScheduled_(false), events_(0), received_(0), reusable_(true),
+      parser_(headRequest), consumedTotal_(0), bodyStreamed_(0), headStreamed_(false),
+      relayChecked_(false), bodyChecked_(false), relayRemaining_(0), relayReusable_(false), timer_(0), ticket_(0), unavailable_(false), throttleTimer_(0), held_(false) {}
+
+UpstreamFetch::~UpstreamFetch() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+void UpstreamFetch::start() {
+    self_ = shared_from_this();
+    // Tunnels are not exchanges and are not limited
+    if (!slot_ && context_.limiter && !request_.empty()) {
+        phase_ = QUEUED;
+        std::weak_ptr<UpstreamFetch> weak = self_;
+        OriginLimiter::Admission admission = context_.limiter->acquire(origin_, reactor_,
+            [weak](const std::shared_ptr<OriginSlot>& slot) {
+                std::shared_ptr<UpstreamFetch> fetch = weak.lock();
+                if (fetch && fetch->phase_ == QUEUED) {
+                    fetch->cancelTimer();
+                    fetch->ticket_ = 0;
+                    fetch->slot_ = slot;
+                    fetch->start();
+                }
+            }, ticket_);
+        if (admission == OriginLimiter::REJECTED) {
+            context_.log("Queue of " + origin_ + " is full");
+            fail("Origin is too busy");
+        } else if (admission == OriginLimiter::QUEUED) {
+            context_.log("Waiting for a free slot of " + origin_);
+            armTimer(context_.limiter->maxQueueWaitMs(), "queue");
+        }
+        return;
+    }
+    sent_ = 0;
+    received_ = 0;
+    reusable_ = true;
+
+    if (upload_ && attempt_ == 0) {
+        // Body bytes from the client resume a send that waits for them,
+        // one turn of the loop later
+        std::weak_ptr<UpstreamFetch> weak = self_;
+        Reactor* reactor = &reactor_;
+        upload_->onReadable([weak, reactor]() {
+            std::shared_ptr<UpstreamFetch> fetch = weak.lock();
+            if (!fetch || fetch->uploadWakeScheduled_) {
+                return;
+            }
+            fetch->uploadWakeScheduled_ = true;
+            reactor->post([weak]() {
+                std::shared_ptr<UpstreamFetch> fetch = weak.lock();
+                if (fetch) {
+                    fetch->uploadWakeScheduled_ = false;
+                    if (fetch->phase_ == SENDING) {
+                        fetch->sendRequest();
+                    }
+                }
+            });
+        });
+    }
+
+    // A tunnel gets a connection of its own
+    int fd = attempt_ == 0 && !request_.empty() ? context_.pool->acquire(origin_) : -1;
+    if (fd >= 0) {
+        context_.log("Reusing pooled connection to " + origin_);
+        reused_ = true;
+        fd_ = fd;
+        setNonBlocking(fd_);
+        phase_ = SENDING;
+        events_ = EPOLLOUT;
+        reactor_.add(fd_, events_, self_);
+        return;
+    }
+
+    // Lookups that miss the DNS cache run on the worker pool; the connect
+    // timeout covers the lookup as well
+    reused_ = false;
+    phase_ = RESOLVING;
+    armTimer(context_.timeouts.connectMs, "connect");
+
+    std::weak_ptr<UpstreamFetch> weak = self_;
+    context_.dns->resolve(host_, reactor_, [weak](const std::vector<ResolvedAddress>& addresses) {
+        std::shared_ptr<UpstreamFetch> fetch = weak.lock();
+        if (fetch) {
+            fetch->onResolved(addresses);
+        }
+    });
+}
+
+void UpstreamFetch::abandon() {
+    if (phase_ == QUEUED) {
+        context_.log("No client waits for " + origin_ + " any more, leaving its queue");
+        fail("Abandoned while queued");
+    }
+}
+
+void UpstreamFetch::onResolved(const std::vector<ResolvedAddress>& addresses) {
+    if (phase_ != RESOLVING) {
+        return; // Timed out meanwhile
+    }
+    if (addresses.empty()) {
+        context_.log("Failed to resolve hostname: " + host_);
+        fail("Failed to resolve hostname");
+        return;
+    }
+    addresses_ = addresses;
+    nextAddress_ = 0;
+    connectNext();
+}
+
+bool UpstreamFetch::hasNextAddress() const {
+    return nextAddress_ < addresses_.size() && nextAddress_ < kMaxConnectAttempts;
+}
+
+void UpstreamFetch::connectNext() {
+    // An unreachable address (typically IPv6 without a route) falls
+    // through to the next one instead of failing the request
+    while (hasNextAddress()) {
+        ResolvedAddress address = addresses_[nextAddress_++];
+        if (address.addr.ss_family == AF_INET6) {
+            reinterpret_cast<sockaddr_in6*>(&address.addr)->sin6_port = htons(port_);
+        } else {
+            reinterpret_cast<sockaddr_in*>(&address.addr)->sin_port = htons(port_);
+        }
+
+        fd_ = socket(address.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd_ < 0) {
+            continue;
+        }
+        if (connect(fd_, reinterpret_cast<const sockaddr*>(&address.addr), address.length) < 0 &&
+            errno != EINPROGRESS) {
+            ::close(fd_);
+            fd_ = -1;
+            continue;
+        }
+
+        // Writability signals that the connection attempt finished
+        phase_ = CONNECTING;
+        events_ = EPOLLOUT;
+        reactor_.add(fd_, events_, self_);
+        armTimer(context_.timeouts.connectMs, "connect");
+        return;
+    }
+
+    context_.log("Failed to connect to server: " + origin_);
+    fail("Failed to connect to server");
+}
+
+void UpstreamFetch::onEvent(uint32_t events) {
+    std::shared_ptr<UpstreamFetch> guard = shared_from_this();
+
+    switch (phase_) {
+    case CONNECTING: {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+            closeSocket();
+            connectNext();
+            return;
+        }
+        cancelTimer();
+        if (request_.empty()) {
+            handOffConnection();
+            return;
+        }
+        phase_ = SENDING;
+        sendRequest();
+        break;
+    }
+    case SENDING:
+        if ((events & EPOLLIN) && uploadStarted_) {
+            // The origin answered before it had the whole body (e.g. 413):
+            // the response is read and the connection not reused
+            reusable_ = false;
+            phase_ = WAITING;
+            watch(EPOLLIN);
+            readResponse();
+            break;
+        }
+        if (events & (EPOLLERR | EPOLLHUP)) {
+            retryOrFail("Failed to send request");
+            return;
+        }
+        sendRequest();
+        break;
+    case WAITING:
+    case READING:
+        readResponse();
+        break;
+    default:
+        break;
+    }
+}
+
+void UpstreamFetch::sendRequest() {
+    if (!sendBuffer(request_, sent_)) {
+        return;
+    }
+
+    // A body still arriving from the client follows piece by piece
+    while (upload_) {
+        if (uploadSent_ == uploadChunk_.size()) {
+            uploadChunk_.clear();
+            uploadSent_ = 0;
+            UploadStream::Status status = upload_->read(uploadChunk_, kUploadChunk);
+            if (status == UploadStream::DONE) {
+                break;
+            }
+            if (status == UploadStream::FAILED) {
+                context_.log("Request body for " + origin_ + " was not received in full");
+                fail("Request body was not received in full");
+                return;
+            }
+            if (status == UploadStream::WAIT) {
+                // The origin may answer while the client is still sending
+                watch(uploadStarted_ ? static_cast<uint32_t>(EPOLLIN) : 0);
+                armTimer(context_.timeouts.idleMs, "send");
+                return;
+            }
+            uploadStarted_ = true;
+        }
+        if (!sendBuffer(uploadChunk_, uploadSent_)) {
+            return;
+        }
+    }
+
+    phase_ = WAITING;
+    watch(EPOLLIN);
+    armTimer(context_.timeouts.firstByteMs, "first byte");
+}
+
+bool UpstreamFetch::sendBuffer(const std::string& data, size_t& offset) {
+    while (offset < data.size()) {
+        ssize_t n = send(fd_, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                watch(uploadStarted_ ? EPOLLOUT | EPOLLIN : EPOLLOUT);
+                armTimer(context_.timeouts.idleMs, "send");
+                return false;
+            }
+            if (uploadStarted_) {
+                // The origin may have answered and stopped reading the body
+                reusable_ = false;
+                phase_ = WAITING;
+                watch(EPOLLIN);
+                readResponse();
+                return false;
+            }
+            retryOrFail("Failed to send request");
+            return false;
+        }
+        offset += n;
+    }
+    return true;
+}
+
+void UpstreamFetch::watch(uint32_t events) {
+    if (events != events_) {
+        events_ = events;
+        reactor_.modify(fd_, events_);
+    }
+}
+
+void UpstreamFetch::readResponse() {
+    char buffer[16384];
+    bool closed = false;
+
+    while (!parser_.complete() && !parser_.failed()) {
+        if (full_ && full_()) {
+            // Like a throttled read, but until the consumer calls resume()
+            cancelTimer();
+            watch(0);
+            held_ = true;
+            return;
+        }
+        size_t wanted = sizeof(buffer);
+        if (context_.limiter) {
+            int waitMs = 0;
+            wanted = context_.limiter->allowance(origin_, wanted, waitMs);
+            if (wanted == 0) {
+                throttle(waitMs);
+                return;
+            }
+        }
+        ssize_t n = recv(fd_, buffer, wanted, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n <= 0) {
+            parser_.finishOnClose();
+            closed = true;
+            reusable_ = false;
+            break;
+        }
+
+        phase_ = READING;
+        received_ += n;
+        if (context_.limiter) {
+            context_.limiter->consume(origin_, n);
+        }
+        size_t consumed = parser_.feed(buffer, n);
+        if (consumed < static_cast<size_t>(n)) {
+            // Data past the end of the response: the connection is out of sync
+            reusable_ = false;
+        }
+        stream(buffer, n, consumed);
+        passBody();
+        if (startRelay()) {
+            return;
+        }
+    }
+
+    if (parser_.complete()) {
+        succeed();
+    } else if (parser_.failed() || closed) {
+        retryOrFail(received_ == 0 ? "Empty response from server" : "Malformed response from server");
+    } else if (phase_ == READING) {
+        armTimer(context_.timeouts.idleMs, "idle");
+    }
+}
+
+void UpstreamFetch::stream(const char* data, size_t len, size_t consumed) {
+    (void)len;
+    consumedTotal_ += consumed;
+    if (!dataCallback_ || !parser_.headersComplete() || parser_.failed()) {
+        return;
+    }
+
+    // The head once it is known, then the body bytes as received
+    if (!headStreamed_) {
+        std::string head = parser_.forwardHead();
+        dataCallback_(head.data(), head.size());
+        headStreamed_ = true;
+    }
+    size_t bodyTotal = consumedTotal_ - parser_.headerBytes();
+    size_t fresh = bodyTotal - bodyStreamed_;
+    if (fresh > 0) {
+        dataCallback_(data + consumed - fresh, fresh);
+        bodyStreamed_ = bodyTotal;
+    }
+}
+
+void UpstreamFetch::passBody() {
+    if (!bodyCallback_ || !parser_.headersComplete() || parser_.failed()) {
+        return;
+    }
+    if (!bodyChecked_) {
+        bodyChecked_ = true;
+        if (!bodyFilter_(parser_)) {
+            bodyCallback_ = DataCallback();
+            return;
+        }
+    }
+    if (!parser_.body().empty()) {
+        std::string body = parser_.takeBody();
+        bodyCallback_(body.data(), body.size());
+    }
+}
+
+void UpstreamFetch::resume() {
+    if (!held_) {
+        return;
+    }
+    held_ = false;
+    if (phase_ == READING) {
+        watch(EPOLLIN);
+        readResponse();
+    }
+}
+
+// Stops reading until the origin's bucket has refilled. The socket is not
+// watched meanwhile, so the origin is slowed down by the TCP window, and
+// the idle timeout does not run, as the pause is the proxy's own.
+void UpstreamFetch::throttle(int delayMs) {
+    cancelTimer();
+    watch(0);
+    std::weak_ptr<UpstreamFetch> weak = shared_from_this();
+    throttleTimer_ = reactor_.runAfter(delayMs, [weak]() {
+        std::shared_ptr<UpstreamFetch> fetch = weak.lock();
+        if (fetch && (fetch->phase_ == WAITING || fetch->phase_ == READING)) {
+            fetch->throttleTimer_ = 0;
+            fetch->watch(EPOLLIN);
+            if (fetch->phase_ == WAITING) {
+                fetch->armTimer(fetch->context_.timeouts.firstByteMs, "first byte");
+            }
+            fetch->readResponse();
+        }
+    });
+}
+
+bool UpstreamFetch::startRelay() {
+    // Decided once, right after the head, and only for a body whose end
+    // can be found without parsing it. A metered origin's bytes must all
+    // pass through the fetch.
+    if (relayChecked_ || !relayFilter_ || !parser_.headersComplete() ||
+        parser_.complete() || parser_.failed() ||
+        (context_.limiter && context_.limiter->shapesBandwidth())) {
+        return false;
+    }
+    relayChecked_ = true;
+    if (!(parser_.awaitingLengthBody() || parser_.awaitingCloseBody()) || !relayFilter_(parser_)) {
+        return false;
+    }
+
+    cancelTimer();
+    reactor_.remove(fd_);
+    phase_ = RELAYED;
+    if (parser_.awaitingLengthBody()) {
+        relayRemaining_ = parser_.remainingBodyBytes();
+        relayReusable_ = reusable_ && parser_.persistentConnection();
+    } else {
+        relayRemaining_ = SpliceRelay::kUnlimited;
+        relayReusable_ = false;
+    }
+
+    std::shared_ptr<UpstreamFetch> self = self_;
+    self_.reset();
+    if (completionCallback_) {
+        completionCallback_(*this);
+    }
+    return true;
+}
+
+void UpstreamFetch::handOffConnection() {
+    // Without a request there is nothing to read: the caller takes over
+    // the connected socket for as long as it stays open
+    reactor_.remove(fd_);
+    phase_ = RELAYED;
+    relayRemaining_ = SpliceRelay::kUnlimited;
+    relayReusable_ = false;
+
+    std::shared_ptr<UpstreamFetch> self = self_;
+    self_.reset();
+    if (completionCallback_) {
+        completionCallback_(*this);
+    }
+}
+
+std::shared_ptr<OriginSlot> UpstreamFetch::takeSlot() {
+    std::shared_ptr<OriginSlot> slot;
+    slot.swap(slot_);
+    return slot;
+}
+
+int UpstreamFetch::releaseSocket() {
+    int fd = fd_;
+    fd_ = -1;
+    return fd;
+}
+
+void UpstreamFetch::retryOrFail(const std::string& error) {
+    // A pooled connection may have been closed by the server while idle;
+    // in that case the request is retried once over a fresh connection,
+    // unless part of a streamed body went out, which cannot be sent again.
+    if (reused_ && received_ == 0 && (idempotent_ || phase_ == SENDING) && attempt_ == 0 &&
+        !uploadStarted_) {
+        cancelTimer();
+        closeSocket();
+        attempt_++;
+        parser_ = HttpResponseParser(headRequest_);
+        consumedTotal_ = 0;
+        start();
+        return;
+    }
+    context_.log("Upstream exchange with " + origin_ + " failed: " + error);
+    fail(error);
+}
+
+void UpstreamFetch::succeed() {
+    cancelTimer();
+    phase_ = DONE;
+    slot_.reset();
+    if (reusable_ && parser_.keepAlive()) {
+        reactor_.remove(fd_);
+        context_.pool->release(origin_, fd_);
+        fd_ = -1;
+    } else {
+        closeSocket();
+    }
+
+    std::shared_ptr<UpstreamFetch> self = self_;
+    self_.reset();
+    if (completionCallback_) {
+        completionCallback_(*this);
+    }
+}
+
+void UpstreamFetch::fail(const std::string& error) {
+    if (phase_ == QUEUED) {
+        if (ticket_ != 0) {
+            context_.limiter->withdraw(origin_, ticket_);
+            ticket_ = 0;
+        }
+        unavailable_ = true;
+    }
+    cancelTimer();
+    closeSocket();
+    phase_ = FAILED;
+    slot_.reset();
+    error_ = error;
+
+    std::shared_ptr<UpstreamFetch> self = self_;
+    self_.reset();
+    if (completionCallback_) {
+        completionCallback_(*this);
+    }
+}
+
+void UpstreamFetch::armTimer(int delayMs, const std::string& phase) {
+    cancelTimer();
+    if (delayMs <= 0) {
+        return;
+    }
+    std::weak_ptr<UpstreamFetch> weak = shared_from_this();
+    timer_ = reactor_.runAfter(delayMs, [weak, phase]() {
+        std::shared_ptr<UpstreamFetch> fetch = weak.lock();
+        if (fetch && fetch->phase_ != DONE && fetch->phase_ != RELAYED && fetch->phase_ != FAILED) {
+            fetch->timer_ = 0;
+            fetch->context_.log("Upstream " + phase + " timeout: " + fetch->origin_);
+            if (fetch->phase_ == CONNECTING && fetch->hasNextAddress()) {
+                fetch->closeSocket();
+                fetch->connectNext();
+                return;
+            }
+            fetch->fail("Upstream " + phase + " timeout");
+        }
+    });
+}
+
+void UpstreamFetch::cancelTimer() {
+    if (timer_ != 0) {
+        reactor_.cancelTimer(timer_);
+        timer_ = 0;
+    }
+    if (throttleTimer_ != 0) {
+        reactor_.cancelTimer(throttleTimer_);
+        throttleTimer_ = 0;
+    }
+}
+
+void UpstreamFetch::closeSocket() {
+    if (fd_ >= 0) {
+        reactor_.remove(fd_);
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
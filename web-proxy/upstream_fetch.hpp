@@ -0,0 +1,194 @@
+#ifndef UPSTREAM_FETCH_HPP
+#define UPSTREAM_FETCH_HPP
+
+#include <string>
+#include <memory>
+#include <functional>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <sys/socket.h>
+#include "reactor.hpp"
+#include "dns_cache.hpp"
+#include "upstream_pool.hpp"
+#include "http_message.hpp"
+#include "splice_relay.hpp"
+#include "upload_stream.hpp"
+#include "origin_limiter.hpp"
+
+// Per-phase limits of an upstream exchange, in milliseconds
+struct UpstreamTimeouts {
+    int connectMs;      // resolving the host and establishing the connection
+    int firstByteMs;    // from the request being sent to the first response byte
+    int idleMs;         // between two reads while the response arrives
+
+    UpstreamTimeouts() : connectMs(5000), firstByteMs(30000), idleMs(30000) {}
+};
+
+// Services shared by all upstream fetches
+struct UpstreamContext {
+    UpstreamPool* pool;
+    DnsCache* dns;
+    OriginLimiter* limiter;     // null: exchanges are neither queued nor metered
+    UpstreamTimeouts timeouts;
+    std::function<void(const std::string&)> log;
+
+    UpstreamContext() : pool(nullptr), dns(nullptr), limiter(nullptr) {}
+};
+
+// One request/response exchange with an origin server as a non-blocking
+// state machine on a reactor: wait for a slot of the origin's limiter,
+// resolve (through the DNS cache), connect, send, wait for the first
+// byte, read; reading pauses while the origin's byte budget is spent.
+// Each phase has its own timeout, the wait for a slot that of the
+// limiter. Up
+// to kMaxConnectAttempts resolved addresses are tried in turn, and a
+// pooled connection that turns out to be dead is replaced by a fresh one
+// once. An empty request only establishes the connection, which is then
+// handed over as if the whole response were relayed (CONNECT tunnels).
+// A request body that is still arriving follows the head from an
+// UploadStream in bounded pieces; a response that starts before the body
+// is all sent is read at once and ends the sending. The fetch keeps
+// itself alive until its completion callback has run.
+class UpstreamFetch : public EventHandler, public std::enable_shared_from_this<UpstreamFetch> {
+public:
+    typedef std::function<void(const char*, size_t)> DataCallback;
+    typedef std::function<void(UpstreamFetch&)> CompletionCallback;
+    // Decides, once the head is known, whether the rest of the body may
+    // bypass the parser and be relayed straight from the socket
+    typedef std::function<bool(const HttpResponseParser&)> RelayFilter;
+    // Decides, once the head is known, whether the decoded body goes to the
+    // body callback as it is parsed instead of collecting in the parser
+    typedef std::function<bool(const HttpResponseParser&)> BodyFilter;
+
+    UpstreamFetch(Reactor& reactor, const UpstreamContext& context,
+                  const std::string& host, int port, const std::string& request,
+                  bool headRequest, bool idempotent);
+    ~UpstreamFetch();
+
+    // Receives the client-facing bytes (forwardHead() and the raw body)
+    // as they arrive.
+    void onData(const DataCallback& callback) { dataCallback_ = callback; }
+    // Called exactly once on the reactor thread when the exchange ends.
+    void onComplete(const CompletionCallback& callback) { completionCallback_ = callback; }
+    // Without a filter every body is read through the parser.
+    void allowRelay(const RelayFilter& filter) { relayFilter_ = filter; }
+    // Reading stops when `full` returns true (the consumer is behind),
+    // checked before every read, until resume() is called.
+    void holdWhile(const std::function<bool()>& full) { full_ = full; }
+    // Must be called on the reactor thread; does nothing unless held.
+    void resume();
+    // Without a filter, or if it declines, parser().body() holds the whole
+    // body once the exchange ends; otherwise it is left empty.
+    void takeBody(const BodyFilter& filter, const DataCallback& callback) {
+        bodyFilter_ = filter;
+        bodyCallback_ = callback;
+    }
+    // Sends the body from `upload` after the request, which must declare
+    // its framing. Must be called before start().
+    void sendBody(const std::shared_ptr<UploadStream>& upload) { upload_ = upload; }
+
+    // Must be called on the reactor thread.
+    void start();
+    // Gives up the exchange as failed if it still waits for a slot of its
+    // origin; does nothing later on. Must be called on the reactor thread.
+    void abandon();
+
+    bool succeeded() const { return phase_ == DONE; }
+    bool queued() const { return phase_ == QUEUED; }
+    const std::string& error() const { return error_; }
+    // True if it failed without a slot (queue full, waited too long or
+    // abandoned): the origin was busy rather than broken
+    bool unavailable() const { return unavailable_; }
+    const HttpResponseParser& parser() const { return parser_; }
+    // True once the response head was passed to the data callback
+    bool streamed() const { return headStreamed_; }
+
+    // The exchange ended by handing the socket over for the body's rest:
+    // relayRemaining() bytes (SpliceRelay::kUnlimited until close).
+    bool relayed() const { return phase_ == RELAYED; }
+    uint64_t relayRemaining() const { return relayRemaining_; }
+    // True if the connection may be pooled once the remainder was relayed
+    bool relayReusable() const { return relayReusable_; }
+    // The origin slot held for a relayed remainder, to be kept until it ends
+    std::shared_ptr<OriginSlot> takeSlot();
+    // Ownership of the relayed socket passes to the caller.
+    int releaseSocket();
+    const std::string& origin() const { return origin_; }
+
+    void onEvent(uint32_t events) override;
+
+private:
+    static const size_t kMaxConnectAttempts = 3;
+    // Upload bytes taken from the stream at a time
+    static const size_t kUploadChunk = 64 * 1024;
+
+    enum Phase { IDLE, QUEUED, RESOLVING, CONNECTING, SENDING, WAITING, READING, DONE, RELAYED, FAILED };
+
+    Reactor& reactor_;
+    UpstreamContext context_;
+    std::string host_;
+    int port_;
+    std::string origin_;
+    std::string request_;
+    bool headRequest_;
+    bool idempotent_;
+    Phase phase_;
+    int fd_;
+    std::vector<ResolvedAddress> addresses_;
+    size_t nextAddress_;
+    bool reused_;
+    int attempt_;
+    size_t sent_;
+    std::shared_ptr<UploadStream> upload_;
+    std::string uploadChunk_;       // the piece of the body being sent
+    size_t uploadSent_;
+    bool uploadStarted_;            // body bytes were taken, so the request cannot be repeated
+    bool uploadWakeScheduled_;
+    uint32_t events_;
+    size_t received_;
+    bool reusable_;
+    HttpResponseParser parser_;
+    size_t consumedTotal_;
+    size_t bodyStreamed_;
+    bool headStreamed_;
+    std::string error_;
+    bool relayChecked_;
+    bool bodyChecked_;
+    uint64_t relayRemaining_;
+    bool relayReusable_;
+    TimerWheel::TimerId timer_;
+    std::shared_ptr<OriginSlot> slot_;
+    OriginLimiter::Ticket ticket_;  // place in the origin's queue, 0 = none
+    bool unavailable_;
+    TimerWheel::TimerId throttleTimer_;
+    bool held_;
+    DataCallback dataCallback_;
+    CompletionCallback completionCallback_;
+    RelayFilter relayFilter_;
+    std::function<bool()> full_;
+    BodyFilter bodyFilter_;
+    DataCallback bodyCallback_;
+    std::shared_ptr<UpstreamFetch> self_;
+
+    void onResolved(const std::vector<ResolvedAddress>& addresses);
+    bool hasNextAddress() const;
+    void connectNext();
+    void sendRequest();
+    bool sendBuffer(const std::string& data, size_t& offset);
+    void watch(uint32_t events);
+    void readResponse();
+    void throttle(int delayMs);
+    void stream(const char* data, size_t len, size_t consumed);
+    void passBody();
+    bool startRelay();
+    void handOffConnection();
+    void retryOrFail(const std::string& error);
+    void succeed();
+    void fail(const std::string& error);
+    void armTimer(int delayMs, const std::string& phase);
+    void cancelTimer();
+    void closeSocket();
+};
+
+#endif // UPSTREAM_FETCH_HPP
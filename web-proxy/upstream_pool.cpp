@@ -0,0 +1,126 @@
+#include "upstream_pool.hpp"
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <cerrno>
+
+UpstreamPool::UpstreamPool(size_t maxIdlePerHost, int maxIdleSeconds)
+    : maxIdlePerHost_(maxIdlePerHost), maxIdleSeconds_(maxIdleSeconds),
+      hits_(0), misses_(0) {}
+
+UpstreamPool::~UpstreamPool() {
+    clear();
+}
+
+int UpstreamPool::acquire(const std::string& origin) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    time_t now = std::time(nullptr);
+    pruneExpired(now);
+
+    std::map<std::string, std::deque<IdleConnection> >::iterator it = idle_.find(origin);
+    while (it != idle_.end() && !it->second.empty()) {
+        // Most recently used first: it is the least likely to be timed out by the server
+        IdleConnection conn = it->second.back();
+        it->second.pop_back();
+        if (isHealthy(conn.fd)) {
+            hits_++;
+            return conn.fd;
+        }
+        ::close(conn.fd);
+    }
+
+    misses_++;
+    return -1;
+}
+
+void UpstreamPool::release(const std::string& origin, int fd) {
+    if (fd < 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::deque<IdleConnection>& conns = idle_[origin];
+    if (conns.size() >= maxIdlePerHost_) {
+        // Drop the oldest connection to stay within the per-host limit
+        ::close(conns.front().fd);
+        conns.pop_front();
+    }
+
+    IdleConnection conn;
+    conn.fd = fd;
+    conn.idleSince = std::time(nullptr);
+    conns.push_back(conn);
+}
+
+void UpstreamPool::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& entry : idle_) {
+        for (const IdleConnection& conn : entry.second) {
+            ::close(conn.fd);
+        }
+    }
+    idle_.clear();
+}
+
+size_t UpstreamPool::hits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hits_;
+}
+
+size_t UpstreamPool::misses() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return misses_;
+}
+
+size_t UpstreamPool::idleConnections() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t total = 0;
+    for (const auto& entry : idle_) {
+        total += entry.second.size();
+    }
+    return total;
+}
+
+void UpstreamPool::pruneExpired(time_t now) {
+    auto it = idle_.begin();
+    while (it != idle_.end()) {
+        std::deque<IdleConnection>& conns = it->second;
+        // Connections are appended in release order, so the oldest are in front
+        while (!conns.empty() && now - conns.front().idleSince > maxIdleSeconds_) {
+            ::close(conns.front().fd);
+            conns.pop_front();
+        }
+        if (conns.empty()) {
+            it = idle_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool UpstreamPool::isHealthy(int fd) {
+    // An idle connection must have nothing to read: readable means either
+    // the server closed it (EOF) or sent unexpected data.
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    int ready = poll(&pfd, 1, 0);
+    if (ready < 0) {
+        return false;
+    }
+    if (ready == 0) {
+        return true;
+    }
+    if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        return false;
+    }
+
+    char probe;
+    ssize_t n = recv(fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return true;
+    }
+    return false;
+}
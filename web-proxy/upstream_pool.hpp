@@ -0,0 +1,52 @@
+#ifndef UPSTREAM_POOL_HPP
+#define UPSTREAM_POOL_HPP
+
+#include <string>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <ctime>
+#include <cstddef>
+
+// Pool of idle keep-alive connections to origin servers, keyed by
+// "host:port". Connections are health-checked before reuse and dropped
+// once they exceed the idle time limit or the per-host limit.
+class UpstreamPool {
+public:
+    UpstreamPool(size_t maxIdlePerHost = 8, int maxIdleSeconds = 30);
+    ~UpstreamPool();
+
+    UpstreamPool(const UpstreamPool&) = delete;
+    UpstreamPool& operator=(const UpstreamPool&) = delete;
+
+    // Returns a healthy idle connection to the origin, or -1 if none is
+    // available. Ownership of the descriptor passes to the caller.
+    int acquire(const std::string& origin);
+
+    // Returns a connection to the pool after a complete response.
+    void release(const std::string& origin, int fd);
+
+    void clear();
+
+    size_t hits() const;
+    size_t misses() const;
+    size_t idleConnections() const;
+
+private:
+    struct IdleConnection {
+        int fd;
+        time_t idleSince;
+    };
+
+    size_t maxIdlePerHost_;
+    int maxIdleSeconds_;
+    mutable std::mutex mutex_;
+    std::map<std::string, std::deque<IdleConnection> > idle_;
+    size_t hits_;
+    size_t misses_;
+
+    void pruneExpired(time_t now);
+    static bool isHealthy(int fd);
+};
+
+#endif // UPSTREAM_POOL_HPP
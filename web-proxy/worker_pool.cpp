@@ -0,0 +1,48 @@
+#include "worker_pool.hpp"
+
+WorkerPool::WorkerPool(size_t threads) : stopping_(false) {
+    for (size_t i = 0; i < threads; ++i) {
+        threads_.push_back(std::thread(&WorkerPool::workerLoop, this));
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    stop();
+}
+
+void WorkerPool::submit(const std::function<void()>& task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(task);
+    }
+    cond_.notify_one();
+}
+
+void WorkerPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_all();
+    for (size_t i = 0; i < threads_.size(); ++i) {
+        if (threads_[i].joinable() && threads_[i].get_id() != std::this_thread::get_id()) {
+            threads_[i].join();
+        }
+    }
+}
+
+void WorkerPool::workerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                return;
+            }
+            task = tasks_.front();
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
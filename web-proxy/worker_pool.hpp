@@ -0,0 +1,38 @@
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <functional>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+
+// Small fixed set of threads for calls that can only be made blocking
+// (such as getaddrinfo) and for long CPU or disk work (compressing and
+// writing cached objects), so that they never run on a reactor thread.
+class WorkerPool {
+public:
+    explicit WorkerPool(size_t threads);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void submit(const std::function<void()>& task);
+
+    // Finishes the queued tasks and joins the threads.
+    void stop();
+
+private:
+    std::vector<std::thread> threads_;
+    std::deque<std::function<void()> > tasks_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool stopping_;
+
+    void workerLoop();
+};
+
+#endif // WORKER_POOL_HPP